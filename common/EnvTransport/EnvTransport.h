@@ -0,0 +1,288 @@
+#pragma once
+// ================================================================
+//  センサー ⇔ ハブ間の配送路（トランスポート）の共通インタフェース
+//   - 両ファームウェアで共用する。やり取りは「トピック + 文字列ペイロード」
+//     の 1 通ずつ（MQTT と同じ形）で、中身の CSV は配送路に依らない。
+//   - 実装
+//       MQTT      : センサー = PubSubClient, ハブ = PicoMQTT（各 main.cpp）
+//       ESP-NOW   : 接続なしの 1 フレーム送信（EspNowTransport.h, ESP32 専用）
+//       Loopback  : 同じプロセス内の 2 端点を直結（下の LoopbackTransport）
+//   - 受信は loop() の中で受信関数へ渡す（割り込み・別タスクからは呼ばない）。
+//   - 接続なしの配送路は 1 通 = 1 フレーム（EnvFrame）。トピックとペイロードを
+//     長さ付きで詰め、ESP-NOW の上限 250 バイトに収まらないものは送らない。
+//     フレームには送信番号と認証子を付け（FrameSeal, FrameAuth.h）、鍵の合わない
+//     もの・送り直されたものは受信関数へ渡さない。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "FrameAuth.h"
+
+class EnvTransport {
+public:
+    typedef void (*Receiver)(void* ctx, EnvTransport& from,
+                             const char* topic, const char* payload);
+
+    struct Stats {
+        uint32_t sent;       // 送れた（配送路が受け付けた）
+        uint32_t failed;     // 送れなかった（未接続・長すぎ・相手が応答しない）
+        uint32_t received;   // 受信関数へ渡した
+        uint32_t dropped;    // 受信したが渡せなかった（キュー溢れ・形式不正）
+        uint32_t rejected;   // 認証子が合わない・送り直し（送信番号が古い）
+    };
+
+    virtual ~EnvTransport() {}
+
+    virtual const char* name() const = 0;
+    virtual bool begin() = 0;
+    virtual void loop() = 0;                // 受信の配送・接続維持
+    virtual bool ready() const = 0;         // 今送れるか
+    virtual bool publish(const char* topic, const char* payload) = 0;
+
+    // topic へ 1 通で送れるペイロードの上限（既定は EnvFrame の 1 フレーム分）
+    virtual size_t maxPayload(const char* topic) const;
+
+    void setReceiver(Receiver fn, void* ctx) {
+        _recv    = fn;
+        _recvCtx = ctx;
+    }
+
+    const Stats& stats() const { return _stats; }
+
+protected:
+    void deliver(const char* topic, const char* payload) {
+        if (!_recv) {
+            _stats.dropped++;
+            return;
+        }
+        _stats.received++;
+        _recv(_recvCtx, *this, topic, payload);
+    }
+
+    Stats    _stats   = Stats();
+    Receiver _recv    = nullptr;
+    void*    _recvCtx = nullptr;
+};
+
+// ---- 1 通 = 1 フレームの形式 ----
+//   [0] 'E'  [1] 版  [2] トピック長 n  [3..7) 送信番号（LE）
+//   [7..7+n) トピック  [7+n..) ペイロード  末尾 8 バイト 認証子（FrameSeal が付ける）
+//   終端の NUL は送らない（受信側で足す）
+namespace EnvFrame {
+
+constexpr uint8_t MAGIC   = 'E';
+constexpr uint8_t VERSION = 2;     // 1 = 送信番号・認証子なし（受け付けない）
+constexpr size_t  HEADER  = 7;
+constexpr size_t  MAX_LEN = 250;   // ESP-NOW の 1 フレーム上限（認証子を含む）
+
+// 認証子の手前までを buf に詰めて長さを返す（収まらなければ 0）
+inline size_t encode(const char* topic, const char* payload, uint32_t counter,
+                     uint8_t* buf, size_t cap) {
+    size_t tl = strlen(topic);
+    size_t pl = strlen(payload);
+    if (tl == 0 || tl > 255 || HEADER + tl + pl > cap) return 0;
+    buf[0] = MAGIC;
+    buf[1] = VERSION;
+    buf[2] = (uint8_t)tl;
+    for (int i = 0; i < 4; ++i) buf[3 + i] = (uint8_t)(counter >> (8 * i));
+    memcpy(buf + HEADER, topic, tl);
+    memcpy(buf + HEADER + tl, payload, pl);
+    return HEADER + tl + pl;
+}
+
+// 認証子の手前まで（len）を topic / payload（NUL 終端）に分ける。
+//   out は len + 2 バイト以上。失敗（形式不正）は false
+inline bool decode(const uint8_t* buf, size_t len, char* out, size_t cap, uint32_t& counter,
+                   const char*& topic, const char*& payload) {
+    if (len < HEADER || buf[0] != MAGIC || buf[1] != VERSION) return false;
+    size_t tl = buf[2];
+    if (tl == 0 || HEADER + tl > len || len + 2 > cap) return false;
+    size_t pl = len - HEADER - tl;
+    counter = (uint32_t)buf[3] | (uint32_t)buf[4] << 8 | (uint32_t)buf[5] << 16 |
+              (uint32_t)buf[6] << 24;
+    memcpy(out, buf + HEADER, tl);
+    out[tl] = '\0';
+    memcpy(out + tl + 1, buf + HEADER + tl, pl);
+    out[tl + 1 + pl] = '\0';
+    if (memchr(out, '\0', tl) || memchr(out + tl + 1, '\0', pl)) return false;
+    topic   = out;
+    payload = out + tl + 1;
+    return true;
+}
+
+}  // namespace EnvFrame
+
+inline size_t EnvTransport::maxPayload(const char* topic) const {
+    size_t used = EnvFrame::HEADER + strlen(topic) + FrameAuth::TAG;
+    return (used < EnvFrame::MAX_LEN) ? EnvFrame::MAX_LEN - used : 0;
+}
+
+// ---- フレームの封（送信番号 + 認証子）と開封 ----
+//   接続なしの配送路が 1 つずつ持つ。鍵が無いうちは送らず、受けたものも通さない。
+//   送信番号は RESERVE 件ごとに persist へ「ここまで使う」値を渡して保存させ、
+//   再起動後は保存された値から setCounter() で再開する（使っていない番号を
+//   飛ばすだけで、同じ番号を 2 度使うことはない）。
+class FrameSeal {
+public:
+    typedef bool (*Persist)(void* ctx, uint32_t reservedUntil);
+
+    enum Verdict : uint8_t {
+        OPENED,      // 受信関数へ渡してよい
+        MALFORMED,   // 形式不正（dropped へ）
+        FORGED,      // 認証子が合わない・鍵が無い（rejected へ）
+        REPLAYED,    // 送信番号が古い（rejected へ）
+    };
+
+    void setKey(const FrameAuth::Key& key) {
+        _key   = key;
+        _keyed = true;
+        _guard.clear();
+    }
+
+    void setCounter(uint32_t next, Persist fn, void* ctx) {
+        _next       = next ? next : 1;
+        _reserved   = _next;
+        _persist    = fn;
+        _persistCtx = ctx;
+    }
+
+    bool     keyed() const { return _keyed; }
+    uint32_t next() const { return _next; }
+    uint32_t senderEvictions() const { return _guard.evictions(); }
+
+    // 詰めて認証子を付け、長さを返す（0 = 鍵が無い・収まらない・番号を保存できない）
+    size_t seal(const uint8_t mac[FrameAuth::MAC_LEN], const char* topic, const char* payload,
+                uint8_t* buf, size_t cap) {
+        if (!_keyed || cap < FrameAuth::TAG) return 0;
+        size_t n = EnvFrame::encode(topic, payload, _next, buf, cap - FrameAuth::TAG);
+        if (!n) return 0;
+        if (_next >= _reserved) {
+            uint32_t until = _next + FrameAuth::RESERVE;
+            if (_persist && !_persist(_persistCtx, until)) return 0;
+            _reserved = until;
+        }
+        FrameAuth::putU64(buf + n, FrameAuth::tag(_key, mac, buf, n));
+        _next++;
+        return n + FrameAuth::TAG;
+    }
+
+    // mac から届いた buf[0..len) を確かめて topic / payload に分ける（out は len + 2 以上）
+    Verdict open(const uint8_t mac[FrameAuth::MAC_LEN], const uint8_t* buf, size_t len,
+                 char* out, size_t cap, const char*& topic, const char*& payload) {
+        if (len < EnvFrame::HEADER + FrameAuth::TAG) return MALFORMED;
+        if (!_keyed) return FORGED;
+        size_t body = len - FrameAuth::TAG;
+        if (!FrameAuth::tagEquals(FrameAuth::tag(_key, mac, buf, body), buf + body)) {
+            return FORGED;
+        }
+        uint32_t counter;
+        if (!EnvFrame::decode(buf, body, out, cap, counter, topic, payload)) return MALFORMED;
+        return _guard.accept(mac, counter) ? OPENED : REPLAYED;
+    }
+
+    // open() の結果を stats へ数え、渡してよければ true
+    static bool count(Verdict v, EnvTransport::Stats& stats) {
+        if (v == MALFORMED) stats.dropped++;
+        else if (v != OPENED) stats.rejected++;
+        return v == OPENED;
+    }
+
+private:
+    FrameAuth::Key           _key        = {};
+    bool                     _keyed      = false;
+    uint32_t                 _next       = 1;
+    uint32_t                 _reserved   = 1;
+    Persist                  _persist    = nullptr;
+    void*                    _persistCtx = nullptr;
+    FrameAuth::ReplayGuard<> _guard;
+};
+
+// ================================================================
+//  Loopback：同じプロセス内の 2 端点を直結する配送路
+//   - publish() は相手側のキューへフレームを積むだけで、相手の loop() で渡る
+//     （実機の配送路と同じく、送信の中から受信関数が呼ばれることはない）。
+//   - フレームは ESP-NOW と同じく FrameSeal で封をして開けるので、形式と認証の
+//     確認も兼ねる。端点には id から作ったローカル MAC（02:00:00:00:00:id）を付ける。
+//   - receive() は「無線」に当たる入口で、録ったフレーム・細工したフレームを
+//     そのまま積める（ホストテストで送り直し・改ざんを確かめる）。
+//   - ホストテスト・ベンチマークでセンサー → ハブの処理を無線なしで通すためのもの。
+// ================================================================
+class LoopbackTransport : public EnvTransport {
+public:
+    static constexpr size_t QUEUE = 16;
+
+    explicit LoopbackTransport(const char* name = "loopback", uint8_t id = 1) : _name(name) {
+        static const uint8_t BASE[FrameAuth::MAC_LEN] = { 0x02, 0, 0, 0, 0, 0 };
+        memcpy(_mac, BASE, sizeof(_mac));
+        _mac[5] = id;
+    }
+
+    // a ⇔ b を結ぶ
+    static void link(LoopbackTransport& a, LoopbackTransport& b) {
+        a._peer = &b;
+        b._peer = &a;
+    }
+
+    const char* name() const override { return _name; }
+    bool begin() override { return _peer != nullptr; }
+    bool ready() const override { return _peer != nullptr; }
+
+    bool publish(const char* topic, const char* payload) override {
+        uint8_t buf[EnvFrame::MAX_LEN];
+        size_t  len = _seal.seal(_mac, topic, payload, buf, sizeof(buf));
+        if (!_peer || !len || !_peer->receive(_mac, buf, len)) {
+            _stats.failed++;
+            return false;
+        }
+        _stats.sent++;
+        return true;
+    }
+
+    // mac から届いたフレームを積む（false = キューが一杯・長すぎる）
+    bool receive(const uint8_t mac[FrameAuth::MAC_LEN], const uint8_t* data, size_t len) {
+        if (_count == QUEUE || len > EnvFrame::MAX_LEN) return false;
+        Slot& s = _queue[(_head + _count) % QUEUE];
+        memcpy(s.mac, mac, sizeof(s.mac));
+        s.len = (uint8_t)len;
+        memcpy(s.data, data, len);
+        _count++;
+        return true;
+    }
+
+    // 溜まっているフレームをすべて受信関数へ渡す
+    void loop() override {
+        char buf[EnvFrame::MAX_LEN + 2];
+        while (_count) {
+            const Slot& s = _queue[_head];
+            _head = (_head + 1) % QUEUE;
+            _count--;
+            const char* topic;
+            const char* payload;
+            if (FrameSeal::count(_seal.open(s.mac, s.data, s.len, buf, sizeof(buf), topic, payload),
+                                 _stats)) {
+                deliver(topic, payload);
+            }
+        }
+    }
+
+    FrameSeal&     seal() { return _seal; }
+    const uint8_t* mac() const { return _mac; }
+    size_t         pending() const { return _count; }
+
+private:
+    struct Slot {
+        uint8_t mac[FrameAuth::MAC_LEN];
+        uint8_t len;
+        uint8_t data[EnvFrame::MAX_LEN];
+    };
+
+    const char*        _name;
+    uint8_t            _mac[FrameAuth::MAC_LEN];
+    FrameSeal          _seal;
+    LoopbackTransport* _peer  = nullptr;
+    Slot               _queue[QUEUE];
+    size_t             _head  = 0;
+    size_t             _count = 0;
+};
@@ -0,0 +1,197 @@
+#pragma once
+// ================================================================
+//  ESP-NOW の配送路（EnvTransport の実装, ESP32 専用）
+//   - 接続（アソシエーション・DHCP・TCP・MQTT CONNECT）なしで 1 通を
+//     1 フレーム（EnvFrame）として送る。送信は数 ms で終わり、送る以外の
+//     時間は無線を止めておける。
+//   - 送信先は setPeer() の MAC（未設定ならブロードキャスト）。
+//       センサー → ハブ : ハブの SoftAP の MAC（リンクキャッシュの BSSID）
+//       ハブ → センサー : 設定の配信はブロードキャスト（センサー側はトピックで選ぶ）。
+//                         受けたメッセージへの応答（受信関数の中の publish()）は
+//                         送り主へのユニキャスト。送り主は REPLY_PEERS 台まで
+//                         ピアに登録し、溢れたら古いものから外す。
+//     ユニキャストは MAC 層の再送と送達確認があり、失敗は stats().failed に数える。
+//   - ESP-NOW の暗号化ピアは使わない（登録できる台数が少なく、ブロードキャストは
+//     暗号化できない）。代わりに全フレームへ送信番号と認証子を付け（FrameSeal）、
+//     鍵の合わないもの・送り直しは stats().rejected に数えて捨てる。鍵と送信番号は
+//     begin() の前に seal() で設定する。
+//   - 受信コールバックは Wi-Fi タスクで呼ばれるので、フレームを FreeRTOS の
+//     キューへ写すだけにして、loop() で受信関数へ渡す。
+//   - チャネルは呼び出し側で合わせておく（ハブ = SoftAP のチャネル）。
+//   - インスタンスは 1 つだけ（コールバックから static で参照する）。
+//   - キューは begin() で 1 回だけ確保する。
+// ================================================================
+
+#include <esp_now.h>
+#include <esp_wifi.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include "EnvTransport.h"
+
+class EspNowTransport : public EnvTransport {
+public:
+    static constexpr size_t QUEUE       = 8;
+    static constexpr size_t REPLY_PEERS = 8;    // 応答先として登録しておく台数
+
+    explicit EspNowTransport(wifi_interface_t ifidx) : _ifidx(ifidx) {
+        memset(_peer, 0xFF, sizeof(_peer));
+    }
+
+    // 送信先（begin() の前に呼ぶ。channel 0 = 今のチャネル）
+    void setPeer(const uint8_t mac[6], uint8_t channel) {
+        memcpy(_peer, mac, sizeof(_peer));
+        _channel = channel;
+    }
+
+    const char* name() const override { return "espnow"; }
+
+    bool begin() override {
+        if (_started) return true;
+        if (!_queue) _queue = xQueueCreate(QUEUE, sizeof(Frame));
+        if (!_queue || esp_wifi_get_mac(_ifidx, _mac) != ESP_OK || esp_now_init() != ESP_OK) {
+            return false;
+        }
+        self() = this;
+        esp_now_register_recv_cb(onRecv);
+        esp_now_register_send_cb(onSent);
+
+        if (!addPeer(_peer)) {
+            esp_now_deinit();
+            return false;
+        }
+        _started = true;
+        return true;
+    }
+
+    bool ready() const override { return _started; }
+
+    bool publish(const char* topic, const char* payload) override {
+        uint8_t        buf[EnvFrame::MAX_LEN];
+        size_t         len = _started ? _seal.seal(_mac, topic, payload, buf, sizeof(buf)) : 0;
+        const uint8_t* to  = _delivering ? _lastSender : _peer;
+        if (!len || (to != _peer && !replyPeer(to))) {
+            _stats.failed++;
+            return false;
+        }
+        _sendStartUs = esp_timer_get_time();
+        if (esp_now_send(to, buf, len) != ESP_OK) {
+            _stats.failed++;
+            return false;
+        }
+        _stats.sent++;
+        return true;
+    }
+
+    void loop() override {
+        // コールバック側の数を取り込む（Wi-Fi タスクと競合しないよう差分で）
+        uint32_t nack = _txNack, over = _rxOverflow;
+        _stats.failed  += nack - _txNackSeen;
+        _stats.dropped += over - _rxOverflowSeen;
+        _txNackSeen     = nack;
+        _rxOverflowSeen = over;
+
+        if (!_queue) return;
+        Frame f;
+        char  buf[EnvFrame::MAX_LEN + 2];
+        while (xQueueReceive(_queue, &f, 0) == pdTRUE) {
+            const char* topic;
+            const char* payload;
+            if (FrameSeal::count(_seal.open(f.mac, f.data, f.len, buf, sizeof(buf), topic, payload),
+                                 _stats)) {
+                memcpy(_lastSender, f.mac, sizeof(_lastSender));
+                _delivering = true;
+                deliver(topic, payload);
+                _delivering = false;
+            }
+        }
+    }
+
+    FrameSeal& seal() { return _seal; }
+
+    // 直近の送信 → 送達確認（ユニキャスト）/ 送出完了（ブロードキャスト）までの µs
+    uint32_t lastSendUs() const { return _lastSendUs; }
+    const uint8_t* lastSender() const { return _lastSender; }
+
+private:
+    struct Frame {
+        uint8_t mac[6];
+        uint8_t len;
+        uint8_t data[EnvFrame::MAX_LEN];
+    };
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    static void onRecv(const esp_now_recv_info_t* info, const uint8_t* data, int len) {
+        const uint8_t* mac = info->src_addr;
+#else
+    static void onRecv(const uint8_t* mac, const uint8_t* data, int len) {
+#endif
+        EspNowTransport* t = self();
+        if (!t || len <= 0 || len > (int)EnvFrame::MAX_LEN) return;
+        Frame f;
+        memcpy(f.mac, mac, sizeof(f.mac));
+        f.len = (uint8_t)len;
+        memcpy(f.data, data, len);
+        if (xQueueSend(t->_queue, &f, 0) != pdTRUE) t->_rxOverflow++;
+    }
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 5, 0)
+    static void onSent(const esp_now_send_info_t*, esp_now_send_status_t status) {
+#else
+    static void onSent(const uint8_t*, esp_now_send_status_t status) {
+#endif
+        EspNowTransport* t = self();
+        if (!t) return;
+        t->_lastSendUs = (uint32_t)(esp_timer_get_time() - t->_sendStartUs);
+        if (status != ESP_NOW_SEND_SUCCESS) t->_txNack++;
+    }
+
+    bool addPeer(const uint8_t mac[6]) {
+        if (esp_now_is_peer_exist(mac)) return true;
+        esp_now_peer_info_t peer = {};
+        memcpy(peer.peer_addr, mac, sizeof(peer.peer_addr));
+        peer.channel = _channel;
+        peer.ifidx   = _ifidx;
+        peer.encrypt = false;   // 認証は FrameSeal で行う
+        return esp_now_add_peer(&peer) == ESP_OK;
+    }
+
+    // 応答先をピアに加える（REPLY_PEERS 台を超えたら最も古い登録を外す）
+    bool replyPeer(const uint8_t mac[6]) {
+        if (esp_now_is_peer_exist(mac)) return true;
+        uint8_t* slot = _replyPeers[_replyNext];
+        if (_replyCount == REPLY_PEERS) {
+            esp_now_del_peer(slot);
+        } else {
+            _replyCount++;
+        }
+        if (!addPeer(mac)) return false;
+        memcpy(slot, mac, 6);
+        _replyNext = (_replyNext + 1) % REPLY_PEERS;
+        return true;
+    }
+
+    static EspNowTransport*& self() {
+        static EspNowTransport* instance = nullptr;
+        return instance;
+    }
+
+    wifi_interface_t  _ifidx;
+    uint8_t           _peer[6];
+    uint8_t           _channel     = 0;
+    uint8_t           _mac[6]      = {};
+    uint8_t           _lastSender[6] = {};
+    bool              _delivering  = false;   // 受信関数の中（publish() は送り主へ返す）
+    FrameSeal         _seal;
+    uint8_t           _replyPeers[REPLY_PEERS][6];
+    size_t            _replyNext   = 0;
+    size_t            _replyCount  = 0;
+    QueueHandle_t     _queue       = nullptr;
+    bool              _started     = false;
+    int64_t           _sendStartUs = 0;
+    volatile uint32_t _lastSendUs  = 0;
+    volatile uint32_t _txNack      = 0;   // Wi-Fi タスクで増える
+    volatile uint32_t _rxOverflow  = 0;
+    uint32_t          _txNackSeen     = 0;
+    uint32_t          _rxOverflowSeen = 0;
+};
@@ -0,0 +1,177 @@
+#pragma once
+// ================================================================
+//  接続なしの配送路（ESP-NOW / Loopback）のフレーム認証
+//   - ESP-NOW の平文フレームは同じチャネルにいれば誰でも送れて、録ったものを
+//     そのまま送り直すこともできる。ESP-NOW 自体の暗号化（PMK/LMK）はピアを
+//     ハブ側に 1 台ずつ登録する必要があり（暗号化ピアは 6〜17 台まで）、
+//     センサーを数十台つなぐ構成には使えない。
+//   - そこで各フレームに
+//       SipHash-2-4(鍵, 送り主の MAC + フレーム（送信番号を含む）)
+//     の 8 バイトを付け、受信側で確かめる。送り主の MAC を混ぜるので、
+//     別の端末が録ったフレームを自分の MAC で送っても通らない。
+//   - 鍵はハブの SoftAP のパスワードから作る（両ファームウェアが既に共有している
+//     唯一の秘密）。強さはパスワードの強さまで。
+//   - 送信番号は送り主ごとに単調増加。受信側は送り主ごとに最後に受け付けた
+//     番号を覚え、それ以下（送り直し・MAC 層の重複）を捨てる（ReplayGuard）。
+//     送信側は再起動で番号を戻さないよう、RESERVE 件ごとに先の値を保存する。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace FrameAuth {
+
+constexpr size_t   MAC_LEN     = 6;
+constexpr size_t   TAG         = 8;      // 付ける認証子のバイト数
+constexpr size_t   SENDERS_MAX = 64;     // 送り主を覚える数（ハブの送信枠の上限と同じ）
+constexpr uint32_t RESERVE     = 1024;   // 送信番号を保存する刻み
+constexpr uint32_t KEY_ROUNDS  = 1024;   // パスワード → 鍵の繰り返し回数
+
+struct Key {
+    uint64_t k0;
+    uint64_t k1;
+};
+
+inline uint64_t getU64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = v << 8 | p[i];
+    return v;
+}
+
+inline void putU64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+// SipHash-2-4（分けて渡せる形）
+class SipHash {
+public:
+    explicit SipHash(const Key& k) {
+        _v[0] = k.k0 ^ 0x736f6d6570736575ULL;
+        _v[1] = k.k1 ^ 0x646f72616e646f6dULL;
+        _v[2] = k.k0 ^ 0x6c7967656e657261ULL;
+        _v[3] = k.k1 ^ 0x7465646279746573ULL;
+    }
+
+    void update(const uint8_t* p, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            _tail |= (uint64_t)p[i] << (8 * (_len & 7));
+            if ((++_len & 7) == 0) {
+                compress(_tail);
+                _tail = 0;
+            }
+        }
+    }
+
+    uint64_t finish() {
+        compress((uint64_t)_len << 56 | _tail);
+        _v[2] ^= 0xFF;
+        for (int i = 0; i < 4; ++i) round();
+        return _v[0] ^ _v[1] ^ _v[2] ^ _v[3];
+    }
+
+private:
+    static uint64_t rotl(uint64_t x, int b) { return (x << b) | (x >> (64 - b)); }
+
+    void round() {
+        _v[0] += _v[1]; _v[1] = rotl(_v[1], 13); _v[1] ^= _v[0]; _v[0] = rotl(_v[0], 32);
+        _v[2] += _v[3]; _v[3] = rotl(_v[3], 16); _v[3] ^= _v[2];
+        _v[0] += _v[3]; _v[3] = rotl(_v[3], 21); _v[3] ^= _v[0];
+        _v[2] += _v[1]; _v[1] = rotl(_v[1], 17); _v[1] ^= _v[2]; _v[2] = rotl(_v[2], 32);
+    }
+
+    void compress(uint64_t m) {
+        _v[3] ^= m;
+        round();
+        round();
+        _v[0] ^= m;
+    }
+
+    uint64_t _v[4];
+    uint64_t _tail = 0;
+    size_t   _len  = 0;
+};
+
+// パスワード → 鍵。総当たりを少しでも遅くするため KEY_ROUNDS 回かけ直す
+// （ESP32 で数 ms。起動時と設定変更時に 1 回だけ）
+inline Key deriveKey(const char* password) {
+    static const Key DOMAIN = { 0x3176687475416e45ULL, 0x656d617246766e45ULL };   // "EnAuthv1EnvFrame"
+    size_t pl = strlen(password);
+    Key    k  = DOMAIN;
+    for (uint32_t i = 0; i < KEY_ROUNDS; ++i) {
+        uint8_t prev[16];
+        putU64(prev, k.k0);
+        putU64(prev + 8, k.k1);
+        Key next;
+        for (uint8_t half = 0; half < 2; ++half) {
+            SipHash h(DOMAIN);
+            h.update(&half, 1);
+            h.update(prev, sizeof(prev));
+            h.update((const uint8_t*)password, pl);
+            (half ? next.k1 : next.k0) = h.finish();
+        }
+        k = next;
+    }
+    return k;
+}
+
+// 送り主の MAC + data[0..len) の認証子
+inline uint64_t tag(const Key& key, const uint8_t mac[MAC_LEN], const uint8_t* data, size_t len) {
+    SipHash h(key);
+    h.update(mac, MAC_LEN);
+    h.update(data, len);
+    return h.finish();
+}
+
+// 固定時間で比べる（一致するバイト数で時間が変わらないように）
+inline bool tagEquals(uint64_t expected, const uint8_t* p) {
+    uint64_t diff = expected ^ getU64(p);
+    return diff == 0;
+}
+
+// ---- 送り主ごとの最後の送信番号 ----
+//   表が埋まったら、いちばん長く届いていない送り主を忘れる（忘れた送り主の
+//   古いフレームは一度だけ通りうる。SENDERS_MAX をノード数以上にしておく）
+template <size_t N = SENDERS_MAX>
+class ReplayGuard {
+public:
+    // counter を受け付けてよければ覚えて true
+    bool accept(const uint8_t mac[MAC_LEN], uint32_t counter) {
+        Entry* victim = &_entries[0];
+        for (Entry& e : _entries) {
+            if (e.used && memcmp(e.mac, mac, MAC_LEN) == 0) {
+                if (counter <= e.last) return false;
+                e.last = counter;
+                e.used = ++_tick;
+                return true;
+            }
+            if (e.used < victim->used) victim = &e;
+        }
+        if (victim->used) _evictions++;
+        memcpy(victim->mac, mac, MAC_LEN);
+        victim->last = counter;
+        victim->used = ++_tick;
+        return true;
+    }
+
+    void clear() {
+        memset(_entries, 0, sizeof(_entries));
+        _tick = 0;
+    }
+
+    uint32_t evictions() const { return _evictions; }
+
+private:
+    struct Entry {
+        uint8_t  mac[MAC_LEN];
+        uint32_t last;
+        uint32_t used;   // 0 = 空き。それ以外は最後に受け付けた順
+    };
+
+    Entry    _entries[N] = {};
+    uint32_t _tick       = 0;
+    uint32_t _evictions  = 0;
+};
+
+}  // namespace FrameAuth
@@ -0,0 +1,235 @@
+#pragma once
+// ================================================================
+//  受信サンプルの異常検知（デバイスごと O(1) メモリ）
+//   - 範囲外        : 物理的にありえない値 → 隔離（使わない）
+//   - 変化率        : 直前の採用値から急に飛んだ → 隔離。ただし飛びが JUMP_CONFIRM 回
+//                     続き、どの項目も毎回同じ向き（上がり続け / 下がり続け）なら
+//                     「本当の段差」として採用し直す。向きは項目ごとに見る
+//   - 張り付き      : 全項目がビット単位で同じ値のまま STUCK_SAMPLES 回 → 注記
+//   - z スコア      : 指数移動平均 / 分散からのずれが Z_LIMIT 超 → 注記
+//   - 途絶          : 受信間隔（移動平均）の STALE_FACTOR 倍以上届かない → 状態のみ
+//   隔離 = g_env・ログ・表情に入れない。注記 = 採用するがフラグを付ける。
+//   表が一杯のときは、途絶しているデバイスのうち最後に届いたのが一番古いものを
+//   追い出して使う（途絶していなければ新しいデバイスは素通し）。
+//   動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+enum AnomalyFlag : uint8_t {
+    ANOM_RANGE   = 0x01,   // 範囲外
+    ANOM_RATE    = 0x02,   // 変化率超過（段差として採用し直したときも付く）
+    ANOM_STUCK   = 0x04,   // 張り付き
+    ANOM_OUTLIER = 0x08,   // z スコア超過
+    ANOM_STALE   = 0x10,   // 途絶（デバイスの状態のみ）
+};
+
+enum class AnomalyVerdict : uint8_t { Accept, Flag, Quarantine };
+
+class AnomalyDetector {
+public:
+    static constexpr size_t   MaxDevices     = 64;     // ハブの台数の上限（HUB_DEVICES_MAX）と同じ
+    static constexpr uint8_t  FIELDS         = 3;      // T / H / P
+    static constexpr float    EWMA_ALPHA     = 0.05f;  // 平均・分散の追従の速さ（約 20 サンプル）
+    static constexpr uint16_t WARMUP         = 20;     // これ未満は z スコアを見ない
+    static constexpr float    Z_LIMIT        = 4.0f;
+    static constexpr uint16_t STUCK_SAMPLES  = 60;
+    static constexpr uint8_t  JUMP_CONFIRM   = 3;
+    static constexpr float    STALE_FACTOR   = 3.0f;
+    static constexpr uint32_t STALE_MIN_MS   = 30000;
+
+    struct FieldStats {
+        float mean;
+        float var;
+        float last;        // 直前の採用値
+    };
+
+    struct Device {
+        uint32_t   hash;               // 0 = 未使用
+        char       name[16];
+        uint32_t   lastMs;             // 直前の採用時刻
+        uint32_t   seenMs;             // 直前の受信時刻（隔離したものも含む。追い出しの順）
+        float      intervalMs;         // 受信間隔の移動平均
+        FieldStats f[FIELDS];
+        uint32_t   samples;
+        uint32_t   accepted;
+        uint32_t   flagged;
+        uint32_t   quarantined;
+        uint16_t   sinceReset;         // 統計を取り直してからの採用数
+        uint16_t   sameCount;          // 連続して全項目が同じ値だった回数
+        uint8_t    jumpCount;          // 連続した変化率超過
+        uint8_t    jumpUp;             // 連続した飛びで上がった項目（ビット i = 項目 i）
+        uint8_t    jumpDown;           // 同じく下がった項目
+        uint8_t    lastFlags;          // 直前のサンプルのフラグ
+    };
+
+    // 範囲（物理限界）と 1 分あたりの変化率上限、ノイズ幅（T / H / P）
+    static float rangeMin(uint8_t i) { static const float v[FIELDS] = { -40.0f, 0.0f, 300.0f };  return v[i]; }
+    static float rangeMax(uint8_t i) { static const float v[FIELDS] = { 85.0f, 100.0f, 1100.0f }; return v[i]; }
+    static float ratePerMin(uint8_t i) { static const float v[FIELDS] = { 3.0f, 10.0f, 2.0f };   return v[i]; }
+    static float noiseFloor(uint8_t i) { static const float v[FIELDS] = { 0.3f, 2.0f, 0.5f };    return v[i]; }
+
+    AnomalyDetector() { memset(_dev, 0, sizeof(_dev)); }
+
+    // flagsOut = このサンプルのフラグ
+    AnomalyVerdict check(uint32_t hash, const char* name, uint32_t nowMs,
+                         const float v[FIELDS], uint8_t& flagsOut) {
+        flagsOut = 0;
+        Device* d = slot(hash, name, nowMs);
+        if (!d) return AnomalyVerdict::Accept;   // 表が一杯なら素通し
+        d->samples++;
+        d->seenMs = nowMs;
+
+        for (uint8_t i = 0; i < FIELDS; ++i) {
+            if (!(v[i] >= rangeMin(i) && v[i] <= rangeMax(i))) {   // NaN も範囲外
+                flagsOut |= ANOM_RANGE;
+            }
+        }
+        if (flagsOut) return quarantine(d, flagsOut);
+
+        if (d->accepted == 0) {
+            reset(d, nowMs, v);
+            d->accepted++;
+            d->lastFlags = 0;
+            return AnomalyVerdict::Accept;
+        }
+
+        // 変化率（直前の採用値から）
+        float dtSec = (float)(nowMs - d->lastMs) * 0.001f;
+        if (dtSec < 1.0f) dtSec = 1.0f;
+        uint8_t up = 0, down = 0;
+        for (uint8_t i = 0; i < FIELDS; ++i) {
+            float delta = v[i] - d->f[i].last;
+            float limit = ratePerMin(i) * dtSec / 60.0f + noiseFloor(i);
+            if (fabsf(delta) > limit) {
+                if (delta > 0) up   |= (uint8_t)(1u << i);
+                else           down |= (uint8_t)(1u << i);
+            }
+        }
+        if (up | down) {
+            // どれかの項目が前の飛びと逆向きなら数え直す
+            if (d->jumpCount && ((up & d->jumpDown) || (down & d->jumpUp))) {
+                d->jumpCount = 0;
+            }
+            if (!d->jumpCount) d->jumpUp = d->jumpDown = 0;
+            d->jumpUp   |= up;
+            d->jumpDown |= down;
+            if (++d->jumpCount < JUMP_CONFIRM) {
+                flagsOut |= ANOM_RATE;
+                return quarantine(d, flagsOut);
+            }
+            // 項目ごとに同じ向きの飛びが続いた → 段差として採用し、統計を取り直す
+            reset(d, nowMs, v);
+            d->accepted++;
+            d->flagged++;
+            d->lastFlags = ANOM_RATE;
+            flagsOut = ANOM_RATE;
+            return AnomalyVerdict::Flag;
+        }
+        d->jumpCount = 0;
+
+        // 張り付き
+        bool same = true;
+        for (uint8_t i = 0; i < FIELDS; ++i) {
+            same = same && memcmp(&v[i], &d->f[i].last, sizeof(float)) == 0;
+        }
+        d->sameCount = same ? (uint16_t)(d->sameCount + 1) : 0;
+        if (d->sameCount >= STUCK_SAMPLES) flagsOut |= ANOM_STUCK;
+
+        // z スコア → 統計更新
+        for (uint8_t i = 0; i < FIELDS; ++i) {
+            FieldStats& s = d->f[i];
+            float diff = v[i] - s.mean;
+            float sd   = sqrtf(s.var) + noiseFloor(i) * 0.25f;
+            if (d->sinceReset >= WARMUP && fabsf(diff) > Z_LIMIT * sd) {
+                flagsOut |= ANOM_OUTLIER;
+            }
+            s.mean += EWMA_ALPHA * diff;
+            s.var   = (1.0f - EWMA_ALPHA) * (s.var + EWMA_ALPHA * diff * diff);
+            s.last  = v[i];
+        }
+
+        uint32_t gap = nowMs - d->lastMs;
+        d->intervalMs = d->intervalMs > 0.0f
+                      ? d->intervalMs + 0.1f * ((float)gap - d->intervalMs)
+                      : (float)gap;
+        d->lastMs    = nowMs;
+        d->accepted++;
+        if (d->sinceReset < 0xFFFF) d->sinceReset++;
+        d->lastFlags = flagsOut;
+        if (flagsOut) {
+            d->flagged++;
+            return AnomalyVerdict::Flag;
+        }
+        return AnomalyVerdict::Accept;
+    }
+
+    bool isStale(const Device& d, uint32_t nowMs) const {
+        if (!d.hash || !d.accepted) return false;
+        return (float)(nowMs - d.lastMs) > staleLimitMs(d);
+    }
+
+    // 状態フラグ（直前のサンプル + 途絶）
+    uint8_t healthFlags(const Device& d, uint32_t nowMs) const {
+        return (uint8_t)(d.lastFlags | (isStale(d, nowMs) ? ANOM_STALE : 0));
+    }
+
+    const Device* devices() const { return _dev; }
+    uint32_t      evictions() const { return _evictions; }
+
+private:
+    static float staleLimitMs(const Device& d) {
+        float limit = d.intervalMs * STALE_FACTOR;
+        return (limit < STALE_MIN_MS) ? (float)STALE_MIN_MS : limit;
+    }
+
+    Device* slot(uint32_t hash, const char* name, uint32_t nowMs) {
+        Device* free   = nullptr;
+        Device* oldest = nullptr;
+        for (auto& d : _dev) {
+            if (d.hash == hash) return &d;
+            if (!d.hash) {
+                if (!free) free = &d;
+            } else if ((float)(nowMs - d.seenMs) > staleLimitMs(d) &&
+                       (!oldest || nowMs - d.seenMs > nowMs - oldest->seenMs)) {
+                oldest = &d;   // 途絶している中で一番長く届いていない
+            }
+        }
+        if (!free && oldest) {
+            free = oldest;
+            _evictions++;
+        }
+        if (free) {
+            memset(free, 0, sizeof(*free));
+            free->hash = hash;
+            strncpy(free->name, name, sizeof(free->name) - 1);
+        }
+        return free;
+    }
+
+    AnomalyVerdict quarantine(Device* d, uint8_t flags) {
+        d->quarantined++;
+        d->lastFlags = flags;
+        return AnomalyVerdict::Quarantine;
+    }
+
+    void reset(Device* d, uint32_t nowMs, const float v[FIELDS]) {
+        for (uint8_t i = 0; i < FIELDS; ++i) {
+            d->f[i].mean = v[i];
+            d->f[i].var  = 0.0f;
+            d->f[i].last = v[i];
+        }
+        d->lastMs     = nowMs;
+        d->sinceReset = 0;
+        d->sameCount  = 0;
+        d->jumpCount  = 0;
+        d->jumpUp     = 0;
+        d->jumpDown   = 0;
+    }
+
+    Device   _dev[MaxDevices];
+    uint32_t _evictions = 0;
+};
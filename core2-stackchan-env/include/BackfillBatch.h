@@ -0,0 +1,71 @@
+#pragma once
+// ================================================================
+//  後送りの塊（home/env/<device>/backfill）の読み取り
+//   - 形式: <先頭 seq>,<基準エポック秒>;<差秒>,<温度×100>,<湿度×100>,<気圧×10>;...
+//     差秒は直前の行（1 行目は基準）からの秒。行の seq は先頭 seq から 1 ずつ増える。
+//   - 1 か所でも崩れていたら塊ごと不正（ハブは ack しないのでセンサーが送り直す）。
+//     行が ROWS_MAX を超える・1 行も無いのも不正。
+//   - 値は送られてきた整数のまま返す（校正・物理量への換算は呼び出し側）。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+namespace BackfillBatch {
+
+constexpr size_t ROWS_MAX = 64;   // 1 塊の最大行数（センサーは 48 件ずつ送る）
+
+struct Row {
+    uint32_t time;       // エポック秒
+    int32_t  t100;       // 温度 ×100
+    int32_t  h100;       // 湿度 ×100
+    int32_t  p10;        // 気圧 ×10
+};
+
+// payload を rows[0..cap) に読み、行数を返す（0 = 形式不正・cap を超える）
+inline size_t parse(const char* payload, uint32_t& first, Row* rows, size_t cap) {
+    char* end;
+    first = strtoul(payload, &end, 10);
+    if (end == payload || *end != ',') return 0;
+    const char* s    = end + 1;
+    uint32_t    time = strtoul(s, &end, 10);
+    if (end == s) return 0;
+    s = end;
+
+    size_t n = 0;
+    while (*s == ';') {
+        long v[4];
+        ++s;
+        for (uint8_t k = 0; k < 4; ++k) {
+            v[k] = strtol(s, &end, 10);
+            if (end == s || (k < 3 && *end != ',') || n == cap) return 0;
+            s = (k < 3) ? end + 1 : end;
+        }
+        time += (uint32_t)v[0];
+        Row& r = rows[n++];
+        r.time = time;
+        r.t100 = (int32_t)v[1];
+        r.h100 = (int32_t)v[2];
+        r.p10  = (int32_t)v[3];
+    }
+    return (*s == '\0') ? n : 0;
+}
+
+// rows[0..n) を時刻の昇順にそろえる（同じ時刻は元の順のまま）。
+//   journal は取得順なので通常はそのままで、入れ替わりがあっても数件
+template <typename T>
+void sortByTime(T* rows, size_t n) {
+    for (size_t i = 1; i < n; ++i) {
+        T      e = rows[i];
+        size_t j = i;
+        while (j > 0 && rows[j - 1].time > e.time) {
+            rows[j] = rows[j - 1];
+            --j;
+        }
+        rows[j] = e;
+    }
+}
+
+}  // namespace BackfillBatch
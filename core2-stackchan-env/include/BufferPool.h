@@ -0,0 +1,74 @@
+#pragma once
+// ================================================================
+//  固定長バッファの貸し出し（受信した MQTT の本文など）
+//   - SIZE バイトのバッファを COUNT 個だけ静的に持ち、acquire() で貸して
+//     release() で返してもらう。ヒープを使わないので、長時間動かしても
+//     断片化しない。
+//   - 大きすぎる要求・空きが無いときは nullptr（呼び出し側で捨てる）。
+//     その数と、同時に貸した数の最大（high water）を数える。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <stdint.h>
+#include <stddef.h>
+
+template <size_t SIZE, size_t COUNT>
+class BufferPool {
+public:
+    static constexpr size_t BUFFER_SIZE = SIZE;
+    static constexpr size_t BUFFERS     = COUNT;
+    static_assert(COUNT > 0 && COUNT <= 32, "free map is one uint32_t");
+
+    struct Stats {
+        uint32_t acquired;     // 貸した
+        uint32_t oversize;     // SIZE を超える要求で断った
+        uint32_t exhausted;    // 空きが無くて断った
+        uint32_t inUse;        // 今貸している
+        uint32_t highWater;    // 同時に貸した数の最大
+    };
+
+    BufferPool() : _used(0), _stats() {}
+
+    // need バイト（終端を含む）のバッファを借りる（nullptr = 断った）
+    char* acquire(size_t need) {
+        if (need > SIZE) {
+            _stats.oversize++;
+            return nullptr;
+        }
+        for (size_t i = 0; i < COUNT; ++i) {
+            uint32_t bit = 1u << i;
+            if (_used & bit) continue;
+            _used |= bit;
+            _stats.acquired++;
+            if (++_stats.inUse > _stats.highWater) _stats.highWater = _stats.inUse;
+            return _buf[i];
+        }
+        _stats.exhausted++;
+        return nullptr;
+    }
+
+    // 借りたバッファを返す（この表のものでなければ何もしない）
+    void release(char* p) {
+        for (size_t i = 0; i < COUNT; ++i) {
+            if (p != _buf[i] || !(_used & (1u << i))) continue;
+            _used &= ~(1u << i);
+            _stats.inUse--;
+            return;
+        }
+    }
+
+    const Stats& stats() const { return _stats; }
+
+    // 数え直す（貸している数はそのまま）
+    void resetStats() {
+        uint32_t inUse = _stats.inUse;
+        _stats           = Stats();
+        _stats.inUse     = inUse;
+        _stats.highWater = inUse;
+    }
+
+private:
+    char     _buf[COUNT][SIZE];
+    uint32_t _used;   // 貸している印（bit i = _buf[i]）
+    Stats    _stats;
+};
@@ -0,0 +1,84 @@
+#pragma once
+// ================================================================
+//  固定バッファの分割出力（HTTP 応答を String に溜めずに送る）
+//   - 呼び出し側が用意したバッファに書き、一杯になったらシンクへ渡して
+//     先頭から使い直す。ページの大きさに依らずメモリ使用量は一定。
+//   - シンク = HTTP のチャンク送信 / 自己診断では数えるだけ、など。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "TextEscape.h"
+
+class ChunkWriter {
+public:
+    typedef void (*Sink)(void* ctx, const char* data, size_t len);
+
+    ChunkWriter(char* buf, size_t cap, Sink sink, void* ctx)
+        : _buf(buf), _cap(cap), _sink(sink), _ctx(ctx) {}
+
+    void print(const char* s) {
+        write(s, strlen(s));
+    }
+
+    void write(const char* s, size_t len) {
+        while (len) {
+            if (_len == _cap) flush();
+            size_t n = _cap - _len;
+            if (n > len) n = len;
+            memcpy(_buf + _len, s, n);
+            _len += n;
+            s    += n;
+            len  -= n;
+        }
+    }
+
+    // HTML の本文・属性値として書く（& < > " ' を実体参照に置き換える）
+    void printHtml(const char* s) {
+        const char* run = s;
+        for (; *s; ++s) {
+            const char* rep = TextEscape::htmlEntity(*s);
+            if (!rep) continue;
+            write(run, (size_t)(s - run));
+            print(rep);
+            run = s + 1;
+        }
+        write(run, (size_t)(s - run));
+    }
+
+    // 1 回の書式化は FMT_MAX バイトまで（超えた分は切り捨て）
+    void printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+        static constexpr size_t FMT_MAX = 256;
+        if (_cap - _len < FMT_MAX) flush();
+
+        va_list ap;
+        va_start(ap, fmt);
+        size_t room = (_cap - _len < FMT_MAX) ? _cap - _len : FMT_MAX;
+        int n = vsnprintf(_buf + _len, room, fmt, ap);
+        va_end(ap);
+        if (n < 0) return;
+        _len += ((size_t)n < room) ? (size_t)n : room - 1;
+    }
+
+    void flush() {
+        if (!_len) return;
+        _sink(_ctx, _buf, _len);
+        _total += _len;
+        _len    = 0;
+    }
+
+    size_t total() const { return _total + _len; }   // これまでに書いたバイト数
+
+private:
+    char*  _buf;
+    size_t _cap;
+    Sink   _sink;
+    void*  _ctx;
+    size_t _len   = 0;
+    size_t _total = 0;
+};
@@ -0,0 +1,122 @@
+#pragma once
+// ================================================================
+//  ログの列（固定小数点）と集計カーネル
+//   - 時刻・温度・湿度・気圧を項目ごとの配列で持つ（列指向）。
+//     1 項目の集計は 2 バイト × 件数だけ読めばよく、行（EnvLogEntry）を
+//     丸ごとキャッシュへ引き込まない。
+//   - 値は int16 の固定小数点: 温度 0.01℃、湿度 0.01%、気圧 0.1hPa。
+//     範囲外は飽和させる（表示・集計の精度はこれで十分）。
+//   - カーネルは分岐なしの単純な計数ループ（min/max は値の選択、和は
+//     int32 で数える）。ホストの -O2 以上ではそのまま SIMD 化され、
+//     ESP32 ではゼロオーバーヘッドループ（LOOP 命令）になる。
+//     int32 の和は SUM_CHUNK 件ごとに int64 へ移すのであふれない。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace ColumnScan {
+
+// ---- 固定小数点 ----
+constexpr float T_SCALE = 100.0f;   // 0.01 ℃
+constexpr float H_SCALE = 100.0f;   // 0.01 %
+constexpr float P_SCALE = 10.0f;    // 0.1 hPa
+
+inline int16_t encode(float v, float scale) {
+    float x = v * scale;
+    if (!(x > -32767.0f)) return -32767;   // NaN もここ
+    if (x > 32767.0f) return 32767;
+    return (int16_t)(x < 0.0f ? x - 0.5f : x + 0.5f);
+}
+
+inline float decode(int32_t v, float scale) {
+    return (float)v / scale;
+}
+
+// ---- 集計結果（ブロック要約・範囲集計の共通形） ----
+struct Agg {
+    uint32_t count;
+    int32_t  min;
+    int32_t  max;
+    int64_t  sum;
+
+    void clear() {
+        count = 0;
+        min   = INT16_MAX;
+        max   = INT16_MIN;
+        sum   = 0;
+    }
+
+    void merge(const Agg& o) {
+        if (!o.count) return;
+        if (o.min < min) min = o.min;
+        if (o.max > max) max = o.max;
+        sum   += o.sum;
+        count += o.count;
+    }
+
+    float mean(float scale) const {
+        return count ? (float)((double)sum / count) / scale : 0.0f;
+    }
+};
+
+constexpr size_t SUM_CHUNK = 65536;   // 32767 × 65536 < 2^31
+
+// v[0..n) の最小・最大・和を a に足し込む
+inline void aggregate(const int16_t* v, size_t n, Agg& a) {
+    if (!n) return;
+    int32_t mn = a.count ? a.min : INT16_MAX;
+    int32_t mx = a.count ? a.max : INT16_MIN;
+    int64_t total = a.sum;
+
+    while (n) {
+        size_t m = (n < SUM_CHUNK) ? n : SUM_CHUNK;
+        // 4 本の独立した累算器（依存の鎖を切ってパイプライン / SIMD に載せる）
+        int32_t mn0 = mn, mn1 = mn, mn2 = mn, mn3 = mn;
+        int32_t mx0 = mx, mx1 = mx, mx2 = mx, mx3 = mx;
+        int32_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+        size_t  i = 0;
+        for (; i + 4 <= m; i += 4) {
+            int32_t x0 = v[i], x1 = v[i + 1], x2 = v[i + 2], x3 = v[i + 3];
+            mn0 = x0 < mn0 ? x0 : mn0;  mx0 = x0 > mx0 ? x0 : mx0;  s0 += x0;
+            mn1 = x1 < mn1 ? x1 : mn1;  mx1 = x1 > mx1 ? x1 : mx1;  s1 += x1;
+            mn2 = x2 < mn2 ? x2 : mn2;  mx2 = x2 > mx2 ? x2 : mx2;  s2 += x2;
+            mn3 = x3 < mn3 ? x3 : mn3;  mx3 = x3 > mx3 ? x3 : mx3;  s3 += x3;
+        }
+        for (; i < m; ++i) {
+            int32_t x = v[i];
+            mn0 = x < mn0 ? x : mn0;
+            mx0 = x > mx0 ? x : mx0;
+            s0 += x;
+        }
+        mn0 = mn1 < mn0 ? mn1 : mn0;  mn2 = mn3 < mn2 ? mn3 : mn2;  mn = mn2 < mn0 ? mn2 : mn0;
+        mx0 = mx1 > mx0 ? mx1 : mx0;  mx2 = mx3 > mx2 ? mx3 : mx2;  mx = mx2 > mx0 ? mx2 : mx0;
+        total += (int64_t)s0 + s1 + s2 + s3;
+        v += m;
+        n -= m;
+    }
+    a.min = mn;
+    a.max = mx;
+    a.sum = total;
+}
+
+// 件数だけ別に数える（空でない範囲をまとめて渡すときに 1 回）
+inline void aggregateCounted(const int16_t* v, size_t n, Agg& a) {
+    aggregate(v, n, a);
+    a.count += (uint32_t)n;
+}
+
+// 時刻列 t[0..n) の最小・最大（ほぼ昇順だが、センサー時刻で前後することがある）
+inline void timeRange(const uint32_t* t, size_t n, uint32_t& tMin, uint32_t& tMax) {
+    uint32_t mn = tMin, mx = tMax;
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t x = t[i];
+        mn = x < mn ? x : mn;
+        mx = x > mx ? x : mx;
+    }
+    tMin = mn;
+    tMax = mx;
+}
+
+}  // namespace ColumnScan
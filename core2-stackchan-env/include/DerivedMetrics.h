@@ -0,0 +1,194 @@
+#pragma once
+// ================================================================
+//  派生指標（露点・暑さ指数・絶対湿度・気圧傾向）
+//   - 受信ごとの計算と、起動時 / 問い合わせ時にログ全件を計算し直す
+//     バッチ計算で同じ式を使う。
+//   - libm を呼ばない: 飽和水蒸気圧は温度の表を線形補間、ln は
+//     指数部 + 仮数部の多項式。分岐は値の選択だけなので、ループが
+//     そのまま展開・パイプライン化される（ESP32 の FPU で 1 件 1µs 未満）。
+//   - 誤差（-40〜60℃, 1〜100%）: 露点 ±0.02℃、絶対湿度 ±0.01 g/m³ 程度。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+struct DerivedValues {
+    float dewPoint;       // ℃
+    float heatIndex;      // ℃（NOAA / Rothfusz）
+    float absHumidity;    // g/m³
+};
+
+class DerivedCalc {
+public:
+    // Magnus 式（Alduchov & Eskridge）の係数
+    static constexpr float MAGNUS_A = 17.625f;
+    static constexpr float MAGNUS_B = 243.04f;   // ℃
+    static constexpr float MAGNUS_C = 6.1094f;   // hPa
+
+    static constexpr float ES_T_MIN  = -40.0f;
+    static constexpr float ES_T_STEP = 0.5f;
+    static constexpr int   ES_SIZE   = 201;      // -40〜60 ℃
+
+    // 表は起動時に 1 回だけ expf で作る
+    DerivedCalc() {
+        for (int i = 0; i < ES_SIZE; ++i) {
+            float t = ES_T_MIN + ES_T_STEP * i;
+            _es[i] = MAGNUS_C * expf(MAGNUS_A * t / (MAGNUS_B + t));
+        }
+    }
+
+    // ln(x)（x > 0）。指数部 × ln2 + 仮数部の ln を 4 次多項式で近似（誤差 1e-4 程度）
+    static float fastLn(float x) {
+        uint32_t bits;
+        memcpy(&bits, &x, sizeof(bits));
+        float e = (float)(int32_t)((bits >> 23) & 0xFF) - 127.0f;
+        bits = (bits & 0x007FFFFFu) | 0x3F800000u;   // 仮数部 m ∈ [1, 2)
+        float m;
+        memcpy(&m, &bits, sizeof(m));
+        float lnm = -1.7417939f +
+                    (2.8212026f + (-1.4699568f + (0.44717955f - 0.056570851f * m) * m) * m) * m;
+        return e * 0.69314718f + lnm;
+    }
+
+    // 飽和水蒸気圧 [hPa]
+    float saturationVaporPressure(float t) const {
+        float f = (t - ES_T_MIN) * (1.0f / ES_T_STEP);
+        f = f < 0.0f ? 0.0f : (f > ES_SIZE - 1.001f ? ES_SIZE - 1.001f : f);
+        int   i = (int)f;
+        float w = f - i;
+        return _es[i] + (_es[i + 1] - _es[i]) * w;
+    }
+
+    void compute(float t, float rh, DerivedValues& out) const {
+        rh = rh < 1.0f ? 1.0f : (rh > 100.0f ? 100.0f : rh);
+
+        // 露点: γ = ln(RH/100) + aT/(b+T), Td = bγ/(a-γ)
+        float g = fastLn(rh * 0.01f) + MAGNUS_A * t / (MAGNUS_B + t);
+        out.dewPoint = MAGNUS_B * g / (MAGNUS_A - g);
+
+        // 絶対湿度: ρv = 216.7 · e / (273.15 + T)   e = RH/100 · es(T)
+        out.absHumidity = 2.167f * rh * saturationVaporPressure(t) / (273.15f + t);
+
+        out.heatIndex = heatIndex(t, rh);
+    }
+
+    // バッチ版（列ごとの配列。ログ全件の再計算・ベンチマーク用）
+    void computeBatch(const float* t, const float* rh,
+                      float* dewPoint, float* heatIndexOut, float* absHumidity,
+                      size_t n) const {
+        for (size_t i = 0; i < n; ++i) {
+            DerivedValues v;
+            compute(t[i], rh[i], v);
+            dewPoint[i]     = v.dewPoint;
+            heatIndexOut[i] = v.heatIndex;
+            absHumidity[i]  = v.absHumidity;
+        }
+    }
+
+    // NOAA の暑さ指数（℉ で計算して ℃ に戻す）。80℉ 未満は Steadman の簡易式
+    static float heatIndex(float t, float rh) {
+        float tf     = t * 1.8f + 32.0f;
+        float simple = 0.5f * (tf + 61.0f + (tf - 68.0f) * 1.2f + rh * 0.094f);
+        float full   = -42.379f + 2.04901523f * tf + 10.14333127f * rh
+                     - 0.22475541f * tf * rh - 0.00683783f * tf * tf
+                     - 0.05481717f * rh * rh + 0.00122874f * tf * tf * rh
+                     + 0.00085282f * tf * rh * rh - 0.00000199f * tf * tf * rh * rh;
+        float hf = (0.5f * (simple + tf) < 80.0f) ? simple : full;
+        return (hf - 32.0f) * (1.0f / 1.8f);
+    }
+
+    // libm による基準値（精度確認用）
+    static void computeExact(float t, float rh, DerivedValues& out) {
+        rh = rh < 1.0f ? 1.0f : (rh > 100.0f ? 100.0f : rh);
+        float g = logf(rh * 0.01f) + MAGNUS_A * t / (MAGNUS_B + t);
+        out.dewPoint    = MAGNUS_B * g / (MAGNUS_A - g);
+        float es        = MAGNUS_C * expf(MAGNUS_A * t / (MAGNUS_B + t));
+        out.absHumidity = 2.167f * rh * es / (273.15f + t);
+        out.heatIndex   = heatIndex(t, rh);
+    }
+
+private:
+    float _es[ES_SIZE];
+};
+
+// ================================================================
+//  気圧傾向（3 時間の傾き）
+//   - 10 分ごとのバケット平均を最大 18 個（3 時間）保持する。
+//   - 最小二乗の累積和を整数（x = バケット番号, y = 0.01 hPa）で持ち、
+//     バケットの追加・期限切れのたびに足し引きするだけで O(1) 更新。
+//     整数なので長時間動かしても誤差が溜まらない。
+// ================================================================
+class PressureTrend {
+public:
+    static constexpr uint32_t BUCKET_SEC  = 600;
+    static constexpr uint8_t  WINDOW      = 18;   // 3 時間
+    static constexpr uint8_t  MIN_BUCKETS = 3;    // これ未満は「不明」
+
+    void add(uint32_t nowSec, float hPa) {
+        int32_t bucket = (int32_t)(nowSec / BUCKET_SEC);
+        if (_openCount && bucket != _openBucket) {
+            closeBucket();
+        }
+        _openBucket = bucket;
+        _openSum   += (int32_t)lroundf(hPa * 100.0f);
+        _openCount++;
+
+        // 窓から外れたバケットを捨てる
+        while (_n && _x[_head] <= bucket - (int32_t)WINDOW) {
+            evict();
+        }
+    }
+
+    bool valid() const { return _n >= MIN_BUCKETS; }
+
+    // hPa / 3h（valid() でなければ 0）
+    float slopePer3h() const {
+        if (!valid()) return 0.0f;
+        int64_t n   = _n;
+        int64_t den = n * _sxx - _sx * _sx;
+        if (den == 0) return 0.0f;
+        double slope = (double)(n * _sxy - _sx * _sy) / (double)den;   // 0.01 hPa / バケット
+        return (float)(slope * WINDOW / 100.0);
+    }
+
+    void reset() { *this = PressureTrend(); }
+
+private:
+    void closeBucket() {
+        int32_t y = _openSum / (int32_t)_openCount;
+        if (_n == WINDOW) evict();
+        uint8_t tail = (uint8_t)((_head + _n) % WINDOW);
+        _x[tail] = _openBucket;
+        _y[tail] = y;
+        _n++;
+        _sx  += _openBucket;
+        _sy  += y;
+        _sxx += (int64_t)_openBucket * _openBucket;
+        _sxy += (int64_t)_openBucket * y;
+        _openSum   = 0;
+        _openCount = 0;
+    }
+
+    void evict() {
+        int64_t x = _x[_head], y = _y[_head];
+        _sx  -= x;
+        _sy  -= y;
+        _sxx -= x * x;
+        _sxy -= x * y;
+        _head = (uint8_t)((_head + 1) % WINDOW);
+        _n--;
+    }
+
+    int32_t  _x[WINDOW] = {};
+    int32_t  _y[WINDOW] = {};
+    uint8_t  _head = 0;
+    uint8_t  _n    = 0;
+    int64_t  _sx = 0, _sy = 0, _sxx = 0, _sxy = 0;
+
+    int32_t  _openBucket = 0;
+    int32_t  _openSum    = 0;
+    uint16_t _openCount  = 0;
+};
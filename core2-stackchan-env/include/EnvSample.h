@@ -0,0 +1,119 @@
+#pragma once
+// ================================================================
+//  計測値メッセージ（home/env/<device>）の読み取りと重複排除
+//   - 形式: "<t>,<h>,<p>,<seq>,<bootId>[,<取得時刻 sec.ms>]"。seq の無い
+//     "<t>,<h>,<p>" は旧形式（ack も重複排除もしない）。
+//   - Dedup はキー（トピックのハッシュ）ごとに最大 seq と直近 WINDOW 件の
+//     ビットマップを持ち、受け取り済みの seq を捨てる。bootId が変わったら
+//     センサー再起動とみなしてやり直す。表が埋まったら最も長く届いていない
+//     キーを忘れる。時刻は ms（折り返してよい）。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace EnvSample {
+
+// デバイス名・トピックのハッシュ（FNV-1a, 0 は「未使用」に取っておく）
+inline uint32_t hashName(const char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h = (h ^ (uint8_t)*s++) * 16777619u;
+    }
+    return h ? h : 1;
+}
+
+enum class Format : uint8_t { Invalid, Legacy, Sequenced };
+
+struct Sample {
+    float    t, h, p;
+    uint32_t seq;
+    uint32_t bootId;
+    uint32_t time;     // センサーの取得時刻（エポック秒, 0 = 無し。ミリ秒は捨てる）
+};
+
+inline Format parse(const char* payload, Sample& s) {
+    unsigned long seq = 0, sec = 0;
+    unsigned      bootId = 0;
+    int n = sscanf(payload, "%f,%f,%f,%lu,%u,%lu", &s.t, &s.h, &s.p, &seq, &bootId, &sec);
+    s.seq    = (uint32_t)seq;
+    s.bootId = bootId;
+    s.time   = (n == 6) ? (uint32_t)sec : 0;
+    if (n == 3) return Format::Legacy;
+    return (n == 5 || n == 6) ? Format::Sequenced : Format::Invalid;
+}
+
+enum class Verdict : uint8_t { Accepted, Reordered, Duplicate };
+
+template <size_t N>
+class Dedup {
+public:
+    static constexpr uint32_t WINDOW = 64;
+
+    Dedup() { clear(); }
+
+    void clear() { memset(_state, 0, sizeof(_state)); }
+
+    // Reordered = 窓の中で順序が入れ替わって届いた（受け入れる）
+    Verdict accept(uint32_t key, uint16_t bootId, uint32_t seq, uint32_t nowMs) {
+        State* st   = nullptr;
+        State* free = nullptr;
+        for (auto& d : _state) {
+            if (d.key == key) { st = &d; break; }
+            if (!d.key) {
+                if (!free || free->key) free = &d;
+            } else if (!free || (free->key && nowMs - d.lastMs > nowMs - free->lastMs)) {
+                free = &d;   // 空きが無ければ最も長く届いていないキー
+            }
+        }
+        if (!st) {
+            st      = free;
+            st->key = key;
+            restart(*st, bootId, seq, nowMs);
+            return Verdict::Accepted;
+        }
+
+        st->lastMs = nowMs;
+        if (st->bootId != bootId) {
+            restart(*st, bootId, seq, nowMs);
+            return Verdict::Accepted;
+        }
+
+        if (seq > st->highestSeq) {
+            uint32_t shift = seq - st->highestSeq;
+            st->seenMask   = (shift >= WINDOW) ? 1 : ((st->seenMask << shift) | 1);
+            st->highestSeq = seq;
+            return Verdict::Accepted;
+        }
+
+        uint32_t back = st->highestSeq - seq;
+        if (back >= WINDOW) return Verdict::Duplicate;   // 窓より古い再送は受け取り済みとみなす
+        uint64_t bit = 1ULL << back;
+        if (st->seenMask & bit) return Verdict::Duplicate;
+        st->seenMask |= bit;
+        return Verdict::Reordered;
+    }
+
+private:
+    struct State {
+        uint32_t key;          // 0 = 未使用
+        uint16_t bootId;
+        uint32_t highestSeq;
+        uint64_t seenMask;     // bit i = (highestSeq - i) を受信済み
+        uint32_t lastMs;       // 最後に届いた時刻（追い出しの順）
+    };
+
+    static void restart(State& st, uint16_t bootId, uint32_t seq, uint32_t nowMs) {
+        st.bootId     = bootId;
+        st.highestSeq = seq;
+        st.seenMask   = 1;
+        st.lastMs     = nowMs;
+    }
+
+    State _state[N];
+};
+
+}  // namespace EnvSample
@@ -0,0 +1,191 @@
+#pragma once
+// ================================================================
+//  エポック秒の時計（RTC で較正する単調時計）
+//   - RTC（I2C）は起動時と RESYNC_SEC ごとにだけ読み、その間は
+//     単調カウンタ（esp_timer の µs）からの経過で進める。
+//     ログの記録・表示のたびに I2C を叩かない。
+//   - 値は 1970/01/01 00:00:00 からの秒。RTC は現地時刻で合わせているので
+//     タイムゾーンは持たず「RTC の時刻をそのままエポック秒にしたもの」とする。
+//   - RTC は秒単位でしか読めないので、読んだ瞬間で合わせるとミリ秒が最大 1 秒
+//     ずれる。較正は beginEdge → RTC を読むたびに onRtcRead で秒の変わり目を待ち、
+//     変わる前後の読みの中間を「ちょうど秒の頭」として合わせる（誤差は読む間隔の半分）。
+//     EDGE_TIMEOUT_US 待っても変わらない（RTC が止まっている）ときはそのまま合わせる。
+//   - 較正で時計が戻る場合は、追いつくまで同じ秒を返す（単調）。
+//     手動で時刻を合わせたときだけ step = true で戻すことを許す。
+//   - 日付 ↔ エポック秒の変換も持つ（表示・CSV 移行用）。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+class EpochClock {
+public:
+    static constexpr uint32_t RESYNC_SEC      = 3600;      // RTC を読み直す間隔
+    static constexpr int64_t  EDGE_TIMEOUT_US = 1500000;   // 秒の変わり目を待つ上限
+
+    struct Civil {
+        int     year;
+        uint8_t month, day, hour, minute, second;
+    };
+
+    // ---- 較正 ----
+    //   epoch = RTC から読んだ時刻, monoUs = そのときの単調カウンタ
+    void sync(uint32_t epoch, int64_t monoUs, bool step) {
+        if (_valid) {
+            _lastCorrection = (int32_t)(epoch - nowRaw(monoUs));
+        }
+        _baseEpoch = epoch;
+        _baseUs    = monoUs;
+        _syncUs    = monoUs;
+        _valid     = true;
+        if (step) _floor = 0;
+    }
+
+    // 秒の変わり目での較正を始める（以後 RTC を読むたびに onRtcRead）
+    void beginEdge(bool step) {
+        _edgePending = true;
+        _edgeStep    = step;
+        _edgeEpoch   = 0;
+    }
+
+    bool edgePending() const { return _edgePending; }
+    void cancelEdge() { _edgePending = false; }
+
+    // RTC を読んだ結果を渡す。秒が変わったところ（かタイムアウト）で sync して true
+    bool onRtcRead(uint32_t epoch, int64_t monoUs) {
+        if (!_edgePending) return false;
+        if (!_edgeEpoch) {
+            _edgeEpoch   = epoch;
+            _edgeFirstUs = monoUs;
+            _edgeLastUs  = monoUs;
+            return false;
+        }
+        if (epoch == _edgeEpoch && monoUs - _edgeFirstUs < EDGE_TIMEOUT_US) {
+            _edgeLastUs = monoUs;
+            return false;
+        }
+        int64_t atUs = epoch == _edgeEpoch ? monoUs : _edgeLastUs + (monoUs - _edgeLastUs) / 2;
+        _edgePending = false;
+        sync(epoch, atUs, _edgeStep);
+        return true;
+    }
+
+    bool valid() const { return _valid; }
+
+    bool needsResync(int64_t monoUs) const {
+        return !_valid || (monoUs - _syncUs) >= (int64_t)RESYNC_SEC * 1000000;
+    }
+
+    // 直前の較正で RTC とずれていた秒数（正 = 時計が遅れていた）
+    int32_t lastCorrection() const { return _lastCorrection; }
+
+    // 現在のエポック秒（未較正なら 0）
+    uint32_t now(int64_t monoUs) {
+        if (!_valid) return 0;
+        uint32_t t = nowRaw(monoUs);
+        if (t < _floor) t = _floor;
+        _floor = t;
+        return t;
+    }
+
+    // 現在のエポック秒 + ミリ秒（時刻配信用。据え置き中のミリ秒は 999）
+    uint32_t nowMs(int64_t monoUs, uint16_t& ms) {
+        uint32_t t = now(monoUs);
+        ms = (_valid && t == nowRaw(monoUs))
+           ? (uint16_t)(((monoUs - _baseUs) / 1000) % 1000)
+           : 999;
+        return t;
+    }
+
+    // ---- 日付 ↔ エポック秒（グレゴリオ暦, H. Hinnant の days_from_civil） ----
+    static int32_t daysFromCivil(int y, unsigned m, unsigned d) {
+        y -= m <= 2;
+        const int32_t  era = (y >= 0 ? y : y - 399) / 400;
+        const unsigned yoe = (unsigned)(y - era * 400);
+        const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+        const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + (int32_t)doe - 719468;
+    }
+
+    static void civilFromDays(int32_t z, int& y, unsigned& m, unsigned& d) {
+        z += 719468;
+        const int32_t  era = (z >= 0 ? z : z - 146096) / 146097;
+        const unsigned doe = (unsigned)(z - era * 146097);
+        const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        const unsigned mp  = (5 * doy + 2) / 153;
+        d = doy - (153 * mp + 2) / 5 + 1;
+        m = mp < 10 ? mp + 3 : mp - 9;
+        y = (int)yoe + era * 400 + (m <= 2);
+    }
+
+    // 範囲外（1970〜2105 年以外・不正な日時）は 0
+    static uint32_t toEpoch(const Civil& c) {
+        if (c.year < 1970 || c.year > 2105 || c.month < 1 || c.month > 12 ||
+            c.day < 1 || c.day > 31 || c.hour > 23 || c.minute > 59 || c.second > 59) {
+            return 0;
+        }
+        int64_t days = daysFromCivil(c.year, c.month, c.day);
+        int64_t sec  = days * 86400 + c.hour * 3600 + c.minute * 60 + c.second;
+        return (sec > 0 && sec <= 0xFFFFFFFFLL) ? (uint32_t)sec : 0;
+    }
+
+    static Civil toCivil(uint32_t epoch) {
+        Civil c;
+        int      y;
+        unsigned m, d;
+        civilFromDays((int32_t)(epoch / 86400), y, m, d);
+        uint32_t s = epoch % 86400;
+        c.year   = y;
+        c.month  = (uint8_t)m;
+        c.day    = (uint8_t)d;
+        c.hour   = (uint8_t)(s / 3600);
+        c.minute = (uint8_t)(s / 60 % 60);
+        c.second = (uint8_t)(s % 60);
+        return c;
+    }
+
+    // "YYYY/MM/DD HH:MM:SS"（20 バイト必要）。0 = 不明
+    static void format(uint32_t epoch, char* buf, size_t len) {
+        if (!epoch) {
+            snprintf(buf, len, "----/--/-- --:--:--");
+            return;
+        }
+        Civil c = toCivil(epoch);
+        snprintf(buf, len, "%04d/%02u/%02u %02u:%02u:%02u",
+                 c.year, (unsigned)c.month, (unsigned)c.day,
+                 (unsigned)c.hour, (unsigned)c.minute, (unsigned)c.second);
+    }
+
+    // "YYYY/MM/DD HH:MM:SS" → エポック秒（失敗 = 0）
+    static uint32_t parse(const char* s) {
+        int y, mo, d, h, mi, se;
+        if (sscanf(s, "%d/%d/%d %d:%d:%d", &y, &mo, &d, &h, &mi, &se) != 6) return 0;
+        if (mo < 1 || mo > 12 || d < 1 || d > 31 ||
+            h < 0 || h > 23 || mi < 0 || mi > 59 || se < 0 || se > 59) {
+            return 0;
+        }
+        Civil c = { y, (uint8_t)mo, (uint8_t)d, (uint8_t)h, (uint8_t)mi, (uint8_t)se };
+        return toEpoch(c);
+    }
+
+private:
+    uint32_t nowRaw(int64_t monoUs) const {
+        return _baseEpoch + (uint32_t)((monoUs - _baseUs) / 1000000);
+    }
+
+    uint32_t _baseEpoch      = 0;
+    int64_t  _baseUs         = 0;
+    int64_t  _syncUs         = 0;
+    uint32_t _floor          = 0;
+    int32_t  _lastCorrection = 0;
+    bool     _valid          = false;
+
+    bool     _edgePending    = false;
+    bool     _edgeStep       = false;
+    uint32_t _edgeEpoch      = 0;     // 最初に読んだ秒（0 = まだ読んでいない）
+    int64_t  _edgeFirstUs    = 0;
+    int64_t  _edgeLastUs     = 0;     // 最初の秒のまま読めた最後
+};
@@ -0,0 +1,383 @@
+#pragma once
+// ================================================================
+//  ハブの受信の取り込み（計測値・時刻要求・後送り）
+//   - ファームウェア（src/main.cpp）がこのクラスをそのまま呼ぶ。ホスト版
+//     （tools/trace_tool replay・tools/hub_sim・test_trace_replay）も同じものを
+//     HubIngestHost.h の土台から呼ぶので、取り込みの変更は再生結果に出る。
+//   - 計測値: 読み取り → ack → 重複判定（EnvSample::Dedup）→ 異常検知 →
+//     送信枠の更新 → 取得時刻の検証 → 校正（Host）→ 派生指標・気圧傾向 →
+//     デバイスごとの間引き → ログ（Host）→ 表示（Host）。
+//   - 後送り: 取り込み済みの seq・範囲外の時刻・間引きを除き、時刻順にそろえて
+//     ログへ差し込む（Host。同じ行の判定と実際の差し込みは保存先の仕事）。
+//   - 時計・応答・校正・ログの保存・表示は Host の仮想関数で差し替える。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <math.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "EnvSample.h"
+#include "AnomalyDetector.h"
+#include "DerivedMetrics.h"
+#include "BackfillBatch.h"
+#include "PublishSlots.h"
+
+class HubIngest {
+public:
+    static constexpr size_t   DEVICES         = AnomalyDetector::MaxDevices;   // ハブの台数の上限
+    static constexpr uint32_t TIME_FUTURE_SEC = 60;          // 取得時刻はハブの時計からこれより先 /
+    static constexpr uint32_t TIME_PAST_SEC   = 7 * 86400;   // これより前なら受信時刻で記録する
+
+    typedef PublishSlots<DEVICES> Slots;
+
+    // 設定のうち取り込みが使う項目（HubConfig から setConfig() で渡す）
+    struct Config {
+        float   logDeltaT;      // これ未満の変化はログに残さない
+        float   logDeltaH;
+        float   logDeltaP;
+        uint8_t publishSlots;   // 送信時刻の枠の数
+    };
+
+    // 取り込んだ 1 サンプル（ログの 1 行・表示の元）
+    struct Reading {
+        uint32_t      device;     // EnvSample::hashName(デバイス名)。0 = 不明
+        uint32_t      time;       // センサーの取得時刻（検証済み, エポック秒）。0 = 受信時刻を使う
+        float         rawT;       // センサーの生値
+        float         rawH;
+        float         rawP;
+        float         t;          // 校正後（Host::calibrate）
+        float         h;
+        float         p;
+        uint16_t      calEpoch;   // 校正した世代
+        DerivedValues derived;    // 校正後の値から
+        float         trend;      // hPa / 3h（NAN = 不明）
+        uint8_t       flags;      // AnomalyFlag
+    };
+
+    struct Stats {
+        uint32_t accepted;
+        uint32_t duplicates;         // 重複として捨てた数
+        uint32_t reordered;          // 窓内で順序が入れ替わって届いた数
+        uint32_t legacy;             // seq 無し（旧フォーマット）
+        uint32_t quarantined;        // 隔離して使わなかった数
+        uint32_t timeRequests;       // 応答した時刻要求
+        uint32_t timeStamped;        // 取得時刻付きで記録したサンプル
+        uint32_t timeRejected;       // 取得時刻がずれすぎていて受信時刻にしたサンプル
+        uint32_t backfillBatches;    // 受け取った塊
+        uint32_t backfillRows;       // 受け取った行
+        uint32_t backfillMerged;     // ログへ差し込んだ行
+        uint32_t backfillDuplicates; // 取り込み済みとして捨てた行（seq / 同じ時刻・同じ値）
+        uint32_t backfillThinned;    // 記録しきい値未満の変化で間引いた行
+        uint32_t backfillRejected;   // 形式不正・時刻が範囲外
+        uint32_t logWrites;          // ログに入れた行（後送りの差し込みを含む）
+    };
+
+    // ファームウェア / ホストで差し替える部分
+    class Host {
+    public:
+        virtual ~Host() {}
+
+        virtual uint32_t nowMs() = 0;                          // 単調な ms（折り返してよい）
+        virtual uint32_t nowEpoch() = 0;                       // エポック秒（0 = 時計が未設定）
+        virtual uint32_t nowEpochMs(uint16_t& ms) = 0;         // 時刻要求への応答用
+        virtual uint32_t trendSec() { return nowMs() / 1000; } // 気圧傾向の時刻（秒）
+
+        // ack・時刻の応答（届いた配送路へ返す）
+        virtual void publish(const char* topic, const char* payload) = 0;
+
+        // r.rawT/H/P と r.device から r.t/h/p と r.calEpoch を埋める
+        virtual void calibrate(Reading& r) = 0;
+
+        // ログの末尾へ 1 行（間引きは済んでいる）
+        virtual void appendLog(const Reading& r) = 0;
+
+        // 時刻の昇順の rows[0..k) を時刻順の位置へ差し込み、差し込んだ行数を返す
+        // （既にある同じ行は捨てる）
+        virtual size_t mergeLog(const Reading* rows, size_t k) = 0;
+
+        // 採用したサンプル（表示・ルール・状態の公開）。ログの後に呼ぶ
+        virtual void onSample(const Reading& r) = 0;
+
+        // 隔離したサンプル（r は生値と flags だけ）
+        virtual void onQuarantine(const char* device, const Reading& r) {
+            (void)device;
+            (void)r;
+        }
+    };
+
+    explicit HubIngest(Host& host) : _host(host) {
+        _cfg = Config{ 0.2f, 1.0f, 0.5f, 32 };
+        clear();
+    }
+
+    // 電源投入時と同じ状態へ戻す（設定はそのまま）
+    void clear() {
+        _dedup.clear();
+        _anomaly = AnomalyDetector();
+        _trend.reset();
+        _slots.clear();
+        memset(_cursor, 0, sizeof(_cursor));
+        memset(_logged, 0, sizeof(_logged));
+        _stats = Stats();
+    }
+
+    void setConfig(const Config& c) { _cfg = c; }
+    const Config& config() const { return _cfg; }
+
+    // ===== 計測値: "<t>,<h>,<p>,<seq>,<bootId>[,<time>]" か旧形式 "<t>,<h>,<p>" =====
+    void onEnvMessage(const char* topic, const char* payload) {
+        const char* slash  = strrchr(topic, '/');
+        const char* device = slash ? slash + 1 : topic;
+        EnvSample::Sample s;
+        EnvSample::Format fmt = EnvSample::parse(payload, s);
+        if (fmt == EnvSample::Format::Legacy) {
+            _stats.legacy++;
+            ingestSample(device, s.t, s.h, s.p, 0);
+            return;
+        }
+        if (fmt != EnvSample::Format::Sequenced) return;
+
+        // 重複でも ack は返す（前回の ack が届かなかった可能性がある）
+        char ackTopic[64];
+        char ack[24];
+        snprintf(ackTopic, sizeof(ackTopic), "%s/ack", topic);
+        snprintf(ack, sizeof(ack), "%u,%lu", (unsigned)s.bootId, (unsigned long)s.seq);
+        _host.publish(ackTopic, ack);
+
+        EnvSample::Verdict v = _dedup.accept(EnvSample::hashName(topic), (uint16_t)s.bootId, s.seq,
+                                             _host.nowMs());
+        if (v == EnvSample::Verdict::Duplicate) {
+            _stats.duplicates++;
+            return;
+        }
+        if (v == EnvSample::Verdict::Reordered) _stats.reordered++;
+        _stats.accepted++;
+        ingestSample(device, s.t, s.h, s.p, s.time);
+    }
+
+    // ===== 時刻要求 → "<t1>,<sec>,<ms>,<slotOffsetMs>,<periodMs>" =====
+    //   枠が無ければ 0,0（自由に送る）。時計が未設定なら答えない
+    void onTimeRequest(const char* payload, const char* device) {
+        uint16_t ms;
+        uint32_t sec = _host.nowEpochMs(ms);
+        if (!sec) return;
+
+        int slot = _slots.slotFor(EnvSample::hashName(device), _host.nowMs(), _cfg.publishSlots);
+        unsigned long t1 = strtoul(payload, nullptr, 10);
+        char topic[64];
+        char reply[56];
+        snprintf(topic, sizeof(topic), "home/env/%s/time", device);
+        snprintf(reply, sizeof(reply), "%lu,%lu,%u,%lu,%lu", t1, (unsigned long)sec, (unsigned)ms,
+                 (unsigned long)(slot >= 0 ? Slots::offsetMs(slot, _cfg.publishSlots) : 0),
+                 (unsigned long)(slot >= 0 ? Slots::PERIOD_MS : 0));
+        _host.publish(topic, reply);
+        _stats.timeRequests++;
+    }
+
+    // ===== 後送り: "<firstSeq>,<baseEpoch>;<dt>,<t>,<h>,<p>;..."（BackfillBatch） =====
+    //   書式が崩れていたら塊ごと捨てる（ack しないのでセンサーが送り直す）
+    void onBackfill(const char* topic, const char* payload, const char* device) {
+        uint32_t first;
+        size_t   n = BackfillBatch::parse(payload, first, _parsed, BackfillBatch::ROWS_MAX);
+        if (!n) {
+            _stats.backfillRejected++;
+            return;
+        }
+        _stats.backfillBatches++;
+        _stats.backfillRows += n;
+
+        uint32_t hash = EnvSample::hashName(device);
+        Cursor&  cur  = cursor(hash);
+        uint32_t now  = _host.nowEpoch();
+        size_t   kept = 0;
+        for (size_t i = 0; i < n; ++i) {
+            const BackfillBatch::Row& r = _parsed[i];
+            if (first + i <= cur.lastSeq) {
+                _stats.backfillDuplicates++;
+                continue;
+            }
+            if (!r.time || (now && r.time > now + TIME_FUTURE_SEC)) {
+                _stats.backfillRejected++;
+                continue;
+            }
+            Reading& e = _rows[kept];
+            e.device = hash;
+            e.time   = r.time;
+            e.rawT   = r.t100 * 0.01f;
+            e.rawH   = r.h100 * 0.01f;
+            e.rawP   = r.p10 * 0.1f;
+            e.trend  = NAN;
+            e.flags  = 0;
+            _host.calibrate(e);
+            _derived.compute(e.t, e.h, e.derived);
+            if (kept && near(_rows[kept - 1].t, _rows[kept - 1].h, _rows[kept - 1].p, e)) {
+                _stats.backfillThinned++;
+                continue;
+            }
+            kept++;
+        }
+
+        // 時刻順にそろえる（journal は取得順なので通常はそのまま）
+        BackfillBatch::sortByTime(_rows, kept);
+        if (kept) {
+            size_t merged = _host.mergeLog(_rows, kept);
+            _stats.backfillDuplicates += (uint32_t)(kept - merged);
+            _stats.backfillMerged     += (uint32_t)merged;
+            _stats.logWrites          += (uint32_t)merged;
+        }
+
+        uint32_t last = first + (uint32_t)n - 1;
+        if ((int32_t)(last - cur.lastSeq) > 0) cur.lastSeq = last;
+
+        char ackTopic[64];
+        char ack[12];
+        snprintf(ackTopic, sizeof(ackTopic), "%s/ack", topic);
+        snprintf(ack, sizeof(ack), "%lu", (unsigned long)last);
+        _host.publish(ackTopic, ack);
+    }
+
+    // ログへ 1 行。同じデバイスが最後に記録した値から変化が小さければ残さない
+    //   （直前の行は別のセンサーのことが多いので、デバイスごとに比べる）。
+    //   校正の世代が変わった・表から忘れたデバイスの次の行は必ず残す
+    bool logReading(const Reading& r) {
+        Logged& last = loggedFor(r.device);
+        if (last.used && last.calEpoch == r.calEpoch && near(last.t, last.h, last.p, r)) {
+            return false;
+        }
+        last.used     = true;
+        last.calEpoch = r.calEpoch;
+        last.t        = r.t;
+        last.h        = r.h;
+        last.p        = r.p;
+        last.lastMs   = _host.nowMs();
+        _host.appendLog(r);
+        _stats.logWrites++;
+        return true;
+    }
+
+    // ログを消したとき（次の行はデバイスごとに必ず残す）
+    void forgetLogged() { memset(_logged, 0, sizeof(_logged)); }
+
+    const Stats&     stats() const { return _stats; }
+    AnomalyDetector& anomaly() { return _anomaly; }
+    PressureTrend&   trend() { return _trend; }
+    DerivedCalc&     derived() { return _derived; }
+    const Slots&     slots() const { return _slots; }
+    size_t           slotsUsed() const { return _slots.used(_cfg.publishSlots); }
+
+private:
+    struct Cursor {
+        uint32_t device;    // 0 = 未使用
+        uint32_t lastSeq;   // 取り込み済みの最大 seq
+        uint32_t lastMs;    // 最後に届いた時刻（表が埋まったら古い順に忘れる）
+    };
+
+    struct Logged {
+        bool     used;
+        uint16_t calEpoch;   // 値を校正した世代（変わったら比べずに残す）
+        uint32_t device;
+        float    t;          // 最後に記録した校正後の値
+        float    h;
+        float    p;
+        uint32_t lastMs;
+    };
+
+    // sampleTime = センサーの取得時刻（エポック秒, 0 = 無し）
+    void ingestSample(const char* device, float t, float h, float p, uint32_t sampleTime) {
+        Reading r;
+        r.device = EnvSample::hashName(device);
+        r.time   = 0;
+        r.rawT   = t;
+        r.rawH   = h;
+        r.rawP   = p;
+        r.flags  = 0;
+
+        // 異常検知（隔離したサンプルは表示・ログに入れない）
+        const float raw[AnomalyDetector::FIELDS] = { t, h, p };
+        uint32_t    nowMs = _host.nowMs();
+        if (_anomaly.check(r.device, device, nowMs, raw, r.flags) == AnomalyVerdict::Quarantine) {
+            _stats.quarantined++;
+            _host.onQuarantine(device, r);
+            return;
+        }
+        _slots.touch(r.device, nowMs, _cfg.publishSlots);
+
+        if (sampleTime) {
+            uint32_t now = _host.nowEpoch();
+            if (now && sampleTime <= now + TIME_FUTURE_SEC && sampleTime + TIME_PAST_SEC >= now) {
+                r.time = sampleTime;
+                _stats.timeStamped++;
+            } else {
+                _stats.timeRejected++;
+            }
+        }
+
+        _host.calibrate(r);
+        _derived.compute(r.t, r.h, r.derived);
+        _trend.add(_host.trendSec(), r.p);
+        r.trend = _trend.valid() ? _trend.slopePer3h() : NAN;
+
+        logReading(r);
+        _host.onSample(r);
+    }
+
+    bool near(float t, float h, float p, const Reading& r) const {
+        return fabsf(r.t - t) < _cfg.logDeltaT &&
+               fabsf(r.h - h) < _cfg.logDeltaH &&
+               fabsf(r.p - p) < _cfg.logDeltaP;
+    }
+
+    // デバイスの取り込み位置（無ければ空き → 最も長く届いていないデバイスの順に使う。
+    // 忘れたデバイスの再送は Host::mergeLog の同じ行の判定で捨てる）
+    Cursor& cursor(uint32_t device) {
+        uint32_t now  = _host.nowMs();
+        Cursor*  free = nullptr;
+        for (auto& c : _cursor) {
+            if (c.device == device) {
+                c.lastMs = now;
+                return c;
+            }
+            if (!c.device) {
+                if (!free || free->device) free = &c;
+            } else if (!free || (free->device && now - c.lastMs > now - free->lastMs)) {
+                free = &c;
+            }
+        }
+        *free = Cursor{ device, 0, now };
+        return *free;
+    }
+
+    // デバイスが最後に記録した値（無ければ空き → 最も長く記録していないデバイスを忘れる）
+    Logged& loggedFor(uint32_t device) {
+        uint32_t now  = _host.nowMs();
+        Logged*  free = nullptr;
+        for (auto& l : _logged) {
+            if (l.used && l.device == device) return l;
+            if (!l.used) {
+                if (!free || free->used) free = &l;
+            } else if (!free || (free->used && now - l.lastMs > now - free->lastMs)) {
+                free = &l;
+            }
+        }
+        free->used   = false;
+        free->device = device;
+        return *free;
+    }
+
+    Host&                     _host;
+    Config                    _cfg;
+    EnvSample::Dedup<DEVICES> _dedup;
+    AnomalyDetector           _anomaly;
+    DerivedCalc               _derived;
+    PressureTrend             _trend;
+    Slots                     _slots;
+    Cursor                    _cursor[DEVICES];
+    Logged                    _logged[DEVICES];
+    Stats                     _stats = {};
+    BackfillBatch::Row        _parsed[BackfillBatch::ROWS_MAX];   // 読んだままの値
+    Reading                   _rows[BackfillBatch::ROWS_MAX];     // 差し込む行
+};
@@ -0,0 +1,219 @@
+#pragma once
+// ================================================================
+//  HubIngest をホスト（PC）で動かす土台（tools/trace_tool replay・tools/hub_sim）
+//   - 取り込みはファームウェアと同じ HubIngest。ここはその Host の実装だけを持つ:
+//       時計   : message() の nowMs と setClock() の開始エポック秒（流す速さに依らない）
+//       応答   : setReply() の関数へ渡す
+//       校正   : 校正表なし（ファームウェアの初期状態と同じ恒等 + 湿度 0〜100, 世代 0）
+//       ログ   : RAM のリング LOG_MAX 件（時刻順の差し込み・同じ行の判定つき）
+//       表示   : 採用したサンプルの数と最後の値だけ残す
+//   - 振り分けはファームウェアの setupTopicRoutes() と同じパターン
+//     （リンク計測値 .../stat は表示だけなので受けて捨てる）。
+//   - 動的確保なし（ログを含め約 1.2 MB, 静的に置く）。
+//     Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <math.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "TopicRouter.h"
+#include "HubIngest.h"
+
+class HubIngestHost : public HubIngest::Host {
+public:
+    static constexpr size_t LOG_MAX = 50000;   // LOG_CAPACITY_MAX
+
+    typedef void (*Reply)(void* ctx, const char* topic, const char* payload);
+
+    struct LogRow {
+        uint32_t time;          // エポック秒
+        uint32_t device;        // EnvSample::hashName(デバイス名)
+        float    temperature;
+        float    humidity;
+        float    pressure;
+        uint8_t  anomalyFlags;
+    };
+
+    HubIngestHost() : _ingest(*this) { clear(); }
+
+    // 電源投入時と同じ状態へ戻す（応答先・時計・設定はそのまま）
+    void clear() {
+        _ingest.clear();
+        _logHead  = 0;
+        _logCount = 0;
+        _messages = 0;
+        _replies  = 0;
+        _samples  = 0;
+        memset(&_last, 0, sizeof(_last));
+    }
+
+    void setReply(Reply fn, void* ctx) {
+        _reply    = fn;
+        _replyCtx = ctx;
+    }
+
+    // nowMs = 0 のときのエポック秒（0 = 時計が未設定。時刻要求に答えない）
+    void setClock(uint32_t startEpoch) { _startEpoch = startEpoch; }
+
+    // 1 通を振り分けて取り込む（nowMs は折り返してよい）
+    void message(const char* topic, const char* payload, uint32_t nowMs) {
+        _nowMs = nowMs;
+        _messages++;
+        HubIngestHost*& self = current();
+        HubIngestHost*  prev = self;
+        self = this;
+        router().route(topic, payload);
+        self = prev;
+    }
+
+    HubIngest&                ingest() { return _ingest; }
+    uint32_t                  messages() const { return _messages; }
+    uint32_t                  replies() const { return _replies; }    // ack・時刻の応答
+    uint32_t                  samples() const { return _samples; }    // 表示へ渡したサンプル
+    const HubIngest::Reading& lastSample() const { return _last; }
+    size_t                    logRows() const { return _logCount; }
+    const LogRow&             logAt(size_t i) const { return _log[phys(i)]; }
+
+    // ===== HubIngest::Host =====
+    uint32_t nowMs() override { return _nowMs; }
+
+    uint32_t nowEpoch() override { return _startEpoch ? _startEpoch + _nowMs / 1000 : 0; }
+
+    uint32_t nowEpochMs(uint16_t& ms) override {
+        ms = (uint16_t)(_nowMs % 1000);
+        return nowEpoch();
+    }
+
+    void publish(const char* topic, const char* payload) override {
+        _replies++;
+        if (_reply) _reply(_replyCtx, topic, payload);
+    }
+
+    void calibrate(HubIngest::Reading& r) override {
+        r.t        = r.rawT;
+        r.h        = r.rawH < 0.0f ? 0.0f : (r.rawH > 100.0f ? 100.0f : r.rawH);
+        r.p        = r.rawP;
+        r.calEpoch = 0;
+    }
+
+    void appendLog(const HubIngest::Reading& r) override {
+        if (_logCount == LOG_MAX) dropOldest();
+        _log[phys(_logCount++)] = row(r);
+    }
+
+    size_t mergeLog(const HubIngest::Reading* rows, size_t k) override {
+        static LogRow keep[BackfillBatch::ROWS_MAX];
+        size_t unique = 0;
+        for (size_t i = 0; i < k && i < BackfillBatch::ROWS_MAX; ++i) {
+            LogRow e = row(rows[i]);
+            if (!hasRow(e)) keep[unique++] = e;
+        }
+        mergeSorted(keep, unique);
+        return unique;
+    }
+
+    void onSample(const HubIngest::Reading& r) override {
+        _samples++;
+        _last = r;
+    }
+
+private:
+    typedef TopicRouter<8> Router;
+
+    static HubIngestHost*& current() {
+        static HubIngestHost* self = nullptr;
+        return self;
+    }
+
+    static const Router& router() {
+        static Router r;
+        static bool   built = false;
+        if (!built) {
+            r.add("home/env/+", [](const char* topic, const char* payload,
+                                   const char* const*, uint8_t) {
+                current()->_ingest.onEnvMessage(topic, payload);
+            });
+            r.add("home/env/+/stat", [](const char*, const char*, const char* const*, uint8_t) {
+            });
+            r.add("home/env/+/timereq", [](const char*, const char* payload,
+                                           const char* const* levels, uint8_t) {
+                current()->_ingest.onTimeRequest(payload, levels[2]);
+            });
+            r.add("home/env/+/backfill", [](const char* topic, const char* payload,
+                                            const char* const* levels, uint8_t) {
+                current()->_ingest.onBackfill(topic, payload, levels[2]);
+            });
+            built = true;
+        }
+        return r;
+    }
+
+    LogRow row(const HubIngest::Reading& r) {
+        return LogRow{ r.time ? r.time : nowEpoch(), r.device, r.t, r.h, r.p, r.flags };
+    }
+
+    // ===== ログ（リング, 論理番号 0 = 最古） =====
+    size_t phys(size_t i) const { return (_logHead + i) % LOG_MAX; }
+
+    void dropOldest() {
+        _logHead = (_logHead + 1) % LOG_MAX;
+        _logCount--;
+    }
+
+    // time より後ろの最初の論理番号
+    size_t upperBound(uint32_t time) const {
+        size_t lo = 0, hi = _logCount;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (_log[phys(mid)].time <= time) lo = mid + 1;
+            else                              hi = mid;
+        }
+        return lo;
+    }
+
+    // 同じ時刻・同じデバイス・同じ値の行（ファームウェアの logHasRow() と同じ判定）
+    bool hasRow(const LogRow& e) const {
+        for (size_t i = upperBound(e.time); i > 0 && _log[phys(i - 1)].time == e.time; --i) {
+            const LogRow& o = _log[phys(i - 1)];
+            if (o.device == e.device && fabsf(o.temperature - e.temperature) < 0.005f &&
+                fabsf(o.humidity - e.humidity) < 0.005f && fabsf(o.pressure - e.pressure) < 0.05f) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 時刻の昇順の rows[0..k) を時刻順の位置へ併合する（入りきらない分は最古から捨てる）
+    void mergeSorted(const LogRow* rows, size_t k) {
+        if (!k) return;
+        while (_logCount + k > LOG_MAX) dropOldest();
+        size_t pos = upperBound(rows[0].time);
+        size_t i = _logCount, j = k, w = _logCount + k;
+        _logCount = w;
+        while (j > 0) {
+            if (i > pos && _log[phys(i - 1)].time > rows[j - 1].time) {
+                _log[phys(w - 1)] = _log[phys(i - 1)];
+                --i;
+            } else {
+                _log[phys(w - 1)] = rows[j - 1];
+                --j;
+            }
+            --w;
+        }
+    }
+
+    HubIngest          _ingest;
+    LogRow             _log[LOG_MAX];
+    size_t             _logHead    = 0;
+    size_t             _logCount   = 0;
+    uint32_t           _messages   = 0;
+    uint32_t           _replies    = 0;
+    uint32_t           _samples    = 0;
+    HubIngest::Reading _last;
+    Reply              _reply      = nullptr;
+    void*              _replyCtx   = nullptr;
+    uint32_t           _startEpoch = 0;
+    uint32_t           _nowMs      = 0;
+};
@@ -0,0 +1,143 @@
+#pragma once
+// ================================================================
+//  ログの問い合わせ（時刻範囲 + 1 項目の範囲条件 + 集計間隔）
+//   - 呼び出し側がブロック（ログ領域の LOG_BLOCK 件）ごとに
+//       1) prune()  : ブロック要約（ゾーンマップ: 時刻範囲・項目ごとの最小/最大）
+//                     から「1 件も当てはまらない」と分かれば読まずに飛ばす
+//       2) fold()   : 全件が当てはまり、集計間隔の 1 区間に収まるなら
+//                     要約をそのまま足し込む（列も読まない）
+//       3) scan()   : それ以外は列（ColumnScan.h の固定小数点）を 1 件ずつ見る
+//     の順に渡す。読む量は当てはまるデータの量に比例し、履歴全体の長さに依らない。
+//   - 結果はできた順にシンクへ渡す（行 / 区間ごと）。溜め込まない。
+//   - 区間はログ順に作る。時刻が前後した行があると同じ区間が 2 回出ることがある。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <stdint.h>
+#include <stddef.h>
+#include "ColumnScan.h"
+
+class LogQuery {
+public:
+    static constexpr uint8_t FIELDS = 3;   // T / H / P（列の並び）
+
+    struct Params {
+        uint32_t from       = 0;            // 時刻範囲（両端を含む, エポック秒）
+        uint32_t to         = UINT32_MAX;
+        int8_t   whereField = -1;           // 範囲条件の項目（-1 = 条件なし）
+        int16_t  lo         = INT16_MIN;    // 範囲条件（両端を含む, 列と同じ固定小数点）
+        int16_t  hi         = INT16_MAX;
+        uint8_t  field      = 0;            // 集計する項目
+        uint32_t every      = 0;            // 集計間隔 [秒]（0 = 当てはまる行をそのまま返す）
+        uint32_t limit      = UINT32_MAX;   // 返す行 / 区間の上限
+    };
+
+    struct Stats {
+        uint32_t blocks;       // 渡されたブロック（の断片）
+        uint32_t pruned;       // 要約で飛ばした
+        uint32_t folded;       // 要約だけで集計した
+        uint32_t scanned;      // 列を読んだ
+        uint32_t rows;         // 読んだ行
+        uint32_t matched;      // 当てはまった行（要約で集計した分を含む）
+        uint32_t emitted;      // 返した行 / 区間
+    };
+
+    typedef void (*RowSink)(void* ctx, uint32_t time, const int16_t v[FIELDS]);
+    typedef void (*BucketSink)(void* ctx, uint32_t start, const ColumnScan::Agg& agg);
+
+    LogQuery(const Params& p, RowSink rows, BucketSink buckets, void* ctx)
+        : _p(p), _rowSink(rows), _bucketSink(buckets), _ctx(ctx) {
+        _bucket.clear();
+    }
+
+    // ゾーンマップで飛ばせるか（true = 読まなくてよい）
+    bool prune(uint32_t tMin, uint32_t tMax, const int16_t mn[FIELDS], const int16_t mx[FIELDS]) {
+        _stats.blocks++;
+        bool skip = tMax < _p.from || tMin > _p.to ||
+                    (_p.whereField >= 0 &&
+                     (mx[_p.whereField] < _p.lo || mn[_p.whereField] > _p.hi));
+        if (skip) _stats.pruned++;
+        return skip;
+    }
+
+    // 要約だけで集計できれば足し込んで true（count = ブロックの全件を渡すときだけ）
+    bool fold(uint32_t tMin, uint32_t tMax, uint32_t count,
+              const int16_t mn[FIELDS], const int16_t mx[FIELDS], const int32_t sum[FIELDS]) {
+        if (!_p.every || !count || full()) return false;
+        if (tMin < _p.from || tMax > _p.to) return false;
+        if (_p.whereField >= 0 &&
+            (mn[_p.whereField] < _p.lo || mx[_p.whereField] > _p.hi)) {
+            return false;
+        }
+        uint32_t start = bucketOf(tMin);
+        if (start != bucketOf(tMax)) return false;
+
+        enterBucket(start);
+        ColumnScan::Agg a = { count, mn[_p.field], mx[_p.field], sum[_p.field] };
+        _bucket.merge(a);
+        _stats.folded++;
+        _stats.matched += count;
+        return true;
+    }
+
+    // 列を 1 件ずつ見る（t と v[] は同じ位置から n 件）
+    void scan(const uint32_t* t, const int16_t* const v[FIELDS], size_t n) {
+        _stats.scanned++;
+        const int16_t* w = (_p.whereField >= 0) ? v[_p.whereField] : nullptr;
+        for (size_t i = 0; i < n && !full(); ++i) {
+            _stats.rows++;
+            uint32_t ti = t[i];
+            if (ti < _p.from || ti > _p.to) continue;
+            if (w && (w[i] < _p.lo || w[i] > _p.hi)) continue;
+            _stats.matched++;
+
+            if (_p.every) {
+                enterBucket(bucketOf(ti));
+                int32_t x = v[_p.field][i];
+                if (x < _bucket.min) _bucket.min = x;
+                if (x > _bucket.max) _bucket.max = x;
+                _bucket.sum += x;
+                _bucket.count++;
+            } else {
+                const int16_t row[FIELDS] = { v[0][i], v[1][i], v[2][i] };
+                _rowSink(_ctx, ti, row);
+                _stats.emitted++;
+            }
+        }
+    }
+
+    // 最後の区間を出す
+    void finish() {
+        flushBucket();
+    }
+
+    bool full() const { return _stats.emitted >= _p.limit; }
+
+    const Params& params() const { return _p; }
+    const Stats&  stats()  const { return _stats; }
+
+private:
+    uint32_t bucketOf(uint32_t t) const {
+        return t - t % _p.every;
+    }
+
+    void enterBucket(uint32_t start) {
+        if (_bucket.count && start != _bucketStart) flushBucket();
+        _bucketStart = start;
+    }
+
+    void flushBucket() {
+        if (!_bucket.count || full()) return;
+        _bucketSink(_ctx, _bucketStart, _bucket);
+        _stats.emitted++;
+        _bucket.clear();
+    }
+
+    Params            _p;
+    RowSink           _rowSink;
+    BucketSink        _bucketSink;
+    void*             _ctx;
+    Stats             _stats       = Stats();
+    ColumnScan::Agg   _bucket;
+    uint32_t          _bucketStart = 0;
+};
@@ -0,0 +1,104 @@
+#pragma once
+// ================================================================
+//  送信時刻の枠（publish slot）
+//   - センサーの送信周期 PERIOD_MS を count 等分し、デバイスごとに別の
+//     位置（オフセット）を割り当てる。全ノードが勝手な位相で送ると、台数が
+//     増えたときに同じ瞬間へ重なって受信側の処理待ちが伸びるため。
+//   - 割り当ての順: 既に持っている枠 → 空き → IDLE_MS 何も届いていない
+//     ノードの枠（回す）。どれも無ければ -1（満杯。センサーは自由に送る）。
+//   - count は呼び出しごとに渡す（設定で変わる）。count を減らしたときに
+//     範囲外へ出た枠は使わない（count を戻せばそのまま使える）。
+//   - デバイスはハッシュ（0 以外）で持つ。時刻は ms（折り返してよい）。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+template <size_t N>
+class PublishSlots {
+public:
+    static constexpr size_t   MAX       = N;
+    static constexpr uint32_t PERIOD_MS = 2000;    // センサーの送信間隔と同じ
+    static constexpr uint32_t IDLE_MS   = 60000;
+
+    struct Stats {
+        uint32_t assigned;     // 新しく割り当てた
+        uint32_t reassigned;   // 止まったノードの枠を回した
+        uint32_t full;         // 空きが無く割り当てられなかった
+    };
+
+    PublishSlots() { clear(); }
+
+    void clear() {
+        memset(_slots, 0, sizeof(_slots));
+        _stats = Stats();
+    }
+
+    // 枠 i のオフセット（周期を count 等分）
+    static uint32_t offsetMs(size_t i, size_t count) {
+        return (uint32_t)(i * PERIOD_MS / clampCount(count));
+    }
+
+    // デバイスの枠（-1 = 満杯）
+    int slotFor(uint32_t device, uint32_t nowMs, size_t count) {
+        count = clampCount(count);
+        int free = -1, idle = -1;
+        for (size_t i = 0; i < count; ++i) {
+            Slot& s = _slots[i];
+            if (s.device == device) {
+                s.lastSeenMs = nowMs;
+                return (int)i;
+            }
+            if (!s.device) {
+                if (free < 0) free = (int)i;
+            } else if (idle < 0 && nowMs - s.lastSeenMs >= IDLE_MS) {
+                idle = (int)i;
+            }
+        }
+        int i = (free >= 0) ? free : idle;
+        if (i < 0) {
+            _stats.full++;
+            return -1;
+        }
+        if (free >= 0) _stats.assigned++;
+        else           _stats.reassigned++;
+        _slots[i].device     = device;
+        _slots[i].lastSeenMs = nowMs;
+        return i;
+    }
+
+    // 受信のたびに最終時刻だけ更新する（枠が無ければ何もしない）
+    void touch(uint32_t device, uint32_t nowMs, size_t count) {
+        count = clampCount(count);
+        for (size_t i = 0; i < count; ++i) {
+            if (_slots[i].device == device) {
+                _slots[i].lastSeenMs = nowMs;
+                return;
+            }
+        }
+    }
+
+    size_t used(size_t count) const {
+        count = clampCount(count);
+        size_t n = 0;
+        for (size_t i = 0; i < count; ++i) n += _slots[i].device != 0;
+        return n;
+    }
+
+    const Stats& stats() const { return _stats; }
+
+private:
+    struct Slot {
+        uint32_t device;       // 0 = 空き
+        uint32_t lastSeenMs;
+    };
+
+    static size_t clampCount(size_t count) {
+        return count < 1 ? 1 : (count > N ? N : count);
+    }
+
+    Slot  _slots[N];
+    Stats _stats;
+};
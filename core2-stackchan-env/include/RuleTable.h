@@ -0,0 +1,153 @@
+#pragma once
+// ================================================================
+//  表情 / LED ルールの量子化ルックアップ表
+//   - ルール = 各軸（温度・湿度・気圧・不快指数・露点・暑さ指数・気圧傾向）の
+//     範囲 [lo, hi) の AND。
+//     範囲を指定しない軸は全域に一致する。
+//   - 起動時 / ルール更新時に、軸ごとに「ビン → 一致するルールのビットマスク」
+//     の表を作っておく。評価は軸の数だけの表引き + AND + 最下位ビットだけで
+//     ルール数に依らず一定時間（先に書いたルールほど優先）。
+//   - ヒステリシス: 範囲を軸ごとの幅だけ広げた「保持用」の表も作り、
+//     今のルールが保持範囲に残っている間は切り替えない（ゾーン境界でのバタつき防止）。
+//   - NaN の軸は、その軸に範囲を指定したルールのどれにも一致しない
+//     （範囲を指定していないルールだけが残る）。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum RuleAxisId : uint8_t {
+    RULE_AXIS_TEMP = 0,   // ℃
+    RULE_AXIS_HUM,        // %
+    RULE_AXIS_PRESS,      // hPa
+    RULE_AXIS_DI,         // 不快指数
+    RULE_AXIS_DEW,        // 露点 ℃
+    RULE_AXIS_HEAT,       // 暑さ指数 ℃
+    RULE_AXIS_TREND,      // 気圧傾向 hPa / 3h
+    RULE_AXIS_COUNT
+};
+
+// 軸ごとのビン数（RuleTable::axis() と TotalBins はここから取る）
+constexpr uint16_t RULE_AXIS_BINS[RULE_AXIS_COUNT] = { 1000, 200, 500, 240, 320, 480, 200 };
+
+constexpr size_t ruleAxisBinsFrom(size_t a) {
+    return a < RULE_AXIS_COUNT ? RULE_AXIS_BINS[a] + ruleAxisBinsFrom(a + 1) : 0;
+}
+
+class RuleTable {
+public:
+    static constexpr size_t MaxRules = 16;
+    static constexpr int8_t NoRule   = -1;
+
+    struct Rule {
+        float lo[RULE_AXIS_COUNT];   // 下限（含む）。未指定 = -1e9
+        float hi[RULE_AXIS_COUNT];   // 上限（含まない）。未指定 = 1e9
+    };
+
+    // 軸ごとの量子化（min から step 刻みで bins 個。範囲外は端のビンに丸める）
+    struct Axis {
+        const char* name;
+        float       min;
+        float       step;
+        uint16_t    bins;
+    };
+
+    static const Axis& axis(uint8_t a) {
+        static const Axis AXES[RULE_AXIS_COUNT] = {
+            { "T",  -40.0f, 0.1f,  RULE_AXIS_BINS[RULE_AXIS_TEMP]  },   // -40〜60 ℃
+            { "H",    0.0f, 0.5f,  RULE_AXIS_BINS[RULE_AXIS_HUM]   },   // 0〜100 %
+            { "P",  850.0f, 0.5f,  RULE_AXIS_BINS[RULE_AXIS_PRESS] },   // 850〜1100 hPa
+            { "DI",  40.0f, 0.25f, RULE_AXIS_BINS[RULE_AXIS_DI]    },   // 40〜100
+            { "DP", -40.0f, 0.25f, RULE_AXIS_BINS[RULE_AXIS_DEW]   },   // -40〜40 ℃
+            { "HI", -40.0f, 0.25f, RULE_AXIS_BINS[RULE_AXIS_HEAT]  },   // -40〜80 ℃
+            { "PT", -10.0f, 0.1f,  RULE_AXIS_BINS[RULE_AXIS_TREND] },   // -10〜10 hPa / 3h
+        };
+        return AXES[a];
+    }
+
+    static void clearRule(Rule& r) {
+        for (uint8_t a = 0; a < RULE_AXIS_COUNT; ++a) {
+            r.lo[a] = -1e9f;
+            r.hi[a] = 1e9f;
+        }
+    }
+
+    RuleTable() { compile(nullptr, 0, nullptr); }
+
+    // hyst[a] = 軸ごとのヒステリシス幅（nullptr = なし）
+    void compile(const Rule* rules, size_t count, const float* hyst) {
+        if (count > MaxRules) count = MaxRules;
+        _count = (uint8_t)count;
+
+        size_t base = 0;
+        for (uint8_t a = 0; a < RULE_AXIS_COUNT; ++a) {
+            const Axis& ax = axis(a);
+            float h = hyst ? hyst[a] : 0.0f;
+
+            for (uint16_t b = 0; b < ax.bins; ++b) {
+                // ビンの代表値は中央（境界値の丸め誤差で隣のビンに化けないように）
+                float x = ax.min + ax.step * (b + 0.5f);
+                uint16_t strict = 0, hold = 0;
+                for (size_t i = 0; i < count; ++i) {
+                    const Rule& r = rules[i];
+                    if (x >= r.lo[a] && x < r.hi[a]) strict |= (uint16_t)(1u << i);
+                    if (x >= r.lo[a] - h && x < r.hi[a] + h) hold |= (uint16_t)(1u << i);
+                }
+                _strict[base + b] = strict;
+                _hold[base + b]   = hold;
+            }
+            _axisBase[a] = (uint16_t)base;
+            base += ax.bins;
+
+            uint16_t open = 0;   // この軸に範囲を指定していないルール
+            for (size_t i = 0; i < count; ++i) {
+                if (!(rules[i].lo[a] > -1e8f) && !(rules[i].hi[a] < 1e8f)) open |= (uint16_t)(1u << i);
+            }
+            _open[a] = open;
+        }
+    }
+
+    // 一致したルール番号（NoRule = どれにも一致しない）
+    //   current = 直前のルール。保持範囲内ならそれを返す
+    int8_t evaluate(const float v[RULE_AXIS_COUNT], int8_t current) const {
+        uint16_t strict = 0xFFFF, hold = 0xFFFF;
+        for (uint8_t a = 0; a < RULE_AXIS_COUNT; ++a) {
+            if (v[a] != v[a]) {   // NaN
+                strict &= _open[a];
+                hold   &= _open[a];
+                continue;
+            }
+            uint16_t i = _axisBase[a] + binOf(a, v[a]);
+            strict &= _strict[i];
+            hold   &= _hold[i];
+        }
+
+        if (current >= 0 && current < (int8_t)_count && (hold & (1u << current))) {
+            return current;
+        }
+        if (!strict) return NoRule;
+        return (int8_t)__builtin_ctz(strict);
+    }
+
+    size_t ruleCount() const { return _count; }
+
+    static uint16_t binOf(uint8_t a, float v) {
+        const Axis& ax = axis(a);
+        float f = (v - ax.min) / ax.step;
+        if (!(f > 0.0f)) return 0;   // NaN もここ（evaluate は NaN をビンに入れない）
+        if (f >= ax.bins - 1) return ax.bins - 1;
+        return (uint16_t)f;
+    }
+
+    // axis() の bins の合計
+    static constexpr size_t TotalBins = ruleAxisBinsFrom(0);
+    static_assert(TotalBins <= 0xFFFF, "bin index must fit _axisBase");
+
+private:
+    uint16_t _strict[TotalBins];
+    uint16_t _hold[TotalBins];
+    uint16_t _axisBase[RULE_AXIS_COUNT] = {};
+    uint16_t _open[RULE_AXIS_COUNT] = {};
+    uint8_t  _count = 0;
+};
@@ -0,0 +1,64 @@
+#pragma once
+// ================================================================
+//  2 面交互書き込みのスナップショット（RTC メモリの暖機再起動用）
+//   - 面の型 T は magic / version / size / seq と、末尾に checksum を持つ POD。
+//     checksum は先頭から checksum の手前までの FNV-1a。
+//   - write() は新しい方でない面に書く（seq / checksum はここで付ける）。
+//     書き込み途中でリセットされてももう一方の面が残り、壊れた面は
+//     checksum で弾くので、load() が返すのは「直前に書き終えた内容」か
+//     「今回の内容」のどちらかだけ。
+//   - seq は 32 ビットの差で比べる（一周しても新旧を取り違えない）。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <stdint.h>
+#include <stddef.h>
+
+template <typename T, uint32_t Magic, uint16_t Version>
+class SnapshotSlots {
+public:
+    static constexpr int SLOTS = 2;
+
+    static uint32_t checksum(const T& s) {
+        const uint8_t* p = (const uint8_t*)&s;
+        uint32_t       h = 2166136261u;
+        for (size_t i = 0; i < offsetof(T, checksum); ++i) h = (h ^ p[i]) * 16777619u;
+        return h;
+    }
+
+    static bool valid(const T& s) {
+        return s.magic == Magic && s.version == Version && s.size == sizeof(T) &&
+               s.checksum == checksum(s);
+    }
+
+    // 正しくて新しい方の面の番号（-1 = どちらも壊れている）
+    static int newest(const T* slots) {
+        int best = -1;
+        for (int i = 0; i < SLOTS; ++i) {
+            if (!valid(slots[i])) continue;
+            if (best < 0 || (int32_t)(slots[i].seq - slots[best].seq) > 0) best = i;
+        }
+        return best;
+    }
+
+    // 正しくて新しい方を out へ（無ければ false）
+    static bool load(const T* slots, T& out) {
+        int best = newest(slots);
+        if (best < 0) return false;
+        out = slots[best];
+        return true;
+    }
+
+    // 新しい方でない面に書く。戻り値 = 書いた面の番号
+    static int write(T* slots, T& s) {
+        int cur    = newest(slots);
+        s.magic    = Magic;
+        s.version  = Version;
+        s.size     = sizeof(T);
+        s.seq      = (cur < 0) ? 1 : slots[cur].seq + 1;
+        s.checksum = checksum(s);
+        int target = (cur == 0) ? 1 : 0;
+        slots[target] = s;
+        return target;
+    }
+};
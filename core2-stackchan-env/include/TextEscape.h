@@ -0,0 +1,85 @@
+#pragma once
+// ================================================================
+//  文字列の書き出し用エスケープ（JSON の文字列 / HTML の本文・属性値）
+//   - 設定値やデバイス名など、外から入った文字列を応答へ埋め込む前に通す。
+//   - out は常に NUL 終端。入りきらないときは置き換えの途中で切らずに
+//     そこまでで止めて false を返す。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace TextEscape {
+
+// 置き換え後の最大倍率（"\u001f" / "&quot;" の 6 文字）
+constexpr size_t MAX_EXPANSION = 6;
+
+// c の JSON 表記を rep に書いて長さを返す（0 = そのまま）
+inline size_t jsonChar(char c, char rep[7]) {
+    switch (c) {
+        case '"':  memcpy(rep, "\\\"", 3); return 2;
+        case '\\': memcpy(rep, "\\\\", 3); return 2;
+        case '\n': memcpy(rep, "\\n", 3);  return 2;
+        case '\r': memcpy(rep, "\\r", 3);  return 2;
+        case '\t': memcpy(rep, "\\t", 3);  return 2;
+        default:
+            if ((uint8_t)c < 0x20) {
+                snprintf(rep, 7, "\\u%04x", (unsigned)(uint8_t)c);
+                return 6;
+            }
+            return 0;
+    }
+}
+
+// c の HTML 実体参照を返す（nullptr = そのまま）。属性値は ' " のどちらで囲んでもよい
+inline const char* htmlEntity(char c) {
+    switch (c) {
+        case '&':  return "&amp;";
+        case '<':  return "&lt;";
+        case '>':  return "&gt;";
+        case '"':  return "&quot;";
+        case '\'': return "&#39;";
+        default:   return nullptr;
+    }
+}
+
+inline bool json(char* out, size_t cap, const char* in) {
+    if (!cap) return false;
+    size_t n = 0;
+    for (; *in; ++in) {
+        char   rep[7];
+        size_t len = jsonChar(*in, rep);
+        const char* s = len ? rep : in;
+        if (!len) len = 1;
+        if (n + len >= cap) {
+            out[n] = '\0';
+            return false;
+        }
+        memcpy(out + n, s, len);
+        n += len;
+    }
+    out[n] = '\0';
+    return true;
+}
+
+inline bool html(char* out, size_t cap, const char* in) {
+    if (!cap) return false;
+    size_t n = 0;
+    for (; *in; ++in) {
+        const char* rep = htmlEntity(*in);
+        size_t      len = rep ? strlen(rep) : 1;
+        if (n + len >= cap) {
+            out[n] = '\0';
+            return false;
+        }
+        memcpy(out + n, rep ? rep : in, len);
+        n += len;
+    }
+    out[n] = '\0';
+    return true;
+}
+
+}  // namespace TextEscape
@@ -0,0 +1,235 @@
+#pragma once
+// ================================================================
+//  MQTT トピックルーター（トピックツリー索引）
+//   - 購読パターン（"home/env/+"、"stackchan/cmd/#" など）を起動時に
+//     レベル単位の木へ登録しておき、受信時はトピックを '/' で区切って
+//     木を辿るだけでハンドラを見つける（strcmp の羅列をしない）。
+//   - 子ノードは (親ノード, レベル名ハッシュ) をキーにした固定サイズの
+//     オープンアドレス表で引くので、1 レベルあたりの探索は兄弟数に依らない。
+//   - 辺は 32bit ハッシュで当たりを付け、ノードに残したレベル名（固定長の
+//     名前プールに詰める）と文字列で確かめる（ハッシュの衝突で別のトピックの
+//     ハンドラを呼ばない）。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// パターンとトピックの MQTT ワイルドカード一致（'+' = 1 レベル / '#' = 残り全部）
+inline bool mqttTopicMatches(const char* f, const char* t) {
+    while (true) {
+        if (*f == '#') return true;
+
+        if (*f == '+') {
+            while (*t && *t != '/') ++t;
+            ++f;
+        } else {
+            while (*f && *f != '/' && *f == *t) {
+                ++f;
+                ++t;
+            }
+            if ((*f && *f != '/') || (*t && *t != '/')) return false;
+        }
+
+        if (!*f && !*t) return true;
+        if (*f == '/' && *t == '/') {
+            ++f;
+            ++t;
+            continue;
+        }
+        // "a/#" は "a" 自身にも一致する
+        return !*t && f[0] == '/' && f[1] == '#' && !f[2];
+    }
+}
+
+template <size_t MaxNodes, size_t MaxLevels = 8, size_t NameBytes = MaxNodes * 12>
+class TopicRouter {
+public:
+    // levels[i] は '/' で区切った各レベル（topic は書き換えない）
+    typedef void (*Handler)(const char* topic, const char* payload,
+                            const char* const* levels, uint8_t levelCount);
+
+    TopicRouter() { clear(); }
+
+    void clear() {
+        _nodeCount = 1;  // 0 = ルート
+        _nameUsed  = 0;
+        _nodes[0] = Node();
+        for (auto& e : _edges) e.child = 0;
+    }
+
+    // パターン登録（失敗 = ノード / 辺が足りない）
+    bool add(const char* pattern, Handler handler) {
+        uint16_t node = 0;
+        const char* p = pattern;
+
+        while (true) {
+            const char* end = strchr(p, '/');
+            size_t len = end ? (size_t)(end - p) : strlen(p);
+
+            if (len == 1 && p[0] == '#') {
+                if (!_nodes[node].hashChild) {
+                    if (_nodeCount >= MaxNodes) return false;
+                    _nodes[node].hashChild = _nodeCount;
+                    _nodes[_nodeCount++] = Node();
+                }
+                node = _nodes[node].hashChild;
+                break;  // '#' は末尾のみ
+            } else if (len == 1 && p[0] == '+') {
+                if (!_nodes[node].plusChild) {
+                    if (_nodeCount >= MaxNodes) return false;
+                    _nodes[node].plusChild = _nodeCount;
+                    _nodes[_nodeCount++] = Node();
+                }
+                node = _nodes[node].plusChild;
+            } else {
+                uint32_t h = hashLevel(p, len);
+                uint16_t child = findEdge(node, h, p, len);
+                if (!child) {
+                    if (_nodeCount >= MaxNodes || len > 0xFF || _nameUsed + len > NameBytes) {
+                        return false;
+                    }
+                    child = _nodeCount;
+                    if (!insertEdge(node, h, child)) return false;
+                    Node& c = _nodes[_nodeCount++];
+                    c = Node();
+                    c.name    = (uint16_t)_nameUsed;
+                    c.nameLen = (uint8_t)len;
+                    memcpy(_names + _nameUsed, p, len);
+                    _nameUsed += len;
+                }
+                node = child;
+            }
+
+            if (!end) break;
+            p = end + 1;
+        }
+
+        _nodes[node].handler = handler;
+        return true;
+    }
+
+    // 一致したハンドラを全部呼ぶ。呼んだ数を返す
+    uint8_t route(const char* topic, const char* payload) const {
+        // 作業用バッファにコピーして '/' を終端に置き換え、各レベルを切り出す
+        char        buf[128];
+        const char* levels[MaxLevels];
+        uint32_t    hashes[MaxLevels];
+        uint8_t     count = 0;
+
+        size_t tlen = strlen(topic);
+        if (tlen >= sizeof(buf)) return 0;
+        memcpy(buf, topic, tlen + 1);
+
+        char* p = buf;
+        while (true) {
+            if (count == MaxLevels) return 0;  // 深すぎる
+            char* end = strchr(p, '/');
+            if (end) *end = '\0';
+            levels[count] = p;
+            hashes[count] = hashLevel(p, strlen(p));
+            ++count;
+            if (!end) break;
+            p = end + 1;
+        }
+
+        return walk(0, 0, topic, payload, levels, hashes, count);
+    }
+
+    size_t nodeCount() const { return _nodeCount; }
+    size_t nameBytes() const { return _nameUsed; }
+
+private:
+    struct Node {
+        Handler  handler   = nullptr;
+        uint16_t plusChild = 0;
+        uint16_t hashChild = 0;
+        uint16_t name      = 0;   // _names の位置（辺で入るノードのみ）
+        uint8_t  nameLen   = 0;
+    };
+
+    struct Edge {
+        uint32_t hash;
+        uint16_t parent;
+        uint16_t child;   // 0 = 空き
+    };
+
+    static constexpr size_t pow2AtLeast(size_t n, size_t p = 1) {
+        return (p >= n) ? p : pow2AtLeast(n, p * 2);
+    }
+
+    static constexpr size_t EdgeSlots = pow2AtLeast(MaxNodes * 2);
+
+    static uint32_t hashLevel(const char* s, size_t len) {
+        uint32_t h = 2166136261u;  // FNV-1a
+        for (size_t i = 0; i < len; ++i) {
+            h = (h ^ (uint8_t)s[i]) * 16777619u;
+        }
+        return h;
+    }
+
+    uint16_t findEdge(uint16_t parent, uint32_t h, const char* s, size_t len) const {
+        size_t i = (h ^ (parent * 2654435761u)) & (EdgeSlots - 1);
+        for (size_t n = 0; n < EdgeSlots; ++n) {
+            const Edge& e = _edges[i];
+            if (!e.child) return 0;
+            if (e.hash == h && e.parent == parent) {
+                const Node& c = _nodes[e.child];
+                if (c.nameLen == len && memcmp(_names + c.name, s, len) == 0) return e.child;
+            }
+            i = (i + 1) & (EdgeSlots - 1);
+        }
+        return 0;
+    }
+
+    bool insertEdge(uint16_t parent, uint32_t h, uint16_t child) {
+        size_t i = (h ^ (parent * 2654435761u)) & (EdgeSlots - 1);
+        for (size_t n = 0; n < EdgeSlots; ++n) {
+            Edge& e = _edges[i];
+            if (!e.child) {
+                e.hash   = h;
+                e.parent = parent;
+                e.child  = child;
+                return true;
+            }
+            i = (i + 1) & (EdgeSlots - 1);
+        }
+        return false;
+    }
+
+    uint8_t walk(uint16_t node, uint8_t depth, const char* topic, const char* payload,
+                 const char* const* levels, const uint32_t* hashes, uint8_t count) const {
+        uint8_t hits = 0;
+        const Node& n = _nodes[node];
+
+        // '#' はこの位置以降すべてに一致（"a/#" は "a" 自身にも一致）
+        if (n.hashChild && _nodes[n.hashChild].handler) {
+            _nodes[n.hashChild].handler(topic, payload, levels, count);
+            ++hits;
+        }
+
+        if (depth == count) {
+            if (n.handler) {
+                n.handler(topic, payload, levels, count);
+                ++hits;
+            }
+            return hits;
+        }
+
+        uint16_t exact = findEdge(node, hashes[depth], levels[depth], strlen(levels[depth]));
+        if (exact) {
+            hits += walk(exact, depth + 1, topic, payload, levels, hashes, count);
+        }
+        if (n.plusChild) {
+            hits += walk(n.plusChild, depth + 1, topic, payload, levels, hashes, count);
+        }
+        return hits;
+    }
+
+    Node     _nodes[MaxNodes];
+    Edge     _edges[EdgeSlots];
+    char     _names[NameBytes];
+    size_t   _nameUsed  = 0;
+    uint16_t _nodeCount = 1;
+};
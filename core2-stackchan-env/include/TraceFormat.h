@@ -0,0 +1,200 @@
+#pragma once
+// ================================================================
+//  受信トレース（/trace.bin）の形式
+//   - ハブが受けたメッセージを届いた順に「前の記録からの ms + トピック +
+//     ペイロード」で並べる。tools/trace_tool（dump・replay）と TraceReplay で読む。
+//   - トピックは初出のときだけ定義レコードで書き、以降は番号（1 バイト）で
+//     参照する。計測値 1 通はおよそ 40 バイト。
+//   - 形式（整数はリトルエンディアン）
+//       ヘッダ 16 B : "ETRC" 版 予約(3) 開始エポック秒(u32) 予約(u32)
+//       定義        : dt(varint) 0xFF 番号 長さ トピック
+//       メッセージ  : dt(varint) (番号 | 配送路 << 6) 長さ ペイロード
+//   - Writer はバッファへ詰めるだけ（ファイルへの書き出しは呼び出し側）。
+//     Reader は渡されたバイト列の先頭から 1 件ずつ取り出し、途中で切れた
+//     レコードは「足りない」（0）として呼び出し側の読み足しを待つ。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace TraceFormat {
+
+constexpr char     MAGIC[4]   = { 'E', 'T', 'R', 'C' };
+constexpr uint8_t  VERSION    = 1;
+constexpr size_t   HEADER     = 16;
+constexpr uint8_t  DEFINE     = 0xFF;
+constexpr uint8_t  TOPICS     = 63;      // 番号 0..62（0x3F | 3 << 6 = 0xFF は定義）
+constexpr uint8_t  TRANSPORTS = 4;       // 配送路の番号 0..3
+constexpr size_t   TOPIC_MAX  = 63;      // トピックの長さ（NUL を除く）
+constexpr size_t   PAYLOAD_MAX = 255;
+constexpr size_t   RECORD_MAX = 5 + 3 + TOPIC_MAX + 5 + 2 + PAYLOAD_MAX;   // 定義 + メッセージ
+
+inline void putU32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+inline uint32_t getU32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+inline size_t writeHeader(uint8_t* buf, uint32_t startEpoch) {
+    memset(buf, 0, HEADER);
+    memcpy(buf, MAGIC, sizeof(MAGIC));
+    buf[4] = VERSION;
+    putU32(buf + 8, startEpoch);
+    return HEADER;
+}
+
+inline bool readHeader(const uint8_t* buf, size_t len, uint32_t& startEpoch) {
+    if (len < HEADER || memcmp(buf, MAGIC, sizeof(MAGIC)) != 0 || buf[4] != VERSION) {
+        return false;
+    }
+    startEpoch = getU32(buf + 8);
+    return true;
+}
+
+inline size_t putVarint(uint8_t* p, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+// 0 = 足りない / 5 バイトを超える
+inline size_t getVarint(const uint8_t* p, size_t len, uint32_t& v) {
+    v = 0;
+    for (size_t i = 0; i < len && i < 5; ++i) {
+        v |= (uint32_t)(p[i] & 0x7F) << (7 * i);
+        if (!(p[i] & 0x80)) return i + 1;
+    }
+    return 0;
+}
+
+class Writer {
+public:
+    void begin(uint32_t nowMs) {
+        _count  = 0;
+        _lastMs = nowMs;
+    }
+
+    // 1 通を out に詰めて長さを返す（初出のトピックは定義も前に付ける）。
+    //   0 = 番号が尽きた・長すぎる・cap が足りない（何も書かない）
+    size_t encode(uint32_t nowMs, uint8_t transport, const char* topic, const char* payload,
+                  uint8_t* out, size_t cap) {
+        size_t tl = strlen(topic);
+        size_t pl = strlen(payload);
+        if (tl == 0 || tl > TOPIC_MAX || pl > PAYLOAD_MAX || transport >= TRANSPORTS ||
+            cap < RECORD_MAX) {
+            return 0;
+        }
+        int id = -1;
+        for (uint8_t i = 0; i < _count; ++i) {
+            if (strcmp(_topics[i], topic) == 0) {
+                id = i;
+                break;
+            }
+        }
+        uint32_t dt = nowMs - _lastMs;
+        size_t   n  = 0;
+        if (id < 0) {
+            if (_count == TOPICS) return 0;
+            id = _count;
+            n += putVarint(out + n, dt);
+            out[n++] = DEFINE;
+            out[n++] = (uint8_t)id;
+            out[n++] = (uint8_t)tl;
+            memcpy(out + n, topic, tl);
+            n += tl;
+            dt = 0;
+            memcpy(_topics[_count], topic, tl + 1);
+            _count++;
+        }
+        n += putVarint(out + n, dt);
+        out[n++] = (uint8_t)(id | transport << 6);
+        out[n++] = (uint8_t)pl;
+        memcpy(out + n, payload, pl);
+        n += pl;
+        _lastMs = nowMs;
+        return n;
+    }
+
+    uint8_t topics() const { return _count; }
+
+private:
+    char     _topics[TOPICS][TOPIC_MAX + 1];   // 番号 → トピック（ハッシュだけだと衝突で取り違える）
+    uint8_t  _count  = 0;
+    uint32_t _lastMs = 0;
+};
+
+struct Message {
+    uint32_t    ms;          // 記録開始からの ms
+    uint8_t     transport;
+    const char* topic;       // nullptr = 定義レコード（渡すメッセージはない）
+    const char* payload;
+};
+
+class Reader {
+public:
+    void begin() {
+        _ms      = 0;
+        _corrupt = false;
+        for (auto& t : _topics) t[0] = '\0';
+    }
+
+    // buf の先頭の 1 件を取り出して使ったバイト数を返す（0 = 足りない / 壊れている）
+    size_t next(const uint8_t* buf, size_t len, Message& m) {
+        uint32_t dt;
+        size_t   n = getVarint(buf, len, dt);
+        if (!n) {
+            if (len >= 5) _corrupt = true;
+            return 0;
+        }
+        if (n + 2 > len) return 0;
+        uint8_t tag  = buf[n];
+        m.topic      = nullptr;
+        m.payload    = nullptr;
+        if (tag == DEFINE) {
+            if (n + 3 > len) return 0;
+            uint8_t id = buf[n + 1], tl = buf[n + 2];
+            if (id >= TOPICS || tl == 0 || tl > TOPIC_MAX) {
+                _corrupt = true;
+                return 0;
+            }
+            if (n + 3 + tl > len) return 0;
+            memcpy(_topics[id], buf + n + 3, tl);
+            _topics[id][tl] = '\0';
+            _ms += dt;
+            m.ms = _ms;
+            return n + 3 + tl;
+        }
+        uint8_t id = tag & 0x3F, pl = buf[n + 1];
+        if (id >= TOPICS || !_topics[id][0]) {   // 0x3F は番号にならない（0xFF 以外は壊れている）
+            _corrupt = true;
+            return 0;
+        }
+        if (n + 2 + pl > len) return 0;
+        memcpy(_payload, buf + n + 2, pl);
+        _payload[pl] = '\0';
+        _ms += dt;
+        m.ms        = _ms;
+        m.transport = tag >> 6;
+        m.topic     = _topics[id];
+        m.payload   = _payload;
+        return n + 2 + pl;
+    }
+
+    bool corrupt() const { return _corrupt; }
+
+private:
+    char     _topics[TOPICS][TOPIC_MAX + 1];
+    char     _payload[PAYLOAD_MAX + 1];
+    uint32_t _ms      = 0;
+    bool     _corrupt = false;
+};
+
+}  // namespace TraceFormat
@@ -0,0 +1,151 @@
+#pragma once
+// ================================================================
+//  受信トレース（/trace.bin）の再生
+//   - 記録を届いた順・記録された到着時刻のまま、ファームウェアと同じ取り込み
+//     （HubIngest.h を HubIngestHost.h の土台で動かす）へ 1 通ずつ渡し、
+//     結果（受理・重複・隔離・表示へ渡したサンプル・ログの中身）を集計する。
+//     時計は記録の時刻なので、同じ取り込み・同じトレースなら流す速さに依らず
+//     同じ digest（FNV-1a）になる。
+//   - digest に入れるもの: 表示へ渡したサンプルごとに「何通目か + デバイス・取得時刻・
+//     校正後の値・派生指標・気圧傾向・異常フラグ」、最後にログの全行
+//     （時刻・デバイス・温湿度・気圧・異常フラグ）。
+//   - 1 通の取り込み時間は呼び出し側の時計（µs）で測り、HIST_US 刻みの分布から
+//     平均・p50/p90/p99・最大を出す（分位は区間の上端。最後の区間は最大）。
+//   - 結果は tools/trace_tool check が読む平らな JSON（{"key":値,...}）。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <math.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "TraceFormat.h"
+#include "HubIngestHost.h"
+
+namespace TraceReplay {
+
+constexpr size_t   HIST_BUCKETS = 160;   // 25 µs 刻み, 4 ms まで
+constexpr uint32_t HIST_US      = 25;
+
+typedef uint32_t (*MicrosFn)();   // 取り込み時間を測る時計（nullptr = 測らない）
+
+inline uint32_t hash(uint32_t h, const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < len; ++i) h = (h ^ p[i]) * 16777619u;   // FNV-1a
+    return h;
+}
+
+struct Report {
+    bool              valid;            // ヘッダが読めた
+    bool              corrupt;          // 途中で壊れていた（そこまでの結果）
+    uint32_t          startEpoch;
+    uint32_t          messages;
+    uint32_t          spanMs;           // 最後の記録の時刻
+    uint32_t          samples;          // 表示へ渡したサンプル
+    uint32_t          replies;          // ack・時刻の応答
+    uint32_t          logRows;
+    uint32_t          digest;
+    HubIngest::Stats  stats;
+    uint32_t          usSum;
+    uint32_t          usMax;
+    uint32_t          hist[HIST_BUCKETS];
+
+    // 分布の q 分位（その区間の上端）。最後の区間は最大
+    uint32_t percentile(float q) const {
+        uint32_t need = (uint32_t)ceilf(q * messages), seen = 0;
+        for (size_t i = 0; i < HIST_BUCKETS - 1; ++i) {
+            seen += hist[i];
+            if (seen >= need && need) return (uint32_t)(i + 1) * HIST_US;
+        }
+        return usMax;
+    }
+
+    // 平らな JSON を out に書いて長さを返す（入りきらなければ 0）
+    size_t toJson(char* out, size_t cap, uint32_t wallMs) const {
+        int n = snprintf(out, cap,
+            "{\"messages\":%u,\"span_s\":%u,\"wall_ms\":%u,\"corrupt\":%s,"
+            "\"accepted\":%u,\"duplicates\":%u,\"reordered\":%u,\"legacy\":%u,"
+            "\"quarantined\":%u,\"backfill_rows\":%u,\"replies\":%u,"
+            "\"log_writes\":%u,\"log_rows\":%u,\"samples\":%u,"
+            "\"ingest_us_avg\":%u,\"ingest_us_p50\":%u,\"ingest_us_p90\":%u,"
+            "\"ingest_us_p99\":%u,\"ingest_us_max\":%u,\"digest\":\"%08lx\"}",
+            (unsigned)messages, (unsigned)(spanMs / 1000), (unsigned)wallMs,
+            corrupt ? "true" : "false", (unsigned)stats.accepted,
+            (unsigned)stats.duplicates, (unsigned)stats.reordered,
+            (unsigned)stats.legacy, (unsigned)stats.quarantined,
+            (unsigned)stats.backfillMerged, (unsigned)replies,
+            (unsigned)stats.logWrites, (unsigned)logRows, (unsigned)samples,
+            (unsigned)(messages ? usSum / messages : 0),
+            (unsigned)percentile(0.50f), (unsigned)percentile(0.90f),
+            (unsigned)percentile(0.99f), (unsigned)usMax, (unsigned long)digest);
+        return (n > 0 && (size_t)n < cap) ? (size_t)n : 0;
+    }
+};
+
+// trace[0..len) を hub に流して report に集計する（hub は電源投入時の状態から始める）。
+//   false = トレースのヘッダが読めない（壊れた途中までは true, report.corrupt）
+inline bool run(const uint8_t* trace, size_t len, HubIngestHost& hub, Report& report,
+                MicrosFn micros = nullptr) {
+    static TraceFormat::Reader reader;
+    memset(&report, 0, sizeof(report));
+    report.digest = 2166136261u;
+    if (!TraceFormat::readHeader(trace, len, report.startEpoch)) return false;
+    report.valid = true;
+
+    hub.clear();
+    hub.setClock(report.startEpoch);
+    reader.begin();
+
+    size_t pos = TraceFormat::HEADER;
+    TraceFormat::Message m;
+    while (size_t used = reader.next(trace + pos, len - pos, m)) {
+        pos += used;
+        if (!m.topic) continue;
+
+        uint32_t samples = hub.samples();
+        uint32_t t0      = micros ? micros() : 0;
+        hub.message(m.topic, m.payload, m.ms);
+        uint32_t us = micros ? micros() - t0 : 0;
+
+        report.messages++;
+        report.spanMs = m.ms;
+        report.usSum += us;
+        if (us > report.usMax) report.usMax = us;
+        size_t b = us / HIST_US;
+        report.hist[b < HIST_BUCKETS ? b : HIST_BUCKETS - 1]++;
+
+        if (hub.samples() != samples) {
+            const HubIngest::Reading& r = hub.lastSample();
+            report.digest = hash(report.digest, &report.messages, sizeof(report.messages));
+            report.digest = hash(report.digest, &r.device, sizeof(r.device));
+            report.digest = hash(report.digest, &r.time, sizeof(r.time));
+            report.digest = hash(report.digest, &r.t, sizeof(r.t));
+            report.digest = hash(report.digest, &r.h, sizeof(r.h));
+            report.digest = hash(report.digest, &r.p, sizeof(r.p));
+            report.digest = hash(report.digest, &r.derived, sizeof(r.derived));
+            report.digest = hash(report.digest, &r.trend, sizeof(r.trend));
+            report.digest = hash(report.digest, &r.flags, sizeof(r.flags));
+        }
+    }
+    report.corrupt = reader.corrupt();
+
+    // ログの中身（時刻順に差し込んだ後送りも含む）
+    for (size_t i = 0; i < hub.logRows(); ++i) {
+        const HubIngestHost::LogRow& r = hub.logAt(i);
+        report.digest = hash(report.digest, &r.time, sizeof(r.time));
+        report.digest = hash(report.digest, &r.device, sizeof(r.device));
+        report.digest = hash(report.digest, &r.temperature, sizeof(r.temperature));
+        report.digest = hash(report.digest, &r.humidity, sizeof(r.humidity));
+        report.digest = hash(report.digest, &r.pressure, sizeof(r.pressure));
+        report.digest = hash(report.digest, &r.anomalyFlags, sizeof(r.anomalyFlags));
+    }
+    report.logRows = (uint32_t)hub.logRows();
+    report.samples = hub.samples();
+    report.replies = hub.replies();
+    report.stats   = hub.ingest().stats();
+    return true;
+}
+
+}  // namespace TraceReplay
@@ -1,13 +1,36 @@
 #include <Arduino.h>
 #include <WiFi.h>
+#include <esp_wifi.h>
 #include <WebServer.h>
 #include <PicoMQTT.h>
 #include <M5Unified.h>
 #include <Avatar.h>
 #include <LittleFS.h>
 #include <math.h>
+#include <stdarg.h>
+#include <type_traits>
 #include <Adafruit_NeoPixel.h>
 #include <ESP32Servo.h>
+#include <Preferences.h>
+
+#include "TopicRouter.h"
+#include "RuleTable.h"
+#include "DerivedMetrics.h"
+#include "AnomalyDetector.h"
+#include "EpochClock.h"
+#include "ChunkWriter.h"
+#include "BufferPool.h"
+#include "ColumnScan.h"
+#include "LogQuery.h"
+#include "EnvTransport.h"
+#include "EspNowTransport.h"
+#include "TraceFormat.h"
+#include "SnapshotSlots.h"
+#include "TextEscape.h"
+#include "BackfillBatch.h"
+#include "PublishSlots.h"
+#include "EnvSample.h"
+#include "HubIngest.h"
 
 using namespace m5avatar;
 
@@ -26,41 +49,343 @@ bool  g_servoAttached = false;  // attach 済みかどうか
 constexpr int SERVO_X_PIN = 33;
 constexpr int SERVO_Y_PIN = 32;
 
-// 基準角度（センター位置）と左右スイング幅
-constexpr int SERVO_X_CENTER    = 90;
-constexpr int SERVO_Y_CENTER    = 90;
-constexpr int SERVO_X_AMPLITUDE = 15;   // 左右のふり幅
+// 基準角度（センター位置）と左右スイング幅の既定値（実際の値は g_cfg）
+constexpr int SERVO_X_CENTER_DEFAULT    = 90;
+constexpr int SERVO_Y_CENTER_DEFAULT    = 90;
+constexpr int SERVO_X_AMPLITUDE_DEFAULT = 15;   // 左右のふり幅
 
 // 首の上下用：現在角度・目標角度・ポーズ切り替えタイミング
-float         g_servoYCurrent = SERVO_Y_CENTER;
-float         g_servoYTarget  = SERVO_Y_CENTER;
+float         g_servoYCurrent = SERVO_Y_CENTER_DEFAULT;
+float         g_servoYTarget  = SERVO_Y_CENTER_DEFAULT;
 unsigned long g_nextPoseChangeMs = 0;
 
 // ======================================================================
-//  SoftAP 設定
+//  SoftAP 設定（SSID / パスワードの実際の値は g_cfg）
 // ======================================================================
-const char* AP_SSID     = "Core2EnvAP";
-const char* AP_PASSWORD = "m5password";
+const char* AP_SSID_DEFAULT     = "Core2EnvAP";
+const char* AP_PASSWORD_DEFAULT = "m5password";
+constexpr uint8_t AP_CHANNEL_DEFAULT = 1;
+constexpr uint8_t AP_MAX_STATIONS    = 10;   // IDF 4.x の SoftAP の上限（ESP_WIFI_MAX_CONN_NUM）
+
+// ======================================================================
+//  リンクプロファイル（AP 側）
+//   センサー側の同名プロファイル（モデムスリープ / listen interval）と対
+//   DTIM は IDF 5.1 以降のみ設定可能（それ以前は既定の 1）
+// ======================================================================
+enum class LinkProfile : uint8_t {
+    LowLatency = 0,
+    Balanced   = 1,
+    LowPower   = 2
+};
+
+struct ApLinkParams {
+    const char*  name;
+    uint16_t     beaconIntervalTU;   // 1 TU = 1.024 ms
+    uint8_t      dtimPeriod;
+    wifi_power_t txPower;
+};
+
+const ApLinkParams LINK_PROFILES[] = {
+    { "lowlatency", 100, 1, WIFI_POWER_19_5dBm },
+    { "balanced",   100, 3, WIFI_POWER_15dBm   },
+    { "lowpower",   300, 3, WIFI_POWER_11dBm   },
+};
+constexpr uint8_t LINK_PROFILE_COUNT = sizeof(LINK_PROFILES) / sizeof(LINK_PROFILES[0]);
+
+// プロファイルごとの計測値（センサーの stat トピック + ハブ自身の電流）
+struct LinkProfileStats {
+    uint32_t reports;          // 受信した stat 数
+    uint32_t lastAssocMs;      // センサーの直近の接続所要時間
+    uint32_t assocMsMax;
+    uint64_t pubAvgUsSum;      // センサーの publish() 平均の合計
+    uint32_t pubMaxUs;
+    int64_t  sensorCurrentSum; // mA（取れない機種は 0）
+    int64_t  hubCurrentSum;    // mA（AXP192）
+    int32_t  lastBattmV;
+    int32_t  lastRssi;
+};
+
+LinkProfileStats g_linkStats[LINK_PROFILE_COUNT] = {};
+
+// センサーの起動〜最初の送信までの計測値（直近の stat）
+struct SensorConnectStats {
+    uint32_t bootToFirstPubMs;   // 0 = まだ送信していない
+    uint32_t mqttConnMs;
+    bool     assocCached;        // BSSID/IP キャッシュ経路で接続したか
+    uint32_t cachedAssocs;       // stat 受信のうちキャッシュ経路だった数
+    uint32_t scanAssocs;
+    const char* transport;       // 直近の stat が届いた配送路（nullptr = 未受信）
+};
+
+SensorConnectStats g_sensorConnect = {};
+
+// センサーの時刻同期（ハブが時刻を配信し、センサーが取得時刻を付けて送る）
+//   応答・取得時刻の検証の数は HubIngest::Stats、ここはセンサーの stat から（直近値）
+struct SensorTimeStats {
+    uint32_t rttMs;
+    float    driftPpm;
+    int32_t  errMs;
+};
+
+SensorTimeStats g_sensorTime = {};
+
+// ハブが同時に扱うセンサーの台数。デバイスごとの表（重複排除・後送り・校正・
+// 異常検知・送信時刻の枠）はすべてこの大きさにそろえ、slot.count の上限もこれにする
+constexpr size_t HUB_DEVICES_MAX = 64;
+static_assert(HubIngest::DEVICES >= HUB_DEVICES_MAX, "ingest tables smaller than hub");
+static_assert(FrameAuth::SENDERS_MAX >= HUB_DEVICES_MAX, "ESP-NOW replay table smaller than hub");
+
+// ======================================================================
+//  受信の取り込み（HubIngest.h。tools/trace_tool replay・hub_sim と同じコード）
+//   - 重複排除: センサーは "<t>,<h>,<p>,<seq>,<bootId>" で送り、ack が無ければ
+//     再送する。トピック（= デバイス）ごとに受け取り済みの seq を覚えて捨てる。
+//   - 後送り: センサーはハブへ届けられなかったサンプルを自分のフラッシュ（journal）に
+//     残し、つながったら journal の通し番号（seq, 再起動をまたいで連続）つきで
+//     時刻順にまとめて送る。再送された塊は取り込まずに ack だけ返す。
+//   - 送信時刻の割り当て（publish slot）: 全ノードが 2 秒ごとに勝手な位相で送ると、
+//     台数が増えたときに同じ瞬間へ重なる。ハブ時刻の 2 秒周期を slot.count 等分し、
+//     ノードごとに別の位置を割り当てて時刻要求への応答に載せる（PublishSlots.h）。
+//   - 異常検知（範囲外・急変・張り付き・z スコア・途絶）とデバイスごとの間引き。
+//   取り込みの状態は g_ingest が持ち、時計・応答・校正・ログの保存・表示は
+//   FirmwareIngestHost（下の「受信サンプルの取り込み」）が受け持つ。
+// ======================================================================
+constexpr size_t PUBLISH_SLOTS_MAX = HUB_DEVICES_MAX;
+
+class FirmwareIngestHost : public HubIngest::Host {
+public:
+    uint32_t nowMs() override { return millis(); }
+    uint32_t nowEpoch() override;
+    uint32_t nowEpochMs(uint16_t& ms) override;
+    uint32_t trendSec() override;
+    void     publish(const char* topic, const char* payload) override;
+    void     calibrate(HubIngest::Reading& r) override;
+    void     appendLog(const HubIngest::Reading& r) override;
+    size_t   mergeLog(const HubIngest::Reading* rows, size_t k) override;
+    void     onSample(const HubIngest::Reading& r) override;
+    void     onQuarantine(const char* device, const HubIngest::Reading& r) override;
+};
+
+FirmwareIngestHost g_ingestHost;
+HubIngest          g_ingest(g_ingestHost);
+
+// 後送りの差し込みにかかった時間（数は g_ingest.stats()）
+struct BackfillStats {
+    uint32_t lastMergeUs;   // 直近の差し込み + CSV 末尾の書き直し
+    uint32_t maxMergeUs;
+    uint32_t sensorPending; // センサーの stat が報告した未送の件数
+};
+
+BackfillStats g_backfill = {};
+
+uint8_t g_lastSampleFlags = 0;   // 直前に採用したサンプルの AnomalyFlag
+
+// センサーから報告される送信側カウンタ（stat）
+uint32_t g_txRetransmits = 0;
+uint32_t g_txDropped     = 0;
 
 // ======================================================================
 //  MQTT 設定
 // ======================================================================
 const uint16_t MQTT_PORT  = 1883;
-const char*    MQTT_TOPIC = "home/env/stackchan1";  // StickP2側と合わせる
+// センサー → ハブ（StickP2側と合わせる。既定センサーは "home/env/stackchan1"）
+//  ブローカへは MQTT_SUB_FILTER だけを購読し、細かい振り分けは TopicRouter で行う
+const char*    MQTT_SUB_FILTER    = "home/env/#";
+const char*    MQTT_PATTERN_ENV   = "home/env/+";        // 計測値
+const char*    MQTT_PATTERN_STAT  = "home/env/+/stat";   // センサーのリンク計測値
+const char*    MQTT_PATTERN_TIMEREQ = "home/env/+/timereq";  // 時刻要求 "<t1>" → .../time に "<t1>,<sec>,<ms>"
+const char*    MQTT_PATTERN_BACKFILL = "home/env/+/backfill"; // 後送り → .../backfill/ack に最後の seq
+
+// ハブ → LAN：派生状態（保持して新しい購読者に再送する）
+const char*    STATE_TOPIC_ENV        = "stackchan/state/env";         // "<t>,<h>,<p>"（補正後）
+const char*    STATE_TOPIC_EXPRESSION = "stackchan/state/expression";  // "happy" など
+const char*    STATE_TOPIC_OFFSET     = "stackchan/state/offset";      // 温度オフセット
+const char*    STATE_TOPIC_AGGREGATE  = "stackchan/state/aggregate";   // "<count>,<minT>,<maxT>,<meanT>"
+const char*    STATE_TOPIC_DERIVED    = "stackchan/state/derived";     // "<dew>,<heatIndex>,<absHum>,<trend|>"
+
+// センサーへの設定配信（PicoMQTT は retained 非対応なので定期的に再送）
+const char*    MQTT_TOPIC_SEALEVEL = "stackchan/cmd/sealevel";
+const char*    MQTT_TOPIC_LINK     = "stackchan/cmd/link";
+constexpr unsigned long SENSOR_CFG_REPUBLISH_MS = 30000;
 
 // ======================================================================
 //  LittleFS ファイルパス
 // ======================================================================
 const char* LOG_FILE_PATH    = "/logs.csv";
 const char* CONFIG_FILE_PATH = "/config.txt";
+const char* TRACE_FILE_PATH  = "/trace.bin";           // 受信トレース（/api/trace）
 
 // ======================================================================
 //  MQTT ブローカ / HTTP サーバ / Avatar
 // ======================================================================
-PicoMQTT::Server mqtt;
+// ======================================================================
+//  ブローカの接続数
+//   PicoMQTT はクライアントごとに TCP の送受信バッファ（lwIP）と受信処理の
+//   状態を持ち、上限なしに受け付けるとヒープが尽きて loop 全体が止まる。
+//   同時接続は mqtt.max_clients・「mqtt.budget_kb / 1 接続の見積り」・
+//   「起動時の空きヒープ - 予備」・lwIP のソケット数の最小までにし、超えた
+//   CONNECT は Server unavailable で断る（接続中と同じクライアント ID は受け付ける）。
+//   止まったクライアントは keep-alive + MQTT_KEEPALIVE_TOLERANCE_MS でブローカが、
+//   無通信の端末は ap.idle_s で AP が切る。
+//   これより多いノードは ESP-NOW（接続・ソケットを持たない）で受ける。
+// ======================================================================
+constexpr uint8_t  MQTT_CLIENTS_MAX            = 32;
+constexpr size_t   MQTT_CLIENT_COST_BYTES      = 12 * 1024;  // TCP 送受信窓 2 × 5744 + 受信処理
+constexpr size_t   MQTT_HEAP_RESERVE_BYTES     = 48 * 1024;  // HTTP・ESP-NOW・描画の分は残す
+constexpr uint8_t  MQTT_RESERVED_SOCKETS       = 3;          // HTTP と MQTT の待ち受け + HTTP 1 本
+constexpr uint32_t MQTT_KEEPALIVE_TOLERANCE_MS = 5000;
+
+struct BrokerStats {
+    uint8_t  limit;       // 実際の同時接続の上限
+    uint8_t  clients;     // 今の接続数
+    uint8_t  peak;
+    uint32_t connects;
+    uint32_t rejected;    // 上限で断った CONNECT
+};
+
+uint32_t    g_brokerClients[MQTT_CLIENTS_MAX] = {};   // 接続中のクライアント ID のハッシュ（0 = 空き）
+BrokerStats g_brokerStats = {};
+
+// ======================================================================
+//  受信負荷の計測（tools/mqtt_loadgen の結果と突き合わせる）
+//   受信の振り分けにかかった時間と、受信処理が loop を占有したことで
+//   サーボ更新・HTTP 受付の周期がどれだけ延びたかを数える。
+//   /api/metrics?reset=load で 0 から数え直す（負荷をかける前に呼ぶ）。
+// ======================================================================
+constexpr uint32_t SERVO_GAP_BUDGET_MS = 50;    // サーボ更新の間隔がこれを超えたら遅れ
+constexpr uint32_t LOOP_GAP_BUDGET_MS  = 100;   // loop 1 周（= HTTP 受付の間隔）
+
+struct LoadStats {
+    uint32_t sinceMs;         // 数え始め
+    uint32_t messages;        // 振り分けた受信
+    uint32_t routeUsSum;
+    uint32_t routeUsMax;      // 1 通の振り分け（取り込み・ack・記録まで）
+    uint32_t serviceUsMax;    // serviceTransports 1 回（溜まった受信をまとめて）
+    uint32_t windowMs;        // 1 秒窓の開始
+    uint32_t windowCount;
+    uint32_t rateMax;         // 1 秒あたりの最大受信数
+    uint32_t servoGapMaxMs;
+    uint32_t servoLate;       // サーボ更新の間隔が SERVO_GAP_BUDGET_MS を超えた回数
+    uint32_t loopGapMaxMs;
+    uint32_t loopLate;        // loop 1 周が LOOP_GAP_BUDGET_MS を超えた回数
+    uint32_t lastServoMs;     // 0 = まだ（QR 画面から戻った直後も数えない）
+    uint32_t lastLoopMs;
+};
+
+LoadStats g_load = {};
+
+void resetLoadStats() {
+    g_load         = LoadStats();
+    g_load.sinceMs = millis();
+}
+
+// 間隔を測って最大・超過を数える（last == 0 は基準がないので数えない）
+void noteLoadGap(uint32_t& last, uint32_t& maxMs, uint32_t& late, uint32_t budgetMs) {
+    uint32_t now = millis();
+    if (last) {
+        uint32_t gap = now - last;
+        if (gap > maxMs) maxMs = gap;
+        if (gap > budgetMs) late++;
+    }
+    last = now ? now : 1;
+}
+
+// ======================================================================
+//  ブローカ拡張：購読時に保持状態（retained）を再送する
+//   PicoMQTT は retained を保持しないため、ハブ側で最新値を持っておく。
+//   on_subscribe はパケット処理中に呼ばれるので、再送は loop() 側で行う。
+//   接続の受け付け（auth）と接続数の記録（on_connected / on_disconnected）も行う。
+// ======================================================================
+class HubBroker : public PicoMQTT::Server {
+public:
+    HubBroker() : PicoMQTT::Server(1883, MQTT_KEEPALIVE_TOLERANCE_MS) {}
+
+protected:
+    PicoMQTT::ConnectReturnCode auth(const char* client_id, const char* username,
+                                     const char* password) override;
+    void on_connected(const char* client_id) override;
+    void on_disconnected(const char* client_id) override;
+    void on_subscribe(const char* client_id, const char* topic) override;
+};
+
+HubBroker mqtt;
+
+// ======================================================================
+//  センサーとの配送路（common/EnvTransport）
+//   MQTT（このブローカ）と ESP-NOW の両方で受け付け、要求が届いた配送路へ
+//   応答（ack / 時刻）を返す。設定の配信は全配送路へ送る。
+//   stackchan/state/# など LAN 向けの配信はブローカへ直接出す。
+// ======================================================================
+// 受信した本文の置き場所（PicoMQTT に受信ごとの new をさせない）
+//   大きさはセンサーの MQTT バッファ（後送りの塊が入る）と同じ。振り分けの中から
+//   自分の購読へ publish が戻ってきても受けられるよう 2 つ持つ。
+constexpr size_t MQTT_PAYLOAD_SIZE    = 1024;
+constexpr size_t MQTT_PAYLOAD_BUFFERS = 2;
+
+BufferPool<MQTT_PAYLOAD_SIZE, MQTT_PAYLOAD_BUFFERS> g_mqttPayloads;
+
+class HubMqttTransport : public EnvTransport {
+public:
+    const char* name() const override { return "mqtt"; }
+    bool begin() override;
+    void loop() override { mqtt.loop(); }
+    bool ready() const override { return true; }
+
+    bool publish(const char* topic, const char* payload) override {
+        bool ok = mqtt.publish(topic, payload);
+        if (ok) _stats.sent++;
+        else    _stats.failed++;
+        return ok;
+    }
+};
+
+HubMqttTransport g_mqttTransport;
+EspNowTransport  g_espNowTransport(WIFI_IF_AP);   // 設定はブロードキャスト、応答は送り主へ
+EnvTransport* const g_transports[] = { &g_mqttTransport, &g_espNowTransport };
+EnvTransport*       g_rxTransport  = &g_mqttTransport;   // 処理中のメッセージが届いた配送路
+
+constexpr size_t RETAINED_MAX         = 8;
+constexpr size_t RETAINED_REPLAY_MAX  = MQTT_CLIENTS_MAX;   // 再送待ちのクライアント数
+
+struct RetainedEntry {
+    const char* topic;        // 上の STATE_TOPIC_* を指す（nullptr = 未使用）
+    char        payload[64];
+};
+
+// 購読した時点の保持状態のうち、そのクライアントへ送り直すもの（クライアントごとに 1 件）
+//   購読の数に依らないよう、フィルタは on_subscribe で g_retained のビットに直して OR する
+struct RetainedReplay {
+    char    client[32];   // クライアント ID（"" = 空き）
+    uint8_t mask;         // g_retained の添字のビット
+};
+
+struct ReplayStats {
+    uint32_t queued;      // 再送を積んだ購読
+    uint32_t sent;        // 再送した保持状態
+    uint32_t overflow;    // 待ちが一杯で送り直せなかった購読
+};
+
+static_assert(RETAINED_MAX <= 8, "RetainedReplay::mask holds one bit per retained entry");
+
+RetainedEntry  g_retained[RETAINED_MAX] = {};
+RetainedReplay g_replayQueue[RETAINED_REPLAY_MAX] = {};
+ReplayStats    g_replayStats = {};
+
+TopicRouter<32> g_router;
 WebServer        server(80);
 Avatar           avatar;
 
+// ======================================================================
+//  HTTP 応答用の固定バッファ
+//   WebServer のハンドラは loop タスクで 1 件ずつ呼ばれるので全ハンドラで共用する。
+//   HTML はこのバッファ単位でチャンク送信し、String にページ全体を溜めない。
+// ======================================================================
+constexpr size_t HTTP_CHUNK_SIZE = 1436;   // 1 TCP セグメント分
+constexpr size_t HTTP_JSON_SIZE  = 4608;
+constexpr size_t LOG_PAGE_ROWS   = 50;     // コンソールのログ一覧 1 ページの行数
+
+char g_httpChunk[HTTP_CHUNK_SIZE];
+char g_httpJson[HTTP_JSON_SIZE];
+
 // ======================================================================
 //  起動フェーズ管理
 // ======================================================================
@@ -70,6 +395,27 @@ enum class BootPhase {
 };
 BootPhase g_bootPhase = BootPhase::QR;
 
+// 起動時間（setup の各段階の完了時刻。起動からの ms）
+//   ブローカは SoftAP とログ末尾の読み込みが済んだらすぐ起動する（QR / Avatar 画面を待たない）
+struct BootTimings {
+    uint32_t fsMs;          // LittleFS マウント
+    uint32_t configMs;      // 設定・校正・ルール読み込み
+    uint32_t softApMs;      // SoftAP 起動
+    uint32_t logTailMs;     // ログ末尾の読み込み完了（並行タスク）
+    uint32_t brokerMs;      // MQTT ブローカ起動（受信可能）
+    uint32_t httpMs;        // HTTP サーバ起動
+    uint32_t setupMs;       // setup() 完了
+    bool     warm;          // スナップショットから再開した
+    uint8_t  resetReason;   // esp_reset_reason_t
+};
+BootTimings g_boot = {};
+
+// 暖機再起動用スナップショット（RTC メモリ, 本体は setup() の手前）
+bool     g_snapDirty     = false;   // 更新が必要
+uint32_t g_snapSeq       = 0;       // 直前に書いた / 戻した番号
+uint32_t g_snapWarmBoots = 0;       // 暖機再起動の回数（電源投入で 0）
+uint32_t g_snapWrites    = 0;       // 今回の起動で書いた回数
+
 // ======================================================================
 //  QRサブページ管理
 // ======================================================================
@@ -91,26 +437,261 @@ struct EnvReading {
 
 EnvReading g_env = {NAN, NAN, NAN, false};
 
+// 派生指標（受信ごとに更新。表と気圧傾向は g_ingest.derived() / trend()）
+DerivedValues g_envDerived = {NAN, NAN, NAN};
+float         g_envTrend   = NAN;           // hPa / 3h（NAN = データ不足）
+uint32_t      g_trendBaseSec = 0;           // 気圧傾向の時刻の起点（暖機再起動で引き継ぐ）
+
+// 気圧傾向の時刻（秒）。起動からの秒 + 再起動前から引き継いだ分
+uint32_t trendNowSec() {
+    return g_trendBaseSec + millis() / 1000;
+}
+
+// ======================================================================
+//  海面気圧（センサー側の高度計算の基準）の範囲
+// ======================================================================
+constexpr float SEA_LEVEL_DEFAULT_HPA = 1013.25f;
+constexpr float SEA_LEVEL_MIN_HPA     = 900.0f;
+constexpr float SEA_LEVEL_MAX_HPA     = 1100.0f;
+
+unsigned long g_lastSensorCfgPubMs = 0;
+
+// ======================================================================
+//  設定ストア（NVS）
+//   - 起動時に 1 回だけ NVS から読み、以後は RAM 上の g_cfg を直接参照する
+//     （ホットパスでフラッシュを読まない）。よく使う項目を先頭に置く。
+//   - 更新は「コピーを書き換え → 検証 → NVS 保存 → 差し替え」で全体単位。
+//   - 構造を変えたら CONFIG_VERSION を上げる（古い blob は既定値に戻る）。
+// ======================================================================
+constexpr uint16_t CONFIG_VERSION   = 3;    // 2: ログ容量の上限を PSRAM 分に拡大, 3: 接続数の上限
+constexpr size_t   LOG_CAPACITY_MAX = 50000;   // PSRAM 上のログ領域の件数（行 約 2.8MB + 列 約 0.5MB）
+
+struct alignas(32) HubConfig {
+    uint16_t    version;
+    uint16_t    size;
+
+    // 受信ごとに参照する項目
+    float       tempOffset;          // ℃
+    float       zoneSadBelow;        // t <  これ → Sad
+    float       zoneNeutralBelow;    // t <  これ → Neutral
+    float       zoneHappyMax;        // t <= これ → Happy
+    float       zoneDoubtMax;        // t <= これ → Doubt（超えたら Angry）
+    float       logDeltaT;           // これ未満の変化はログに残さない
+    float       logDeltaH;
+    float       logDeltaP;
+    uint8_t     ledSad[3];           // RGB（0,0,0 = 消灯）
+    uint8_t     ledNeutral[3];
+    uint8_t     ledHappy[3];
+    uint8_t     ledDoubt[3];
+    uint8_t     ledAngry[3];
+    uint8_t     ledBrightness;
+    uint16_t    logCapacity;         // 1〜LOG_CAPACITY_MAX
+
+    // 時々参照する項目
+    int16_t     servoXCenter;
+    int16_t     servoYCenter;
+    int16_t     servoXAmplitude;
+    float       seaLevelhPa;
+    LinkProfile linkProfile;
+
+    // 起動時のみ
+    char        apSsid[33];
+    char        apPassword[65];
+
+    // 接続数（v3 で追加。slot.count 以外は起動時のみ）
+    uint8_t     apChannel;           // 1〜13（ESP-NOW も同じチャネル）
+    uint8_t     apMaxStations;       // SoftAP に同時に入れる台数
+    uint16_t    apIdleSec;           // 無通信の端末を AP が切るまで [秒]
+    uint8_t     mqttMaxClients;      // ブローカの同時接続の上限（メモリ予算でさらに絞る）
+    uint8_t     publishSlots;        // 送信時刻の枠の数（2 秒周期を等分）
+    uint16_t    mqttBudgetKb;        // ブローカのクライアントに使ってよいヒープ [KB]
+
+    uint32_t    checksum;
+};
+
+HubConfig g_cfg;
+bool      g_cfgNeedsRestart = false;   // SoftAP 設定の変更は再起動後に反映
+
+// 型付きスキーマ（/api/config の読み書き・コンソールのフォームはこの表から作る）
+enum class CfgType : uint8_t { F32, U8, I16, U16, RGB, Str, Link };
+
+struct CfgField {
+    const char* key;
+    CfgType     type;
+    uint16_t    offset;
+    uint16_t    size;
+    float       minV;
+    float       maxV;
+};
+
+#define CFG_FIELD(key, type, member, lo, hi) \
+    { key, CfgType::type, (uint16_t)offsetof(HubConfig, member), \
+      (uint16_t)sizeof(HubConfig::member), lo, hi }
+
+const CfgField CONFIG_SCHEMA[] = {
+    CFG_FIELD("temp.offset",       F32,  tempOffset,       -20.0f,  20.0f),
+    CFG_FIELD("sealevel",          F32,  seaLevelhPa,      SEA_LEVEL_MIN_HPA, SEA_LEVEL_MAX_HPA),
+    CFG_FIELD("link",              Link, linkProfile,      0, 0),
+    CFG_FIELD("zone.sad",          F32,  zoneSadBelow,     -40.0f,  60.0f),
+    CFG_FIELD("zone.neutral",      F32,  zoneNeutralBelow, -40.0f,  60.0f),
+    CFG_FIELD("zone.happy",        F32,  zoneHappyMax,     -40.0f,  60.0f),
+    CFG_FIELD("zone.doubt",        F32,  zoneDoubtMax,     -40.0f,  60.0f),
+    CFG_FIELD("led.sad",           RGB,  ledSad,           0, 255),
+    CFG_FIELD("led.neutral",       RGB,  ledNeutral,       0, 255),
+    CFG_FIELD("led.happy",         RGB,  ledHappy,         0, 255),
+    CFG_FIELD("led.doubt",         RGB,  ledDoubt,         0, 255),
+    CFG_FIELD("led.angry",         RGB,  ledAngry,         0, 255),
+    CFG_FIELD("led.brightness",    U8,   ledBrightness,    0, 255),
+    CFG_FIELD("servo.x_center",    I16,  servoXCenter,     0, 180),
+    CFG_FIELD("servo.y_center",    I16,  servoYCenter,     40, 140),
+    CFG_FIELD("servo.x_amplitude", I16,  servoXAmplitude,  0, 60),
+    CFG_FIELD("log.capacity",      U16,  logCapacity,      1, LOG_CAPACITY_MAX),
+    CFG_FIELD("log.delta_t",       F32,  logDeltaT,        0.0f, 10.0f),
+    CFG_FIELD("log.delta_h",       F32,  logDeltaH,        0.0f, 50.0f),
+    CFG_FIELD("log.delta_p",       F32,  logDeltaP,        0.0f, 50.0f),
+    CFG_FIELD("ap.ssid",           Str,  apSsid,           1, 32),
+    CFG_FIELD("ap.password",       Str,  apPassword,       8, 63),
+    CFG_FIELD("ap.channel",        U8,   apChannel,        1, 13),
+    CFG_FIELD("ap.max_stations",   U8,   apMaxStations,    1, AP_MAX_STATIONS),
+    CFG_FIELD("ap.idle_s",         U16,  apIdleSec,        10, 3600),
+    CFG_FIELD("mqtt.max_clients",  U8,   mqttMaxClients,   1, MQTT_CLIENTS_MAX),
+    CFG_FIELD("mqtt.budget_kb",    U16,  mqttBudgetKb,     16, 256),
+    CFG_FIELD("slot.count",        U8,   publishSlots,     1, PUBLISH_SLOTS_MAX),
+};
+constexpr size_t CONFIG_SCHEMA_COUNT = sizeof(CONFIG_SCHEMA) / sizeof(CONFIG_SCHEMA[0]);
+
+Preferences g_prefs;   // NVS 名前空間 "hubcfg"
+
 // ======================================================================
-//  温度オフセット（補正値）
+//  センサー校正（デバイスごとの一次式 + 全体の温度オフセット）
+//   校正後 = 生値 × gain + offset（温度にはさらに temp.offset を足す）
+//   - ログは生値と「記録時の校正世代」を持ち、校正後の値は今の世代で
+//     計算し直してから読む（古い校正のまま表示・集計されることはない）。
+//   - 校正を変えたら世代を +1。loop() で少しずつ再計算しておき、
+//     読み出し時は残りだけをその場で計算する。CSV は生値なので書き直し不要。
 // ======================================================================
-float g_tempOffset = 0.0f;
+constexpr uint16_t CAL_VERSION     = 2;
+constexpr size_t   CAL_DEVICES_MAX = HUB_DEVICES_MAX;
+constexpr size_t   CAL_V1_DEVICES  = 4;    // 版 1 の表の大きさ（読み込み時に移す）
+constexpr size_t   RECAL_BATCH     = 8;    // loop 1 回あたりに再計算するログ件数
+
+struct LinearCal {
+    float gain;
+    float offset;
+};
+
+struct DeviceCal {
+    char      device[16];   // トピック末尾（"stackchan1" など。"" = 未使用）
+    uint32_t  deviceHash;   // hashTopic(device)
+    LinearCal t;
+    LinearCal h;
+    LinearCal p;
+};
+
+struct CalTable {
+    uint16_t  version;
+    uint16_t  epoch;        // 校正を変えるたびに +1
+    DeviceCal dev[CAL_DEVICES_MAX];
+    uint32_t  checksum;
+};
+
+CalTable g_cal;
+size_t   g_recalCursor = 0;   // 背景の再計算の位置（論理番号。g_logCount 以上 = 完了）
+
+// 直前に受信した生値（校正変更時に g_env を計算し直す）
+struct RawSample {
+    uint32_t device;        // hashTopic(デバイス名)。0 = 不明（旧形式のログ）
+    float    t;
+    float    h;
+    float    p;
+    uint32_t time;          // センサーの取得時刻（エポック秒）。0 = 受信時刻を使う
+};
+
+RawSample g_lastRaw = {0, NAN, NAN, NAN, 0};
 
 // ======================================================================
 //  ログ管理（メモリ上）
-//  - ログ毎に「記録日時文字列」を持つ
+//  - ログ毎に記録時刻（エポック秒）を持つ。文字列にするのは表示するときだけ
 // ======================================================================
 struct EnvLogEntry {
+    // センサー生値と記録時の校正世代（CSV に残すのはこちら）
+    float    rawTemperature;
+    float    rawHumidity;
+    float    rawPressure;
+    uint32_t device;      // hashTopic(デバイス名)。0 = 不明
+    uint16_t calEpoch;    // 記録した時点の校正世代
+    uint16_t viewEpoch;   // 下の校正後の値を計算したときの世代
+
+    // 校正後（viewEpoch が古ければ logAt() で計算し直す）
     float temperature;
     float humidity;
     float pressure;
-    char  datetime[20];   // "YYYY/MM/DD HH:MM:SS" + 終端 = 20バイト
+    uint32_t time;        // 記録時刻（エポック秒, g_clock）。0 = 不明
+
+    // 派生指標（露点・暑さ指数・絶対湿度は校正後の値と一緒に再計算、
+    // 気圧傾向は記録時点の値を CSV に残す）
+    float dewPoint;
+    float heatIndex;
+    float absHumidity;
+    float pressureTrend;  // hPa / 3h（NAN = 不明）
+
+    uint8_t anomalyFlags; // 記録時の AnomalyFlag（メモリ上のみ）
+    bool    deleted;      // 削除印（compactLogs() で詰めるまで残す。メモリ上のみ）
+};
+
+// ======================================================================
+//  ログ領域
+//   - 実体は起動時に PSRAM から一括確保するリングバッファ（LOG_CAPACITY_MAX 件）。
+//     PSRAM が無ければ内部 RAM に LOG_SLOTS_NO_PSRAM 件だけ確保する。
+//   - 先頭位置・件数・ブロック要約など毎回触るメタデータは内部 RAM に置き、
+//     PSRAM は追記・表示・再計算のときだけ触る（集計でキャッシュを荒らさない）。
+//   - 集計用の列: 時刻・温度・湿度・気圧を物理位置そろえの別配列に固定小数点で
+//     持つ（ColumnScan.h）。集計は列だけを読み、行（約 56 バイト）は触らない。
+//     列は行の校正後の値を計算したとき（logPush / logAt）に一緒に書く。
+//   - ブロック要約: 物理位置 LOG_BLOCK 件ごとの件数・時刻範囲・T/H/P の最小/最大/合計。
+//     書き換えたブロックだけ dirty にし、集計時にそのブロックの列だけ読み直す。
+//   - 削除: 行に削除印を付けるだけ（O(1)）。印の付いた行は表示・集計・CSV から外し、
+//     溜まったら loop() でまとめて 1 回だけ詰め、CSV も 1 回だけ書き直す（compactLogs）。
+//     印の無いブロックの集計はこれまでどおり列だけを読む。
+// ======================================================================
+constexpr size_t LOG_SLOTS_NO_PSRAM = 256;
+constexpr size_t LOG_BLOCK          = 256;
+constexpr size_t LOG_BLOCKS_MAX     = (LOG_CAPACITY_MAX + LOG_BLOCK - 1) / LOG_BLOCK;
+
+enum LogField : uint8_t { LF_T, LF_H, LF_P, LF_COUNT };
+
+const float LOG_FIELD_SCALE[LF_COUNT] = { ColumnScan::T_SCALE, ColumnScan::H_SCALE, ColumnScan::P_SCALE };
+
+struct LogBlockSummary {
+    uint32_t timeMin;
+    uint32_t timeMax;
+    int16_t  min[LF_COUNT];   // 列と同じ固定小数点
+    int16_t  max[LF_COUNT];
+    int32_t  sum[LF_COUNT];
+    uint16_t count;           // 削除印の付いていない行
+    uint16_t dead;            // 削除印の付いた行（読み直しても残す。0 なら行を見ずに列だけ読む）
+    uint16_t colEpoch;        // 列の値を計算した校正世代（違えば行から計算し直す）
+    bool     dirty;           // 中身が変わった（集計前に読み直す）
 };
 
-constexpr size_t LOG_CAPACITY = 32;
-EnvLogEntry g_logs[LOG_CAPACITY];
-size_t      g_logCount    = 0;
-size_t      g_logSelected = 0;
+EnvLogEntry*    g_logs        = nullptr;   // 物理位置で引く（論理番号は logAt / logSlot）
+size_t          g_logSlots    = 0;         // 確保した件数
+bool            g_logsInPsram = false;
+size_t          g_logHead     = 0;         // 最古のログの物理位置
+size_t          g_logCount    = 0;
+size_t          g_logSelected = 0;
+size_t          g_logDead     = 0;         // 削除印の付いた行（g_logCount に含む）
+uint32_t        g_logDeadMs   = 0;         // 最初に削除印を付けた時刻（millis）
+LogBlockSummary g_logBlocks[LOG_BLOCKS_MAX];
+
+// 集計用の列（物理位置は g_logs と同じ）
+uint32_t* g_colTime = nullptr;
+int16_t*  g_col[LF_COUNT] = { nullptr, nullptr, nullptr };
+
+// 起動時に測る読み出しコスト（ns / 件。診断用）
+float g_logReadNsSeq   = 0.0f;   // 連続読み出し
+float g_logReadNsRand  = 0.0f;   // ランダム読み出し
+float g_logReadNsSram  = 0.0f;   // 比較用：内部 RAM の連続読み出し
 
 // 吹き出しON/OFF
 bool g_showSpeech = true;
@@ -129,8 +710,10 @@ static const int EARS_LED_COUNT = 18;
 Adafruit_NeoPixel bodyStrip(BODY_LED_COUNT, BODY_LED_PIN, NEO_GRB + NEO_KHZ800);
 Adafruit_NeoPixel earsStrip(EARS_LED_COUNT, EARS_LED_PIN, NEO_GRB + NEO_KHZ800);
 
-bool g_ledInited = false;
-bool g_ledWasOn  = false;   // 直前フレームでLEDが点灯していたか？
+bool    g_ledInited     = false;
+bool    g_ledWasOn      = false;   // 直前フレームでLEDが点灯していたか？
+bool    g_ledShownValid = false;   // g_ledShown が実際の LED と一致しているか
+uint8_t g_ledShown[3]   = { 0, 0, 0 };
 
 // ======================================================================
 //  表情変化／鳴き声制御用
@@ -142,12 +725,72 @@ bool       g_exprInitialized  = false;
 // 「次のループで悲鳴を鳴らしてほしい」フラグ
 bool       g_requestScream    = false;
 
+// ======================================================================
+//  UI 状態
+//   受信・HTTP 側は dirty ビットを立てるだけ。loop() の描画ティック
+//   （UI_TICK_MS ごと）でまとめて Avatar / LED に反映する。
+//   Avatar への呼び出しはすべて loop タスクの描画ティックから行う。
+// ======================================================================
+constexpr unsigned long UI_TICK_MS = 50;   // 20 fps
+
+enum UiDirty : uint8_t {
+    UI_DIRTY_EXPRESSION = 0x01,
+    UI_DIRTY_SPEECH     = 0x02,
+    UI_DIRTY_LED        = 0x04,
+    UI_DIRTY_ALL        = 0x07,
+};
+
+uint8_t       g_uiDirty      = 0;
+unsigned long g_uiLastTickMs = 0;
+
+// 表示中の表情（同じなら setExpression しない）
+Expression g_shownExpression = Expression::Neutral;
+bool       g_exprShown       = false;
+
+// 吹き出しに出している値（表示単位に丸めた後。変わらなければ書式化もしない）
+struct SpeechShown {
+    int16_t tempDeci;    // 0.1℃
+    int16_t hum;         // %
+    int16_t dewDeci;     // 0.1℃
+    int16_t trendDeci;   // 0.1 hPa/3h（INT16_MIN = 傾向なし）
+    int8_t  mode;        // -1 = 未表示, 0 = 非表示, 1 = 待機中, 2 = 値
+};
+
+SpeechShown g_speechShown = { 0, 0, 0, 0, -1 };
+
+inline void markUiDirty(uint8_t bits) {
+    g_uiDirty |= bits;
+}
+
+// ======================================================================
+//  表情 / LED ルール
+//   テキスト（1 行 1 ルール、先に書いたものが優先）:
+//     <表情> <r>,<g>,<b> [<軸>:lo..hi] ...
+//     hyst <軸>:<幅> ...
+//   軸: T（温度）H（湿度）P（気圧）DI（不快指数）DP（露点）HI（暑さ指数）PT（気圧傾向 hPa/3h）
+//   範囲は lo <= 値 < hi。片側は省略可（"T:..18" / "T:30.."）。
+//   /rules.txt が無いときは設定のゾーン / LED 色から生成する。
+// ======================================================================
+const char* RULES_FILE_PATH = "/rules.txt";
+
+struct ExprRule {
+    RuleTable::Rule cond;
+    Expression      expr;
+    uint8_t         rgb[3];   // 0,0,0 = 消灯
+};
+
+ExprRule  g_rules[RuleTable::MaxRules];
+size_t    g_ruleCount  = 0;
+float     g_ruleHyst[RULE_AXIS_COUNT] = { 0.3f, 2.0f, 1.0f, 0.5f, 0.3f, 0.3f, 0.2f };
+bool      g_rulesCustom = false;               // true = /rules.txt から読んだ
+RuleTable g_ruleTable;                         // 量子化済みの表（約 8KB）
+int8_t    g_activeRule  = RuleTable::NoRule;   // 直前に一致したルール
+
 // ======================================================================
 //  プロトタイプ宣言
 // ======================================================================
 void updateAvatarExpression();
 void updateSpeech();
-bool  saveOffsetToFS();
 bool  rewriteLogsToFS();
 void  startMQTTBroker();
 void  enterAvatarMode();
@@ -158,9 +801,22 @@ void  updateLedsForTemp();
 void  playScreamSound();
 void  initServo();
 void  updateServoIdle();
-void  getCurrentDatetimeString(char* buf, size_t len);
+size_t   staticMemoryBytes();
+size_t   psramMemoryBytes();
+size_t   logStoreBytes();
+void     markAllLogsDirty();
+uint32_t nowEpoch();
+void     syncClockFromRtc(bool step, bool wait);
+void     getCurrentDatetimeString(char* buf, size_t len);
 void  handleSetTime();
-Expression getExpressionForTemp(float t);   // 温度→表情 ヘルパー
+void  publishSensorConfig();
+void  publishHubState();
+bool  parseLinkProfile(const char* name, LinkProfile& out);
+void  applyApLinkProfile();
+void  evaluateRules();
+uint32_t hashTopic(const char* s);
+void  setRgb(uint8_t* dst, uint8_t r, uint8_t g, uint8_t b);
+const char* expressionName(Expression e);
 
 // ================================================================
 //  2. 共通ユーティリティ（エラー／警告表示）
@@ -207,6 +863,35 @@ void showWarning(const char* msg) {
     M5.Display.setTextColor(WHITE, BLACK);
 }
 
+// ======================================================================
+//  固定長バッファへの追記（切り詰め時も len は cap-1 で止める）
+// ======================================================================
+void appendf(char* buf, size_t cap, size_t& len, const char* fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+void appendf(char* buf, size_t cap, size_t& len, const char* fmt, ...) {
+    if (len + 1 >= cap) return;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + len, cap - len, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    len += ((size_t)n < cap - len) ? (size_t)n : (cap - len - 1);
+}
+
+// ======================================================================
+//  リンクプロファイル名 → enum
+// ======================================================================
+bool parseLinkProfile(const char* name, LinkProfile& out) {
+    for (uint8_t i = 0; i < LINK_PROFILE_COUNT; ++i) {
+        if (strcmp(name, LINK_PROFILES[i].name) == 0) {
+            out = (LinkProfile)i;
+            return true;
+        }
+    }
+    return false;
+}
+
 // ================================================================
 //  3. I/O ユーティリティ（LED）
 // ================================================================
@@ -237,76 +922,269 @@ void turnOffAllLeds() {
 // ================================================================
 
 // ======================================================================
-//  温度 → Expression 判定（共通ロジック）
+//  表情名 ⇔ Expression
 // ======================================================================
-Expression getExpressionForTemp(float t) {
-    if (t < 18.0f) {
-        return Expression::Sad;
-    } else if (t < 22.0f) {
-        return Expression::Neutral;
-    } else if (t <= 26.0f) {
-        return Expression::Happy;
-    } else if (t <= 30.0f) {
-        return Expression::Doubt;
-    } else {
-        return Expression::Angry;
+const char* expressionName(Expression e) {
+    switch (e) {
+        case Expression::Happy:   return "happy";
+        case Expression::Angry:   return "angry";
+        case Expression::Sad:     return "sad";
+        case Expression::Doubt:   return "doubt";
+        case Expression::Sleepy:  return "sleepy";
+        case Expression::Neutral:
+        default:                  return "neutral";
+    }
+}
+
+bool parseExpression(const char* name, Expression& out) {
+    static const Expression ALL[] = {
+        Expression::Happy, Expression::Angry, Expression::Sad,
+        Expression::Doubt, Expression::Sleepy, Expression::Neutral,
+    };
+    for (Expression e : ALL) {
+        if (strcasecmp(name, expressionName(e)) == 0) {
+            out = e;
+            return true;
+        }
     }
+    return false;
 }
 
 // ======================================================================
-//  温度に応じて LED 色切り替え（表情と連動）
-//   Sad    = 青
-//   Neutral= 水色
-//   Doubt  = ピンク
-//   Angry  = 赤
-//   Happy  = 消灯
+//  不快指数（DI = 0.81T + 0.01H(0.99T - 14.3) + 46.3）
 // ======================================================================
-void updateLedsForTemp() {
-    if (!g_ledInited) return;
+float discomfortIndex(float t, float h) {
+    return 0.81f * t + 0.01f * h * (0.99f * t - 14.3f) + 46.3f;
+}
 
+// ======================================================================
+//  既定ルール（設定の温度ゾーン / 表情ごとの LED 色から生成）
+//   Happy の上限は「<=」なので温度 1 ビン分（0.1℃）広げる
+// ======================================================================
+void buildDefaultRules() {
+    struct Zone { Expression expr; float lo; float hi; const uint8_t* rgb; };
+    const Zone zones[] = {
+        { Expression::Sad,     -1e9f,                  g_cfg.zoneSadBelow,         g_cfg.ledSad     },
+        { Expression::Neutral, g_cfg.zoneSadBelow,     g_cfg.zoneNeutralBelow,     g_cfg.ledNeutral },
+        { Expression::Happy,   g_cfg.zoneNeutralBelow, g_cfg.zoneHappyMax + 0.1f,  g_cfg.ledHappy   },
+        { Expression::Doubt,   g_cfg.zoneHappyMax + 0.1f, g_cfg.zoneDoubtMax + 0.1f, g_cfg.ledDoubt },
+        { Expression::Angry,   g_cfg.zoneDoubtMax + 0.1f, 1e9f,                    g_cfg.ledAngry   },
+    };
+
+    g_ruleCount = 0;
+    for (const Zone& z : zones) {
+        ExprRule& r = g_rules[g_ruleCount++];
+        RuleTable::clearRule(r.cond);
+        r.cond.lo[RULE_AXIS_TEMP] = z.lo;
+        r.cond.hi[RULE_AXIS_TEMP] = z.hi;
+        r.expr = z.expr;
+        memcpy(r.rgb, z.rgb, sizeof(r.rgb));
+    }
+    g_rulesCustom = false;
+}
+
+// ======================================================================
+//  ルール → 量子化表
+// ======================================================================
+void compileRules() {
+    RuleTable::Rule conds[RuleTable::MaxRules];
+    for (size_t i = 0; i < g_ruleCount; ++i) {
+        conds[i] = g_rules[i].cond;
+    }
+    g_ruleTable.compile(conds, g_ruleCount, g_ruleHyst);
+    g_activeRule = RuleTable::NoRule;   // 番号が変わるので保持状態は捨てる
+}
+
+// ======================================================================
+//  現在値でルール評価（表引きのみ。受信ごとに 1 回）
+// ======================================================================
+void evaluateRules() {
     if (!g_env.valid) {
-        turnOffAllLeds();
-        g_ledWasOn = false;
+        g_activeRule = RuleTable::NoRule;
         return;
     }
+    float v[RULE_AXIS_COUNT];
+    v[RULE_AXIS_TEMP]  = g_env.temperature;
+    v[RULE_AXIS_HUM]   = g_env.humidity;
+    v[RULE_AXIS_PRESS] = g_env.pressure;
+    v[RULE_AXIS_DI]    = discomfortIndex(g_env.temperature, g_env.humidity);
+    v[RULE_AXIS_DEW]   = g_envDerived.dewPoint;
+    v[RULE_AXIS_HEAT]  = g_envDerived.heatIndex;
+    v[RULE_AXIS_TREND] = isnan(g_envTrend) ? 0.0f : g_envTrend;   // 不明は「横ばい」
+    g_activeRule = g_ruleTable.evaluate(v, g_activeRule);
+}
+
+// どのルールにも一致しないときは Neutral / 消灯
+Expression currentRuleExpression() {
+    return (g_activeRule >= 0) ? g_rules[g_activeRule].expr : Expression::Neutral;
+}
+
+// ======================================================================
+//  ルールテキストの解析（全行が正しいときだけ out に書く）
+// ======================================================================
+bool parseRangeToken(const char* tok, RuleTable::Rule& r) {
+    const char* colon = strchr(tok, ':');
+    const char* dots  = strstr(tok, "..");
+    if (!colon || !dots || dots < colon) return false;
+
+    for (uint8_t a = 0; a < RULE_AXIS_COUNT; ++a) {
+        const char* name = RuleTable::axis(a).name;
+        size_t len = strlen(name);
+        if ((size_t)(colon - tok) != len || strncasecmp(tok, name, len) != 0) continue;
+
+        char* end;
+        if (dots > colon + 1) {
+            r.lo[a] = strtof(colon + 1, &end);
+            if (end != dots) return false;
+        }
+        if (dots[2]) {
+            r.hi[a] = strtof(dots + 2, &end);
+            if (*end) return false;
+        }
+        return r.lo[a] < r.hi[a];
+    }
+    return false;
+}
 
-    // 温度から表情を取得（Avatar と同じロジック）
-    Expression expr = getExpressionForTemp(g_env.temperature);
+bool parseHystToken(const char* tok, float* hyst) {
+    for (uint8_t a = 0; a < RULE_AXIS_COUNT; ++a) {
+        const char* name = RuleTable::axis(a).name;
+        size_t len = strlen(name);
+        if (strncasecmp(tok, name, len) != 0 || tok[len] != ':') continue;
+
+        char* end;
+        float v = strtof(tok + len + 1, &end);
+        if (*end || !(v >= 0.0f && v <= 20.0f)) return false;
+        hyst[a] = v;
+        return true;
+    }
+    return false;
+}
 
-    uint8_t r = 0, g = 0, b = 0;
-    bool shouldBeOn = true;
+// text は書き換える（strtok_r）。err には失敗した行番号付きのメッセージ
+bool parseRulesText(char* text, ExprRule* out, size_t& outCount, float* hyst,
+                    char* err, size_t errLen) {
+    size_t count = 0;
+    int    lineNo = 0;
+    char*  lineSave = nullptr;
+
+    for (char* line = strtok_r(text, "\r\n", &lineSave); line;
+         line = strtok_r(nullptr, "\r\n", &lineSave)) {
+        ++lineNo;
+        char* tokSave = nullptr;
+        char* tok = strtok_r(line, " \t", &tokSave);
+        if (!tok || tok[0] == '#') continue;
+
+        if (strcasecmp(tok, "hyst") == 0) {
+            while ((tok = strtok_r(nullptr, " \t", &tokSave))) {
+                if (!parseHystToken(tok, hyst)) {
+                    snprintf(err, errLen, "line %d: bad hysteresis '%s'", lineNo, tok);
+                    return false;
+                }
+            }
+            continue;
+        }
 
-    switch (expr) {
-        case Expression::Sad:
-            // 青
-            r = 0;   g = 0;   b = 160;
-            break;
+        if (count >= RuleTable::MaxRules) {
+            snprintf(err, errLen, "line %d: too many rules (max %u)",
+                     lineNo, (unsigned)RuleTable::MaxRules);
+            return false;
+        }
+        ExprRule& r = out[count];
+        RuleTable::clearRule(r.cond);
 
-        case Expression::Neutral:
-            // 水色（シアン寄り）
-            r = 80;  g = 160; b = 160;
-            break;
+        if (!parseExpression(tok, r.expr)) {
+            snprintf(err, errLen, "line %d: unknown expression '%s'", lineNo, tok);
+            return false;
+        }
+        int cr, cg, cb;
+        tok = strtok_r(nullptr, " \t", &tokSave);
+        if (!tok || sscanf(tok, "%d,%d,%d", &cr, &cg, &cb) != 3 ||
+            cr < 0 || cr > 255 || cg < 0 || cg > 255 || cb < 0 || cb > 255) {
+            snprintf(err, errLen, "line %d: colour must be r,g,b", lineNo);
+            return false;
+        }
+        setRgb(r.rgb, (uint8_t)cr, (uint8_t)cg, (uint8_t)cb);
 
-        case Expression::Doubt:
-            // ピンク
-            r = 200; g = 80;  b = 160;
-            break;
+        while ((tok = strtok_r(nullptr, " \t", &tokSave))) {
+            if (!parseRangeToken(tok, r.cond)) {
+                snprintf(err, errLen, "line %d: bad range '%s'", lineNo, tok);
+                return false;
+            }
+        }
+        ++count;
+    }
 
-        case Expression::Angry:
-            // 赤
-            r = 200; g = 40;  b = 40;
-            break;
+    if (count == 0) {
+        snprintf(err, errLen, "no rules");
+        return false;
+    }
+    outCount = count;
+    return true;
+}
+
+// ======================================================================
+//  ルール → テキスト（保存・コンソール表示用）
+// ======================================================================
+size_t formatRulesText(char* buf, size_t cap) {
+    size_t n = 0;
+    appendf(buf, cap, n, "hyst");
+    for (uint8_t a = 0; a < RULE_AXIS_COUNT; ++a) {
+        appendf(buf, cap, n, " %s:%g", RuleTable::axis(a).name, g_ruleHyst[a]);
+    }
+    appendf(buf, cap, n, "\n");
+
+    for (size_t i = 0; i < g_ruleCount; ++i) {
+        const ExprRule& r = g_rules[i];
+        appendf(buf, cap, n, "%s %u,%u,%u", expressionName(r.expr),
+                (unsigned)r.rgb[0], (unsigned)r.rgb[1], (unsigned)r.rgb[2]);
+        for (uint8_t a = 0; a < RULE_AXIS_COUNT; ++a) {
+            bool hasLo = r.cond.lo[a] > -1e8f;
+            bool hasHi = r.cond.hi[a] <  1e8f;
+            if (!hasLo && !hasHi) continue;
+            appendf(buf, cap, n, " %s:", RuleTable::axis(a).name);
+            if (hasLo) appendf(buf, cap, n, "%g", r.cond.lo[a]);
+            appendf(buf, cap, n, "..");
+            if (hasHi) appendf(buf, cap, n, "%g", r.cond.hi[a]);
+        }
+        appendf(buf, cap, n, "\n");
+    }
+    return n;
+}
+
+// ======================================================================
+//  ルールに応じて LED 色切り替え（表情と連動）
+//   既定ルールの色は設定（led.*）から取る。既定値:
+//   Sad    = 青
+//   Neutral= 水色
+//   Doubt  = ピンク
+//   Angry  = 赤
+//   Happy  = 消灯
+//   0,0,0 の表情は消灯扱い
+// ======================================================================
+void updateLedsForTemp() {
+    if (!g_ledInited) return;
+
+    // 一致したルールの色（Avatar と同じルール。どれにも一致しなければ消灯）
+    static const uint8_t OFF[3] = { 0, 0, 0 };
+    const uint8_t* rgb = (g_env.valid && g_activeRule >= 0) ? g_rules[g_activeRule].rgb : OFF;
 
-        case Expression::Happy:
-        default:
-            // 快適ゾーン：耳は光らせない
+    bool shouldBeOn = (rgb[0] | rgb[1] | rgb[2]) != 0;
+
+    // 色が変わったときだけ書き込む（NeoPixel の show() は割り込みを止めるので）
+    if (!g_ledShownValid || memcmp(rgb, g_ledShown, sizeof(g_ledShown)) != 0) {
+        if (shouldBeOn) {
+            setAllLedsColor(rgb[0], rgb[1], rgb[2]);
+        } else {
             turnOffAllLeds();
-            shouldBeOn = false;
-            break;
+        }
+        memcpy(g_ledShown, rgb, sizeof(g_ledShown));
+        g_ledShownValid = true;
     }
 
-    if (shouldBeOn) {
-        setAllLedsColor(r, g, b);
+    if (!g_env.valid) {
+        g_ledWasOn = false;
+        return;
     }
 
     // ★ 消灯状態 → 点灯状態に変わったタイミングでだけ
@@ -346,486 +1224,3313 @@ void playScreamSound() {
 // ================================================================
 
 // ======================================================================
-//  LittleFS: オフセットの読み書き
+//  設定ストア: 既定値 / チェックサム
 // ======================================================================
-bool loadOffsetFromFS() {
-    if (!LittleFS.exists(CONFIG_FILE_PATH)) return false;
-    File f = LittleFS.open(CONFIG_FILE_PATH, FILE_READ);
-    if (!f) return false;
+uint32_t fnv1a(const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
 
-    String line = f.readStringUntil('\n');
-    line.trim();
-    f.close();
-    if (line.length() == 0) return false;
+uint32_t configChecksum(const HubConfig& c) {
+    return fnv1a(&c, offsetof(HubConfig, checksum));
+}
 
-    g_tempOffset = line.toFloat();
-    return true;
+void setRgb(uint8_t* dst, uint8_t r, uint8_t g, uint8_t b) {
+    dst[0] = r;
+    dst[1] = g;
+    dst[2] = b;
 }
 
-bool saveOffsetToFS() {
-    File f = LittleFS.open(CONFIG_FILE_PATH, FILE_WRITE);
-    if (!f) return false;
-    f.printf("%.2f\n", g_tempOffset);
-    f.close();
+HubConfig defaultConfig() {
+    HubConfig c;
+    memset(&c, 0, sizeof(c));   // パディングも 0 にしてチェックサムを安定させる
+    c.version          = CONFIG_VERSION;
+    c.size             = sizeof(HubConfig);
+    c.tempOffset       = 0.0f;
+    c.zoneSadBelow     = 18.0f;
+    c.zoneNeutralBelow = 22.0f;
+    c.zoneHappyMax     = 26.0f;
+    c.zoneDoubtMax     = 30.0f;
+    c.logDeltaT        = 0.2f;
+    c.logDeltaH        = 1.0f;
+    c.logDeltaP        = 0.5f;
+    setRgb(c.ledSad,     0,   0,   160);   // 青
+    setRgb(c.ledNeutral, 80,  160, 160);   // 水色
+    setRgb(c.ledHappy,   0,   0,   0);     // 快適ゾーンは消灯
+    setRgb(c.ledDoubt,   200, 80,  160);   // ピンク
+    setRgb(c.ledAngry,   200, 40,  40);    // 赤
+    c.ledBrightness    = 40;
+    c.logCapacity      = LOG_CAPACITY_MAX;
+    c.servoXCenter     = SERVO_X_CENTER_DEFAULT;
+    c.servoYCenter     = SERVO_Y_CENTER_DEFAULT;
+    c.servoXAmplitude  = SERVO_X_AMPLITUDE_DEFAULT;
+    c.seaLevelhPa      = SEA_LEVEL_DEFAULT_HPA;
+    c.linkProfile      = LinkProfile::Balanced;
+    strncpy(c.apSsid,     AP_SSID_DEFAULT,     sizeof(c.apSsid) - 1);
+    strncpy(c.apPassword, AP_PASSWORD_DEFAULT, sizeof(c.apPassword) - 1);
+    c.apChannel        = AP_CHANNEL_DEFAULT;
+    c.apMaxStations    = AP_MAX_STATIONS;
+    c.apIdleSec        = 60;
+    c.mqttMaxClients   = 8;
+    c.publishSlots     = 32;
+    c.mqttBudgetKb     = 96;
+    c.checksum = configChecksum(c);
+    return c;
+}
+
+// 項目間の整合（ゾーンは昇順）
+bool validateConfig(const HubConfig& c, const char*& err) {
+    if (!(c.zoneSadBelow <= c.zoneNeutralBelow &&
+          c.zoneNeutralBelow <= c.zoneHappyMax &&
+          c.zoneHappyMax <= c.zoneDoubtMax)) {
+        err = "zones must be ascending (sad <= neutral <= happy <= doubt)";
+        return false;
+    }
+    if ((uint8_t)c.linkProfile >= LINK_PROFILE_COUNT) {
+        err = "invalid link profile";
+        return false;
+    }
     return true;
 }
 
 // ======================================================================
-//  RTC → "YYYY/MM/DD HH:MM:SS" に変換
+//  設定ストア: スキーマに沿った文字列 ⇔ 値
 // ======================================================================
-void getCurrentDatetimeString(char* buf, size_t len) {
-    auto dt = M5.Rtc.getDateTime();  // rtc_datetime_t
-
-    snprintf(buf, len,
-             "%04d/%02d/%02d %02d:%02d:%02d",
-             (int)dt.date.year,
-             (int)dt.date.month,
-             (int)dt.date.date,
-             (int)dt.time.hours,
-             (int)dt.time.minutes,
-             (int)dt.time.seconds);
+bool parseConfigField(HubConfig& c, const CfgField& f, const char* v) {
+    uint8_t* dst = (uint8_t*)&c + f.offset;
+    char* end = nullptr;
+
+    switch (f.type) {
+        case CfgType::F32: {
+            float x = strtof(v, &end);
+            if (end == v || !(x >= f.minV && x <= f.maxV)) return false;
+            memcpy(dst, &x, sizeof(x));
+            return true;
+        }
+        case CfgType::U8:
+        case CfgType::I16:
+        case CfgType::U16: {
+            long x = strtol(v, &end, 10);
+            if (end == v || x < (long)f.minV || x > (long)f.maxV) return false;
+            if (f.type == CfgType::U8) {
+                *dst = (uint8_t)x;
+            } else if (f.type == CfgType::I16) {
+                int16_t y = (int16_t)x;
+                memcpy(dst, &y, sizeof(y));
+            } else {
+                uint16_t y = (uint16_t)x;
+                memcpy(dst, &y, sizeof(y));
+            }
+            return true;
+        }
+        case CfgType::RGB: {
+            int r, g, b;
+            if (sscanf(v, "%d,%d,%d", &r, &g, &b) != 3) return false;
+            if (r < 0 || r > 255 || g < 0 || g > 255 || b < 0 || b > 255) return false;
+            setRgb(dst, (uint8_t)r, (uint8_t)g, (uint8_t)b);
+            return true;
+        }
+        case CfgType::Str: {
+            size_t len = strlen(v);
+            if (len < (size_t)f.minV || len > (size_t)f.maxV || len >= f.size) return false;
+            memset(dst, 0, f.size);
+            memcpy(dst, v, len);
+            return true;
+        }
+        case CfgType::Link: {
+            LinkProfile lp;
+            if (!parseLinkProfile(v, lp)) return false;
+            *dst = (uint8_t)lp;
+            return true;
+        }
+    }
+    return false;
 }
 
-// ======================================================================
-//  LittleFS: ログの読み書き
-//   CSV: temperature,humidity,pressure,datetime
-// ======================================================================
-bool loadLogsFromFS() {
-    g_logCount    = 0;
-    g_logSelected = 0;
+// 値を文字列化（quoteStr = JSON 用に文字列型を "" で囲んでエスケープする）
+//   out は CFG_VALUE_MAX あれば文字列型もエスケープ込みで切れない
+constexpr size_t CFG_VALUE_MAX = sizeof(HubConfig::apPassword) * TextEscape::MAX_EXPANSION + 3;
 
-    if (!LittleFS.exists(LOG_FILE_PATH)) return false;
-    File f = LittleFS.open(LOG_FILE_PATH, FILE_READ);
-    if (!f) return false;
+void formatConfigField(const HubConfig& c, const CfgField& f, char* out, size_t len,
+                       bool quoteStr) {
+    const uint8_t* src = (const uint8_t*)&c + f.offset;
 
-    while (f.available() && g_logCount < LOG_CAPACITY) {
-        String line = f.readStringUntil('\n');
-        line.trim();
-        if (line.length() == 0) continue;
-
-        float t, h, p;
-        char  dtstr[20] = {0};
-
-        if (sscanf(line.c_str(), "%f,%f,%f,%19[^\n]",
-                   &t, &h, &p, dtstr) == 4) {
-            EnvLogEntry e;
-            e.temperature = t;
-            e.humidity    = h;
-            e.pressure    = p;
-            strncpy(e.datetime, dtstr, sizeof(e.datetime));
-            e.datetime[sizeof(e.datetime) - 1] = '\0';
-            g_logs[g_logCount++] = e;
+    switch (f.type) {
+        case CfgType::F32: {
+            float x;
+            memcpy(&x, src, sizeof(x));
+            snprintf(out, len, "%.2f", x);
+            break;
+        }
+        case CfgType::U8:
+            snprintf(out, len, "%u", (unsigned)*src);
+            break;
+        case CfgType::I16: {
+            int16_t x;
+            memcpy(&x, src, sizeof(x));
+            snprintf(out, len, "%d", (int)x);
+            break;
+        }
+        case CfgType::U16: {
+            uint16_t x;
+            memcpy(&x, src, sizeof(x));
+            snprintf(out, len, "%u", (unsigned)x);
+            break;
         }
+        case CfgType::RGB:
+            snprintf(out, len, quoteStr ? "\"%u,%u,%u\"" : "%u,%u,%u",
+                     (unsigned)src[0], (unsigned)src[1], (unsigned)src[2]);
+            break;
+        case CfgType::Str:
+            if (quoteStr && len >= 3) {
+                out[0] = '"';
+                TextEscape::json(out + 1, len - 2, (const char*)src);
+                size_t k = strlen(out);
+                out[k]     = '"';
+                out[k + 1] = '\0';
+            } else {
+                snprintf(out, len, "%s", (const char*)src);
+            }
+            break;
+        case CfgType::Link:
+            snprintf(out, len, quoteStr ? "\"%s\"" : "%s",
+                     LINK_PROFILES[*src < LINK_PROFILE_COUNT ? *src : 0].name);
+            break;
     }
-    f.close();
+}
+
+// ======================================================================
+//  設定ストア: NVS 読み書き
+//   旧形式の /config.txt（オフセット / 海面気圧 / リンク名）があれば 1 回だけ取り込む
+// ======================================================================
+bool migrateLegacyConfig(HubConfig& c) {
+    if (!LittleFS.exists(CONFIG_FILE_PATH)) return false;
+    File f = LittleFS.open(CONFIG_FILE_PATH, FILE_READ);
+    if (!f) return false;
+
+    char line[32];
+    for (int i = 0; i < 3 && f.available(); ++i) {
+        size_t n = f.readBytesUntil('\n', line, sizeof(line) - 1);
+        line[n] = '\0';
+        parseConfigField(c, CONFIG_SCHEMA[i], line);   // temp.offset / sealevel / link の順
+    }
+    f.close();
+
+    LittleFS.remove(CONFIG_FILE_PATH);
+    return true;
+}
+
+bool saveConfig(HubConfig& c) {
+    c.version  = CONFIG_VERSION;
+    c.size     = sizeof(HubConfig);
+    c.checksum = configChecksum(c);
+    return g_prefs.putBytes("cfg", &c, sizeof(c)) == sizeof(c);
+}
+
+// v2 の blob（接続数の項目が無く、チェックサムの位置が違う）を既定値の上に重ねる
+constexpr size_t CONFIG_V2_BODY     = offsetof(HubConfig, apPassword) + sizeof(HubConfig::apPassword);
+constexpr size_t CONFIG_V2_CHECKSUM = (CONFIG_V2_BODY + 3) & ~(size_t)3;
+
+bool migrateConfigV2(HubConfig& c) {
+    uint8_t  buf[sizeof(HubConfig)];
+    size_t   len = g_prefs.getBytesLength("cfg");
+    uint16_t version, size;
+    uint32_t sum;
+    if (len < CONFIG_V2_CHECKSUM + sizeof(sum) || len > sizeof(buf) ||
+        g_prefs.getBytes("cfg", buf, len) != len) {
+        return false;
+    }
+    memcpy(&version, buf, sizeof(version));
+    memcpy(&size, buf + sizeof(version), sizeof(size));
+    memcpy(&sum, buf + CONFIG_V2_CHECKSUM, sizeof(sum));
+    if (version != 2 || size != len || sum != fnv1a(buf, CONFIG_V2_CHECKSUM)) {
+        return false;
+    }
+    memcpy(&c, buf, CONFIG_V2_BODY);
+    return true;
+}
+
+// 戻り値 false = 保存済みの設定が無く既定値を使った
+bool loadConfig() {
+    g_prefs.begin("hubcfg", false);
+
+    HubConfig c;
+    if (g_prefs.getBytesLength("cfg") == sizeof(c) &&
+        g_prefs.getBytes("cfg", &c, sizeof(c)) == sizeof(c) &&
+        c.size == sizeof(c) && c.checksum == configChecksum(c)) {
+        if (c.version == 1) {
+            // v1 の既定値（= 旧上限 32 件）のままなら新しい既定値へ
+            if (c.logCapacity == 32) c.logCapacity = LOG_CAPACITY_MAX;
+            saveConfig(c);
+        }
+        if (c.version == CONFIG_VERSION && c.logCapacity > LOG_CAPACITY_MAX) {
+            c.logCapacity = LOG_CAPACITY_MAX;   // 上限を下げた版からの読み込み
+            saveConfig(c);
+        }
+        if (c.version == CONFIG_VERSION) {
+            g_cfg = c;
+            return true;
+        }
+    }
+
+    g_cfg = defaultConfig();
+    if (migrateConfigV2(g_cfg)) {
+        saveConfig(g_cfg);
+        return true;
+    }
+    bool migrated = migrateLegacyConfig(g_cfg);
+    saveConfig(g_cfg);
+    return migrated;
+}
+
+// 取り込みが使う設定（記録しきい値・送信枠の数）を g_ingest へ渡す
+void applyIngestConfig() {
+    g_ingest.setConfig({ g_cfg.logDeltaT, g_cfg.logDeltaH, g_cfg.logDeltaP, g_cfg.publishSlots });
+}
+
+// ======================================================================
+//  時計
+//   RTC は起動時と 1 時間ごと（serviceClock, 秒の変わり目を待つ間だけ続けて）に読み、
+//   それ以外は esp_timer から進めたエポック秒を使う
+// ======================================================================
+EpochClock g_clock;
+
+// RTC を読んでエポック秒にする（読めない・不正な日付は false）
+bool readRtcEpoch(uint32_t& epoch) {
+    auto dt = M5.Rtc.getDateTime();  // rtc_datetime_t
+
+    EpochClock::Civil c = {
+        (int)dt.date.year,
+        (uint8_t)dt.date.month,
+        (uint8_t)dt.date.date,
+        (uint8_t)dt.time.hours,
+        (uint8_t)dt.time.minutes,
+        (uint8_t)dt.time.seconds,
+    };
+    epoch = EpochClock::toEpoch(c);
+    return epoch != 0;
+}
+
+// 秒の変わり目を待っている間、RTC を 1 回読む（合わせたら true）
+bool pollRtcEdge() {
+    uint32_t epoch;
+    if (!readRtcEpoch(epoch)) {
+        g_clock.cancelEdge();
+        Serial.println("[RTC] invalid date, clock not synced");
+        return false;
+    }
+    if (!g_clock.onRtcRead(epoch, esp_timer_get_time())) {
+        return false;
+    }
+    if (g_clock.lastCorrection()) {
+        Serial.printf("[RTC] resync: corrected %+ld s\n", (long)g_clock.lastCorrection());
+    }
+    return true;
+}
+
+// RTC の秒の変わり目で合わせる。wait = true は変わるまで待つ（最大 1.5 秒。起動時用）、
+// false は loop の serviceClock で読み続けて合わせる（それまでは今の時計のまま）
+void syncClockFromRtc(bool step, bool wait) {
+    g_clock.beginEdge(step);
+    while (g_clock.edgePending() && !pollRtcEdge() && wait) {
+        delay(2);
+    }
+}
+
+void serviceClock() {
+    if (g_clock.edgePending()) {
+        pollRtcEdge();
+    } else if (g_clock.needsResync(esp_timer_get_time())) {
+        syncClockFromRtc(false, false);
+    }
+}
+
+uint32_t nowEpoch() {
+    return g_clock.now(esp_timer_get_time());
+}
+
+// 現在時刻 → "YYYY/MM/DD HH:MM:SS"
+void getCurrentDatetimeString(char* buf, size_t len) {
+    EpochClock::format(nowEpoch(), buf, len);
+}
+
+// ======================================================================
+//  LittleFS: 表情 / LED ルール
+//   /rules.txt が無い・壊れている → 設定から既定ルールを生成
+// ======================================================================
+char g_rulesText[2048];   // 読み書き・解析の作業領域
+
+void loadRules() {
+    bool ok = false;
+
+    if (LittleFS.exists(RULES_FILE_PATH)) {
+        File f = LittleFS.open(RULES_FILE_PATH, FILE_READ);
+        if (f) {
+            size_t n = f.readBytes(g_rulesText, sizeof(g_rulesText) - 1);
+            g_rulesText[n] = '\0';
+            f.close();
+
+            ExprRule rules[RuleTable::MaxRules];
+            size_t   count = 0;
+            float    hyst[RULE_AXIS_COUNT];
+            memcpy(hyst, g_ruleHyst, sizeof(hyst));
+            char     err[64];
+            if (parseRulesText(g_rulesText, rules, count, hyst, err, sizeof(err))) {
+                memcpy(g_rules, rules, sizeof(ExprRule) * count);
+                memcpy(g_ruleHyst, hyst, sizeof(hyst));
+                g_ruleCount   = count;
+                g_rulesCustom = true;
+                ok = true;
+            } else {
+                Serial.printf("[Rules] %s: %s\n", RULES_FILE_PATH, err);
+            }
+        }
+    }
+
+    if (!ok) {
+        buildDefaultRules();
+    }
+    compileRules();
+}
+
+bool saveRulesToFS() {
+    size_t n = formatRulesText(g_rulesText, sizeof(g_rulesText));
+    File f = LittleFS.open(RULES_FILE_PATH, FILE_WRITE);
+    if (!f) return false;
+    f.write((const uint8_t*)g_rulesText, n);
+    f.close();
+    return true;
+}
+
+// ======================================================================
+//  校正: NVS 読み書き / 適用
+// ======================================================================
+uint32_t calChecksum(const CalTable& c) {
+    return fnv1a(&c, offsetof(CalTable, checksum));
+}
+
+bool saveCal() {
+    g_cal.version  = CAL_VERSION;
+    g_cal.checksum = calChecksum(g_cal);
+    return g_prefs.putBytes("cal", &g_cal, sizeof(g_cal)) == sizeof(g_cal);
+}
+
+// 版 1 の表（CAL_V1_DEVICES 台）
+struct CalTableV1 {
+    uint16_t  version;
+    uint16_t  epoch;
+    DeviceCal dev[CAL_V1_DEVICES];
+    uint32_t  checksum;
+};
+
+void loadCal() {
+    size_t len = g_prefs.getBytesLength("cal");
+    if (len == sizeof(g_cal) && g_prefs.getBytes("cal", &g_cal, sizeof(g_cal)) == sizeof(g_cal) &&
+        g_cal.version == CAL_VERSION && g_cal.checksum == calChecksum(g_cal)) {
+        return;
+    }
+    memset(&g_cal, 0, sizeof(g_cal));
+    CalTableV1 v1;
+    if (len == sizeof(v1) && g_prefs.getBytes("cal", &v1, sizeof(v1)) == sizeof(v1) &&
+        v1.version == 1 && v1.checksum == fnv1a(&v1, offsetof(CalTableV1, checksum))) {
+        g_cal.epoch = v1.epoch;   // 世代はそのまま（ログの校正世代と合わせる）
+        memcpy(g_cal.dev, v1.dev, sizeof(v1.dev));
+    }
+    saveCal();
+}
+
+const DeviceCal* findDeviceCal(uint32_t device) {
+    if (!device) return nullptr;
+    for (const auto& d : g_cal.dev) {
+        if (d.device[0] && d.deviceHash == device) return &d;
+    }
+    return nullptr;
+}
+
+// 生値 → 校正後（校正の無いデバイスは温度オフセットだけ）
+void applyCal(uint32_t device, float rawT, float rawH, float rawP,
+              float& t, float& h, float& p) {
+    const DeviceCal* c = findDeviceCal(device);
+    if (c) {
+        t = rawT * c->t.gain + c->t.offset;
+        h = rawH * c->h.gain + c->h.offset;
+        p = rawP * c->p.gain + c->p.offset;
+    } else {
+        t = rawT;
+        h = rawH;
+        p = rawP;
+    }
+    t += g_cfg.tempOffset;
+    h = constrain(h, 0.0f, 100.0f);
+}
+
+// 校正を変えたら呼ぶ：世代を進めて背景の再計算をやり直す
+void bumpCalEpoch() {
+    g_cal.epoch++;
+    saveCal();
+    g_recalCursor = 0;
+    markAllLogsDirty();   // 温度が変わるので要約も読み直す
+}
+
+// ======================================================================
+//  ログの校正後の値（遅延計算）
+// ======================================================================
+void materializeLog(EnvLogEntry& e) {
+    applyCal(e.device, e.rawTemperature, e.rawHumidity, e.rawPressure,
+             e.temperature, e.humidity, e.pressure);
+
+    DerivedValues v;
+    g_ingest.derived().compute(e.temperature, e.humidity, v);
+    e.dewPoint    = v.dewPoint;
+    e.heatIndex   = v.heatIndex;
+    e.absHumidity = v.absHumidity;
+    e.viewEpoch   = g_cal.epoch;
+}
+
+// ======================================================================
+//  ログ領域の操作（論理番号 0 = 最古）
+// ======================================================================
+constexpr size_t LOG_COLUMN_BYTES = sizeof(uint32_t) + LF_COUNT * sizeof(int16_t);   // 1 件あたり
+
+// 行と列をまとめて確保する（どれか 1 つでも失敗したら全部返す）
+bool allocLogStore(size_t slots, uint32_t caps) {
+    g_logs    = (EnvLogEntry*)heap_caps_malloc(slots * sizeof(EnvLogEntry), caps);
+    g_colTime = (uint32_t*)heap_caps_malloc(slots * sizeof(uint32_t), caps);
+    bool ok = g_logs && g_colTime;
+    for (auto& c : g_col) {
+        c  = (int16_t*)heap_caps_malloc(slots * sizeof(int16_t), caps);
+        ok = ok && c;
+    }
+    if (ok) {
+        g_logSlots = slots;
+        return true;
+    }
+    heap_caps_free(g_logs);
+    heap_caps_free(g_colTime);
+    for (auto& c : g_col) heap_caps_free(c);
+    g_logs    = nullptr;
+    g_colTime = nullptr;
+    for (auto& c : g_col) c = nullptr;
+    g_logSlots = 0;
+    return false;
+}
+
+bool initLogStore() {
+    g_logsInPsram = psramFound() &&
+                    allocLogStore(LOG_CAPACITY_MAX, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!g_logsInPsram) {
+        allocLogStore(LOG_SLOTS_NO_PSRAM, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    memset(g_logBlocks, 0, sizeof(g_logBlocks));
+    g_logHead  = 0;
+    g_logCount = 0;
+    return g_logs != nullptr;
+}
+
+// 設定の容量と確保できた件数の小さい方
+size_t logCapacity() {
+    return (g_cfg.logCapacity < g_logSlots) ? g_cfg.logCapacity : g_logSlots;
+}
+
+size_t logPhys(size_t i) {
+    size_t p = g_logHead + i;
+    return (p >= g_logSlots) ? p - g_logSlots : p;
+}
+
+// 校正後の値を計算せずに触る（CSV 書き出し・並べ替え用）
+EnvLogEntry& logSlot(size_t i) {
+    return g_logs[logPhys(i)];
+}
+
+void markLogDirty(size_t phys) {
+    g_logBlocks[phys / LOG_BLOCK].dirty = true;
+}
+
+void markAllLogsDirty() {
+    for (auto& b : g_logBlocks) b.dirty = true;
+}
+
+void storeLogColumns(size_t p, const EnvLogEntry& e) {
+    g_colTime[p]   = e.time;
+    g_col[LF_T][p] = ColumnScan::encode(e.temperature, ColumnScan::T_SCALE);
+    g_col[LF_H][p] = ColumnScan::encode(e.humidity,    ColumnScan::H_SCALE);
+    g_col[LF_P][p] = ColumnScan::encode(e.pressure,    ColumnScan::P_SCALE);
+}
+
+// 表示・集計・API は必ずここを通す
+const EnvLogEntry& logAt(size_t i) {
+    size_t       p = logPhys(i);
+    EnvLogEntry& e = g_logs[p];
+    if (e.viewEpoch != g_cal.epoch) {
+        materializeLog(e);
+        storeLogColumns(p, e);
+    }
+    return e;
+}
+
+// 最古を捨てる
+void logDropOldest() {
+    if (!g_logCount) return;
+    if (g_logs[g_logHead].deleted) {
+        g_logBlocks[g_logHead / LOG_BLOCK].dead--;
+        g_logDead--;
+    }
+    markLogDirty(g_logHead);
+    g_logHead = (g_logHead + 1 == g_logSlots) ? 0 : g_logHead + 1;
+    g_logCount--;
+    if (g_recalCursor) g_recalCursor--;
+}
+
+// 末尾に追加（容量いっぱいなら最古を捨てる）
+void logPush(const EnvLogEntry& e) {
+    size_t cap = logCapacity();
+    if (!cap) return;
+    while (g_logCount >= cap) logDropOldest();
+
+    size_t p = logPhys(g_logCount);
+    g_logs[p] = e;
+    g_logs[p].deleted = false;
+    storeLogColumns(p, e);
+    g_logCount++;
+
+    // 空き位置への追記なら要約に足すだけ（dirty なら集計時に読み直す）
+    LogBlockSummary& b = g_logBlocks[p / LOG_BLOCK];
+    if (!b.dirty) {
+        if (!b.count) {
+            b.timeMin  = b.timeMax = e.time;
+            b.colEpoch = g_cal.epoch;
+            for (uint8_t f = 0; f < LF_COUNT; ++f) {
+                b.min[f] = b.max[f] = g_col[f][p];
+                b.sum[f] = 0;
+            }
+        }
+        if (e.time < b.timeMin) b.timeMin = e.time;
+        if (e.time > b.timeMax) b.timeMax = e.time;
+        for (uint8_t f = 0; f < LF_COUNT; ++f) {
+            int16_t v = g_col[f][p];
+            if (v < b.min[f]) b.min[f] = v;
+            if (v > b.max[f]) b.max[f] = v;
+            b.sum[f] += v;
+        }
+        b.count++;
+    }
+}
+
+// 物理位置 src の行と列を dst へ写す
+void logCopySlot(size_t dst, size_t src) {
+    g_logs[dst]    = g_logs[src];
+    g_colTime[dst] = g_colTime[src];
+    for (auto c : g_col) c[dst] = c[src];
+    markLogDirty(dst);
+}
+
+// 削除印を付ける（行は compactLogStore() でまとめて詰める）。false = 既に印がある
+bool logMarkDeleted(size_t index) {
+    size_t p = logPhys(index);
+    if (g_logs[p].deleted) return false;
+    g_logs[p].deleted = true;
+    LogBlockSummary& b = g_logBlocks[p / LOG_BLOCK];
+    b.dead++;
+    b.dirty = true;
+    if (!g_logDead) g_logDeadMs = millis();
+    g_logDead++;
+    return true;
+}
+
+// 物理位置 [p, p + n)（1 ブロック内）の生きている行の連なりごとに fn(位置, 件数)。
+//   削除印の無いブロックは行を見ずに 1 回で済ませる
+template <typename Fn>
+void forLiveRuns(size_t p, size_t n, Fn fn) {
+    if (!g_logBlocks[p / LOG_BLOCK].dead) {
+        if (n) fn(p, n);
+        return;
+    }
+    size_t end = p + n;
+    while (p < end) {
+        while (p < end && g_logs[p].deleted) ++p;
+        size_t run = p;
+        while (p < end && !g_logs[p].deleted) ++p;
+        if (p > run) fn(run, p - run);
+    }
+}
+
+// 削除印の付いた行を 1 回の走査でまとめて詰める（最初の印より前の行は動かさない）。
+//   戻り値 = 取り除いた件数
+size_t compactLogStore() {
+    if (!g_logDead) return 0;
+
+    // 最初の印を探す（印の無いブロックは飛ばす）
+    size_t first = 0;
+    while (first < g_logCount) {
+        size_t p   = logPhys(first);
+        size_t b   = p / LOG_BLOCK;
+        size_t end = (b + 1) * LOG_BLOCK;
+        if (end > g_logSlots) end = g_logSlots;
+        size_t n = end - p;
+        if (n > g_logCount - first) n = g_logCount - first;
+        if (g_logBlocks[b].dead) {
+            while (n && !g_logs[logPhys(first)].deleted) {
+                ++first;
+                --n;
+            }
+            if (n) break;
+        }
+        first += n;
+    }
+
+    size_t w = first, selected = g_logSelected;
+    for (size_t r = first; r < g_logCount; ++r) {
+        size_t p = logPhys(r);
+        if (g_logs[p].deleted) {
+            if (r < g_logSelected) selected--;
+            continue;
+        }
+        logCopySlot(logPhys(w++), p);
+    }
+    for (size_t r = w; r < g_logCount; ++r) markLogDirty(logPhys(r));
+
+    size_t removed = g_logCount - w;
+    g_logCount = w;
+    if (g_recalCursor > first) g_recalCursor = first;
+    g_logSelected = (selected < g_logCount) ? selected : (g_logCount ? g_logCount - 1 : 0);
+    for (auto& b : g_logBlocks) b.dead = 0;
+    g_logDead = 0;
+    return removed;
+}
+
+// 先頭（最古の前）に追加。起動後の読み込みで古いログを後から足すとき用
+bool logPushFront(const EnvLogEntry& e) {
+    if (g_logCount >= logCapacity()) return false;
+    g_logHead = g_logHead ? g_logHead - 1 : g_logSlots - 1;
+    g_logs[g_logHead] = e;
+    g_logs[g_logHead].deleted = false;
+    storeLogColumns(g_logHead, e);
+    markLogDirty(g_logHead);
+    if (g_logCount) g_logSelected++;
+    g_logCount++;
+    if (g_recalCursor) g_recalCursor++;   // 論理番号が 1 つずれる（足した行は計算済み）
+    return true;
+}
+
+// 時刻が t より後の最初の論理番号（ログはほぼ時刻順。列だけで二分探索）
+size_t logUpperBound(uint32_t t) {
+    size_t lo = 0, hi = g_logCount;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (g_colTime[logPhys(mid)] <= t) lo = mid + 1;
+        else                              hi = mid;
+    }
+    return lo;
+}
+
+// 同じ時刻・同じ生値の行が既にあるか（ハブ再起動で取り込み済みの seq を忘れた場合）
+bool logHasRow(const EnvLogEntry& e) {
+    for (size_t i = logUpperBound(e.time); i > 0 && g_colTime[logPhys(i - 1)] == e.time; --i) {
+        const EnvLogEntry& o = logSlot(i - 1);
+        if (o.device == e.device &&
+            fabsf(o.rawTemperature - e.rawTemperature) < 0.005f &&
+            fabsf(o.rawHumidity - e.rawHumidity) < 0.005f &&
+            fabsf(o.rawPressure - e.rawPressure) < 0.05f) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 時刻の昇順に並んだ rows[0..k) を時刻順の位置へまとめて差し込む（後送りの取り込み用）。
+//   差し込む位置より後ろの行（tail 件）を後ろから 1 回ずつ動かすだけの併合で、
+//   1 件ずつ挿入するより移動が少ない。後送りは「途切れていた間」の行なので
+//   tail は再接続後に届いた数件で済む。
+//   容量を超える分は最古から捨てる。戻り値 = 最初に差し込んだ論理番号（tail = 元の件数 - これ）
+//   行を動かすので、削除印は先に compactLogs() で詰めておく。
+size_t logMergeSorted(const EnvLogEntry* rows, size_t k, size_t& tail) {
+    size_t cap = logCapacity();
+    tail = 0;
+    if (!k || !cap) return g_logCount;
+    if (k > cap) {
+        rows += k - cap;   // 入りきらない古い方は捨てる
+        k     = cap;
+    }
+    while (g_logCount + k > cap) logDropOldest();
+
+    size_t pos      = logUpperBound(rows[0].time);
+    size_t oldCount = g_logCount;
+    tail = oldCount - pos;
+
+    size_t i = oldCount, j = k, w = oldCount + k;
+    g_logCount = w;
+    while (j > 0) {
+        if (i > pos && g_colTime[logPhys(i - 1)] > rows[j - 1].time) {
+            logCopySlot(logPhys(w - 1), logPhys(i - 1));
+            --i;
+        } else {
+            size_t p = logPhys(w - 1);
+            g_logs[p] = rows[j - 1];
+            g_logs[p].deleted = false;
+            storeLogColumns(p, rows[j - 1]);
+            markLogDirty(p);
+            --j;
+        }
+        --w;
+    }
+
+    if (g_recalCursor > pos) g_recalCursor = pos;   // 動かした行は校正世代を見直す
+    if (g_logSelected >= pos && oldCount) g_logSelected += k;
+    return pos;
+}
+
+void logClear() {
+    g_logHead     = 0;
+    g_logCount    = 0;
+    g_logDead     = 0;
+    g_recalCursor = 0;
+    memset(g_logBlocks, 0, sizeof(g_logBlocks));
+    g_ingest.forgetLogged();
+}
+
+// 物理位置 [b0, b1) のうち生きている区間（リングの折り返しで最大 2 つ）
+size_t liveRanges(size_t b0, size_t b1, size_t from[2], size_t to[2]) {
+    size_t n    = 0;
+    size_t end1 = g_logHead + g_logCount;
+    size_t segA0 = g_logHead, segA1 = (end1 < g_logSlots) ? end1 : g_logSlots;
+    size_t segB1 = (end1 > g_logSlots) ? end1 - g_logSlots : 0;
+    size_t lo = (segA0 > b0) ? segA0 : b0, hi = (segA1 < b1) ? segA1 : b1;
+    if (lo < hi) { from[n] = lo; to[n] = hi; ++n; }
+    hi = (segB1 < b1) ? segB1 : b1;
+    if (b0 < hi) { from[n] = b0; to[n] = hi; ++n; }
+    return n;
+}
+
+// ブロックの要約を列から読み直す（校正世代が古ければ先に行から列を作り直す）
+void rebuildLogBlock(size_t b) {
+    LogBlockSummary& s = g_logBlocks[b];
+    size_t b0 = b * LOG_BLOCK;
+    size_t b1 = (b0 + LOG_BLOCK < g_logSlots) ? b0 + LOG_BLOCK : g_logSlots;
+    size_t from[2], to[2];
+    size_t ranges = liveRanges(b0, b1, from, to);
+
+    if (s.colEpoch != g_cal.epoch) {
+        for (size_t r = 0; r < ranges; ++r) {
+            for (size_t p = from[r]; p < to[r]; ++p) {
+                logAt((p >= g_logHead) ? p - g_logHead : p + g_logSlots - g_logHead);
+            }
+        }
+    }
+
+    uint16_t dead = s.dead;
+    s = LogBlockSummary();
+    s.dead     = dead;
+    s.colEpoch = g_cal.epoch;
+    s.timeMin  = UINT32_MAX;
+    ColumnScan::Agg agg[LF_COUNT];
+    for (auto& a : agg) a.clear();
+    for (size_t r = 0; r < ranges; ++r) {
+        forLiveRuns(from[r], to[r] - from[r], [&](size_t p, size_t n) {
+            ColumnScan::timeRange(g_colTime + p, n, s.timeMin, s.timeMax);
+            for (uint8_t f = 0; f < LF_COUNT; ++f) {
+                ColumnScan::aggregateCounted(g_col[f] + p, n, agg[f]);
+            }
+            s.count += (uint16_t)n;
+        });
+    }
+    for (uint8_t f = 0; f < LF_COUNT; ++f) {
+        s.min[f] = (int16_t)agg[f].min;
+        s.max[f] = (int16_t)agg[f].max;
+        s.sum[f] = (int32_t)agg[f].sum;
+    }
+}
+
+// 集計前に要約を最新にする
+const LogBlockSummary& logBlock(size_t b) {
+    if (g_logBlocks[b].dirty || g_logBlocks[b].colEpoch != g_cal.epoch) rebuildLogBlock(b);
+    return g_logBlocks[b];
+}
+
+// 全ログの T/H/P の件数・最小・最大・合計（ブロック要約から）
+size_t logSummary(ColumnScan::Agg out[LF_COUNT]) {
+    for (uint8_t f = 0; f < LF_COUNT; ++f) out[f].clear();
+    size_t blocks = (g_logSlots + LOG_BLOCK - 1) / LOG_BLOCK;
+    for (size_t b = 0; b < blocks; ++b) {
+        const LogBlockSummary& s = logBlock(b);
+        if (!s.count) continue;
+        for (uint8_t f = 0; f < LF_COUNT; ++f) {
+            ColumnScan::Agg a = { s.count, s.min[f], s.max[f], s.sum[f] };
+            out[f].merge(a);
+        }
+    }
+    return out[LF_T].count;
+}
+
+// 論理番号 [from, to) の T/H/P の集計（列を直接読む）
+size_t logRangeSummary(size_t from, size_t to, ColumnScan::Agg out[LF_COUNT]) {
+    for (uint8_t f = 0; f < LF_COUNT; ++f) out[f].clear();
+    if (to > g_logCount) to = g_logCount;
+    if (from >= to) return 0;
+
+    // ブロック境界で区切って読む（先に古いブロックの列を今の校正にそろえる）
+    for (size_t i = from; i < to; ) {
+        size_t p   = logPhys(i);
+        size_t b   = p / LOG_BLOCK;
+        size_t end = (b + 1) * LOG_BLOCK;
+        if (end > g_logSlots) end = g_logSlots;
+        size_t n = end - p;
+        if (n > to - i) n = to - i;
+        logBlock(b);
+        forLiveRuns(p, n, [&](size_t q, size_t m) {
+            for (uint8_t f = 0; f < LF_COUNT; ++f) {
+                ColumnScan::aggregateCounted(g_col[f] + q, m, out[f]);
+            }
+        });
+        i += n;
+    }
+    return out[LF_T].count;
+}
+
+// 問い合わせをログ順（古い順）に流す。ブロック単位でゾーンマップ → 要約 → 列の順に試す
+void runLogQuery(LogQuery& q) {
+    for (size_t i = 0; i < g_logCount && !q.full(); ) {
+        size_t p   = logPhys(i);
+        size_t b   = p / LOG_BLOCK;
+        size_t end = (b + 1) * LOG_BLOCK;
+        if (end > g_logSlots) end = g_logSlots;
+        size_t n = end - p;
+        if (n > g_logCount - i) n = g_logCount - i;
+
+        const LogBlockSummary& s = logBlock(b);
+        if (!q.prune(s.timeMin, s.timeMax, s.min, s.max) &&
+            !(!s.dead && n == s.count &&
+              q.fold(s.timeMin, s.timeMax, s.count, s.min, s.max, s.sum))) {
+            forLiveRuns(p, n, [&](size_t r, size_t m) {
+                const int16_t* const v[LF_COUNT] = { g_col[LF_T] + r, g_col[LF_H] + r, g_col[LF_P] + r };
+                q.scan(g_colTime + r, v, m);
+            });
+        }
+        i += n;
+    }
+    q.finish();
+}
+
+// 読み出しコストの計測（起動時に 1 回。ログの中身は変えない）
+void measureLogAccess() {
+    if (!g_logSlots) return;
+    const size_t N = (g_logSlots < 4096) ? g_logSlots : 4096;
+    volatile float sink = 0.0f;
+
+    uint32_t t0 = micros();
+    for (size_t i = 0; i < N; ++i) sink = sink + g_logs[i].rawTemperature;
+    uint32_t t1 = micros();
+    uint32_t x = 2463534242u;
+    for (size_t i = 0; i < N; ++i) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;   // xorshift
+        sink = sink + g_logs[x % g_logSlots].rawTemperature;
+    }
+    uint32_t t2 = micros();
+
+    EnvLogEntry local[16];
+    memset(local, 0, sizeof(local));
+    for (size_t i = 0; i < N; ++i) sink = sink + local[i & 15].rawTemperature;
+    uint32_t t3 = micros();
+
+    g_logReadNsSeq  = (t1 - t0) * 1000.0f / N;
+    g_logReadNsRand = (t2 - t1) * 1000.0f / N;
+    g_logReadNsSram = (t3 - t2) * 1000.0f / N;
+}
+
+// loop() から呼ぶ：校正変更後のログを少しずつ計算し直す（受信処理を止めない）
+void serviceRecalibration() {
+    size_t end = g_recalCursor + RECAL_BATCH;
+    for (; g_recalCursor < g_logCount && g_recalCursor < end; ++g_recalCursor) {
+        logAt(g_recalCursor);
+    }
+}
+
+// 残り件数（背景の再計算の位置から。表示のたびに全件は見ない）
+size_t recalPending() {
+    return (g_recalCursor < g_logCount) ? g_logCount - g_recalCursor : 0;
+}
+
+// ======================================================================
+//  LittleFS: ログの読み書き
+//   CSV: rawT,rawH,rawP,time(エポック秒),device(hex),calEpoch[,pressureTrend]
+//   旧形式（temperature,humidity,pressure,datetime[,pressureTrend]、校正後の値）は
+//   今の温度オフセットを引いて生値とみなし、読み込み後に新形式で書き直す。
+//   time の位置に "YYYY/MM/DD HH:MM:SS" が入っている行も同様に変換して書き直す
+// ======================================================================
+void printLogLine(File& f, const EnvLogEntry& e) {
+    f.printf("%.2f,%.2f,%.2f,%lu,%08x,%u",
+             e.rawTemperature, e.rawHumidity, e.rawPressure, (unsigned long)e.time,
+             (unsigned)e.device, (unsigned)e.calEpoch);
+    if (!isnan(e.pressureTrend)) {
+        f.printf(",%.2f", e.pressureTrend);
+    }
+    f.print("\n");
+}
+
+// 1 行を解析する（空行・壊れた行は false）。旧形式なら migrated を立てる
+bool parseLogLine(const char* line, EnvLogEntry& e, bool& migrated) {
+    float    t, h, p, trend = NAN;
+    char     timestr[24] = {0};
+    unsigned device = 0, epoch = 0;
+
+    int n = sscanf(line, "%f,%f,%f,%23[^,\n],%8x,%u,%f",
+                   &t, &h, &p, timestr, &device, &epoch, &trend);
+    if (n >= 6) {
+        e.device   = device;
+        e.calEpoch = (uint16_t)epoch;
+    } else {
+        trend = NAN;
+        if (sscanf(line, "%f,%f,%f,%23[^,\n],%f",
+                   &t, &h, &p, timestr, &trend) < 4) {
+            return false;
+        }
+        t -= g_cfg.tempOffset;
+        e.device   = 0;
+        e.calEpoch = g_cal.epoch;
+        migrated   = true;
+    }
+
+    e.rawTemperature = t;
+    e.rawHumidity    = h;
+    e.rawPressure    = p;
+    e.pressureTrend  = trend;
+    e.anomalyFlags   = 0;
+    if (strchr(timestr, '/')) {
+        e.time   = EpochClock::parse(timestr);
+        migrated = true;
+    } else {
+        e.time = (uint32_t)strtoul(timestr, nullptr, 10);
+    }
+    materializeLog(e);
+    return true;
+}
+
+// ======================================================================
+//  ログの遅延読み込み
+//   - 起動時は CSV の末尾 LOG_TAIL_BYTES だけ読む（最新の数百件。起動時間が
+//     ログの長さに依らない）。
+//   - 残りは loop() の serviceLogLoad() で末尾側から LOG_PAGE_BYTES ずつ
+//     さかのぼって読み、リングの先頭（最古の前）へ足していく。
+//     容量に達したらそれより古い行は読まない（ファイルには残る）。
+//   - 全件が要る操作（CSV の書き直し・古い期間の問い合わせ・古いページの表示）は
+//     その場で必要なところまで読む（finishLogLoad / ensureLogRows）。
+// ======================================================================
+constexpr size_t   LOG_TAIL_BYTES      = 32768;   // 起動時に読む末尾（約 600 件）
+constexpr size_t   LOG_PAGE_BYTES      = 2048;    // さかのぼり読み 1 回分
+constexpr uint32_t LOG_LOAD_BUDGET_US  = 4000;    // loop 1 回あたりの読み込み時間
+
+struct LogLoadState {
+    uint32_t unread;       // ファイル先頭からこの位置までが未読（0 = 読み終わり）
+    bool     migrated;     // 旧形式の行があった（読み終わったら書き直す）
+    uint32_t tailRows;     // 起動時に読んだ件数
+    uint32_t tailMs;       // 起動時の読み込みにかかった時間
+    uint32_t doneMs;       // 全部読み終わった時刻（起動からの ms, 0 = 読み込み中）
+};
+
+LogLoadState g_logLoad = {};
+char         g_logPageBuf[LOG_PAGE_BYTES + 1];
+
+bool logLoadPending() {
+    return g_logLoad.unread > 0;
+}
+
+void logLoadDone() {
+    g_logLoad.unread = 0;
+    if (!g_logLoad.doneMs) g_logLoad.doneMs = millis();
+}
+
+// 起動時：末尾だけ読む
+bool loadLogTail() {
+    uint32_t t0 = millis();
+    logClear();
+    g_logSelected    = 0;
+    g_logLoad        = LogLoadState();
+
+    if (!LittleFS.exists(LOG_FILE_PATH)) {
+        logLoadDone();
+        return false;
+    }
+    File f = LittleFS.open(LOG_FILE_PATH, FILE_READ);
+    if (!f) {
+        logLoadDone();
+        return false;
+    }
+
+    size_t size  = f.size();
+    size_t start = (size > LOG_TAIL_BYTES) ? size - LOG_TAIL_BYTES : 0;
+    char   line[96];
+    if (start) {
+        f.seek(start);
+        start += f.readBytesUntil('\n', line, sizeof(line) - 1) + 1;   // 途中から始まる行は前の読み込みへ
+    }
+
+    while (f.available()) {
+        size_t len = f.readBytesUntil('\n', line, sizeof(line) - 1);
+        while (len && (line[len - 1] == '\r' || line[len - 1] == ' ')) --len;
+        line[len] = '\0';
+        if (len == 0) continue;
+
+        EnvLogEntry e;
+        if (parseLogLine(line, e, g_logLoad.migrated)) logPush(e);
+    }
+    f.close();
+
+    g_logLoad.unread   = (uint32_t)start;
+    g_logLoad.tailRows = (uint32_t)g_logCount;
+    g_logLoad.tailMs   = millis() - t0;
+    if (!start) logLoadDone();
 
     if (g_logCount > 0) {
         g_logSelected = g_logCount - 1;
     }
-    return (g_logCount > 0);
+    return (g_logCount > 0);
+}
+
+// 未読部分の末尾 LOG_PAGE_BYTES を読み、新しい行から順に先頭へ足す
+void loadLogPage(File& f) {
+    uint32_t end   = g_logLoad.unread;
+    uint32_t start = (end > LOG_PAGE_BYTES) ? end - LOG_PAGE_BYTES : 0;
+    f.seek(start);
+    size_t len = f.read((uint8_t*)g_logPageBuf, end - start);
+    g_logPageBuf[len] = '\0';
+
+    // 先頭の途中から始まる行は次の回へ
+    size_t first = 0;
+    if (start) {
+        char* nl = (char*)memchr(g_logPageBuf, '\n', len);
+        first = nl ? (size_t)(nl - g_logPageBuf) + 1 : len;
+    }
+
+    // 後ろから 1 行ずつ
+    size_t stop = len;
+    while (stop > first) {
+        size_t b = stop;
+        while (b > first && g_logPageBuf[b - 1] != '\n') --b;
+        size_t e = stop;
+        while (e > b && (g_logPageBuf[e - 1] == '\n' || g_logPageBuf[e - 1] == '\r' ||
+                         g_logPageBuf[e - 1] == ' ')) {
+            --e;
+        }
+        g_logPageBuf[e] = '\0';
+        stop = b ? b - 1 : 0;
+        if (e == b) continue;
+
+        EnvLogEntry entry;
+        if (parseLogLine(g_logPageBuf + b, entry, g_logLoad.migrated) && !logPushFront(entry)) {
+            logLoadDone();   // 容量いっぱい：これより古い行は読まない
+            return;
+        }
+    }
+
+    if (!start) {
+        logLoadDone();
+        return;
+    }
+    // 改行が無い（1 行が LOG_PAGE_BYTES を超える）ことは無いが、止まらないよう進める
+    g_logLoad.unread = (first < len) ? start + (uint32_t)first : start;
+}
+
+// 時間予算 budgetUs（0 = 無制限）か件数 wantRows に達するまで読む
+void runLogLoad(uint32_t budgetUs, size_t wantRows) {
+    if (!logLoadPending()) return;
+    File f = LittleFS.open(LOG_FILE_PATH, FILE_READ);
+    if (!f) {
+        logLoadDone();
+        return;
+    }
+    uint32_t t0 = micros();
+    while (logLoadPending() && g_logCount < wantRows &&
+           (!budgetUs || micros() - t0 < budgetUs)) {
+        loadLogPage(f);
+    }
+    f.close();
+
+    if (!logLoadPending() && g_logLoad.migrated) {
+        g_logLoad.migrated = false;
+        rewriteLogsToFS();
+    }
+}
+
+// loop() から呼ぶ：少しずつ古い方へ読み進める
+void serviceLogLoad() {
+    runLogLoad(LOG_LOAD_BUDGET_US, SIZE_MAX);
+}
+
+// 新しい方から rows 件が揃うまで読む（コンソールの古いページ用）
+void ensureLogRows(size_t rows) {
+    runLogLoad(0, rows);
+}
+
+// 全部読む（CSV の書き直し・古い期間の問い合わせの前に）
+void finishLogLoad() {
+    runLogLoad(0, SIZE_MAX);
+}
+
+bool rewriteLogsToFS() {
+    finishLogLoad();   // 未読の古い行を消さない
+    File f = LittleFS.open(LOG_FILE_PATH, FILE_WRITE);
+    if (!f) return false;
+
+    for (size_t i = 0; i < g_logCount; ++i) {
+        if (!logSlot(i).deleted) printLogLine(f, logSlot(i));
+    }
+    f.close();
+    return true;
+}
+
+bool appendLogToFS(const EnvLogEntry& e) {
+    File f = LittleFS.open(LOG_FILE_PATH, FILE_APPEND);
+    if (!f) return false;
+
+    printLogLine(f, e);
+    f.close();
+    return true;
+}
+
+// 差し込み後のログ [from, g_logCount) で CSV の末尾 oldRows 行を書き直す
+//   （ファイル全体は書き直さない。oldRows が多いときだけ全体を書き直す）
+//   書く内容は元の末尾より長いので、上書きすれば古い行は残らない。
+constexpr size_t LOG_TAIL_REWRITE_MAX = 2000;
+
+bool rewriteLogTail(size_t from, size_t oldRows) {
+    if (oldRows > LOG_TAIL_REWRITE_MAX) return rewriteLogsToFS();
+    File f = LittleFS.open(LOG_FILE_PATH, "r+");
+    if (!f) return rewriteLogsToFS();
+
+    // 末尾から oldRows 行ぶんの改行をさかのぼる（最後の改行は行の終わりなので数えない）
+    size_t   size   = f.size();
+    size_t   offset = size;
+    size_t   need   = oldRows + 1;
+    uint32_t end    = (uint32_t)size;
+    while (need && end) {
+        uint32_t start = (end > LOG_PAGE_BYTES) ? end - LOG_PAGE_BYTES : 0;
+        f.seek(start);
+        size_t len = f.read((uint8_t*)g_logPageBuf, end - start);
+        while (len && need) {
+            --len;
+            if (g_logPageBuf[len] == '\n' && --need == 0) offset = start + len + 1;
+        }
+        end = start;
+    }
+    if (need) offset = 0;   // 行が足りない：先頭から
+
+    f.seek((uint32_t)offset);
+    for (size_t i = from; i < g_logCount; ++i) {
+        if (!logSlot(i).deleted) printLogLine(f, logSlot(i));
+    }
+    f.close();
+    return true;
+}
+
+// ======================================================================
+//  ログ追加（変化が小さいときの間引きは HubIngest::logReading()）
+// ======================================================================
+// 間引いた後の 1 行を保存する
+void FirmwareIngestHost::appendLog(const HubIngest::Reading& r) {
+    EnvLogEntry e;
+    e.rawTemperature = r.rawT;
+    e.rawHumidity    = r.rawH;
+    e.rawPressure    = r.rawP;
+    e.device         = r.device;
+    e.calEpoch       = r.calEpoch;
+    e.viewEpoch      = r.calEpoch;
+    e.temperature    = r.t;
+    e.humidity       = r.h;
+    e.pressure       = r.p;
+    e.dewPoint       = r.derived.dewPoint;
+    e.heatIndex      = r.derived.heatIndex;
+    e.absHumidity    = r.derived.absHumidity;
+    e.pressureTrend  = r.trend;
+    e.anomalyFlags   = r.flags;
+    e.time           = r.time ? r.time : nowEpoch();
+
+    logPush(e);
+
+    g_logSelected = (g_logCount > 0) ? (g_logCount - 1) : 0;
+
+    appendLogToFS(e);
+}
+
+// 今の表示値をログへ（手動記録。時刻は押した時刻）
+void logCurrentReading() {
+    HubIngest::Reading r;
+    r.device   = g_lastRaw.device;
+    r.time     = 0;
+    r.rawT     = g_lastRaw.t;
+    r.rawH     = g_lastRaw.h;
+    r.rawP     = g_lastRaw.p;
+    r.t        = g_env.temperature;
+    r.h        = g_env.humidity;
+    r.p        = g_env.pressure;
+    r.calEpoch = g_cal.epoch;
+    r.derived  = g_envDerived;
+    r.trend    = g_envTrend;
+    r.flags    = g_lastSampleFlags;
+    g_ingest.logReading(r);
+}
+
+// ======================================================================
+//  ログ削除 / 全削除
+// ======================================================================
+//   削除は印を付けるだけ。続けて何件消しても論理番号（画面の #）はずれず、
+//   行を詰めて CSV を書き直すのは serviceLogCompaction() でまとめて 1 回。
+//   詰める前に電源が落ちたら、その間に消した行は CSV から戻る。
+constexpr size_t   LOG_COMPACT_BATCH    = 32;      // 印がこれだけ溜まったらすぐ詰める
+constexpr uint32_t LOG_COMPACT_DELAY_MS = 10000;   // 最初の削除からこれだけ待って詰める
+
+// 削除印の付いた行を詰め、CSV を 1 回だけ書き直す
+void compactLogs() {
+    if (!compactLogStore()) return;
+    if (g_logCount == 0 && !logLoadPending()) {
+        LittleFS.remove(LOG_FILE_PATH);
+    } else {
+        rewriteLogsToFS();
+    }
+}
+
+void serviceLogCompaction() {
+    if (!g_logDead) return;
+    if (g_logDead < LOG_COMPACT_BATCH && g_logDead < g_logCount &&
+        millis() - g_logDeadMs < LOG_COMPACT_DELAY_MS) {
+        return;
+    }
+    compactLogs();
+}
+
+void deleteLogAt(size_t index) {
+    if (index >= g_logCount) return;
+    logMarkDeleted(index);
+}
+
+void clearAllLogs() {
+    logClear();
+    g_logSelected      = 0;
+    g_logLoad.migrated = false;
+    logLoadDone();   // 未読の古い行も一緒に消える
+    LittleFS.remove(LOG_FILE_PATH);
+}
+
+// ================================================================
+//  6. I/O層：LED・サーボ・Avatar・サウンド
+// ================================================================
+
+// ======================================================================
+//  LED 初期化
+// ======================================================================
+void initLeds() {
+    bodyStrip.begin();
+    earsStrip.begin();
+
+    bodyStrip.setBrightness(g_cfg.ledBrightness);
+    earsStrip.setBrightness(g_cfg.ledBrightness);
+
+    turnOffAllLeds();
+    g_ledInited = true;
+}
+
+// ======================================================================
+//  サーボ初期化
+// ======================================================================
+void initServo() {
+    if (g_servoAttached) return;
+
+    servoX.setPeriodHertz(50);
+    servoY.setPeriodHertz(50);
+    servoX.attach(SERVO_X_PIN, 500, 2400);
+    servoY.attach(SERVO_Y_PIN, 500, 2400);
+
+    // 暖機再起動なら直前の姿勢から（首を中央へ振り戻さない）
+    if (!g_boot.warm) {
+        g_servoYCurrent = g_cfg.servoYCenter;
+        g_servoYTarget  = g_cfg.servoYCenter;
+    }
+    servoX.write(g_cfg.servoXCenter);
+    servoY.write((int)(g_servoYCurrent + 0.5f));
+    g_nextPoseChangeMs = millis() + random(3000, 7000);
+
+    g_servoAttached = true;
+}
+
+// ======================================================================
+//  ボタン操作音
+// ======================================================================
+void playClickSound() {
+    M5.Speaker.tone(1000, 40);
+}
+
+// ======================================================================
+//  公式風 IDLE モーション
+// ======================================================================
+void updateServoIdle() {
+    if (!g_servoAttached) return;
+    noteLoadGap(g_load.lastServoMs, g_load.servoGapMaxMs, g_load.servoLate, SERVO_GAP_BUDGET_MS);
+
+    unsigned long now = millis();
+
+    const float PI_F    = 3.1415926f;
+    const float PERIOD  = 4.5f;
+    float t = now / 1000.0f;
+    float s = sinf(2.0f * PI_F * t / PERIOD);  // -1〜1
+
+    int yaw = g_cfg.servoXCenter + (int)(g_cfg.servoXAmplitude * s);
+    yaw = constrain(yaw, 0, 180);
+    servoX.write(yaw);
+
+    if (now >= g_nextPoseChangeMs) {
+        static const int offsets[] = { -15, -5, 0, 5, 10 };
+        int idx = random(0, 5);
+        int base = g_cfg.servoYCenter + offsets[idx];
+        base = constrain(base, 40, 140);
+        g_servoYTarget = base;
+
+        unsigned long interval = (unsigned long)random(5000, 12001);
+        g_nextPoseChangeMs = now + interval;
+    }
+
+    g_servoYCurrent += (g_servoYTarget - g_servoYCurrent) * 0.05f;
+    int pitch = (int)(g_servoYCurrent + 0.5f);
+    pitch = constrain(pitch, 0, 180);
+    servoY.write(pitch);
+}
+
+// ======================================================================
+//  Avatar 表情（評価済みのルールを使用）
+//   表情が変わったタイミングで g_requestScream = true にする
+// ======================================================================
+void updateAvatarExpression() {
+    Expression newExpr = g_env.valid ? currentRuleExpression() : Expression::Neutral;
+
+    if (!g_env.valid) {
+        g_lastExpression  = Expression::Neutral;
+        g_exprInitialized = true;
+    } else if (!g_exprInitialized) {
+        // 起動直後は「変化」とみなさない（いきなり鳴かない）
+        g_lastExpression  = newExpr;
+        g_exprInitialized = true;
+    } else if (newExpr != g_lastExpression) {
+        // 表情が変わったタイミングでだけ鳴きリクエスト
+        g_requestScream = true;
+        g_lastExpression = newExpr;
+    }
+
+    if (g_exprShown && newExpr == g_shownExpression) return;
+    avatar.setExpression(newExpr);
+    g_shownExpression = newExpr;
+    g_exprShown       = true;
+}
+
+// ======================================================================
+//  吹き出し
+// ======================================================================
+void updateSpeech() {
+    SpeechShown next = { 0, 0, 0, INT16_MIN, 0 };
+    if (g_showSpeech) {
+        if (!g_env.valid) {
+            next.mode = 1;
+        } else {
+            next.mode      = 2;
+            next.tempDeci  = (int16_t)lroundf(g_env.temperature * 10.0f);
+            next.hum       = (int16_t)lroundf(g_env.humidity);
+            next.dewDeci   = (int16_t)lroundf(g_envDerived.dewPoint * 10.0f);
+            next.trendDeci = isnan(g_envTrend) ? INT16_MIN
+                                               : (int16_t)lroundf(g_envTrend * 10.0f);
+        }
+    }
+
+    // 丸めた表示値が同じなら何もしない
+    const SpeechShown& cur = g_speechShown;
+    if (next.mode == cur.mode && next.tempDeci == cur.tempDeci && next.hum == cur.hum &&
+        next.dewDeci == cur.dewDeci && next.trendDeci == cur.trendDeci) {
+        return;
+    }
+    g_speechShown = next;
+
+    if (next.mode == 0) {
+        avatar.setSpeechText("");
+        return;
+    }
+    if (next.mode == 1) {
+        avatar.setSpeechText("Waiting MQTT...");
+        return;
+    }
+
+    char buf[64];
+    int n = snprintf(buf, sizeof(buf),
+                     "Temp: %.1fC  Hum: %d%%  Dew: %.1fC",
+                     next.tempDeci * 0.1f,
+                     (int)next.hum,
+                     next.dewDeci * 0.1f);
+    if (next.trendDeci != INT16_MIN && n > 0 && n < (int)sizeof(buf)) {
+        snprintf(buf + n, sizeof(buf) - n, "  P%+.1f/3h", next.trendDeci * 0.1f);
+    }
+
+    avatar.setSpeechText(buf);
+}
+
+// ======================================================================
+//  描画ティック（loop() から。dirty な部分だけまとめて反映）
+// ======================================================================
+void serviceUiTick() {
+    unsigned long now = millis();
+    if (!g_uiDirty || now - g_uiLastTickMs < UI_TICK_MS) return;
+    g_uiLastTickMs = now;
+
+    uint8_t dirty = g_uiDirty;
+    g_uiDirty = 0;
+
+    if (dirty & UI_DIRTY_EXPRESSION) updateAvatarExpression();  // 変化時は鳴きフラグを立てる
+    if (dirty & UI_DIRTY_SPEECH)     updateSpeech();
+    if (dirty & UI_DIRTY_LED)        updateLedsForTemp();       // 点灯時も鳴きフラグを立てる
+}
+
+// ================================================================
+//  7. 通信層：Wi-Fi / MQTT
+// ================================================================
+
+// ======================================================================
+//  SoftAP 起動
+// ======================================================================
+bool startSoftAP() {
+    WiFi.mode(WIFI_AP);
+
+    IPAddress local_ip(192, 168, 4, 1);
+    IPAddress gateway(192, 168, 4, 1);
+    IPAddress subnet(255, 255, 255, 0);
+    if (!WiFi.softAPConfig(local_ip, gateway, subnet)) {
+        return false;
+    }
+
+    bool ok = WiFi.softAP(g_cfg.apSsid, g_cfg.apPassword, g_cfg.apChannel, 0, g_cfg.apMaxStations);
+    if (!ok) {
+        return false;
+    }
+    applyApLinkProfile();
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
+    esp_wifi_set_inactive_time(WIFI_IF_AP, g_cfg.apIdleSec);   // 無通信の端末を切る（既定は 300 秒）
+#endif
+
+    IPAddress ip = WiFi.softAPIP();
+    Serial.println("[WiFi] SoftAP started");
+    Serial.print("  SSID: "); Serial.println(g_cfg.apSsid);
+    Serial.print("  PASS: "); Serial.println(g_cfg.apPassword);
+    Serial.print("  IP  : "); Serial.println(ip);
+    Serial.printf("  CH  : %u, max %u stations, idle %u s\n",
+                  (unsigned)g_cfg.apChannel, (unsigned)g_cfg.apMaxStations,
+                  (unsigned)g_cfg.apIdleSec);
+    return true;
+}
+
+// ======================================================================
+//  AP のリンクプロファイル適用（ビーコン間隔 / DTIM / 送信出力）
+// ======================================================================
+void applyApLinkProfile() {
+    const ApLinkParams& lp = LINK_PROFILES[(uint8_t)g_cfg.linkProfile];
+
+    wifi_config_t conf;
+    if (esp_wifi_get_config(WIFI_IF_AP, &conf) == ESP_OK) {
+        conf.ap.beacon_interval = lp.beaconIntervalTU;
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+        conf.ap.dtim_period = lp.dtimPeriod;
+#endif
+        esp_wifi_set_config(WIFI_IF_AP, &conf);
+    }
+    WiFi.setTxPower(lp.txPower);
+
+    Serial.printf("[WiFi] link profile: %s (beacon %u TU)\n",
+                  lp.name, (unsigned)lp.beaconIntervalTU);
+}
+
+// ======================================================================
+//  MQTT: センサーのリンク計測値を受信
+//   CSV: <profile>,<assocMs>,<pubAvgUs>,<pubMaxUs>,<currentmA>,<battmV>,<rssi>
+//        [,<bootToFirstPubMs>,<assocCached>,<mqttConnMs>[,<retransmits>,<dropped>]]
+// ======================================================================
+void onLinkStat(const char* payload) {
+    char     name[16];
+    unsigned long assocMs, pubAvgUs, pubMaxUs;
+    long     currentmA;
+    int      battmV, rssi;
+    unsigned long bootToPubMs = 0, mqttConnMs = 0;
+    int      cached = 0;
+    unsigned long retransmits = 0, dropped = 0;
+    unsigned long timeRttMs = 0;
+    float    driftPpm = 0.0f;
+    long     timeErrMs = 0;
+    unsigned long journalPending = 0;
+
+    int n = sscanf(payload, "%15[^,],%lu,%lu,%lu,%ld,%d,%d,%lu,%d,%lu,%lu,%lu,%lu,%f,%ld,%lu",
+                   name, &assocMs, &pubAvgUs, &pubMaxUs, &currentmA, &battmV, &rssi,
+                   &bootToPubMs, &cached, &mqttConnMs, &retransmits, &dropped,
+                   &timeRttMs, &driftPpm, &timeErrMs, &journalPending);
+    if (n != 7 && n != 10 && n != 12 && n != 15 && n != 16) {
+        return;
+    }
+
+    if (n == 16) {
+        g_backfill.sensorPending = journalPending;
+    }
+
+    if (n >= 15) {
+        g_sensorTime.rttMs    = timeRttMs;
+        g_sensorTime.driftPpm = driftPpm;
+        g_sensorTime.errMs    = timeErrMs;
+    }
+
+    if (n >= 12) {
+        g_txRetransmits = retransmits;
+        g_txDropped     = dropped;
+    }
+
+    if (n >= 10) {
+        g_sensorConnect.bootToFirstPubMs = bootToPubMs;
+        g_sensorConnect.mqttConnMs       = mqttConnMs;
+        g_sensorConnect.assocCached      = (cached != 0);
+        g_sensorConnect.transport        = g_rxTransport->name();
+        if (cached) g_sensorConnect.cachedAssocs++;
+        else        g_sensorConnect.scanAssocs++;
+    }
+
+    LinkProfile p;
+    if (!parseLinkProfile(name, p)) return;
+
+    LinkProfileStats& st = g_linkStats[(uint8_t)p];
+    st.reports++;
+    st.lastAssocMs = assocMs;
+    if (assocMs > st.assocMsMax) st.assocMsMax = assocMs;
+    st.pubAvgUsSum += pubAvgUs;
+    if (pubMaxUs > st.pubMaxUs) st.pubMaxUs = pubMaxUs;
+    st.sensorCurrentSum += currentmA;
+    st.hubCurrentSum    += M5.Power.getBatteryCurrent();
+    st.lastBattmV = battmV;
+    st.lastRssi   = rssi;
+}
+
+// ======================================================================
+//  MQTT ブローカ
+// ======================================================================
+uint32_t hashTopic(const char* s) {
+    return EnvSample::hashName(s);
+}
+
+// ======================================================================
+//  AnomalyFlag → "rate,outlier" のような文字列（無ければ "-"）
+// ======================================================================
+const char* anomalyFlagsString(uint8_t flags, char* buf, size_t cap) {
+    static const struct { uint8_t bit; const char* name; } NAMES[] = {
+        { ANOM_RANGE, "range" }, { ANOM_RATE, "rate" }, { ANOM_STUCK, "stuck" },
+        { ANOM_OUTLIER, "outlier" }, { ANOM_STALE, "stale" },
+    };
+    size_t n = 0;
+    buf[0] = '\0';
+    for (const auto& f : NAMES) {
+        if (flags & f.bit) appendf(buf, cap, n, "%s%s", n ? "," : "", f.name);
+    }
+    if (!n) snprintf(buf, cap, "-");
+    return buf;
 }
 
-bool rewriteLogsToFS() {
-    File f = LittleFS.open(LOG_FILE_PATH, FILE_WRITE);
-    if (!f) return false;
+// ======================================================================
+//  途絶の検出（loop() から。状態が変わったときだけシリアルに出す）
+// ======================================================================
+void serviceSensorHealth() {
+    static unsigned long lastCheckMs = 0;
+    // 途絶中と知らせたデバイスのハッシュ（表の位置ごと。0 = 途絶していない）。
+    // 追い出されて別のデバイスが入った位置は、前のデバイスの状態を引き継がない
+    static uint32_t staleHash[AnomalyDetector::MaxDevices] = {};
 
-    for (size_t i = 0; i < g_logCount; ++i) {
-        const auto& e = g_logs[i];
-        f.printf("%.1f,%.1f,%.1f,%s\n",
-                 e.temperature,
-                 e.humidity,
-                 e.pressure,
-                 e.datetime);
+    unsigned long now = millis();
+    if (now - lastCheckMs < 1000) return;
+    lastCheckMs = now;
+
+    for (size_t i = 0; i < AnomalyDetector::MaxDevices; ++i) {
+        const auto& d = g_ingest.anomaly().devices()[i];
+        bool stale = g_ingest.anomaly().isStale(d, now);
+        bool was   = d.hash && staleHash[i] == d.hash;
+        if (stale != was) {
+            Serial.printf("[Anomaly] %s %s\n", d.name, stale ? "stale" : "back");
+        }
+        staleHash[i] = stale ? d.hash : 0;
     }
-    f.close();
-    return true;
 }
 
-bool appendLogToFS(const EnvLogEntry& e) {
-    File f = LittleFS.open(LOG_FILE_PATH, FILE_APPEND);
-    if (!f) return false;
+// ======================================================================
+//  派生指標（露点・暑さ指数・絶対湿度）を現在値から更新
+// ======================================================================
+void updateDerived() {
+    g_ingest.derived().compute(g_env.temperature, g_env.humidity, g_envDerived);
+}
 
-    f.printf("%.1f,%.1f,%.1f,%s\n",
-             e.temperature,
-             e.humidity,
-             e.pressure,
-             e.datetime);
-    f.close();
-    return true;
+// ======================================================================
+//  受信サンプルの取り込み（生値 → 校正 → g_env 更新 → ログ → 表情・吹き出し・LED）
+// ======================================================================
+// 直前の生値に今の校正を当てて g_env を作り直す
+void refreshEnvFromRaw() {
+    applyCal(g_lastRaw.device, g_lastRaw.t, g_lastRaw.h, g_lastRaw.p,
+             g_env.temperature, g_env.humidity, g_env.pressure);
+    updateDerived();
+}
+
+// ===== HubIngest の Host（計測値・時刻要求・後送りの取り込みは HubIngest.h） =====
+uint32_t FirmwareIngestHost::nowEpoch() {
+    return ::nowEpoch();
+}
+
+uint32_t FirmwareIngestHost::nowEpochMs(uint16_t& ms) {
+    return g_clock.nowMs(esp_timer_get_time(), ms);
+}
+
+uint32_t FirmwareIngestHost::trendSec() {
+    return trendNowSec();
+}
+
+// 応答は届いた配送路へ
+void FirmwareIngestHost::publish(const char* topic, const char* payload) {
+    g_rxTransport->publish(topic, payload);
+}
+
+void FirmwareIngestHost::calibrate(HubIngest::Reading& r) {
+    applyCal(r.device, r.rawT, r.rawH, r.rawP, r.t, r.h, r.p);
+    r.calEpoch = g_cal.epoch;
+}
+
+// 隔離したサンプルは g_env・ログ・表情に入れない（シリアルに出すだけ）
+void FirmwareIngestHost::onQuarantine(const char* device, const HubIngest::Reading& r) {
+    char fbuf[40];
+    Serial.printf("[Anomaly] %s quarantined %.2f,%.2f,%.2f (%s)\n", device, r.rawT, r.rawH,
+                  r.rawP, anomalyFlagsString(r.flags, fbuf, sizeof(fbuf)));
+}
+
+// 採用したサンプル → g_env 更新 → 表情・吹き出し・LED
+void FirmwareIngestHost::onSample(const HubIngest::Reading& r) {
+    g_lastSampleFlags = r.flags;
+    g_lastRaw         = { r.device, r.rawT, r.rawH, r.rawP, r.time };
+    g_env             = { r.t, r.h, r.p, true };
+    g_envDerived      = r.derived;
+    g_envTrend        = r.trend;
+
+    evaluateRules();
+    markUiDirty(UI_DIRTY_ALL);  // 反映は描画ティックで
+    publishHubState();
+    g_snapDirty = true;
+}
+
+// ===== 後送り =====
+//   "<firstSeq>,<baseEpoch>;<dt>,<t>,<h>,<p>;<dt>,<t>,<h>,<p>;..."
+//     行の seq は firstSeq から連続、dt は前の行からの秒（先頭は baseEpoch から）、
+//     t / h は 0.01、p は 0.1 単位の整数（センサーの生値）
+//   末尾に足さず時刻順の位置へまとめて差し込み（logMergeSorted）、CSV は
+//   差し込んだ位置から後ろだけ書き直す。
+EnvLogEntry g_backfillRows[BackfillBatch::ROWS_MAX];
+
+// 時刻の昇順の rows[0..k)（間引き済み）から、ログに無い行だけを差し込む
+size_t FirmwareIngestHost::mergeLog(const HubIngest::Reading* rows, size_t k) {
+    if (k > BackfillBatch::ROWS_MAX) k = BackfillBatch::ROWS_MAX;
+
+    // 読み込みの済んでいない古い範囲に入るなら、先に全部読む
+    if (k && logLoadPending() && (!g_logCount || rows[0].time < g_colTime[logPhys(0)])) {
+        finishLogLoad();
+    }
+
+    size_t unique = 0;
+    for (size_t i = 0; i < k; ++i) {
+        const HubIngest::Reading& r = rows[i];
+        EnvLogEntry& e   = g_backfillRows[unique];
+        e.rawTemperature = r.rawT;
+        e.rawHumidity    = r.rawH;
+        e.rawPressure    = r.rawP;
+        e.device         = r.device;
+        e.calEpoch       = r.calEpoch;
+        e.viewEpoch      = r.calEpoch;
+        e.temperature    = r.t;
+        e.humidity       = r.h;
+        e.pressure       = r.p;
+        e.dewPoint       = r.derived.dewPoint;
+        e.heatIndex      = r.derived.heatIndex;
+        e.absHumidity    = r.derived.absHumidity;
+        e.pressureTrend  = NAN;
+        e.anomalyFlags   = 0;
+        e.time           = r.time;
+        if (!logHasRow(e)) unique++;
+    }
+    if (!unique) return 0;
+
+    compactLogs();   // 併合で行を動かす前に削除印を詰める（CSV の末尾の行数も合わせる）
+    uint32_t t0   = micros();
+    size_t   tail = 0;
+    size_t   pos  = logMergeSorted(g_backfillRows, unique, tail);
+    rewriteLogTail(pos, tail);
+    g_backfill.lastMergeUs = micros() - t0;
+    if (g_backfill.lastMergeUs > g_backfill.maxMergeUs) {
+        g_backfill.maxMergeUs = g_backfill.lastMergeUs;
+    }
+    publishHubState();   // 集計が変わる
+    return unique;
 }
 
 // ======================================================================
-//  ログ追加（変化が小さいときはスキップ）
+//  保持状態（retained）の更新と再送
 // ======================================================================
-void addLogEntry(const EnvReading& env) {
-    if (!env.valid) return;
+void setRetained(const char* topic, const char* payload) {
+    RetainedEntry* slot = nullptr;
+    for (auto& r : g_retained) {
+        if (r.topic == topic) { slot = &r; break; }
+        if (!slot && !r.topic) slot = &r;
+    }
+    if (!slot) return;
 
-    if (g_logCount > 0) {
-        const auto& last = g_logs[g_logCount - 1];
-        if (fabsf(env.temperature - last.temperature) < 0.2f &&
-            fabsf(env.humidity    - last.humidity)    < 1.0f &&
-            fabsf(env.pressure    - last.pressure)    < 0.5f) {
+    if (slot->topic == topic && strcmp(slot->payload, payload) == 0) {
+        return;  // 変化なしなら送らない
+    }
+    slot->topic = topic;
+    strncpy(slot->payload, payload, sizeof(slot->payload) - 1);
+    slot->payload[sizeof(slot->payload) - 1] = '\0';
+
+    mqtt.publish(topic, slot->payload, 0, true);
+}
+
+PicoMQTT::ConnectReturnCode HubBroker::auth(const char* client_id, const char*, const char*) {
+    uint32_t h = hashTopic(client_id);
+    for (uint32_t c : g_brokerClients) {
+        if (c == h) return PicoMQTT::CRC_ACCEPTED;   // 再接続（古い接続はブローカが閉じる）
+    }
+    if (g_brokerStats.clients >= g_brokerStats.limit) {
+        g_brokerStats.rejected++;
+        Serial.printf("[MQTT] reject %s: %u clients (limit)\n",
+                      client_id, (unsigned)g_brokerStats.clients);
+        return PicoMQTT::CRC_SERVER_UNAVAILABLE;
+    }
+    return PicoMQTT::CRC_ACCEPTED;
+}
+
+// 送る前に切断したクライアントの待ちは捨てる
+void dropRetainedReplay(const char* client_id) {
+    for (auto& q : g_replayQueue) {
+        if (q.client[0] && strncmp(q.client, client_id, sizeof(q.client) - 1) == 0) {
+            q.client[0] = '\0';
+        }
+    }
+}
+
+void HubBroker::on_connected(const char* client_id) {
+    uint32_t  h    = hashTopic(client_id);
+    uint32_t* free = nullptr;
+    g_brokerStats.connects++;
+    for (auto& c : g_brokerClients) {
+        if (c == h) return;
+        if (!free && !c) free = &c;
+    }
+    if (!free) return;
+    *free = h;
+    g_brokerStats.clients++;
+    if (g_brokerStats.clients > g_brokerStats.peak) g_brokerStats.peak = g_brokerStats.clients;
+}
+
+void HubBroker::on_disconnected(const char* client_id) {
+    dropRetainedReplay(client_id);
+    uint32_t h = hashTopic(client_id);
+    for (auto& c : g_brokerClients) {
+        if (c == h) {
+            c = 0;
+            g_brokerStats.clients--;
             return;
         }
     }
+}
 
-    EnvLogEntry e;
-    e.temperature = env.temperature;
-    e.humidity    = env.humidity;
-    e.pressure    = env.pressure;
-    getCurrentDatetimeString(e.datetime, sizeof(e.datetime));
+// 同時接続の上限（起動時に 1 回。設定・メモリ予算・空きヒープ・ソケット数の最小）
+uint8_t brokerClientLimit() {
+    size_t heap     = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    size_t byBudget = (size_t)g_cfg.mqttBudgetKb * 1024 / MQTT_CLIENT_COST_BYTES;
+    size_t byHeap   = (heap > MQTT_HEAP_RESERVE_BYTES)
+                        ? (heap - MQTT_HEAP_RESERVE_BYTES) / MQTT_CLIENT_COST_BYTES : 0;
+    size_t n = g_cfg.mqttMaxClients;
+    if (byBudget < n) n = byBudget;
+    if (byHeap < n)   n = byHeap;
+#ifdef CONFIG_LWIP_MAX_SOCKETS
+    if (CONFIG_LWIP_MAX_SOCKETS - MQTT_RESERVED_SOCKETS < (int)n) {
+        n = CONFIG_LWIP_MAX_SOCKETS - MQTT_RESERVED_SOCKETS;
+    }
+#endif
+    return n ? (uint8_t)n : 1;
+}
 
-    if (g_logCount < LOG_CAPACITY) {
-        g_logs[g_logCount++] = e;
-    } else {
-        for (size_t i = 1; i < LOG_CAPACITY; ++i) {
-            g_logs[i - 1] = g_logs[i];
+// 購読に一致する保持状態を、そのクライアントの再送待ちに積む
+void HubBroker::on_subscribe(const char* client_id, const char* topic) {
+    uint8_t mask = 0;
+    for (size_t i = 0; i < RETAINED_MAX; ++i) {
+        if (g_retained[i].topic && mqttTopicMatches(topic, g_retained[i].topic)) {
+            mask |= (uint8_t)(1u << i);
         }
-        g_logs[LOG_CAPACITY - 1] = e;
     }
+    if (!mask) return;
 
-    g_logSelected = (g_logCount > 0) ? (g_logCount - 1) : 0;
+    RetainedReplay* slot = nullptr;
+    for (auto& q : g_replayQueue) {
+        if (q.client[0] && strncmp(q.client, client_id, sizeof(q.client) - 1) == 0) {
+            slot = &q;
+            break;
+        }
+        if (!slot && !q.client[0]) slot = &q;
+    }
+    if (!slot) {
+        g_replayStats.overflow++;
+        Serial.printf("[MQTT] retained replay queue full, '%s' from %s not replayed\n",
+                      topic, client_id);
+        return;
+    }
+    if (!slot->client[0]) {
+        strncpy(slot->client, client_id, sizeof(slot->client) - 1);
+        slot->client[sizeof(slot->client) - 1] = '\0';
+        slot->mask = 0;
+    }
+    slot->mask |= mask;
+    g_replayStats.queued++;
+}
 
-    appendLogToFS(e);
+// loop() から呼ぶ：待っているクライアントの保持状態を送る
+//   PicoMQTT の publish は宛先のクライアントを選べない（その時点の購読者全員へ届く）
+//   ので、同じ周回で複数のクライアントが同じ状態を待っていても 1 回にまとめて送る
+void serviceRetainedReplay() {
+    uint8_t pending = 0;
+    for (auto& q : g_replayQueue) {
+        if (!q.client[0]) continue;
+        pending |= q.mask;
+        q.client[0] = '\0';
+    }
+    for (size_t i = 0; i < RETAINED_MAX; ++i) {
+        const RetainedEntry& r = g_retained[i];
+        if ((pending & (1u << i)) && r.topic) {
+            mqtt.publish(r.topic, r.payload, 0, true);
+            g_replayStats.sent++;
+        }
+    }
 }
 
 // ======================================================================
-//  ログ削除 / 全削除
+//  派生状態の公開（stackchan/state/#）
 // ======================================================================
-void deleteLogAt(size_t index) {
-    if (g_logCount == 0) return;
-    if (index >= g_logCount) return;
+void publishHubState() {
+    char buf[64];
+
+    snprintf(buf, sizeof(buf), "%.2f", g_cfg.tempOffset);
+    setRetained(STATE_TOPIC_OFFSET, buf);
+
+    if (!g_env.valid) return;
+
+    snprintf(buf, sizeof(buf), "%.2f,%.2f,%.2f",
+             g_env.temperature, g_env.humidity, g_env.pressure);
+    setRetained(STATE_TOPIC_ENV, buf);
 
-    for (size_t i = index + 1; i < g_logCount; ++i) {
-        g_logs[i - 1] = g_logs[i];
+    setRetained(STATE_TOPIC_EXPRESSION, expressionName(g_lastExpression));
+
+    int n = snprintf(buf, sizeof(buf), "%.2f,%.2f,%.2f,",
+                     g_envDerived.dewPoint, g_envDerived.heatIndex, g_envDerived.absHumidity);
+    if (!isnan(g_envTrend) && n > 0 && n < (int)sizeof(buf)) {
+        snprintf(buf + n, sizeof(buf) - n, "%.2f", g_envTrend);
+    }
+    setRetained(STATE_TOPIC_DERIVED, buf);
+
+    ColumnScan::Agg agg[LF_COUNT];
+    if (logSummary(agg) > 0) {
+        const ColumnScan::Agg& t = agg[LF_T];
+        snprintf(buf, sizeof(buf), "%u,%.2f,%.2f,%.2f",
+                 (unsigned)t.count,
+                 ColumnScan::decode(t.min, ColumnScan::T_SCALE),
+                 ColumnScan::decode(t.max, ColumnScan::T_SCALE),
+                 t.mean(ColumnScan::T_SCALE));
+        setRetained(STATE_TOPIC_AGGREGATE, buf);
     }
-    --g_logCount;
+}
 
-    if (g_logCount == 0) {
-        g_logSelected = 0;
-        LittleFS.remove(LOG_FILE_PATH);
-    } else {
-        if (g_logSelected >= g_logCount) {
-            g_logSelected = g_logCount - 1;
+// ======================================================================
+//  ルーティング表（起動時に 1 回だけ構築）
+// ======================================================================
+void setupTopicRoutes() {
+    g_router.clear();
+    g_router.add(MQTT_PATTERN_ENV, [](const char* topic, const char* payload,
+                                      const char* const*, uint8_t) {
+        g_ingest.onEnvMessage(topic, payload);
+    });
+    g_router.add(MQTT_PATTERN_STAT, [](const char*, const char* payload,
+                                       const char* const*, uint8_t) {
+        onLinkStat(payload);
+    });
+    g_router.add(MQTT_PATTERN_TIMEREQ, [](const char*, const char* payload,
+                                          const char* const* levels, uint8_t) {
+        g_ingest.onTimeRequest(payload, levels[2]);   // home/env/<device>/timereq
+    });
+    g_router.add(MQTT_PATTERN_BACKFILL, [](const char* topic, const char* payload,
+                                           const char* const* levels, uint8_t) {
+        g_ingest.onBackfill(topic, payload, levels[2]);
+    });
+}
+
+// ======================================================================
+//  受信トレースの記録（/api/trace?capture=1 → /trace.bin）
+//   振り分ける受信（home/env/#）をすべて、届いた時刻と配送路付きで
+//   TraceFormat の形式に詰める。1 通ごとにフラッシュへ書かないよう
+//   TRACE_BUF_SIZE ずつまとめて追記し、TRACE_FLUSH_MS ごとにも書き出す。
+//   TRACE_MAX_BYTES に達したら止める。記録は tools/trace_tool replay で再生する。
+// ======================================================================
+constexpr size_t   TRACE_BUF_SIZE  = 2048;
+constexpr uint32_t TRACE_MAX_BYTES = 1024 * 1024;
+constexpr uint32_t TRACE_FLUSH_MS  = 5000;
+
+struct TraceCapture {
+    bool        active;
+    uint32_t    startMs;
+    uint32_t    lastFlushMs;
+    uint32_t    records;
+    uint32_t    bytes;        // ヘッダ + 詰めた分（未書き出しを含む）
+    uint32_t    dropped;      // トピックの番号が尽きた・長すぎる
+    size_t      used;         // g_traceBuf の未書き出し
+    const char* stopReason;   // 止めた理由（nullptr = 記録中 / 未開始）
+};
+
+TraceCapture        g_trace = {};
+TraceFormat::Writer g_traceWriter;
+uint8_t             g_traceBuf[TRACE_BUF_SIZE];
+
+bool flushTrace() {
+    g_trace.lastFlushMs = millis();
+    if (!g_trace.used) return true;
+    File f  = LittleFS.open(TRACE_FILE_PATH, FILE_APPEND);
+    bool ok = f && f.write(g_traceBuf, g_trace.used) == g_trace.used;
+    if (f) f.close();
+    g_trace.used = 0;
+    return ok;
+}
+
+void stopTraceCapture(const char* reason) {
+    if (!g_trace.active) return;
+    bool ok = flushTrace();
+    g_trace.active     = false;
+    g_trace.stopReason = ok ? reason : "write failed";
+    Serial.printf("[Trace] capture stopped (%s): %u records, %u bytes, %u dropped\n",
+                  g_trace.stopReason, (unsigned)g_trace.records, (unsigned)g_trace.bytes,
+                  (unsigned)g_trace.dropped);
+}
+
+bool startTraceCapture() {
+    stopTraceCapture("restarted");
+    uint8_t hdr[TraceFormat::HEADER];
+    TraceFormat::writeHeader(hdr, nowEpoch());
+    File f  = LittleFS.open(TRACE_FILE_PATH, "w");
+    bool ok = f && f.write(hdr, sizeof(hdr)) == sizeof(hdr);
+    if (f) f.close();
+    if (!ok) return false;
+
+    g_trace             = TraceCapture();
+    g_trace.active      = true;
+    g_trace.startMs     = millis();
+    g_trace.lastFlushMs = g_trace.startMs;
+    g_trace.bytes       = TraceFormat::HEADER;
+    g_traceWriter.begin(g_trace.startMs);
+    Serial.println("[Trace] capture started");
+    return true;
+}
+
+uint8_t transportIndex(const EnvTransport& t) {
+    for (size_t i = 0; i < sizeof(g_transports) / sizeof(g_transports[0]); ++i) {
+        if (g_transports[i] == &t) return (uint8_t)i;
+    }
+    return TraceFormat::TRANSPORTS - 1;   // 再生・自己診断の配送路
+}
+
+void traceRecord(const EnvTransport& from, const char* topic, const char* payload) {
+    if (g_trace.used + TraceFormat::RECORD_MAX > TRACE_BUF_SIZE && !flushTrace()) {
+        stopTraceCapture("write failed");
+        return;
+    }
+    size_t n = g_traceWriter.encode(millis(), transportIndex(from), topic, payload,
+                                    g_traceBuf + g_trace.used, TRACE_BUF_SIZE - g_trace.used);
+    if (!n) {
+        g_trace.dropped++;
+        return;
+    }
+    g_trace.used  += n;
+    g_trace.bytes += n;
+    g_trace.records++;
+    if (g_trace.bytes >= TRACE_MAX_BYTES) stopTraceCapture("full");
+}
+
+// loop() から呼ぶ：溜まった分の書き出し
+void serviceTrace() {
+    if (g_trace.active && millis() - g_trace.lastFlushMs >= TRACE_FLUSH_MS && !flushTrace()) {
+        stopTraceCapture("write failed");
+    }
+}
+
+// どの配送路から届いても同じ振り分けに通す（応答は g_rxTransport へ）
+void onTransportMessage(void*, EnvTransport& from, const char* topic, const char* payload) {
+    if (g_trace.active) traceRecord(from, topic, payload);
+    uint32_t t0 = micros();
+    g_rxTransport = &from;
+    g_router.route(topic, payload);
+    g_rxTransport = &g_mqttTransport;
+
+    uint32_t us = micros() - t0;
+    g_load.messages++;
+    g_load.routeUsSum += us;
+    if (us > g_load.routeUsMax) g_load.routeUsMax = us;
+    uint32_t now = millis();
+    if (now - g_load.windowMs >= 1000) {
+        g_load.windowMs    = now;
+        g_load.windowCount = 0;
+    }
+    if (++g_load.windowCount > g_load.rateMax) g_load.rateMax = g_load.windowCount;
+}
+
+bool HubMqttTransport::begin() {
+    // 本文は g_mqttPayloads に読む（借りられなければ捨てる。数は payload_* に出る）
+    mqtt.subscribe(MQTT_SUB_FILTER, [](const char* topic, PicoMQTT::IncomingPacket& packet) {
+        size_t len = packet.get_remaining_size();
+        char*  buf = g_mqttPayloads.acquire(len + 1);
+        if (!buf) return;
+        buf[packet.readBytes(buf, len)] = '\0';
+        g_mqttTransport.deliver(topic, buf);
+        g_mqttPayloads.release(buf);
+    });
+    mqtt.begin();
+    Serial.println("[MQTT] Broker started (PicoMQTT)");
+    return true;
+}
+
+// ESP-NOW のフレームの鍵（SoftAP のパスワードから。変えたら再起動で掛け直す）と
+// 送信番号（FrameAuth::RESERVE 件ごとに NVS へ先の値を保存）
+bool saveFrameCounter(void*, uint32_t reservedUntil) {
+    return g_prefs.putUInt("fctr", reservedUntil) == sizeof(reservedUntil);
+}
+
+void setupFrameSeal() {
+    FrameSeal& seal = g_espNowTransport.seal();
+    seal.setKey(FrameAuth::deriveKey(g_cfg.apPassword));
+    seal.setCounter(g_prefs.getUInt("fctr", 1), saveFrameCounter, nullptr);
+}
+
+void startMQTTBroker() {
+    g_brokerStats.limit = brokerClientLimit();
+    Serial.printf("[MQTT] up to %u clients (max_clients %u, budget %u KB)\n",
+                  (unsigned)g_brokerStats.limit, (unsigned)g_cfg.mqttMaxClients,
+                  (unsigned)g_cfg.mqttBudgetKb);
+    setupTopicRoutes();
+    setupFrameSeal();
+    for (EnvTransport* t : g_transports) {
+        t->setReceiver(onTransportMessage, nullptr);
+        if (!t->begin()) {
+            Serial.printf("[Link] %s transport failed to start\n", t->name());
         }
-        rewriteLogsToFS();
     }
+    Serial.printf("[Link] ESP-NOW %s on channel %d\n",
+                  g_espNowTransport.ready() ? "listening" : "off", (int)g_cfg.apChannel);
+
+    publishSensorConfig();
+    publishHubState();
 }
 
-void clearAllLogs() {
-    g_logCount    = 0;
-    g_logSelected = 0;
-    LittleFS.remove(LOG_FILE_PATH);
+// loop() から呼ぶ：受信の配送
+void serviceTransports() {
+    uint32_t t0 = micros();
+    for (EnvTransport* t : g_transports) t->loop();
+    uint32_t us = micros() - t0;
+    if (us > g_load.serviceUsMax) g_load.serviceUsMax = us;
+}
+
+// ======================================================================
+//  MQTT: 海面気圧・リンクプロファイルをセンサーへ配信
+// ======================================================================
+void publishSensorConfig() {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%.2f", g_cfg.seaLevelhPa);
+    for (EnvTransport* t : g_transports) {
+        if (!t->ready()) continue;
+        t->publish(MQTT_TOPIC_SEALEVEL, buf);
+        t->publish(MQTT_TOPIC_LINK, LINK_PROFILES[(uint8_t)g_cfg.linkProfile].name);
+    }
+    g_lastSensorCfgPubMs = millis();
 }
 
 // ================================================================
-//  6. I/O層：LED・サーボ・Avatar・サウンド
+//  8. HTTP 層：Webコンソール・RTC設定
 // ================================================================
 
 // ======================================================================
-//  LED 初期化
+//  設定の反映（検証 → NVS 保存 → 差し替え → 変わった項目の副作用）
 // ======================================================================
-void initLeds() {
-    bodyStrip.begin();
-    earsStrip.begin();
+bool commitConfig(HubConfig& next, const char*& err) {
+    if (!validateConfig(next, err)) return false;
+    if (!saveConfig(next)) {
+        err = "NVS write failed";
+        return false;
+    }
 
-    bodyStrip.setBrightness(40);
-    earsStrip.setBrightness(40);
+    const HubConfig prev = g_cfg;
+    g_cfg = next;
+    applyIngestConfig();
 
-    turnOffAllLeds();
-    g_ledInited = true;
+    if (g_ledInited && prev.ledBrightness != g_cfg.ledBrightness) {
+        bodyStrip.setBrightness(g_cfg.ledBrightness);
+        earsStrip.setBrightness(g_cfg.ledBrightness);
+        g_ledShownValid = false;   // 次の描画ティックで書き直す
+        markUiDirty(UI_DIRTY_LED);
+    }
+
+    if (prev.linkProfile != g_cfg.linkProfile) {
+        applyApLinkProfile();
+    }
+
+    // 容量を減らしたら古い方から捨てる
+    if (g_logCount > logCapacity()) {
+        while (g_logCount > logCapacity()) logDropOldest();
+        g_logSelected = g_logCount ? g_logCount - 1 : 0;
+        rewriteLogsToFS();
+    }
+
+    if (prev.tempOffset != g_cfg.tempOffset) {
+        bumpCalEpoch();
+    }
+
+    if (!g_rulesCustom) {
+        buildDefaultRules();
+        compileRules();
+    }
+
+    if (strcmp(prev.apSsid, g_cfg.apSsid) != 0 ||
+        strcmp(prev.apPassword, g_cfg.apPassword) != 0 ||
+        prev.apChannel != g_cfg.apChannel || prev.apMaxStations != g_cfg.apMaxStations ||
+        prev.apIdleSec != g_cfg.apIdleSec || prev.mqttMaxClients != g_cfg.mqttMaxClients ||
+        prev.mqttBudgetKb != g_cfg.mqttBudgetKb) {
+        g_cfgNeedsRestart = true;
+    }
+
+    // ブローカは起動直後から動いているので画面に依らず配信する
+    if (prev.linkProfile != g_cfg.linkProfile || prev.seaLevelhPa != g_cfg.seaLevelhPa) {
+        publishSensorConfig();
+    }
+    if (g_env.valid) {
+        refreshEnvFromRaw();
+        evaluateRules();
+        markUiDirty(UI_DIRTY_ALL);
+    }
+    publishHubState();
+    return true;
 }
 
 // ======================================================================
-//  サーボ初期化
+//  HTTP: ルート（Webコンソール）
 // ======================================================================
-void initServo() {
-    if (g_servoAttached) return;
+void httpChunkSink(void*, const char* data, size_t len) {
+    server.sendContent(data, len);
+}
 
-    servoX.setPeriodHertz(50);
-    servoY.setPeriodHertz(50);
-    servoX.attach(SERVO_X_PIN, 500, 2400);
-    servoY.attach(SERVO_Y_PIN, 500, 2400);
+// 長さ未定（チャンク転送）で応答を始める
+ChunkWriter beginChunked(const char* contentType) {
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, contentType, "");
+    return ChunkWriter(g_httpChunk, sizeof(g_httpChunk), httpChunkSink, nullptr);
+}
 
-    servoX.write(SERVO_X_CENTER);
-    servoY.write(SERVO_Y_CENTER);
+void endChunked(ChunkWriter& w) {
+    w.flush();
+    server.sendContent("", 0);   // 終端チャンク
+}
 
-    g_servoYCurrent = SERVO_Y_CENTER;
-    g_servoYTarget  = SERVO_Y_CENTER;
-    g_nextPoseChangeMs = millis() + random(3000, 7000);
+// 引数を固定バッファへ写す（前後の空白を除く）。false = 無い / cap に収まらない
+//   WebServer::arg() は String を返すので、受け取ったらすぐ写して持ち回らない
+bool copyArg(const char* name, char* buf, size_t cap) {
+    if (!server.hasArg(name)) return false;
+    const String& v = server.arg(name);
+    const char*   s = v.c_str();
+    while (isspace((unsigned char)*s)) ++s;
+    size_t len = strlen(s);
+    while (len && isspace((unsigned char)s[len - 1])) --len;
+    if (len >= cap) return false;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    return true;
+}
+
+// 固定バッファの JSON をそのまま送る（String に複製しない）
+void sendJson(const char* json, size_t len) {
+    server.send_P(200, "application/json", json, len);
+}
+
+void renderLogSummaryRow(ChunkWriter& w, const char* label, const ColumnScan::Agg agg[LF_COUNT]) {
+    w.printf("<tr><td>%s</td><td>%u</td>", label, (unsigned)agg[LF_T].count);
+    static const int PREC[LF_COUNT] = { 1, 0, 1 };   // 一覧の列と同じ桁
+    for (uint8_t f = 0; f < LF_COUNT; ++f) {
+        float scale = LOG_FIELD_SCALE[f];
+        w.printf("<td>%.*f / %.*f / %.*f</td>",
+                 PREC[f], ColumnScan::decode(agg[f].min, scale),
+                 PREC[f], agg[f].mean(scale),
+                 PREC[f], ColumnScan::decode(agg[f].max, scale));
+    }
+    w.print("</tr>");
+}
+
+// page = ログ一覧のページ（0 = 最新の LOG_PAGE_ROWS 件）
+void renderConsole(ChunkWriter& w, size_t page) {
+    w.print("<!DOCTYPE html><html><head><meta charset='UTF-8'>"
+            "<title>Stackchan Env Console</title>"
+            "<meta name='viewport' content='width=device-width,initial-scale=1'>"
+            "<style>"
+            "body{font-family:sans-serif;margin:8px;}"
+            "table{border-collapse:collapse;width:100%;}"
+            "th,td{border:1px solid #ccc;padding:4px;font-size:12px;}"
+            "th{background:#eee;}"
+            "a.btn{display:inline-block;margin:2px 4px;padding:4px 8px;border:1px solid #333;"
+            "border-radius:4px;text-decoration:none;font-size:12px;}"
+            "</style></head><body>");
+
+    w.print("<h2>Stackchan Env Console</h2>");
+
+    // 現在値
+    w.print("<h3>Current</h3><ul>");
+    if (!g_env.valid) {
+        w.print("<li>Waiting MQTT...</li>");
+    } else {
+        w.printf("<li>Temperature: %.1f &deg;C (offset %.1f &deg;C)</li>",
+                 g_env.temperature, g_cfg.tempOffset);
+        w.printf("<li>Humidity: %.0f %%</li>", g_env.humidity);
+        w.printf("<li>Pressure: %.1f hPa</li>", g_env.pressure);
+        float alt = 44330.0f * (1.0f - powf(g_env.pressure / g_cfg.seaLevelhPa, 0.1903f));
+        w.printf("<li>Altitude: %.1f m</li>", alt);
+        w.printf("<li>Dew point: %.1f &deg;C</li>", g_envDerived.dewPoint);
+        w.printf("<li>Heat index: %.1f &deg;C</li>", g_envDerived.heatIndex);
+        w.printf("<li>Absolute humidity: %.1f g/m&sup3;</li>", g_envDerived.absHumidity);
+        w.print("<li>Pressure trend: ");
+        if (isnan(g_envTrend)) {
+            w.print("collecting (needs 30 min)");
+        } else {
+            w.printf("%.1f hPa/3h (%s)", g_envTrend,
+                     g_envTrend >= 1.0f ? "rising" : (g_envTrend <= -1.0f ? "falling" : "steady"));
+        }
+        w.print("</li>");
+    }
+    w.print("</ul>");
+
+    // RTC表示 + 設定リンク
+    {
+        char nowBuf[20];
+        getCurrentDatetimeString(nowBuf, sizeof(nowBuf));
+
+        w.print("<h3>RTC Time</h3>");
+        w.printf("<p>Current RTC: <b>%s</b></p>", nowBuf);
+        w.print("<p><a class='btn' href='/settime'>Set RTC Time</a></p>");
+    }
+
+    // オフセット操作
+    w.print("<h3>Offset</h3>");
+    w.printf("<p>Temp offset: <b>%.1f &deg;C</b></p>", g_cfg.tempOffset);
+    w.print("<p>"
+            "<a class='btn' href='/offset?delta=-0.5'>-0.5 C</a>"
+            "<a class='btn' href='/offset?delta=0.5'>+0.5 C</a>"
+            "</p>");
+
+    // 海面気圧（高度の基準）
+    w.print("<h3>Sea level</h3>");
+    w.printf("<p>Sea level pressure: <b>%.2f hPa</b></p>", g_cfg.seaLevelhPa);
+    w.print("<p>"
+            "<a class='btn' href='/sealevel?delta=-1'>-1 hPa</a>"
+            "<a class='btn' href='/sealevel?delta=1'>+1 hPa</a>"
+            "<a class='btn' href='/sealevel?hpa=1013.25'>Reset</a>"
+            "</p>"
+            "<form method='GET' action='/sealevel'>"
+            "Sea level hPa: <input type='text' name='hpa' size='8'> "
+            "<input type='submit' value='Set'></form>"
+            "<form method='GET' action='/sealevel'>"
+            "Known altitude m: <input type='text' name='alt' size='8'> "
+            "<input type='submit' value='Calibrate'></form>");
+
+    // リンクプロファイル
+    w.print("<h3>Link profile</h3>");
+    w.printf("<p>Current: <b>%s</b> (stations %d / %u, MQTT clients %u / %u, "
+             "rejected %u, publish slots %u / %u)</p><p>",
+             LINK_PROFILES[(uint8_t)g_cfg.linkProfile].name,
+             (int)WiFi.softAPgetStationNum(), (unsigned)g_cfg.apMaxStations,
+             (unsigned)g_brokerStats.clients, (unsigned)g_brokerStats.limit,
+             (unsigned)g_brokerStats.rejected,
+             (unsigned)g_ingest.slotsUsed(), (unsigned)g_cfg.publishSlots);
+    for (uint8_t i = 0; i < LINK_PROFILE_COUNT; ++i) {
+        w.printf("<a class='btn' href='/link?p=%s'>%s</a>",
+                 LINK_PROFILES[i].name, LINK_PROFILES[i].name);
+    }
+    w.print("</p>");
+    w.print("<table><tr><th>Profile</th><th>Reports</th><th>Assoc ms (last/max)</th>"
+            "<th>Pub avg us</th><th>Pub max us</th><th>Sensor mA</th><th>Hub mA</th></tr>");
+    for (uint8_t i = 0; i < LINK_PROFILE_COUNT; ++i) {
+        const auto& st = g_linkStats[i];
+        uint32_t n = st.reports ? st.reports : 1;
+        w.printf("<tr><td>%s</td><td>%u</td><td>%u / %u</td><td>%u</td><td>%u</td>"
+                 "<td>%ld</td><td>%ld</td></tr>",
+                 LINK_PROFILES[i].name,
+                 (unsigned)st.reports,
+                 (unsigned)st.lastAssocMs,
+                 (unsigned)st.assocMsMax,
+                 (unsigned)(st.pubAvgUsSum / n),
+                 (unsigned)st.pubMaxUs,
+                 (long)(st.sensorCurrentSum / n),
+                 (long)(st.hubCurrentSum / n));
+    }
+    w.print("</table>");
+    w.printf("<p>Sensor wake &rarr; first publish: <b>%u ms</b> (via %s, assoc %s, MQTT connect %u ms)</p>",
+             (unsigned)g_sensorConnect.bootToFirstPubMs,
+             g_sensorConnect.transport ? g_sensorConnect.transport : "-",
+             g_sensorConnect.assocCached ? "cached" : "scan",
+             (unsigned)g_sensorConnect.mqttConnMs);
+    const HubIngest::Stats& rx = g_ingest.stats();
+    w.printf("<p>Delivery: accepted %u, duplicates dropped %u, reordered %u, "
+             "sensor retransmits %u, sensor window drops %u</p>",
+             (unsigned)rx.accepted,
+             (unsigned)rx.duplicates,
+             (unsigned)rx.reordered,
+             (unsigned)g_txRetransmits,
+             (unsigned)g_txDropped);
+    w.printf("<p>Backfill: sensor pending %u, batches %u, rows merged %u / %u "
+             "(duplicates %u, thinned %u), merge %u us (max %u)</p>",
+             (unsigned)g_backfill.sensorPending,
+             (unsigned)rx.backfillBatches,
+             (unsigned)rx.backfillMerged,
+             (unsigned)rx.backfillRows,
+             (unsigned)rx.backfillDuplicates,
+             (unsigned)rx.backfillThinned,
+             (unsigned)g_backfill.lastMergeUs,
+             (unsigned)g_backfill.maxMergeUs);
+    w.printf("<p>Sensor time sync: requests %u, rtt %u ms, drift %.1f ppm, "
+             "last correction %ld ms, stamped %u, out of range %u</p>",
+             (unsigned)rx.timeRequests,
+             (unsigned)g_sensorTime.rttMs,
+             g_sensorTime.driftPpm,
+             (long)g_sensorTime.errMs,
+             (unsigned)rx.timeStamped,
+             (unsigned)rx.timeRejected);
+
+    // センサーの健全性（異常検知）
+    w.print("<h3>Sensor health</h3>");
+    w.print("<table><tr><th>Device</th><th>State</th><th>Last seen</th><th>Interval</th>"
+            "<th>Accepted</th><th>Flagged</th><th>Quarantined</th><th>T mean / sd</th></tr>");
+    {
+        uint32_t now = millis();
+        for (size_t i = 0; i < AnomalyDetector::MaxDevices; ++i) {
+            const auto& d = g_ingest.anomaly().devices()[i];
+            if (!d.hash) continue;
+            char fbuf[40];
+            w.print("<tr><td>");
+            w.printHtml(d.name);
+            w.printf("</td><td>%s</td><td>%u s ago</td><td>%.1f s</td>"
+                     "<td>%u</td><td>%u</td><td>%u</td><td>%.2f / %.2f</td></tr>",
+                     anomalyFlagsString(g_ingest.anomaly().healthFlags(d, now), fbuf, sizeof(fbuf)),
+                     (unsigned)((now - d.lastMs) / 1000),
+                     d.intervalMs / 1000.0f,
+                     (unsigned)d.accepted,
+                     (unsigned)d.flagged,
+                     (unsigned)d.quarantined,
+                     d.f[0].mean,
+                     sqrtf(d.f[0].var));
+        }
+    }
+    w.print("</table>");
+
+    // デバイスごとの校正
+    w.print("<h3>Calibration</h3>");
+    w.printf("<p>Epoch <b>%u</b>", (unsigned)g_cal.epoch);
+    {
+        size_t pending = recalPending();
+        if (pending) w.printf(" (recomputing %u log rows)", (unsigned)pending);
+    }
+    w.print(" &mdash; value = raw &times; gain + offset (temperature also gets the offset above). "
+            "Logs keep raw values, so history always follows the current calibration.</p>");
+    w.print("<table><tr><th>Device</th><th>T gain/offset</th><th>H gain/offset</th>"
+            "<th>P gain/offset</th><th>Action</th></tr>");
+    for (const auto& d : g_cal.dev) {
+        if (!d.device[0]) continue;
+        w.print("<tr><td>");
+        w.printHtml(d.device);
+        w.printf("</td><td>%.3f / %.2f</td><td>%.3f / %.2f</td><td>%.3f / %.2f</td>",
+                 d.t.gain, d.t.offset, d.h.gain, d.h.offset, d.p.gain, d.p.offset);
+        w.print("<td><a class='btn' href='/calibration?redirect=1&amp;remove=1&amp;device=");
+        w.printHtml(d.device);
+        w.print("'>Remove</a></td></tr>");
+    }
+    w.print("</table>");
+    w.print("<form method='POST' action='/calibration'>"
+            "<input type='hidden' name='redirect' value='1'>"
+            "Device <input type='text' name='device' size='10' value='stackchan1'> "
+            "T <input type='text' name='t_gain' size='4' value='1'>"
+            "<input type='text' name='t_offset' size='4' value='0'> "
+            "H <input type='text' name='h_gain' size='4' value='1'>"
+            "<input type='text' name='h_offset' size='4' value='0'> "
+            "P <input type='text' name='p_gain' size='4' value='1'>"
+            "<input type='text' name='p_offset' size='4' value='0'> "
+            "<input type='submit' value='Set'></form>");
+
+    // 設定（スキーマから生成）
+    w.print("<h3>Settings</h3>");
+    if (g_cfgNeedsRestart) {
+        w.print("<p><b>SoftAP settings change on next restart.</b></p>");
+    }
+    w.print("<form method='POST' action='/api/config'>"
+            "<input type='hidden' name='redirect' value='1'><table>");
+    for (size_t i = 0; i < CONFIG_SCHEMA_COUNT; ++i) {
+        char val[CFG_VALUE_MAX];
+        formatConfigField(g_cfg, CONFIG_SCHEMA[i], val, sizeof(val), false);
+        w.printf("<tr><td>%s</td><td><input type='text' name='%s' value='",
+                 CONFIG_SCHEMA[i].key, CONFIG_SCHEMA[i].key);
+        w.printHtml(val);
+        w.print("' size='16'></td></tr>");
+    }
+    w.print("</table><p><input type='submit' value='Save'> "
+            "<a class='btn' href='/api/config?reset=1&amp;redirect=1'>Defaults</a> "
+            "<a class='btn' href='/api/config'>JSON</a></p></form>");
+
+    // 表情 / LED ルール
+    w.print("<h3>Rules</h3>");
+    w.print("<p>Active: <b>");
+    if (g_activeRule >= 0) {
+        w.printf("%d (%s)", (int)g_activeRule, expressionName(g_rules[g_activeRule].expr));
+    } else {
+        w.print("none");
+    }
+    w.print("</b>");
+    w.print(g_rulesCustom ? " &mdash; custom /rules.txt" : " &mdash; from Settings zones");
+    w.print("</p><p>Line format: <code>&lt;expression&gt; r,g,b [axis:lo..hi] ...</code> "
+            "(axes T, H, P, DI, DP, HI, PT; lo &lt;= v &lt; hi; first match wins), "
+            "<code>hyst T:0.3 H:2 ...</code></p>");
+    w.print("<form method='POST' action='/rules'>"
+            "<input type='hidden' name='redirect' value='1'>"
+            "<textarea name='rules' rows='8' cols='60'>");
+    formatRulesText(g_rulesText, sizeof(g_rulesText));
+    w.print(g_rulesText);
+    w.print("</textarea><p><input type='submit' value='Upload'> "
+            "<a class='btn' href='/rules?reset=1&amp;redirect=1'>Use Settings zones</a></p></form>");
+
+    // ログ一覧
+    w.print("<h3>Logs</h3>");
+    size_t pages = (g_logCount + LOG_PAGE_ROWS - 1) / LOG_PAGE_ROWS;
+    if (pages && page >= pages) page = pages - 1;
+    size_t shownFrom = page * LOG_PAGE_ROWS;   // 新しい方から数えた位置
+    size_t shownTo   = shownFrom + LOG_PAGE_ROWS;
+    if (shownTo > g_logCount) shownTo = g_logCount;
+
+    w.printf("<p>Total: %u / %u (%s)%s", (unsigned)(g_logCount - g_logDead), (unsigned)logCapacity(),
+             g_logsInPsram ? "PSRAM" : "SRAM",
+             logLoadPending() ? " &mdash; loading older logs..." : "");
+    if (g_logCount) {
+        w.printf(" &mdash; showing %u&ndash;%u, newest first",
+                 (unsigned)(shownFrom + 1), (unsigned)shownTo);
+    }
+    w.print("</p><p>");
+    if (page > 0) {
+        w.printf("<a class='btn' href='/?page=%u'>Newer</a> ", (unsigned)(page - 1));
+    }
+    if (page + 1 < pages) {
+        w.printf("<a class='btn' href='/?page=%u'>Older</a>", (unsigned)(page + 1));
+    }
+    w.print("</p>");
+
+    // 要約（全件 = ブロック要約、このページ = 列の直接集計）
+    if (g_logCount) {
+        ColumnScan::Agg all[LF_COUNT], shown[LF_COUNT];
+        logSummary(all);
+        logRangeSummary(g_logCount - shownTo, g_logCount - shownFrom, shown);
+        w.print("<table><tr><th>Summary</th><th>n</th>"
+                "<th>Temp min / avg / max</th><th>Hum min / avg / max</th>"
+                "<th>Press min / avg / max</th></tr>");
+        renderLogSummaryRow(w, "All", all);
+        renderLogSummaryRow(w, "This page", shown);
+        w.print("</table><br>");
+    }
+
+    w.print("<table><tr>"
+            "<th>#</th>"
+            "<th>Datetime</th>"
+            "<th>Temp</th>"
+            "<th>Hum</th>"
+            "<th>Press</th>"
+            "<th>Dew</th>"
+            "<th>HI</th>"
+            "<th>AH</th>"
+            "<th>Trend</th>"
+            "<th>Flags</th>"
+            "<th>Action</th>"
+            "</tr>");
+
+    for (size_t k = shownFrom; k < shownTo; ++k) {
+        size_t i = g_logCount - 1 - k;
+        if (logSlot(i).deleted) continue;   // 詰めるまでは番号を残したまま飛ばす
+        const auto& e = logAt(i);
+
+        char tbuf[20];
+        char trend[12];
+        char fbuf[40];
+        EpochClock::format(e.time, tbuf, sizeof(tbuf));
+        if (isnan(e.pressureTrend)) {
+            snprintf(trend, sizeof(trend), "-");
+        } else {
+            snprintf(trend, sizeof(trend), "%.1f", e.pressureTrend);
+        }
+
+        w.printf("<tr><td>%u</td><td>%s</td><td>%.1f</td><td>%.0f</td><td>%.1f</td>",
+                 (unsigned)i, tbuf, e.temperature, e.humidity, e.pressure);
+        w.printf("<td>%.1f</td><td>%.1f</td><td>%.1f</td><td>%s</td><td>%s</td>",
+                 e.dewPoint, e.heatIndex, e.absHumidity, trend,
+                 anomalyFlagsString(e.anomalyFlags, fbuf, sizeof(fbuf)));
+        w.printf("<td><a class='btn' href='/delete?index=%u'>Delete</a></td></tr>", (unsigned)i);
+    }
+
+    w.print("</table>");
+
+    if (g_logCount > 0) {
+        w.print("<p><a class='btn' href='/clear'>Clear All Logs</a></p>");
+    }
+
+    w.print("<hr><p>操作メモ：<br>"
+            "- 起動直後は本体画面にQRコードが出ます。<br>"
+            "- スマホでWi-Fi用QR → Web用QRの順に読むと、このページを開けます。<br>"
+            "- Avatar画面でもこのページからオフセットとログ操作ができます。</p>");
+
+    w.print("</body></html>");
+}
+
+void handleRoot() {
+    size_t page = server.hasArg("page") ? (size_t)server.arg("page").toInt() : 0;
+    ensureLogRows((page + 2) * LOG_PAGE_ROWS);   // 表示するページと「次」の有無の分だけ読む
+    ChunkWriter w = beginChunked("text/html");
+    renderConsole(w, page);
+    endChunked(w);
+}
+
+// ======================================================================
+//  HTTP: オフセット変更
+// ======================================================================
+void handleOffset() {
+    if (!server.hasArg("delta")) {
+        server.send(400, "text/plain", "delta param required");
+        return;
+    }
+
+    HubConfig next = g_cfg;
+    next.tempOffset += server.arg("delta").toFloat();
 
-    g_servoAttached = true;
-}
+    const char* err = nullptr;
+    if (!commitConfig(next, err)) {
+        server.send(400, "text/plain", err);
+        return;
+    }
 
-// ======================================================================
-//  ボタン操作音
-// ======================================================================
-void playClickSound() {
-    M5.Speaker.tone(1000, 40);
+    server.sendHeader("Location", "/");
+    server.send(303, "text/plain", "Redirecting...");
 }
 
 // ======================================================================
-//  公式風 IDLE モーション
+//  HTTP: 海面気圧の設定
+//   hpa=<値>   : 直接指定
+//   delta=<値> : 相対変更
+//   alt=<m>    : 現在の気圧と既知の標高から逆算
 // ======================================================================
-void updateServoIdle() {
-    if (!g_servoAttached) return;
-
-    unsigned long now = millis();
-
-    const float PI_F    = 3.1415926f;
-    const float PERIOD  = 4.5f;
-    float t = now / 1000.0f;
-    float s = sinf(2.0f * PI_F * t / PERIOD);  // -1〜1
+void handleSeaLevel() {
+    float slp = g_cfg.seaLevelhPa;
+
+    if (server.hasArg("hpa")) {
+        slp = server.arg("hpa").toFloat();
+    } else if (server.hasArg("delta")) {
+        slp += server.arg("delta").toFloat();
+    } else if (server.hasArg("alt")) {
+        if (!g_env.valid) {
+            server.send(400, "text/plain", "no pressure data yet");
+            return;
+        }
+        float alt = server.arg("alt").toFloat();
+        slp = g_env.pressure / powf(1.0f - alt / 44330.0f, 1.0f / 0.1903f);
+    } else {
+        server.send(400, "text/plain", "hpa, delta or alt param required");
+        return;
+    }
 
-    int yaw = SERVO_X_CENTER + (int)(SERVO_X_AMPLITUDE * s);
-    yaw = constrain(yaw, 0, 180);
-    servoX.write(yaw);
+    if (!(slp >= SEA_LEVEL_MIN_HPA && slp <= SEA_LEVEL_MAX_HPA)) {
+        server.send(400, "text/plain", "sea level out of range (900-1100 hPa)");
+        return;
+    }
 
-    if (now >= g_nextPoseChangeMs) {
-        static const int offsets[] = { -15, -5, 0, 5, 10 };
-        int idx = random(0, 5);
-        int base = SERVO_Y_CENTER + offsets[idx];
-        base = constrain(base, 40, 140);
-        g_servoYTarget = base;
+    HubConfig next = g_cfg;
+    next.seaLevelhPa = slp;
 
-        unsigned long interval = (unsigned long)random(5000, 12001);
-        g_nextPoseChangeMs = now + interval;
+    const char* err = nullptr;
+    if (!commitConfig(next, err)) {
+        server.send(400, "text/plain", err);
+        return;
     }
 
-    g_servoYCurrent += (g_servoYTarget - g_servoYCurrent) * 0.05f;
-    int pitch = (int)(g_servoYCurrent + 0.5f);
-    pitch = constrain(pitch, 0, 180);
-    servoY.write(pitch);
+    server.sendHeader("Location", "/");
+    server.send(303, "text/plain", "Redirecting...");
 }
 
 // ======================================================================
-//  Avatar 表情（温度→表情ヘルパーを使用）
-//   表情が変わったタイミングで g_requestScream = true にする
+//  HTTP: リンクプロファイル切り替え（AP に適用しセンサーへ配信）
 // ======================================================================
-void updateAvatarExpression() {
-    if (!g_env.valid) {
-        avatar.setExpression(Expression::Neutral);
-        g_lastExpression  = Expression::Neutral;
-        g_exprInitialized = true;
+void handleLink() {
+    LinkProfile p;
+    if (!server.hasArg("p") || !parseLinkProfile(server.arg("p").c_str(), p)) {
+        server.send(400, "text/plain", "p=lowlatency|balanced|lowpower required");
         return;
     }
 
-    Expression newExpr = getExpressionForTemp(g_env.temperature);
+    HubConfig next = g_cfg;
+    next.linkProfile = p;
 
-    if (!g_exprInitialized) {
-        // 起動直後は「変化」とみなさない（いきなり鳴かない）
-        g_lastExpression  = newExpr;
-        g_exprInitialized = true;
-    } else if (newExpr != g_lastExpression) {
-        // 表情が変わったタイミングでだけ鳴きリクエスト
-        g_requestScream = true;
-        g_lastExpression = newExpr;
+    const char* err = nullptr;
+    if (!commitConfig(next, err)) {
+        server.send(400, "text/plain", err);
+        return;
     }
 
-    avatar.setExpression(newExpr);
+    server.sendHeader("Location", "/");
+    server.send(303, "text/plain", "Redirecting...");
 }
 
 // ======================================================================
-//  吹き出し
+//  HTTP: 表情 / LED ルール
+//   GET /rules        : ルールをテキストで返す
+//   rules=<テキスト>  : 解析できたら差し替えて保存（1 行でも不正なら何も変えない）
+//   reset=1           : /rules.txt を消して設定からの既定ルールに戻す
+//   redirect=1        : 成功時はコンソールへ戻す（フォーム用）
 // ======================================================================
-void updateSpeech() {
-    if (!g_showSpeech) {
-        avatar.setSpeechText("");
-        return;
+void refreshRuleOutputs() {
+    if (!g_env.valid) return;
+    evaluateRules();
+    markUiDirty(UI_DIRTY_ALL);
+    publishHubState();
+}
+
+void handleRules() {
+    if (server.hasArg("reset")) {
+        LittleFS.remove(RULES_FILE_PATH);
+        buildDefaultRules();
+        compileRules();
+        refreshRuleOutputs();
+    } else if (server.hasArg("rules")) {
+        const String& text = server.arg("rules");
+        if (text.length() >= sizeof(g_rulesText)) {
+            server.send(400, "text/plain", "rules too long");
+            return;
+        }
+        memcpy(g_rulesText, text.c_str(), text.length() + 1);
+
+        ExprRule rules[RuleTable::MaxRules];
+        size_t   count = 0;
+        float    hyst[RULE_AXIS_COUNT];
+        memcpy(hyst, g_ruleHyst, sizeof(hyst));
+        char     err[64];
+        if (!parseRulesText(g_rulesText, rules, count, hyst, err, sizeof(err))) {
+            server.send(400, "text/plain", err);
+            return;
+        }
+
+        memcpy(g_rules, rules, sizeof(ExprRule) * count);
+        memcpy(g_ruleHyst, hyst, sizeof(hyst));
+        g_ruleCount   = count;
+        g_rulesCustom = true;
+        saveRulesToFS();
+        compileRules();
+        refreshRuleOutputs();
     }
 
-    if (!g_env.valid) {
-        avatar.setSpeechText("Waiting MQTT...");
+    if (server.hasArg("redirect")) {
+        server.sendHeader("Location", "/");
+        server.send(303, "text/plain", "Redirecting...");
         return;
     }
 
-    char buf[200];
-    snprintf(buf, sizeof(buf),
-             "Temp: %.1fC  Hum: %.0f%%",
-             g_env.temperature,
-             g_env.humidity);
-
-    avatar.setSpeechText(buf);
+    formatRulesText(g_rulesText, sizeof(g_rulesText));
+    server.send(200, "text/plain", g_rulesText);
 }
 
-// ================================================================
-//  7. 通信層：Wi-Fi / MQTT
-// ================================================================
-
 // ======================================================================
-//  SoftAP 起動
+//  HTTP: デバイスごとの校正
+//   GET /calibration                          : 校正表（JSON）
+//   device=<名前>&t_gain=..&t_offset=..&...   : 登録 / 更新（省略した項目は今の値）
+//   device=<名前>&remove=1                    : 削除
+//   redirect=1                                : 成功時はコンソールへ戻す（フォーム用）
 // ======================================================================
-bool startSoftAP() {
-    WiFi.mode(WIFI_AP);
+bool parseCalArg(const char* name, float lo, float hi, float& out) {
+    if (!server.hasArg(name)) return true;
+    char v[24];
+    if (!copyArg(name, v, sizeof(v))) return false;
+    char* end;
+    float x = strtof(v, &end);
+    if (end == v || *end || !(x >= lo && x <= hi)) return false;
+    out = x;
+    return true;
+}
 
-    IPAddress local_ip(192, 168, 4, 1);
-    IPAddress gateway(192, 168, 4, 1);
-    IPAddress subnet(255, 255, 255, 0);
-    if (!WiFi.softAPConfig(local_ip, gateway, subnet)) {
-        return false;
+void handleCalibration() {
+    if (server.hasArg("device")) {
+        char name[sizeof(DeviceCal::device)];
+        if (!copyArg("device", name, sizeof(name)) || !name[0]) {
+            server.send(400, "text/plain", "device name 1-15 chars");
+            return;
+        }
+        uint32_t hash = hashTopic(name);
+
+        DeviceCal* slot = nullptr;
+        DeviceCal* free = nullptr;
+        for (auto& d : g_cal.dev) {
+            if (d.device[0] && d.deviceHash == hash) { slot = &d; break; }
+            if (!free && !d.device[0]) free = &d;
+        }
+
+        if (server.hasArg("remove")) {
+            if (slot) memset(slot, 0, sizeof(*slot));
+        } else {
+            DeviceCal next;
+            if (slot) {
+                next = *slot;
+            } else {
+                memset(&next, 0, sizeof(next));
+                strncpy(next.device, name, sizeof(next.device) - 1);
+                next.deviceHash = hash;
+                next.t = next.h = next.p = { 1.0f, 0.0f };
+            }
+
+            if (!parseCalArg("t_gain",   0.5f,  2.0f, next.t.gain)   ||
+                !parseCalArg("t_offset", -20.0f, 20.0f, next.t.offset) ||
+                !parseCalArg("h_gain",   0.5f,  2.0f, next.h.gain)   ||
+                !parseCalArg("h_offset", -30.0f, 30.0f, next.h.offset) ||
+                !parseCalArg("p_gain",   0.5f,  2.0f, next.p.gain)   ||
+                !parseCalArg("p_offset", -50.0f, 50.0f, next.p.offset)) {
+                server.send(400, "text/plain", "gain 0.5-2.0, offset T +-20 / H +-30 / P +-50");
+                return;
+            }
+
+            if (!slot) slot = free;
+            if (!slot) {
+                server.send(400, "text/plain", "calibration table full");
+                return;
+            }
+            *slot = next;
+        }
+
+        bumpCalEpoch();
+        if (g_env.valid) {
+            refreshEnvFromRaw();
+            evaluateRules();
+            markUiDirty(UI_DIRTY_ALL);
+            publishHubState();
+        }
     }
 
-    bool ok = WiFi.softAP(AP_SSID, AP_PASSWORD);
-    if (!ok) {
-        return false;
+    if (server.hasArg("redirect")) {
+        server.sendHeader("Location", "/");
+        server.send(303, "text/plain", "Redirecting...");
+        return;
     }
 
-    IPAddress ip = WiFi.softAPIP();
-    Serial.println("[WiFi] SoftAP started");
-    Serial.print("  SSID: "); Serial.println(AP_SSID);
-    Serial.print("  PASS: "); Serial.println(AP_PASSWORD);
-    Serial.print("  IP  : "); Serial.println(ip);
-    return true;
+    // 表は HUB_DEVICES_MAX 台まであるので、固定バッファに溜めずに流す
+    ChunkWriter w = beginChunked("application/json");
+    w.printf("{\"epoch\":%u,\"recal_pending\":%u,\"temp_offset\":%.2f,\"devices\":[",
+             (unsigned)g_cal.epoch, (unsigned)recalPending(), g_cfg.tempOffset);
+    bool first = true;
+    for (const auto& d : g_cal.dev) {
+        if (!d.device[0]) continue;
+        char dev[sizeof(d.device) * TextEscape::MAX_EXPANSION];
+        TextEscape::json(dev, sizeof(dev), d.device);
+        w.printf("%s{\"device\":\"%s\",\"t\":[%.4f,%.2f],\"h\":[%.4f,%.2f],\"p\":[%.4f,%.2f]}",
+                 first ? "" : ",", dev,
+                 d.t.gain, d.t.offset, d.h.gain, d.h.offset, d.p.gain, d.p.offset);
+        first = false;
+    }
+    w.print("]}");
+    endChunked(w);
 }
 
 // ======================================================================
-//  MQTT ブローカ
+//  HTTP: 設定（JSON）
+//   GET /api/config                 : 全項目を返す
+//   /api/config?<key>=<値>&...      : 指定項目をまとめて検証・保存（1 つでも不正なら何も変えない）
+//   reset=1                         : 既定値に戻す
+//   redirect=1                      : 成功時はコンソールへ戻す（フォーム用）
 // ======================================================================
-void startMQTTBroker() {
-    mqtt.subscribe("#", [](const char* topic, const char* payload) {
-        if (strcmp(topic, MQTT_TOPIC) != 0) return;
-
-        float t, h, p;
-        if (sscanf(payload, "%f,%f,%f", &t, &h, &p) == 3) {
-            float finalT = t + g_tempOffset;
-
-            g_env.temperature = finalT;
-            g_env.humidity    = h;
-            g_env.pressure    = p;
-            g_env.valid       = true;
-
-            addLogEntry(g_env);
-            updateAvatarExpression();  // ここではフラグを立てるだけ
-            updateSpeech();
-            updateLedsForTemp();       // ここでも必要ならフラグを立てる
+void handleConfig() {
+    HubConfig next = server.hasArg("reset") ? defaultConfig() : g_cfg;
+    bool changed = server.hasArg("reset");
+
+    for (size_t i = 0; i < CONFIG_SCHEMA_COUNT; ++i) {
+        const CfgField& f = CONFIG_SCHEMA[i];
+        if (!server.hasArg(f.key)) continue;
+        if (!parseConfigField(next, f, server.arg(f.key).c_str())) {
+            char msg[64];
+            snprintf(msg, sizeof(msg), "invalid value for %s", f.key);
+            server.send(400, "text/plain", msg);
+            return;
         }
-    });
+        changed = true;
+    }
 
-    mqtt.begin();
-    Serial.println("[MQTT] Broker started (PicoMQTT)");
-}
+    if (changed) {
+        const char* err = nullptr;
+        if (!commitConfig(next, err)) {
+            server.send(400, "text/plain", err);
+            return;
+        }
+    }
 
-// ================================================================
-//  8. HTTP 層：Webコンソール・RTC設定
-// ================================================================
+    if (server.hasArg("redirect")) {
+        server.sendHeader("Location", "/");
+        server.send(303, "text/plain", "Redirecting...");
+        return;
+    }
+
+    char*  json = g_httpJson;
+    size_t n = 0;
+    char   val[CFG_VALUE_MAX];
+
+    appendf(json, HTTP_JSON_SIZE, n, "{\"version\":%u,\"restart_required\":%s,\"config\":{",
+            (unsigned)CONFIG_VERSION, g_cfgNeedsRestart ? "true" : "false");
+    for (size_t i = 0; i < CONFIG_SCHEMA_COUNT; ++i) {
+        formatConfigField(g_cfg, CONFIG_SCHEMA[i], val, sizeof(val), true);
+        appendf(json, HTTP_JSON_SIZE, n, "%s\"%s\":%s", i ? "," : "", CONFIG_SCHEMA[i].key, val);
+    }
+    appendf(json, HTTP_JSON_SIZE, n, "}}");
+
+    sendJson(json, n);
+}
 
 // ======================================================================
-//  HTTP: ルート（Webコンソール）
+//  HTTP: ログの問い合わせ（JSON, チャンク送信）
+//   GET /api/query?from=&to=&days=&where=&field=&every=&limit=
+//     from / to : エポック秒 または "YYYY/MM/DD HH:MM:SS"（省略 = 全期間）
+//     days      : from を「今から N 日前」にする
+//     where     : ルールと同じ範囲指定 "T:28.." / "H:..40" / "P:1000..1010"
+//     field     : 集計する項目 T / H / P（省略 = where の項目, 無ければ T）
+//     every     : 集計間隔（秒, または 15m / 1h / 1d）。省略 = 当てはまる行を返す
+//     limit     : 返す行 / 区間の上限（既定 QUERY_LIMIT_DEFAULT）
+//   結果: {"field":"T","every":N,"rows":[[time,T,H,P],...]} または
+//         {"field":"T","every":N,"buckets":[[start,n,min,mean,max],...]}
+//         の後に "stats"（読んだブロック・行数、所要時間）
 // ======================================================================
-void handleRoot() {
-    String html;
-    html.reserve(4096);
-
-    html += "<!DOCTYPE html><html><head><meta charset='UTF-8'>";
-    html += "<title>Stackchan Env Console</title>";
-    html += "<meta name='viewport' content='width=device-width,initial-scale=1'>";
-    html += "<style>";
-    html += "body{font-family:sans-serif;margin:8px;}";
-    html += "table{border-collapse:collapse;width:100%;}";
-    html += "th,td{border:1px solid #ccc;padding:4px;font-size:12px;}";
-    html += "th{background:#eee;}";
-    html += "a.btn{display:inline-block;margin:2px 4px;padding:4px 8px;border:1px solid #333;";
-    html += "border-radius:4px;text-decoration:none;font-size:12px;}";
-    html += "</style></head><body>";
-
-    html += "<h2>Stackchan Env Console</h2>";
+constexpr uint32_t QUERY_LIMIT_DEFAULT = 1000;
 
-    // 現在値
-    html += "<h3>Current</h3><ul>";
-    if (!g_env.valid) {
-        html += "<li>Waiting MQTT...</li>";
-    } else {
-        html += "<li>Temperature: " + String(g_env.temperature, 1) +
-                " &deg;C (offset " + String(g_tempOffset, 1) + " &deg;C)</li>";
-        html += "<li>Humidity: " + String(g_env.humidity, 0) + " %</li>";
-        html += "<li>Pressure: " + String(g_env.pressure, 1) + " hPa</li>";
+const char* const LOG_FIELD_NAMES[LF_COUNT] = { "T", "H", "P" };
+
+int8_t parseLogField(const char* s) {
+    for (uint8_t f = 0; f < LF_COUNT; ++f) {
+        if (strcasecmp(s, LOG_FIELD_NAMES[f]) == 0) return (int8_t)f;
     }
-    html += "</ul>";
+    return -1;
+}
 
-    // RTC表示 + 設定リンク
-    {
-        char nowBuf[20];
-        getCurrentDatetimeString(nowBuf, sizeof(nowBuf));
+// 失敗 = 0
+uint32_t parseQueryTime(const char* s) {
+    if (strchr(s, '/')) return EpochClock::parse(s);
+    char* end;
+    unsigned long v = strtoul(s, &end, 10);
+    return (*s && !*end) ? (uint32_t)v : 0;
+}
+
+// "900" / "15m" / "1h" / "1d"（失敗 = 0）
+uint32_t parseQueryInterval(const char* s) {
+    char* end;
+    unsigned long v = strtoul(s, &end, 10);
+    if (end == s) return 0;
+    if      (!*end)                        return (uint32_t)v;
+    else if (!strcmp(end, "s"))            return (uint32_t)v;
+    else if (!strcmp(end, "m"))            return (uint32_t)(v * 60);
+    else if (!strcmp(end, "h"))            return (uint32_t)(v * 3600);
+    else if (!strcmp(end, "d"))            return (uint32_t)(v * 86400);
+    return 0;
+}
 
-        html += "<h3>RTC Time</h3>";
-        html += "<p>Current RTC: <b>";
-        html += nowBuf;
-        html += "</b></p>";
-        html += "<p><a class='btn' href='/settime'>Set RTC Time</a></p>";
+// "T:28.." → 項目と固定小数点の範囲
+bool parseQueryWhere(const char* s, LogQuery::Params& p) {
+    const char* colon = strchr(s, ':');
+    const char* dots  = strstr(s, "..");
+    if (!colon || !dots || dots < colon || colon - s != 1) return false;
+
+    char name[2] = { s[0], '\0' };
+    int8_t f = parseLogField(name);
+    if (f < 0) return false;
+    float scale = LOG_FIELD_SCALE[f];
+
+    char* end;
+    if (dots > colon + 1) {
+        float lo = strtof(colon + 1, &end);
+        if (end != dots) return false;
+        p.lo = ColumnScan::encode(lo, scale);
+    }
+    if (dots[2]) {
+        float hi = strtof(dots + 2, &end);
+        if (*end) return false;
+        p.hi = ColumnScan::encode(hi, scale);
     }
+    p.whereField = f;
+    return p.lo <= p.hi;
+}
 
-    // オフセット操作
-    html += "<h3>Offset</h3>";
-    html += "<p>Temp offset: <b>" + String(g_tempOffset, 1) + " &deg;C</b></p>";
-    html += "<p>";
-    html += "<a class='btn' href='/offset?delta=-0.5'>-0.5 C</a>";
-    html += "<a class='btn' href='/offset?delta=0.5'>+0.5 C</a>";
-    html += "</p>";
+struct QueryOut {
+    ChunkWriter* w;
+    uint8_t      field;
+    bool         first;
+};
 
-    // ログ一覧
-    html += "<h3>Logs</h3>";
-    html += "<p>Total: " + String((int)g_logCount) + "</p>";
+void queryRowSink(void* ctx, uint32_t time, const int16_t v[LogQuery::FIELDS]) {
+    QueryOut* o = (QueryOut*)ctx;
+    o->w->printf("%s[%lu,%.2f,%.2f,%.1f]", o->first ? "" : ",",
+                 (unsigned long)time,
+                 ColumnScan::decode(v[LF_T], ColumnScan::T_SCALE),
+                 ColumnScan::decode(v[LF_H], ColumnScan::H_SCALE),
+                 ColumnScan::decode(v[LF_P], ColumnScan::P_SCALE));
+    o->first = false;
+}
 
-    html += "<table><tr>"
-            "<th>#</th>"
-            "<th>Datetime</th>"
-            "<th>Temp</th>"
-            "<th>Hum</th>"
-            "<th>Press</th>"
-            "<th>Action</th>"
-            "</tr>";
+void queryBucketSink(void* ctx, uint32_t start, const ColumnScan::Agg& a) {
+    QueryOut* o = (QueryOut*)ctx;
+    float scale = LOG_FIELD_SCALE[o->field];
+    o->w->printf("%s[%lu,%u,%.2f,%.2f,%.2f]", o->first ? "" : ",",
+                 (unsigned long)start, (unsigned)a.count,
+                 ColumnScan::decode(a.min, scale), a.mean(scale),
+                 ColumnScan::decode(a.max, scale));
+    o->first = false;
+}
 
-    for (size_t i = 0; i < g_logCount; ++i) {
-        const auto& e = g_logs[i];
+void handleQuery() {
+    LogQuery::Params p;
+    p.limit = QUERY_LIMIT_DEFAULT;
 
-        html += "<tr>";
-        html += "<td>" + String((int)i) + "</td>";
-        html += "<td>" + String(e.datetime) + "</td>";
-        html += "<td>" + String(e.temperature, 1) + "</td>";
-        html += "<td>" + String(e.humidity, 0)    + "</td>";
-        html += "<td>" + String(e.pressure, 1)    + "</td>";
-        html += "<td><a class='btn' href='/delete?index=" + String((int)i) +
-                "'>Delete</a></td>";
-        html += "</tr>";
+    if (server.hasArg("days")) {
+        long days = server.arg("days").toInt();
+        uint32_t now = nowEpoch();
+        if (days <= 0 || !now) {
+            server.send(400, "text/plain", "days must be > 0 (and the clock set)");
+            return;
+        }
+        p.from = (now > (uint32_t)days * 86400) ? now - (uint32_t)days * 86400 : 0;
+    }
+    if (server.hasArg("from") && !(p.from = parseQueryTime(server.arg("from").c_str()))) {
+        server.send(400, "text/plain", "bad from");
+        return;
+    }
+    if (server.hasArg("to") && !(p.to = parseQueryTime(server.arg("to").c_str()))) {
+        server.send(400, "text/plain", "bad to");
+        return;
+    }
+    if (server.hasArg("where") && !parseQueryWhere(server.arg("where").c_str(), p)) {
+        server.send(400, "text/plain", "where must be like T:28.. / H:..40 / P:1000..1010");
+        return;
+    }
+    p.field = (p.whereField >= 0) ? (uint8_t)p.whereField : (uint8_t)LF_T;
+    if (server.hasArg("field")) {
+        int8_t f = parseLogField(server.arg("field").c_str());
+        if (f < 0) {
+            server.send(400, "text/plain", "field must be T, H or P");
+            return;
+        }
+        p.field = (uint8_t)f;
+    }
+    if (server.hasArg("every") && !(p.every = parseQueryInterval(server.arg("every").c_str()))) {
+        server.send(400, "text/plain", "every must be seconds or 15m / 1h / 1d");
+        return;
+    }
+    if (server.hasArg("limit")) {
+        long limit = server.arg("limit").toInt();
+        if (limit > 0) p.limit = (uint32_t)limit;
     }
 
-    html += "</table>";
-
-    if (g_logCount > 0) {
-        html += "<p><a class='btn' href='/clear'>Clear All Logs</a></p>";
+    uint32_t t0 = micros();
+    // 読み込み済みの最古より前を含むなら残りを先に読む
+    if (logLoadPending() && (!g_logCount || p.from <= g_colTime[g_logHead])) {
+        finishLogLoad();
     }
+    ChunkWriter w = beginChunked("application/json");
+    QueryOut out = { &w, p.field, true };
+    w.printf("{\"from\":%lu,\"to\":%lu,\"field\":\"%s\",\"every\":%lu,\"%s\":[",
+             (unsigned long)p.from, (unsigned long)p.to, LOG_FIELD_NAMES[p.field],
+             (unsigned long)p.every, p.every ? "buckets" : "rows");
+
+    LogQuery q(p, queryRowSink, queryBucketSink, &out);
+    runLogQuery(q);
+
+    const LogQuery::Stats& st = q.stats();
+    w.printf("],\"stats\":{\"log_rows\":%u,\"blocks\":%u,\"pruned\":%u,\"folded\":%u,"
+             "\"scanned\":%u,\"rows_read\":%u,\"matched\":%u,\"returned\":%u,"
+             "\"truncated\":%s,\"us\":%lu}}",
+             (unsigned)g_logCount, (unsigned)st.blocks, (unsigned)st.pruned,
+             (unsigned)st.folded, (unsigned)st.scanned, (unsigned)st.rows,
+             (unsigned)st.matched, (unsigned)st.emitted,
+             q.full() ? "true" : "false", (unsigned long)(micros() - t0));
+    endChunked(w);
+}
 
-    html += "<hr><p>操作メモ：<br>"
-            "- 起動直後は本体画面にQRコードが出ます。<br>"
-            "- スマホでWi-Fi用QR → Web用QRの順に読むと、このページを開けます。<br>"
-            "- Avatar画面でもこのページからオフセットとログ操作ができます。</p>";
+// ======================================================================
+//  HTTP: 計測値（JSON）
+// ======================================================================
+// 戻り値 = JSON の長さ（"health":[ まで。配列の中身と閉じは handleMetrics が続ける）。
+//   0 = cap に収まらなかった
+size_t buildMetricsJson(char* json, size_t cap) {
+    size_t n = 0;
+
+    appendf(json, cap, n,
+            "{\"uptime_ms\":%lu,\"heap_free\":%u,\"heap_min\":%u,\"heap_largest\":%u,"
+            "\"static_bytes\":%u,\"psram_bytes\":%u,\"ap_stations\":%u,\"hub_current_ma\":%ld,",
+            millis(),
+            (unsigned)ESP.getFreeHeap(),
+            (unsigned)ESP.getMinFreeHeap(),
+            (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+            (unsigned)staticMemoryBytes(),
+            (unsigned)psramMemoryBytes(),
+            (unsigned)WiFi.softAPgetStationNum(),
+            (long)M5.Power.getBatteryCurrent());
+
+    appendf(json, cap, n,
+            "\"log_store\":{\"location\":\"%s\",\"slots\":%u,\"capacity\":%u,\"count\":%u,"
+            "\"entry_bytes\":%u,\"column_bytes\":%u,\"bytes\":%u,\"psram_free\":%u,"
+            "\"read_ns_seq\":%.0f,\"read_ns_rand\":%.0f,\"read_ns_sram\":%.0f},",
+            g_logsInPsram ? "psram" : "sram",
+            (unsigned)g_logSlots,
+            (unsigned)logCapacity(),
+            (unsigned)g_logCount,
+            (unsigned)sizeof(EnvLogEntry),
+            (unsigned)LOG_COLUMN_BYTES,
+            (unsigned)logStoreBytes(),
+            (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+            g_logReadNsSeq, g_logReadNsRand, g_logReadNsSram);
+
+    appendf(json, cap, n,
+            "\"boot\":{\"fs_ms\":%lu,\"config_ms\":%lu,\"softap_ms\":%lu,\"log_tail_ms\":%lu,"
+            "\"broker_ms\":%lu,\"http_ms\":%lu,\"setup_ms\":%lu,\"log_tail_rows\":%u,"
+            "\"log_tail_load_ms\":%lu,\"log_loading\":%s,\"log_loaded_ms\":%lu,"
+            "\"warm\":%s,\"reset_reason\":%u,\"warm_boots\":%lu,\"snapshot_seq\":%lu,"
+            "\"snapshot_writes\":%lu},",
+            (unsigned long)g_boot.fsMs, (unsigned long)g_boot.configMs,
+            (unsigned long)g_boot.softApMs, (unsigned long)g_boot.logTailMs,
+            (unsigned long)g_boot.brokerMs, (unsigned long)g_boot.httpMs,
+            (unsigned long)g_boot.setupMs, (unsigned)g_logLoad.tailRows,
+            (unsigned long)g_logLoad.tailMs,
+            logLoadPending() ? "true" : "false", (unsigned long)g_logLoad.doneMs,
+            g_boot.warm ? "true" : "false", (unsigned)g_boot.resetReason,
+            (unsigned long)g_snapWarmBoots, (unsigned long)g_snapSeq,
+            (unsigned long)g_snapWrites);
+
+    appendf(json, cap, n, "\"link\":{\"profile\":\"%s\",\"profiles\":{",
+            LINK_PROFILES[(uint8_t)g_cfg.linkProfile].name);
+    for (uint8_t i = 0; i < LINK_PROFILE_COUNT; ++i) {
+        const auto& st = g_linkStats[i];
+        uint32_t d = st.reports ? st.reports : 1;
+        appendf(json, cap, n,
+                "%s\"%s\":{\"reports\":%u,\"assoc_ms\":%u,\"assoc_ms_max\":%u,"
+                "\"pub_avg_us\":%u,\"pub_max_us\":%u,\"sensor_ma\":%ld,\"hub_ma\":%ld,"
+                "\"batt_mv\":%d,\"rssi\":%d}",
+                i ? "," : "",
+                LINK_PROFILES[i].name,
+                (unsigned)st.reports,
+                (unsigned)st.lastAssocMs,
+                (unsigned)st.assocMsMax,
+                (unsigned)(st.pubAvgUsSum / d),
+                (unsigned)st.pubMaxUs,
+                (long)(st.sensorCurrentSum / d),
+                (long)(st.hubCurrentSum / d),
+                (int)st.lastBattmV,
+                (int)st.lastRssi);
+    }
+    appendf(json, cap, n, "}},");
+
+    appendf(json, cap, n,
+            "\"sensor_connect\":{\"transport\":\"%s\",\"boot_to_first_pub_ms\":%u,"
+            "\"mqtt_connect_ms\":%u,\"assoc_cached\":%s,\"cached_reports\":%u,\"scan_reports\":%u},",
+            g_sensorConnect.transport ? g_sensorConnect.transport : "",
+            (unsigned)g_sensorConnect.bootToFirstPubMs,
+            (unsigned)g_sensorConnect.mqttConnMs,
+            g_sensorConnect.assocCached ? "true" : "false",
+            (unsigned)g_sensorConnect.cachedAssocs,
+            (unsigned)g_sensorConnect.scanAssocs);
+    appendf(json, cap, n, "\"transports\":{");
+    for (size_t i = 0; i < sizeof(g_transports) / sizeof(g_transports[0]); ++i) {
+        const EnvTransport& t = *g_transports[i];
+        appendf(json, cap, n,
+                "%s\"%s\":{\"ready\":%s,\"sent\":%u,\"failed\":%u,\"received\":%u,\"dropped\":%u,"
+                "\"rejected\":%u}",
+                i ? "," : "", t.name(), t.ready() ? "true" : "false",
+                (unsigned)t.stats().sent, (unsigned)t.stats().failed,
+                (unsigned)t.stats().received, (unsigned)t.stats().dropped,
+                (unsigned)t.stats().rejected);
+    }
+    appendf(json, cap, n, "},");
+    appendf(json, cap, n,
+            "\"broker\":{\"clients\":%u,\"client_limit\":%u,\"peak\":%u,\"connects\":%u,"
+            "\"rejected\":%u,\"max_stations\":%u,\"channel\":%u,\"slots_used\":%u,"
+            "\"slot_count\":%u,\"slots_assigned\":%u,\"slots_reassigned\":%u,\"slots_full\":%u,"
+            "\"replay_queued\":%u,\"replay_sent\":%u,\"replay_overflow\":%u,"
+            "\"payload_high_water\":%u,\"payload_oversize\":%u,\"payload_exhausted\":%u},",
+            (unsigned)g_brokerStats.clients,
+            (unsigned)g_brokerStats.limit,
+            (unsigned)g_brokerStats.peak,
+            (unsigned)g_brokerStats.connects,
+            (unsigned)g_brokerStats.rejected,
+            (unsigned)g_cfg.apMaxStations,
+            (unsigned)g_cfg.apChannel,
+            (unsigned)g_ingest.slotsUsed(),
+            (unsigned)g_cfg.publishSlots,
+            (unsigned)g_ingest.slots().stats().assigned,
+            (unsigned)g_ingest.slots().stats().reassigned,
+            (unsigned)g_ingest.slots().stats().full,
+            (unsigned)g_replayStats.queued,
+            (unsigned)g_replayStats.sent,
+            (unsigned)g_replayStats.overflow,
+            (unsigned)g_mqttPayloads.stats().highWater,
+            (unsigned)g_mqttPayloads.stats().oversize,
+            (unsigned)g_mqttPayloads.stats().exhausted);
+    {
+        uint32_t d = g_load.messages ? g_load.messages : 1;
+        uint32_t s = (millis() - g_load.sinceMs) / 1000;
+        appendf(json, cap, n,
+                "\"load\":{\"window_s\":%u,\"messages\":%u,\"rate_avg\":%.2f,\"rate_max\":%u,"
+                "\"route_us_avg\":%u,\"route_us_max\":%u,\"service_us_max\":%u,"
+                "\"servo_gap_ms_max\":%u,\"servo_late\":%u,\"loop_gap_ms_max\":%u,"
+                "\"loop_late\":%u},",
+                (unsigned)s,
+                (unsigned)g_load.messages,
+                s ? (float)g_load.messages / s : 0.0f,
+                (unsigned)g_load.rateMax,
+                (unsigned)(g_load.routeUsSum / d),
+                (unsigned)g_load.routeUsMax,
+                (unsigned)g_load.serviceUsMax,
+                (unsigned)g_load.servoGapMaxMs,
+                (unsigned)g_load.servoLate,
+                (unsigned)g_load.loopGapMaxMs,
+                (unsigned)g_load.loopLate);
+    }
+    const HubIngest::Stats& rx = g_ingest.stats();
+    appendf(json, cap, n,
+            "\"delivery\":{\"accepted\":%u,\"duplicates\":%u,\"reordered\":%u,"
+            "\"legacy\":%u,\"quarantined\":%u,\"sensor_retransmits\":%u,\"sensor_dropped\":%u},",
+            (unsigned)rx.accepted,
+            (unsigned)rx.duplicates,
+            (unsigned)rx.reordered,
+            (unsigned)rx.legacy,
+            (unsigned)rx.quarantined,
+            (unsigned)g_txRetransmits,
+            (unsigned)g_txDropped);
+    appendf(json, cap, n,
+            "\"backfill\":{\"batches\":%u,\"rows\":%u,\"merged\":%u,\"duplicates\":%u,"
+            "\"thinned\":%u,\"rejected\":%u,\"merge_us\":%u,\"merge_us_max\":%u,"
+            "\"sensor_pending\":%u},",
+            (unsigned)rx.backfillBatches,
+            (unsigned)rx.backfillRows,
+            (unsigned)rx.backfillMerged,
+            (unsigned)rx.backfillDuplicates,
+            (unsigned)rx.backfillThinned,
+            (unsigned)rx.backfillRejected,
+            (unsigned)g_backfill.lastMergeUs,
+            (unsigned)g_backfill.maxMergeUs,
+            (unsigned)g_backfill.sensorPending);
+    appendf(json, cap, n,
+            "\"time_sync\":{\"hub_epoch\":%lu,\"requests\":%u,\"stamped\":%u,"
+            "\"out_of_range\":%u,\"rtt_ms\":%u,\"drift_ppm\":%.1f,\"last_correction_ms\":%ld},",
+            (unsigned long)nowEpoch(),
+            (unsigned)rx.timeRequests,
+            (unsigned)rx.timeStamped,
+            (unsigned)rx.timeRejected,
+            (unsigned)g_sensorTime.rttMs,
+            g_sensorTime.driftPpm,
+            (long)g_sensorTime.errMs);
+
+    appendf(json, cap, n, "\"health_evictions\":%u,\"health\":[", (unsigned)g_ingest.anomaly().evictions());
+    return (n + 1 < cap) ? n : 0;   // appendf は cap - 1 で止まる：届いたら切れている
+}
 
-    html += "</body></html>";
+// デバイスごとの健全性（HUB_DEVICES_MAX 台ぶんは固定バッファに入らないので流す）
+void writeHealthJson(ChunkWriter& w) {
+    uint32_t now   = millis();
+    bool     first = true;
+    for (size_t i = 0; i < AnomalyDetector::MaxDevices; ++i) {
+        const auto& d = g_ingest.anomaly().devices()[i];
+        if (!d.hash) continue;
+        char fbuf[40];
+        char dev[sizeof(d.name) * TextEscape::MAX_EXPANSION];
+        TextEscape::json(dev, sizeof(dev), d.name);
+        w.printf("%s{\"device\":\"%s\",\"state\":\"%s\",\"last_seen_ms\":%u,"
+                 "\"interval_ms\":%u,\"accepted\":%u,\"flagged\":%u,\"quarantined\":%u,"
+                 "\"t_mean\":%.2f,\"t_sd\":%.3f}",
+                 first ? "" : ",", dev,
+                 anomalyFlagsString(g_ingest.anomaly().healthFlags(d, now), fbuf, sizeof(fbuf)),
+                 (unsigned)(now - d.lastMs),
+                 (unsigned)d.intervalMs,
+                 (unsigned)d.accepted,
+                 (unsigned)d.flagged,
+                 (unsigned)d.quarantined,
+                 d.f[0].mean,
+                 sqrtf(d.f[0].var));
+        first = false;
+    }
+}
 
-    server.send(200, "text/html", html);
+// デバイスに依らない部分は固定バッファで作り（0 = 収まらない → 途中で切れた JSON は返さない）、
+// health の配列だけ続けて流す
+void handleMetrics() {
+    if (server.arg("reset") == "load") resetLoadStats();
+    char*  json = g_httpJson;
+    size_t n    = buildMetricsJson(json, HTTP_JSON_SIZE);
+    if (!n) {
+        Serial.printf("[HTTP] metrics JSON exceeds %u bytes\n", (unsigned)HTTP_JSON_SIZE);
+        server.send(507, "text/plain", "metrics JSON exceeds HTTP_JSON_SIZE");
+        return;
+    }
+    ChunkWriter w = beginChunked("application/json");
+    w.write(json, n);
+    writeHealthJson(w);
+    w.print("]}");
+    endChunked(w);
 }
 
 // ======================================================================
-//  HTTP: オフセット変更
+//  HTTP: 受信トレース
+//   /api/trace?capture=1|0  記録の開始（/trace.bin を作り直す）/ 停止
+//   /api/trace?download=1   /trace.bin をそのまま返す
+//   それ以外は記録の状態
 // ======================================================================
-void handleOffset() {
-    if (!server.hasArg("delta")) {
-        server.send(400, "text/plain", "delta param required");
+void streamTraceFile(const char* path, const char* contentType) {
+    File f = LittleFS.open(path, "r");
+    if (!f) {
+        server.send(404, "text/plain", "not found");
         return;
     }
-    float delta = server.arg("delta").toFloat();
-    g_tempOffset += delta;
-    saveOffsetToFS();
+    server.streamFile(f, contentType);
+    f.close();
+}
 
-    if (g_env.valid && g_bootPhase == BootPhase::Avatar) {
-        g_env.temperature += delta;
-        updateAvatarExpression();
-        updateSpeech();
-        updateLedsForTemp();
+void handleTrace() {
+    if (server.hasArg("capture")) {
+        if (server.arg("capture") == "1") {
+            if (!startTraceCapture()) {
+                server.send(500, "text/plain", "cannot create trace file");
+                return;
+            }
+        } else {
+            stopTraceCapture("stopped");
+        }
+    }
+    if (server.hasArg("download")) {
+        if (g_trace.active) flushTrace();
+        streamTraceFile(TRACE_FILE_PATH, "application/octet-stream");
+        return;
     }
 
-    server.sendHeader("Location", "/");
-    server.send(303, "text/plain", "Redirecting...");
+    char*  json = g_httpJson;
+    size_t n    = 0;
+    appendf(json, HTTP_JSON_SIZE, n,
+            "{\"capturing\":%s,\"records\":%u,\"bytes\":%u,\"max_bytes\":%u,\"dropped\":%u,"
+            "\"topics\":%u,\"elapsed_s\":%u,\"stopped\":\"%s\"}",
+            g_trace.active ? "true" : "false",
+            (unsigned)g_trace.records,
+            (unsigned)g_trace.bytes,
+            (unsigned)TRACE_MAX_BYTES,
+            (unsigned)g_trace.dropped,
+            (unsigned)g_traceWriter.topics(),
+            (unsigned)(g_trace.active ? (millis() - g_trace.startMs) / 1000 : 0),
+            g_trace.stopReason ? g_trace.stopReason : "");
+    sendJson(json, n);
 }
 
 // ======================================================================
@@ -860,72 +4565,61 @@ void handleClear() {
 void handleSetTime() {
     // dt 無し → 設定フォームを表示
     if (!server.hasArg("dt")) {
-        String html;
-        html.reserve(2048);
-
         char nowBuf[20];
         getCurrentDatetimeString(nowBuf, sizeof(nowBuf));
 
-        html += "<!DOCTYPE html><html><head><meta charset='UTF-8'>";
-        html += "<title>Set RTC Time</title>";
-        html += "<meta name='viewport' content='width=device-width,initial-scale=1'>";
-        html += "<style>";
-        html += "body{font-family:sans-serif;margin:8px;}";
-        html += "input[type=text]{width:180px;}";
-        html += "button{margin:4px 0;padding:4px 8px;}";
-        html += "</style>";
-        html += "<script>";
-        html += "function pad(n){return n<10?'0'+n:n;}";
-        html += "function setFromDeviceTime(){";
-        html += "  var d=new Date();";
-        html += "  var y=d.getFullYear();";
-        html += "  var m=pad(d.getMonth()+1);";
-        html += "  var dd=pad(d.getDate());";
-        html += "  var hh=pad(d.getHours());";
-        html += "  var mm=pad(d.getMinutes());";
-        html += "  var ss=pad(d.getSeconds());";
-        html += "  var s=y+'/'+m+'/'+dd+' '+hh+':'+mm+':'+ss;";
-        html += "  var url='/settime?dt='+encodeURIComponent(s);";
-        html += "  location.href=url;";
-        html += "}";
-        html += "</script>";
-        html += "</head><body>";
-
-        html += "<h2>Set RTC Time</h2>";
-        html += "<p>現在のRTC: ";
-        html += nowBuf;
-        html += "</p>";
-
-        html += "<h3>このスマホの時刻でセット</h3>";
-        html += "<p><button onclick='setFromDeviceTime()'>";
-        html += "Set RTC from this device time";
-        html += "</button></p>";
-
-        html += "<hr>";
-
-        html += "<h3>手動入力でセット</h3>";
-        html += "<form method='GET' action='/settime'>";
-        html += "日時 (YYYY/MM/DD HH:MM:SS):<br>";
-        html += "<input type='text' name='dt' value='";
-        html += nowBuf;
-        html += "'><br><br>";
-        html += "<input type='submit' value='Set Time'>";
-        html += "</form>";
-
-        html += "<p><a href='/'>Back to Console</a></p>";
-        html += "</body></html>";
-
-        server.send(200, "text/html", html);
+        ChunkWriter w = beginChunked("text/html");
+        w.print("<!DOCTYPE html><html><head><meta charset='UTF-8'>"
+                "<title>Set RTC Time</title>"
+                "<meta name='viewport' content='width=device-width,initial-scale=1'>"
+                "<style>"
+                "body{font-family:sans-serif;margin:8px;}"
+                "input[type=text]{width:180px;}"
+                "button{margin:4px 0;padding:4px 8px;}"
+                "</style>"
+                "<script>"
+                "function pad(n){return n<10?'0'+n:n;}"
+                "function setFromDeviceTime(){"
+                "  var d=new Date();"
+                "  var y=d.getFullYear();"
+                "  var m=pad(d.getMonth()+1);"
+                "  var dd=pad(d.getDate());"
+                "  var hh=pad(d.getHours());"
+                "  var mm=pad(d.getMinutes());"
+                "  var ss=pad(d.getSeconds());"
+                "  var s=y+'/'+m+'/'+dd+' '+hh+':'+mm+':'+ss;"
+                "  var url='/settime?dt='+encodeURIComponent(s);"
+                "  location.href=url;"
+                "}"
+                "</script>"
+                "</head><body>");
+
+        w.print("<h2>Set RTC Time</h2>");
+        w.printf("<p>現在のRTC: %s</p>", nowBuf);
+
+        w.print("<h3>このスマホの時刻でセット</h3>"
+                "<p><button onclick='setFromDeviceTime()'>"
+                "Set RTC from this device time"
+                "</button></p>"
+                "<hr>");
+
+        w.print("<h3>手動入力でセット</h3>"
+                "<form method='GET' action='/settime'>"
+                "日時 (YYYY/MM/DD HH:MM:SS):<br>");
+        w.printf("<input type='text' name='dt' value='%s'><br><br>", nowBuf);
+        w.print("<input type='submit' value='Set Time'>"
+                "</form>"
+                "<p><a href='/'>Back to Console</a></p>"
+                "</body></html>");
+        endChunked(w);
         return;
     }
 
     // dt 付きで来たとき
-    String s = server.arg("dt");
-    s.trim();
-
-    int yyyy, mm, dd, HH, MM, SS;
-    if (sscanf(s.c_str(), "%d/%d/%d %d:%d:%d",
-               &yyyy, &mm, &dd, &HH, &MM, &SS) != 6) {
+    char s[32];
+    int  yyyy, mm, dd, HH, MM, SS;
+    if (!copyArg("dt", s, sizeof(s)) ||
+        sscanf(s, "%d/%d/%d %d:%d:%d", &yyyy, &mm, &dd, &HH, &MM, &SS) != 6) {
         server.send(400, "text/plain", "Invalid format. Use YYYY/MM/DD HH:MM:SS");
         return;
     }
@@ -952,6 +4646,7 @@ void handleSetTime() {
     dt.time = rtcTime;
 
     M5.Rtc.setDateTime(dt);
+    syncClockFromRtc(true, false);   // 手動設定は戻る方向も許す（秒の変わり目で合わせる）
     Serial.printf("[RTC] Set to %04d/%02d/%02d %02d:%02d:%02d\n",
                   yyyy, mm, dd, HH, MM, SS);
 
@@ -983,7 +4678,7 @@ void showWifiQRScreen() {
     char wifiQR[128];
     snprintf(wifiQR, sizeof(wifiQR),
              "WIFI:T:WPA;S:%s;P:%s;;",
-             AP_SSID, AP_PASSWORD);
+             g_cfg.apSsid, g_cfg.apPassword);
 
     int qrSize = 180;
     int qrX = (dw - qrSize) / 2;
@@ -993,9 +4688,9 @@ void showWifiQRScreen() {
 
     M5.Display.setTextSize(1);
     M5.Display.setCursor(8, qrY + qrSize + 4);
-    M5.Display.println("Wi-Fi Setup")
-    M5.Display.printf("SSID: %s\n", AP_SSID);
-    M5.Display.printf("PASS: %s\n\n", AP_PASSWORD);
+    M5.Display.println("Wi-Fi Setup");
+    M5.Display.printf("SSID: %s\n", g_cfg.apSsid);
+    M5.Display.printf("PASS: %s\n\n", g_cfg.apPassword);
     M5.Display.println("B: Switch to Web QR");
     M5.Display.println("C: Avatar mode start");
 }
@@ -1028,6 +4723,76 @@ void showUrlQRScreen() {
     M5.Display.println("C: Avatar mode start");
 }
 
+// ======================================================================
+//  メモリ配置（起動時にシリアルへ出す）
+//   大きな領域はすべて静的配列で持ち、ヒープは主にライブラリ
+//   （WebServer / PicoMQTT / Avatar / LittleFS）だけが使う。
+//   例外はログ領域（行 + 列）で、起動時に 1 回だけ PSRAM（無ければ内部 RAM）
+//   から確保して以後は解放しない。表には置き場所ごとに載せる。
+// ======================================================================
+struct MemRegion {
+    const char* name;
+    size_t      bytes;
+};
+
+const MemRegion MEMORY_MAP[] = {
+    { "log index",     sizeof(g_logBlocks) },
+    { "rule table",    sizeof(g_ruleTable) + sizeof(g_rules) },
+    { "rules text",    sizeof(g_rulesText) },
+    { "topic router",  sizeof(g_router) },
+    { "ingest",        sizeof(g_ingest) },
+    { "calibration",   sizeof(g_cal) },
+    { "retained",      sizeof(g_retained) + sizeof(g_replayQueue) },
+    { "backfill",      sizeof(g_backfillRows) },
+    { "broker",        sizeof(g_brokerClients) },
+    { "mqtt payload",  sizeof(g_mqttPayloads) },
+    { "trace",         sizeof(g_traceBuf) + sizeof(g_traceWriter) },
+    { "http chunk",    sizeof(g_httpChunk) },
+    { "http json",     sizeof(g_httpJson) },
+};
+
+// 起動時に確保したログ領域（行 + 列）
+size_t logStoreBytes() {
+    return g_logSlots * (sizeof(EnvLogEntry) + LOG_COLUMN_BYTES);
+}
+
+// 内部 RAM に常駐する合計（静的配列 + PSRAM に置けなかったときのログ領域）
+size_t staticMemoryBytes() {
+    size_t total = g_logsInPsram ? 0 : logStoreBytes();
+    for (const auto& r : MEMORY_MAP) total += r.bytes;
+    return total;
+}
+
+// PSRAM に常駐する合計（ログ領域だけ）
+size_t psramMemoryBytes() {
+    return g_logsInPsram ? logStoreBytes() : 0;
+}
+
+void printMemoryReport(const char* stage) {
+    Serial.printf("[MEM] %s: heap free %u / %u, min %u, largest block %u\n",
+                  stage,
+                  (unsigned)ESP.getFreeHeap(),
+                  (unsigned)ESP.getHeapSize(),
+                  (unsigned)ESP.getMinFreeHeap(),
+                  (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    for (const auto& r : MEMORY_MAP) {
+        Serial.printf("[MEM]   %-14s %6u\n", r.name, (unsigned)r.bytes);
+    }
+    Serial.printf("[MEM]   %-14s %6u (%s)\n", "log store", (unsigned)logStoreBytes(),
+                  g_logsInPsram ? "PSRAM" : "SRAM");
+    Serial.printf("[MEM]   %-14s %6u\n", "total static", (unsigned)staticMemoryBytes());
+    Serial.printf("[MEM]   %-14s %6u\n", "total psram", (unsigned)psramMemoryBytes());
+    Serial.printf("[MEM]   logs: %s, %u slots x (%u B row + %u B columns) = %u B, PSRAM free %u\n",
+                  g_logsInPsram ? "PSRAM" : "SRAM",
+                  (unsigned)g_logSlots,
+                  (unsigned)sizeof(EnvLogEntry),
+                  (unsigned)LOG_COLUMN_BYTES,
+                  (unsigned)(g_logSlots * (sizeof(EnvLogEntry) + LOG_COLUMN_BYTES)),
+                  (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+    Serial.printf("[MEM]   log read ns/entry: seq %.0f, random %.0f (SRAM %.0f)\n",
+                  g_logReadNsSeq, g_logReadNsRand, g_logReadNsSram);
+}
+
 // ================================================================
 //  10. モード切替 & ライフサイクル（setup / loop）
 // ================================================================
@@ -1042,15 +4807,170 @@ void enterAvatarMode() {
 
     avatar.init();
     avatar.setExpression(Expression::Neutral);
+    g_shownExpression = Expression::Neutral;
+    g_exprShown       = true;
     updateSpeech();
 
     initServo();
     updateLedsForTemp();
-    startMQTTBroker();
+    g_load.lastServoMs = 0;   // QR 画面の間は更新しないので間隔に数えない
 
     g_bootPhase = BootPhase::Avatar;
+    g_snapDirty = true;
+    markUiDirty(UI_DIRTY_ALL);   // QR 表示中に受信した値を反映
 
     Serial.println("[BOOT] Enter Avatar mode");
+    printMemoryReport("avatar");   // Avatar タスク起動後
+}
+
+// ======================================================================
+//  暖機再起動用スナップショット（RTC メモリ）
+//   - 受信値・表情・サーボ姿勢・画面など「すぐ表示に要る状態」を RTC の
+//     未初期化領域に置く。ソフトウェアリセット・WDT・パニックでは中身が残るので、
+//     再起動後は QR 画面を飛ばして直前の表示から再開できる（電源投入時は捨てる）。
+//   - 2 面に交互に書く（SnapshotSlots.h）。書き込み途中でリセットされても
+//     もう一方が残り、壊れた面は checksum で弾く。
+//   - 内容が変わったら SNAPSHOT_MIN_MS 以上あけて、変わらなくても
+//     SNAPSHOT_PERIOD_MS ごとに書く（RTC メモリなのでフラッシュは消耗しない）。
+//   - ログは受信ごとに LittleFS へ追記済みなので持たない。
+// ======================================================================
+constexpr uint32_t      SNAPSHOT_MAGIC       = 0x50414E53;   // "SNAP"
+constexpr uint16_t      SNAPSHOT_VERSION     = 1;
+constexpr uint32_t      SNAPSHOT_MAX_AGE_SEC = 600;          // これより古い値は使わない
+constexpr unsigned long SNAPSHOT_MIN_MS      = 250;
+constexpr unsigned long SNAPSHOT_PERIOD_MS   = 2000;
+
+struct HubSnapshot {
+    uint32_t      magic;
+    uint16_t      version;
+    uint16_t      size;
+    uint32_t      seq;            // 書き込み番号（大きい方が新しい）
+    uint32_t      savedEpoch;     // 保存時刻（g_clock, 0 = 不明）
+    uint32_t      trendSec;       // 保存時の trendNowSec()
+    uint32_t      warmBoots;      // 暖機再起動の回数（診断用）
+
+    EnvReading    env;
+    RawSample     raw;
+    DerivedValues derived;
+    float         envTrend;
+    float         servoY;
+    int8_t        activeRule;
+    uint8_t       bootPhase;      // BootPhase
+    uint8_t       expression;     // 直前の表情（Expression）
+    uint8_t       flags;          // bit0 = 吹き出し, bit1 = LED 点灯中, bit2 = 表情あり
+    uint8_t       sampleFlags;
+    uint8_t       trend[sizeof(PressureTrend)];   // 気圧傾向の窓（そのままコピー）
+
+    uint32_t      checksum;
+};
+
+// 既定コンストラクタが走ると RTC の中身を消してしまうので POD に限る
+static_assert(std::is_trivially_default_constructible<HubSnapshot>::value,
+              "HubSnapshot must stay POD (RTC_NOINIT)");
+
+using HubSnapshotSlots = SnapshotSlots<HubSnapshot, SNAPSHOT_MAGIC, SNAPSHOT_VERSION>;
+
+RTC_NOINIT_ATTR HubSnapshot g_snapSlots[HubSnapshotSlots::SLOTS];
+
+BootPhase     g_snapResumePhase = BootPhase::QR;   // 暖機再起動で戻る画面
+unsigned long g_snapLastMs    = 0;
+
+void captureSnapshot(HubSnapshot& s) {
+    memset(&s, 0, sizeof(s));
+    s.savedEpoch  = nowEpoch();
+    s.trendSec    = trendNowSec();
+    s.warmBoots   = g_snapWarmBoots;
+    s.env         = g_env;
+    s.raw         = g_lastRaw;
+    s.derived     = g_envDerived;
+    s.envTrend    = g_envTrend;
+    s.servoY      = g_servoYCurrent;
+    s.activeRule  = g_activeRule;
+    s.bootPhase   = (uint8_t)g_bootPhase;
+    s.expression  = (uint8_t)g_lastExpression;
+    s.flags       = (g_showSpeech ? 0x01 : 0) | (g_ledWasOn ? 0x02 : 0) |
+                    (g_exprInitialized ? 0x04 : 0);
+    s.sampleFlags = g_lastSampleFlags;
+    memcpy(s.trend, (const void*)&g_ingest.trend(), sizeof(s.trend));
+}
+
+// loop() から呼ぶ
+void serviceSnapshot() {
+    unsigned long now = millis();
+    if (now - g_snapLastMs < (g_snapDirty ? SNAPSHOT_MIN_MS : SNAPSHOT_PERIOD_MS)) return;
+    g_snapLastMs = now;
+    g_snapDirty  = false;
+
+    HubSnapshot s;
+    captureSnapshot(s);
+    HubSnapshotSlots::write(g_snapSlots, s);
+    g_snapSeq  = s.seq;
+    g_snapWrites++;
+}
+
+// 起動時：残っていれば状態を戻す。true = 暖機再起動として続ける
+bool restoreSnapshot(esp_reset_reason_t reason) {
+    HubSnapshot s;
+    if (reason == ESP_RST_POWERON || reason == ESP_RST_BROWNOUT ||
+        !HubSnapshotSlots::load(g_snapSlots, s)) {
+        memset(g_snapSlots, 0, sizeof(g_snapSlots));   // 電源投入時の中身は不定
+        return false;
+    }
+    uint32_t now = nowEpoch();
+    if (!s.savedEpoch || !now || now < s.savedEpoch || now - s.savedEpoch > SNAPSHOT_MAX_AGE_SEC) {
+        Serial.println("[BOOT] Snapshot too old, cold start");
+        return false;
+    }
+
+    g_env            = s.env;
+    g_lastRaw        = s.raw;
+    g_envDerived     = s.derived;
+    g_envTrend       = s.envTrend;
+    g_lastSampleFlags = s.sampleFlags;
+    g_servoYCurrent  = s.servoY;
+    g_servoYTarget   = s.servoY;
+    g_activeRule     = (s.activeRule >= 0 && (size_t)s.activeRule < g_ruleCount)
+                     ? s.activeRule : RuleTable::NoRule;
+    g_lastExpression  = (Expression)s.expression;
+    g_showSpeech      = s.flags & 0x01;
+    g_ledWasOn        = s.flags & 0x02;   // 再起動で「点灯した」と鳴かない
+    g_exprInitialized = s.flags & 0x04;
+    memcpy((void*)&g_ingest.trend(), s.trend, sizeof(s.trend));
+    g_trendBaseSec   = s.trendSec + (now - s.savedEpoch);   // 止まっていた間も進める
+    g_snapWarmBoots  = s.warmBoots + 1;
+    g_snapSeq        = s.seq;
+    g_snapResumePhase = (s.bootPhase == (uint8_t)BootPhase::Avatar) ? BootPhase::Avatar
+                                                                    : BootPhase::QR;
+
+    Serial.printf("[BOOT] Warm restart (reason %d): snapshot #%lu, %lu s old, %s mode\n",
+                  (int)reason, (unsigned long)s.seq, (unsigned long)(now - s.savedEpoch),
+                  s.bootPhase == (uint8_t)BootPhase::Avatar ? "Avatar" : "QR");
+    return true;
+}
+
+// ======================================================================
+//  起動時の並行読み込み（ログ末尾は SoftAP 起動と並行して別タスクで読む）
+// ======================================================================
+SemaphoreHandle_t g_bootTailDone = nullptr;
+
+void bootLogTailTask(void*) {
+    if (!loadLogTail()) {
+        Serial.println("[BOOT] No logs found");
+    }
+    g_boot.logTailMs = millis();
+    xSemaphoreGive(g_bootTailDone);
+    vTaskDelete(nullptr);
+}
+
+void printBootTimings() {
+    Serial.printf("[BOOT] %s start (reset reason %u): fs %lu ms, config %lu, softap %lu, log tail %lu (%u rows, %lu ms in parallel), "
+                  "broker %lu, http %lu, setup %lu\n",
+                  g_boot.warm ? "warm" : "cold", (unsigned)g_boot.resetReason,
+                  (unsigned long)g_boot.fsMs, (unsigned long)g_boot.configMs,
+                  (unsigned long)g_boot.softApMs, (unsigned long)g_boot.logTailMs,
+                  (unsigned)g_logLoad.tailRows, (unsigned long)g_logLoad.tailMs,
+                  (unsigned long)g_boot.brokerMs, (unsigned long)g_boot.httpMs,
+                  (unsigned long)g_boot.setupMs);
 }
 
 // ======================================================================
@@ -1061,13 +4981,15 @@ void setup() {
     M5.begin(cfg);
 
     Serial.begin(115200);
-    delay(200);
 
     // スピーカーの音量（0〜255）
     M5.Speaker.setVolume(64);
 
     randomSeed(esp_random());
 
+    // RTC の秒の変わり目で時計を合わせる（以降は esp_timer で進める）
+    syncClockFromRtc(true, true);
+
     M5.Display.setRotation(1);
     M5.Display.fillScreen(BLACK);
     M5.Display.setTextColor(WHITE, BLACK);
@@ -1082,52 +5004,106 @@ void setup() {
     if (!LittleFS.begin(true)) {
         showFatalAndWait("LittleFS init failed");
     }
+    g_boot.fsMs = millis();
 
-    // Step2: 設定・ログ読み込み
-    M5.Display.println("Step2: load config/logs...");
-    if (!loadOffsetFromFS()) {
-        showWarning("No config, use offset=0.0");
+    // Step2: 設定読み込み・ログ領域確保
+    M5.Display.println("Step2: load config...");
+    if (!loadConfig()) {
+        showWarning("No config, use defaults");
     }
-    if (!loadLogsFromFS()) {
-        showWarning("No logs found");
+    applyIngestConfig();
+    loadCal();
+    loadRules();
+    g_boot.resetReason = (uint8_t)esp_reset_reason();
+    g_boot.warm        = restoreSnapshot((esp_reset_reason_t)g_boot.resetReason);
+    if (!initLogStore()) {
+        showFatalAndWait("Log store alloc failed");
+    }
+    if (!g_logsInPsram) {
+        showWarning("No PSRAM, short log");
+    }
+    measureLogAccess();
+    g_boot.configMs = millis();
+
+    // Step3: ログ末尾の読み込み（別タスク）と SoftAP 起動を並行して行う
+    M5.Display.println("Step3: start SoftAP / load logs...");
+    g_bootTailDone = xSemaphoreCreateBinary();
+    if (xTaskCreatePinnedToCore(bootLogTailTask, "logtail", 6144, nullptr, 1, nullptr, 0) != pdPASS) {
+        bootLogTailTask(nullptr);   // 作れなければここで読む（セマフォは与えられる）
     }
-
-    // Step3: SoftAP
-    M5.Display.println("Step3: start SoftAP...");
     if (!startSoftAP()) {
         showFatalAndWait("SoftAP start failed");
     }
+    g_boot.softApMs = millis();
+    xSemaphoreTake(g_bootTailDone, portMAX_DELAY);
+
+    // Step4: MQTT ブローカ（以降 loop() で受信できる）
+    startMQTTBroker();
+    g_boot.brokerMs = millis();
 
-    // Step4: HTTP server
+    // Step5: HTTP server
     M5.Display.println("Step4: start HTTP...");
     server.on("/",        HTTP_GET, handleRoot);
     server.on("/offset",  HTTP_GET, handleOffset);
     server.on("/delete",  HTTP_GET, handleDelete);
     server.on("/clear",   HTTP_GET, handleClear);
     server.on("/settime", HTTP_GET, handleSetTime);
+    server.on("/sealevel", HTTP_GET, handleSeaLevel);
+    server.on("/link",     HTTP_GET, handleLink);
+    server.on("/api/metrics", HTTP_GET, handleMetrics);
+    server.on("/api/query",   HTTP_GET, handleQuery);
+    server.on("/api/trace",   HTTP_GET, handleTrace);
+    server.on("/api/config",  handleConfig);
+    server.on("/rules",       handleRules);
+    server.on("/calibration", handleCalibration);
     server.onNotFound(handleNotFound);
     server.begin();
+    g_boot.httpMs = millis();
     Serial.println("[HTTP] Web console started on http://192.168.4.1/");
 
-    // Step5: LED 初期化
+    // Step6: LED 初期化
     M5.Display.println("Step5: init LEDs...");
     initLeds();
 
     M5.Display.println();
     M5.Display.println("OK. Ready.");
-    delay(700);
+
+    g_boot.setupMs = millis();
+    printBootTimings();
+    printMemoryReport("setup");
 
     g_bootPhase = BootPhase::QR;
     g_qrPage    = QRSubPage::Wifi;
-    showWifiQRScreen();
+    if (g_boot.warm && g_snapResumePhase == BootPhase::Avatar) {
+        enterAvatarMode();   // 暖機再起動：QR を飛ばして直前の表示へ
+    } else {
+        showWifiQRScreen();
+    }
 }
 
 // ======================================================================
 //  loop()
 // ======================================================================
 void loop() {
+    noteLoadGap(g_load.lastLoopMs, g_load.loopGapMaxMs, g_load.loopLate, LOOP_GAP_BUDGET_MS);
     M5.update();
     server.handleClient();
+    serviceClock();
+
+    // 受信・ログはどちらの画面でも動かす
+    serviceTransports();
+    serviceRetainedReplay();
+    serviceRecalibration();
+    serviceSensorHealth();
+    serviceLogLoad();
+    serviceLogCompaction();
+    serviceSnapshot();
+    serviceTrace();
+
+    // 後から接続したセンサー向けに設定を定期再送
+    if (millis() - g_lastSensorCfgPubMs >= SENSOR_CFG_REPUBLISH_MS) {
+        publishSensorConfig();
+    }
 
     // QRモード
     if (g_bootPhase == BootPhase::QR) {
@@ -1155,14 +5131,15 @@ void loop() {
     if (M5.BtnA.wasPressed()) {
         playClickSound();
         g_showSpeech = !g_showSpeech;
-        updateSpeech();
+        g_snapDirty  = true;
+        markUiDirty(UI_DIRTY_SPEECH);
     }
 
     if (M5.BtnB.wasPressed()) {
         playClickSound();
         if (g_env.valid) {
-            addLogEntry(g_env);
-            updateSpeech();
+            logCurrentReading();
+            markUiDirty(UI_DIRTY_SPEECH);
         }
     }
 
@@ -1171,8 +5148,8 @@ void loop() {
         playClickSound();
     }
 
-    mqtt.loop();
     updateServoIdle();
+    serviceUiTick();
 
     // ★ このタイミングでだけ「ぴひぃ〜」を実行
     if (g_requestScream) {
@@ -1182,7 +5159,7 @@ void loop() {
 
     delay(10);
 
-    mqtt.loop();
+    serviceTransports();
     updateServoIdle();
 
     delay(10);
@@ -0,0 +1,190 @@
+// ================================================================
+//  AnomalyDetector（範囲外・変化率・張り付き・z スコア・表の追い出し）のホストテスト
+//   pio test -e native -f test_anomaly_detector
+// ================================================================
+
+#include <unity.h>
+#include <stdio.h>
+
+#include "AnomalyDetector.h"
+
+namespace {
+
+constexpr uint32_t STEP_MS = 5000;
+constexpr uint8_t  F       = AnomalyDetector::FIELDS;
+
+// 決まった小さな揺れ（±0.1 程度。ノイズ幅より十分小さい）
+float wobble(int i) {
+    return (float)((i * 37) % 21 - 10) / 100.0f;
+}
+
+struct Counts {
+    uint32_t accept;
+    uint32_t flag;
+    uint32_t quarantine;
+    uint8_t  seen;
+};
+
+// 基準値 base に揺れを足した列を n 件流す。mutate(i, v) で故障を入れる
+template <typename Mutate>
+Counts feed(AnomalyDetector& det, uint32_t hash, int n, Mutate mutate) {
+    Counts c = {};
+    for (int i = 0; i < n; ++i) {
+        float w    = wobble(i);
+        float v[F] = { 22.0f + w, 50.0f + w * 5.0f, 1013.0f + w };
+        mutate(i, v);
+        uint8_t flags;
+        switch (det.check(hash, "dev", (uint32_t)i * STEP_MS, v, flags)) {
+            case AnomalyVerdict::Accept:     c.accept++;     break;
+            case AnomalyVerdict::Flag:       c.flag++;       break;
+            case AnomalyVerdict::Quarantine: c.quarantine++; break;
+        }
+        c.seen |= flags;
+    }
+    return c;
+}
+
+const AnomalyDetector::Device* find(const AnomalyDetector& det, uint32_t hash) {
+    for (size_t i = 0; i < AnomalyDetector::MaxDevices; ++i) {
+        if (det.devices()[i].hash == hash) return &det.devices()[i];
+    }
+    return nullptr;
+}
+
+}  // namespace
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_normal_trace_is_accepted(void) {
+    static AnomalyDetector det;
+    Counts c = feed(det, 1, 500, [](int, float*) {});
+    TEST_ASSERT_EQUAL_UINT32(500, c.accept);
+    TEST_ASSERT_EQUAL_UINT8(0, c.seen);
+}
+
+// 1 回だけの跳ねは隔離し、次から元どおり採用する
+void test_single_spike_is_quarantined(void) {
+    static AnomalyDetector det;
+    Counts c = feed(det, 1, 200, [](int i, float* v) {
+        if (i == 100) v[0] = 60.0f;
+    });
+    TEST_ASSERT_EQUAL_UINT32(1, c.quarantine);
+    TEST_ASSERT_EQUAL_UINT32(0, c.flag);
+    TEST_ASSERT_TRUE(c.seen & ANOM_RATE);
+}
+
+// 同じ向きの段差が JUMP_CONFIRM 回続いたら採用し直す
+void test_real_step_is_confirmed(void) {
+    static AnomalyDetector det;
+    Counts c = feed(det, 1, 200, [](int i, float* v) {
+        if (i >= 100) v[0] += 8.0f;
+    });
+    TEST_ASSERT_EQUAL_UINT32(AnomalyDetector::JUMP_CONFIRM - 1, c.quarantine);
+    TEST_ASSERT_EQUAL_UINT32(1, c.flag);
+    TEST_ASSERT_EQUAL_UINT32(200 - AnomalyDetector::JUMP_CONFIRM, c.accept);
+}
+
+// 項目ごとに向きがそろっていれば、項目どうしの向きが違っても段差（温度↑・気圧↓）
+void test_step_with_opposite_fields_is_confirmed(void) {
+    static AnomalyDetector det;
+    Counts c = feed(det, 1, 200, [](int i, float* v) {
+        if (i >= 100) {
+            v[0] += 8.0f;
+            v[2] -= 20.0f;
+        }
+    });
+    TEST_ASSERT_EQUAL_UINT32(1, c.flag);
+    TEST_ASSERT_EQUAL_UINT32(AnomalyDetector::JUMP_CONFIRM - 1, c.quarantine);
+}
+
+// 温度は同じ向きでも、湿度が上下に振れているなら段差とみなさない
+//   （先頭の項目の向きだけで判断すると、ここで採用し直してしまう）
+void test_oscillating_field_is_not_confirmed(void) {
+    static AnomalyDetector det;
+    Counts c = feed(det, 1, 120, [](int i, float* v) {
+        if (i >= 100) {
+            v[0] += 8.0f;
+            v[1] += (i % 2) ? 30.0f : -30.0f;
+        }
+    });
+    TEST_ASSERT_EQUAL_UINT32(0, c.flag);
+    TEST_ASSERT_EQUAL_UINT32(20, c.quarantine);
+}
+
+void test_stuck_sensor_is_flagged(void) {
+    static AnomalyDetector det;
+    Counts c = feed(det, 1, 200, [](int i, float* v) {
+        if (i >= 50) {
+            v[0] = 22.11f;
+            v[1] = 50.5f;
+            v[2] = 1013.2f;
+        }
+    });
+    TEST_ASSERT_TRUE(c.seen & ANOM_STUCK);
+    TEST_ASSERT_EQUAL_UINT32(0, c.quarantine);
+}
+
+void test_out_of_range_is_quarantined(void) {
+    static AnomalyDetector det;
+    Counts c = feed(det, 1, 500, [](int i, float* v) {
+        if (i % 50 == 0) v[1] = 150.0f;
+        if (i == 333)    v[2] = NAN;
+    });
+    TEST_ASSERT_EQUAL_UINT32(11, c.quarantine);
+    TEST_ASSERT_TRUE(c.seen & ANOM_RANGE);
+}
+
+// 表が一杯でも、途絶しているデバイスがあれば一番古いものを追い出して使う
+void test_full_table_evicts_stale_lru(void) {
+    static AnomalyDetector det;
+    const size_t N = AnomalyDetector::MaxDevices;
+    float v[F] = { 22.0f, 50.0f, 1013.0f };
+    uint8_t flags;
+    for (size_t k = 0; k < N; ++k) {
+        det.check(100 + k, "old", (uint32_t)k * 100, v, flags);   // N 台でも STALE_MIN_MS 未満
+    }
+
+    // まだ誰も途絶していない：新顔は素通し（表は変えない）
+    const uint32_t fresh = (uint32_t)N * 100;
+    TEST_ASSERT_EQUAL(AnomalyVerdict::Accept, det.check(999, "new", fresh, v, flags));
+    TEST_ASSERT_NULL(find(det, 999));
+    TEST_ASSERT_EQUAL_UINT32(0, det.evictions());
+
+    // 100 以外は届き続けている → 途絶しているのは 100 だけ
+    const uint32_t later = AnomalyDetector::STALE_MIN_MS + 5000;
+    for (size_t k = 1; k < N; ++k) det.check(100 + k, "old", later, v, flags);
+    det.check(999, "new", later + 1000, v, flags);
+    TEST_ASSERT_NOT_NULL(find(det, 999));
+    TEST_ASSERT_NULL(find(det, 100));
+    for (size_t k = 1; k < N; ++k) TEST_ASSERT_NOT_NULL(find(det, 100 + k));
+    TEST_ASSERT_EQUAL_UINT32(1, det.evictions());
+}
+
+// 範囲外ばかり送る（採用されたことのない）デバイスも、届かなくなれば追い出せる
+void test_never_accepted_device_can_be_evicted(void) {
+    static AnomalyDetector det;
+    const size_t N = AnomalyDetector::MaxDevices;
+    float bad[F] = { 200.0f, 50.0f, 1013.0f };
+    uint8_t flags;
+    for (size_t k = 0; k < N; ++k) det.check(100 + k, "bad", 0, bad, flags);
+
+    float v[F] = { 22.0f, 50.0f, 1013.0f };
+    det.check(999, "new", AnomalyDetector::STALE_MIN_MS + 1, v, flags);
+    TEST_ASSERT_NOT_NULL(find(det, 999));
+    TEST_ASSERT_EQUAL_UINT32(1, det.evictions());
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_normal_trace_is_accepted);
+    RUN_TEST(test_single_spike_is_quarantined);
+    RUN_TEST(test_real_step_is_confirmed);
+    RUN_TEST(test_step_with_opposite_fields_is_confirmed);
+    RUN_TEST(test_oscillating_field_is_not_confirmed);
+    RUN_TEST(test_stuck_sensor_is_flagged);
+    RUN_TEST(test_out_of_range_is_quarantined);
+    RUN_TEST(test_full_table_evicts_stale_lru);
+    RUN_TEST(test_never_accepted_device_can_be_evicted);
+    return UNITY_END();
+}
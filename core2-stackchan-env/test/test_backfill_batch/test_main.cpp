@@ -0,0 +1,147 @@
+// ================================================================
+//  BackfillBatch（後送りの塊の読み取り）のホストテスト
+//   pio test -e native -f test_backfill_batch
+//   センサーと同じ形で組んだ塊が行ごとに読めること、崩れた塊は 1 か所でも
+//   塊ごと不正になること、時刻順へのそろえ方を確かめる。
+// ================================================================
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "BackfillBatch.h"
+
+namespace {
+
+using BackfillBatch::Row;
+
+Row g_rows[BackfillBatch::ROWS_MAX + 1];
+
+// センサーの serviceBackfill と同じ組み立て（差秒は直前の行から, 負もありうる）
+size_t build(char* out, size_t cap, uint32_t first, uint32_t base, const Row* rows, size_t n) {
+    size_t   len  = (size_t)snprintf(out, cap, "%lu,%lu", (unsigned long)first, (unsigned long)base);
+    uint32_t prev = base;
+    for (size_t i = 0; i < n && len < cap; ++i) {
+        len += (size_t)snprintf(out + len, cap - len, ";%ld,%ld,%ld,%ld",
+                                (long)(int32_t)(rows[i].time - prev), (long)rows[i].t100,
+                                (long)rows[i].h100, (long)rows[i].p10);
+        prev = rows[i].time;
+    }
+    return len;
+}
+
+bool rejected(const char* payload) {
+    uint32_t first = 0;
+    return BackfillBatch::parse(payload, first, g_rows, BackfillBatch::ROWS_MAX) == 0;
+}
+
+}  // namespace
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_parses_rows_and_accumulates_time(void) {
+    uint32_t first = 0;
+    size_t   n = BackfillBatch::parse(
+        "120,1760000000;0,2345,5510,10083;60,-512,0,9999;5,0,10000,0;-30,1,2,3",
+        first, g_rows, BackfillBatch::ROWS_MAX);
+    TEST_ASSERT_EQUAL_UINT32(4, n);
+    TEST_ASSERT_EQUAL_UINT32(120, first);
+    TEST_ASSERT_EQUAL_UINT32(1760000000u, g_rows[0].time);
+    TEST_ASSERT_EQUAL_INT32(2345, g_rows[0].t100);
+    TEST_ASSERT_EQUAL_INT32(5510, g_rows[0].h100);
+    TEST_ASSERT_EQUAL_INT32(10083, g_rows[0].p10);
+    TEST_ASSERT_EQUAL_UINT32(1760000060u, g_rows[1].time);
+    TEST_ASSERT_EQUAL_INT32(-512, g_rows[1].t100);    // 氷点下
+    TEST_ASSERT_EQUAL_UINT32(1760000065u, g_rows[2].time);
+    TEST_ASSERT_EQUAL_INT32(10000, g_rows[2].h100);
+    TEST_ASSERT_EQUAL_UINT32(1760000035u, g_rows[3].time);   // 時計の戻り（差秒が負）
+}
+
+// センサーが送る最大の塊（48 件）と上限ちょうど（ROWS_MAX 件）がそのまま戻る
+void test_round_trip_full_batches(void) {
+    static char payload[BackfillBatch::ROWS_MAX * 32 + 32];
+    Row         src[BackfillBatch::ROWS_MAX];
+    for (size_t i = 0; i < BackfillBatch::ROWS_MAX; ++i) {
+        src[i].time = 1704067200u + (uint32_t)i * 60 + (uint32_t)(i % 3);
+        src[i].t100 = 2200 + (int32_t)(i * 7) - 300;
+        src[i].h100 = 5000 - (int32_t)i * 11;
+        src[i].p10  = 10120 + (int32_t)(i % 5);
+    }
+    const size_t sizes[] = { 1, 48, BackfillBatch::ROWS_MAX };
+    for (size_t k : sizes) {
+        build(payload, sizeof(payload), 4000000000u, src[0].time, src, k);
+        uint32_t first = 0;
+        size_t   n     = BackfillBatch::parse(payload, first, g_rows, BackfillBatch::ROWS_MAX);
+        TEST_ASSERT_EQUAL_UINT32(k, n);
+        TEST_ASSERT_EQUAL_UINT32(4000000000u, first);
+        for (size_t i = 0; i < k; ++i) {
+            TEST_ASSERT_EQUAL_UINT32(src[i].time, g_rows[i].time);
+            TEST_ASSERT_EQUAL_INT32(src[i].t100, g_rows[i].t100);
+            TEST_ASSERT_EQUAL_INT32(src[i].h100, g_rows[i].h100);
+            TEST_ASSERT_EQUAL_INT32(src[i].p10, g_rows[i].p10);
+        }
+    }
+}
+
+// 上限を超える塊は途中まで読まずに塊ごと不正（cap の外へ書かない）
+void test_rejects_too_many_rows(void) {
+    static char payload[(BackfillBatch::ROWS_MAX + 1) * 32 + 32];
+    Row         src[BackfillBatch::ROWS_MAX + 1] = {};
+    for (size_t i = 0; i <= BackfillBatch::ROWS_MAX; ++i) src[i].time = 1000 + (uint32_t)i;
+    build(payload, sizeof(payload), 1, 1000, src, BackfillBatch::ROWS_MAX + 1);
+    g_rows[BackfillBatch::ROWS_MAX].time = 0xDEADBEEF;
+    TEST_ASSERT_TRUE(rejected(payload));
+    TEST_ASSERT_EQUAL_HEX32(0xDEADBEEF, g_rows[BackfillBatch::ROWS_MAX].time);
+
+    uint32_t first;
+    TEST_ASSERT_EQUAL_UINT32(0, BackfillBatch::parse("1,1000;0,1,2,3;0,1,2,3", first, g_rows, 1));
+}
+
+void test_rejects_malformed(void) {
+    const char* const bad[] = {
+        "",                                 // 空
+        "120",                              // 基準時刻が無い
+        "120,",                             // 同上
+        ",1760000000;0,1,2,3",              // 先頭 seq が無い
+        "x,1760000000;0,1,2,3",
+        "120,1760000000",                   // 行が無い
+        "120,1760000000;",                  // 空の行
+        "120,1760000000;0,1,2",             // 値が 3 つ
+        "120,1760000000;0,1,2,3,4",         // 値が 5 つ
+        "120,1760000000;0,1,,3",            // 値が空
+        "120,1760000000;0,1,2,3;",          // 末尾の区切り
+        "120,1760000000;0,1,2,3 ",          // 末尾のごみ
+        "120,1760000000;0,1,2,3\n",
+        "120,1760000000;0,1,2,3|0,1,2,3",   // 区切りが違う
+        "120;1760000000;0,1,2,3",
+    };
+    for (const char* p : bad) {
+        TEST_ASSERT_TRUE_MESSAGE(rejected(p), p);
+    }
+}
+
+void test_sort_by_time_is_stable(void) {
+    Row rows[6] = {
+        { 30, 1, 0, 0 }, { 10, 2, 0, 0 }, { 20, 3, 0, 0 },
+        { 10, 4, 0, 0 }, { 40, 5, 0, 0 }, { 20, 6, 0, 0 },
+    };
+    BackfillBatch::sortByTime(rows, 6);
+    const uint32_t time[6] = { 10, 10, 20, 20, 30, 40 };
+    const int32_t  tag[6]  = { 2, 4, 3, 6, 1, 5 };
+    for (size_t i = 0; i < 6; ++i) {
+        TEST_ASSERT_EQUAL_UINT32(time[i], rows[i].time);
+        TEST_ASSERT_EQUAL_INT32(tag[i], rows[i].t100);
+    }
+    BackfillBatch::sortByTime(rows, 0);   // 空でも何もしない
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_parses_rows_and_accumulates_time);
+    RUN_TEST(test_round_trip_full_batches);
+    RUN_TEST(test_rejects_too_many_rows);
+    RUN_TEST(test_rejects_malformed);
+    RUN_TEST(test_sort_by_time_is_stable);
+    return UNITY_END();
+}
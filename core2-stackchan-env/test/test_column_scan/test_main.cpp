@@ -0,0 +1,213 @@
+// ================================================================
+//  ColumnScan（固定小数点の列と集計カーネル）のホストテスト
+//   pio test -e native -f test_column_scan
+//   集計が素直な 1 件ずつの集計と一致することと、100 万件での
+//   行の配列（AoS, EnvLogEntry と同じ並び）と列（SoA）の集計時間を出す。
+// ================================================================
+
+#include <unity.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "ColumnScan.h"
+
+namespace {
+
+constexpr size_t N = 70000;   // SUM_CHUNK をまたぐ
+int16_t g_v[N];
+
+// 決まった疑似乱数（xorshift）
+uint32_t g_x = 2463534242u;
+uint32_t next() {
+    g_x ^= g_x << 13;
+    g_x ^= g_x >> 17;
+    g_x ^= g_x << 5;
+    return g_x;
+}
+
+// 1 件ずつの素直な集計
+ColumnScan::Agg naive(const int16_t* v, size_t n) {
+    ColumnScan::Agg a;
+    a.clear();
+    for (size_t i = 0; i < n; ++i) {
+        if (v[i] < a.min) a.min = v[i];
+        if (v[i] > a.max) a.max = v[i];
+        a.sum += v[i];
+    }
+    a.count = (uint32_t)n;
+    return a;
+}
+
+// 速さの比較用: main.cpp の EnvLogEntry と同じ並びの行
+struct AosRow {
+    float    rawTemperature, rawHumidity, rawPressure;
+    uint32_t device;
+    uint16_t calEpoch, viewEpoch;
+    float    temperature, humidity, pressure;
+    uint32_t time;
+    float    dewPoint, heatIndex, absHumidity, pressureTrend;
+    uint8_t  anomalyFlags;
+    bool     deleted;
+};
+
+constexpr size_t BENCH_ROWS = 1000000;
+AosRow  g_rows[BENCH_ROWS];
+int16_t g_col[BENCH_ROWS];
+
+void assertAggEqual(const ColumnScan::Agg& want, const ColumnScan::Agg& got) {
+    TEST_ASSERT_EQUAL_UINT32(want.count, got.count);
+    if (!want.count) return;
+    TEST_ASSERT_EQUAL_INT32(want.min, got.min);
+    TEST_ASSERT_EQUAL_INT32(want.max, got.max);
+    TEST_ASSERT_TRUE(want.sum == got.sum);
+}
+
+}  // namespace
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// 丸め（四捨五入）・飽和・NaN
+void test_encode_rounds_and_saturates(void) {
+    using namespace ColumnScan;
+    TEST_ASSERT_EQUAL_INT16(2235, encode(22.35f, T_SCALE));
+    TEST_ASSERT_EQUAL_INT16(-1005, encode(-10.05f, T_SCALE));
+    TEST_ASSERT_EQUAL_INT16(10132, encode(1013.2f, P_SCALE));
+    TEST_ASSERT_EQUAL_INT16(32767, encode(1e6f, T_SCALE));
+    TEST_ASSERT_EQUAL_INT16(-32767, encode(-1e6f, T_SCALE));
+    TEST_ASSERT_EQUAL_INT16(-32767, encode(NAN, H_SCALE));
+    TEST_ASSERT_FLOAT_WITHIN(0.005f, 22.35f, decode(encode(22.35f, T_SCALE), T_SCALE));
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, 1013.2f, decode(encode(1013.2f, P_SCALE), P_SCALE));
+}
+
+// 4 本の累算器と端数の処理：長さ 0〜40 と先頭のずれで素直な集計と一致
+void test_aggregate_matches_naive_for_short_ragged_runs(void) {
+    for (size_t i = 0; i < 64; ++i) g_v[i] = (int16_t)(next() & 0xFFFF);
+    for (size_t off = 0; off < 4; ++off) {
+        for (size_t n = 0; n <= 40; ++n) {
+            ColumnScan::Agg a;
+            a.clear();
+            ColumnScan::aggregateCounted(g_v + off, n, a);
+            assertAggEqual(naive(g_v + off, n), a);
+        }
+    }
+}
+
+// 続けて足し込んでも 1 回で集計したのと同じ
+void test_aggregate_accumulates_across_calls(void) {
+    for (size_t i = 0; i < 1000; ++i) g_v[i] = (int16_t)((int32_t)(next() % 6000) - 3000);
+    ColumnScan::Agg a;
+    a.clear();
+    for (size_t at = 0; at < 1000; at += 37) {
+        ColumnScan::aggregateCounted(g_v + at, (1000 - at < 37) ? 1000 - at : 37, a);
+    }
+    assertAggEqual(naive(g_v, 1000), a);
+}
+
+// 全部 32767 でも int32 の部分和があふれない（SUM_CHUNK ごとに int64 へ移す）
+void test_sum_does_not_overflow_across_chunks(void) {
+    for (size_t i = 0; i < N; ++i) g_v[i] = 32767;
+    ColumnScan::Agg a;
+    a.clear();
+    ColumnScan::aggregateCounted(g_v, N, a);
+    TEST_ASSERT_TRUE(a.sum == (int64_t)32767 * (int64_t)N);
+    TEST_ASSERT_EQUAL_UINT32(N, a.count);
+
+    for (size_t i = 0; i < N; ++i) g_v[i] = -32767;
+    a.clear();
+    ColumnScan::aggregateCounted(g_v, N, a);
+    TEST_ASSERT_TRUE(a.sum == -(int64_t)32767 * (int64_t)N);
+}
+
+// merge は空の側を無視し、件数・最小・最大・和をまとめる
+void test_merge_and_mean(void) {
+    for (size_t i = 0; i < 300; ++i) g_v[i] = (int16_t)(2000 + (int32_t)(next() % 1000));
+    ColumnScan::Agg a, b, empty, all;
+    a.clear();
+    b.clear();
+    empty.clear();
+    all.clear();
+    ColumnScan::aggregateCounted(g_v, 120, a);
+    ColumnScan::aggregateCounted(g_v + 120, 180, b);
+    ColumnScan::aggregateCounted(g_v, 300, all);
+    a.merge(empty);
+    a.merge(b);
+    assertAggEqual(all, a);
+
+    ColumnScan::Agg w = naive(g_v, 300);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4f, (float)((double)w.sum / 300) / ColumnScan::T_SCALE,
+                             a.mean(ColumnScan::T_SCALE));
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, empty.mean(ColumnScan::T_SCALE));
+}
+
+// 時刻の範囲（前後した時刻も拾う）
+void test_time_range(void) {
+    static const uint32_t t[] = { 1000, 1060, 990, 1200, 1130 };
+    uint32_t mn = UINT32_MAX, mx = 0;
+    ColumnScan::timeRange(t, 5, mn, mx);
+    TEST_ASSERT_EQUAL_UINT32(990, mn);
+    TEST_ASSERT_EQUAL_UINT32(1200, mx);
+
+    ColumnScan::timeRange(t, 0, mn, mx);   // 空なら変えない
+    TEST_ASSERT_EQUAL_UINT32(990, mn);
+    TEST_ASSERT_EQUAL_UINT32(1200, mx);
+}
+
+// 100 万件の温度の最小・最大・平均: 行の配列を 1 件ずつ / 列を aggregateCounted
+void test_aos_soa_speed_report(void) {
+    for (size_t i = 0; i < BENCH_ROWS; ++i) {
+        float t = 15.0f + (float)(next() % 2000) * 0.01f;
+        g_rows[i].temperature = t;
+        g_col[i]              = ColumnScan::encode(t, ColumnScan::T_SCALE);
+    }
+
+    constexpr int   PASSES  = 10;
+    volatile float  sink    = 0.0f;
+    float           aosMean = 0.0f;
+    ColumnScan::Agg col;
+
+    clock_t t0 = clock();
+    for (int k = 0; k < PASSES; ++k) {
+        float  mn = INFINITY, mx = -INFINITY;
+        double sum = 0.0;
+        for (size_t i = 0; i < BENCH_ROWS; ++i) {
+            float t = g_rows[i].temperature;
+            if (t < mn) mn = t;
+            if (t > mx) mx = t;
+            sum += t;
+        }
+        aosMean = (float)(sum / BENCH_ROWS);
+        sink    = sink + mn + mx;
+    }
+    clock_t t1 = clock();
+    for (int k = 0; k < PASSES; ++k) {
+        col.clear();
+        ColumnScan::aggregateCounted(g_col, BENCH_ROWS, col);
+        sink = sink + col.min + col.max;
+    }
+    clock_t t2 = clock();
+
+    TEST_ASSERT_EQUAL_UINT32(BENCH_ROWS, col.count);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, aosMean, col.mean(ColumnScan::T_SCALE));
+
+    double aosUs = (t1 - t0) * 1e6 / CLOCKS_PER_SEC / PASSES;
+    double soaUs = (t2 - t1) * 1e6 / CLOCKS_PER_SEC / PASSES;
+    char   msg[112];
+    snprintf(msg, sizeof(msg), "%u rows: AoS %.0f us/scan, SoA %.0f us/scan (x%.1f)",
+             (unsigned)BENCH_ROWS, aosUs, soaUs, soaUs > 0 ? aosUs / soaUs : 0.0);
+    TEST_MESSAGE(msg);
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_encode_rounds_and_saturates);
+    RUN_TEST(test_aggregate_matches_naive_for_short_ragged_runs);
+    RUN_TEST(test_aggregate_accumulates_across_calls);
+    RUN_TEST(test_sum_does_not_overflow_across_chunks);
+    RUN_TEST(test_merge_and_mean);
+    RUN_TEST(test_time_range);
+    RUN_TEST(test_aos_soa_speed_report);
+    return UNITY_END();
+}
@@ -0,0 +1,169 @@
+// ================================================================
+//  DerivedMetrics（露点・暑さ指数・絶対湿度・気圧傾向）のホストテスト
+//   pio test -e native -f test_derived_metrics
+//   libm 版との誤差・既知の値・気圧傾向を確かめ、ログ全件（LOG_CAPACITY_MAX 件）の
+//   再計算にかかる時間を表引き版と libm 版で並べて出す（PC の libm は速いので
+//   差は小さい。表引きが効くのは単精度 FPU だけの ESP32 の上）。
+// ================================================================
+
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "DerivedMetrics.h"
+
+namespace {
+
+DerivedCalc g_calc;
+
+// 速さの比較用: ハブのログ全件（LOG_CAPACITY_MAX）を起動時・問い合わせで計算し直す量
+constexpr size_t REPLAY_ROWS = 50000;
+float g_t[REPLAY_ROWS], g_h[REPLAY_ROWS];
+float g_dp[REPLAY_ROWS], g_hi[REPLAY_ROWS], g_ah[REPLAY_ROWS];
+
+}  // namespace
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// -40〜60 ℃ × 1〜100 % を libm 版と比べる（ヘッダの誤差の記述どおり）
+void test_matches_libm_within_documented_error(void) {
+    float maxDp = 0.0f, maxAh = 0.0f;
+    for (int ti = 0; ti <= 400; ++ti) {
+        for (int hj = 2; hj <= 200; ++hj) {
+            DerivedValues a, b;
+            g_calc.compute(-40.0f + ti * 0.25f, hj * 0.5f, a);
+            DerivedCalc::computeExact(-40.0f + ti * 0.25f, hj * 0.5f, b);
+            maxDp = fmaxf(maxDp, fabsf(a.dewPoint - b.dewPoint));
+            maxAh = fmaxf(maxAh, fabsf(a.absHumidity - b.absHumidity));
+            TEST_ASSERT_EQUAL_FLOAT(b.heatIndex, a.heatIndex);
+        }
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(0.02f, maxDp);
+    TEST_ASSERT_LESS_OR_EQUAL(0.01f, maxAh);
+}
+
+void test_fast_ln(void) {
+    for (float x = 0.01f; x <= 1.0f; x += 0.001f) {
+        TEST_ASSERT_FLOAT_WITHIN(2e-4f, logf(x), DerivedCalc::fastLn(x));
+    }
+}
+
+// 既知の値: 相対湿度 100 % の露点は気温、NOAA 表の 32.2 ℃(90 ℉) / 70 % ≒ 41 ℃(106 ℉)
+void test_reference_points(void) {
+    DerivedValues v;
+    g_calc.compute(25.0f, 100.0f, v);
+    TEST_ASSERT_FLOAT_WITHIN(0.02f, 25.0f, v.dewPoint);
+    g_calc.compute(25.0f, 50.0f, v);
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, 13.86f, v.dewPoint);
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, 11.5f, v.absHumidity);
+    TEST_ASSERT_FLOAT_WITHIN(0.6f, 41.1f, DerivedCalc::heatIndex(32.22f, 70.0f));
+    // 80 ℉ 未満は簡易式（気温とほぼ同じ）
+    TEST_ASSERT_FLOAT_WITHIN(1.0f, 20.0f, DerivedCalc::heatIndex(20.0f, 50.0f));
+}
+
+// 範囲外の湿度は 1〜100 % に丸める（NaN や -inf を出さない）
+void test_humidity_is_clamped(void) {
+    DerivedValues lo, hi, one, hundred;
+    g_calc.compute(20.0f, 0.0f, lo);
+    g_calc.compute(20.0f, 1.0f, one);
+    g_calc.compute(20.0f, 120.0f, hi);
+    g_calc.compute(20.0f, 100.0f, hundred);
+    TEST_ASSERT_EQUAL_FLOAT(one.dewPoint, lo.dewPoint);
+    TEST_ASSERT_EQUAL_FLOAT(hundred.dewPoint, hi.dewPoint);
+    TEST_ASSERT_FALSE(isnan(lo.dewPoint));
+}
+
+void test_batch_matches_single(void) {
+    static float t[512], h[512], dp[512], hi[512], ah[512];
+    for (size_t i = 0; i < 512; ++i) {
+        t[i] = 10.0f + (i % 250) * 0.1f;
+        h[i] = 20.0f + (i % 60);
+    }
+    g_calc.computeBatch(t, h, dp, hi, ah, 512);
+    for (size_t i = 0; i < 512; ++i) {
+        DerivedValues v;
+        g_calc.compute(t[i], h[i], v);
+        TEST_ASSERT_EQUAL_FLOAT(v.dewPoint, dp[i]);
+        TEST_ASSERT_EQUAL_FLOAT(v.heatIndex, hi[i]);
+        TEST_ASSERT_EQUAL_FLOAT(v.absHumidity, ah[i]);
+    }
+}
+
+void test_pressure_trend_needs_three_buckets(void) {
+    PressureTrend pt;
+    uint32_t sec = 1700000000u;
+    for (int i = 0; i < 2 * 60; ++i, sec += 10) pt.add(sec, 1000.0f);   // 20 分 = 2 バケット目の途中
+    TEST_ASSERT_FALSE(pt.valid());
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, pt.slopePer3h());
+}
+
+// 1 時間に 1 hPa 上がり続ける → 3 時間で +3 hPa。古いバケットが窓から外れても変わらない
+void test_pressure_trend_slope_and_window(void) {
+    PressureTrend pt;
+    uint32_t start = 1700000400u - 1700000400u % PressureTrend::BUCKET_SEC;
+    for (uint32_t s = 0; s < 12 * 3600; s += 30) {
+        pt.add(start + s, 1000.0f + s / 3600.0f);
+        if (s > 3600) {
+            TEST_ASSERT_TRUE(pt.valid());
+            TEST_ASSERT_FLOAT_WITHIN(0.05f, 3.0f, pt.slopePer3h());
+        }
+    }
+    // 下がりに転じたら 3 時間で傾きが入れ替わる
+    uint32_t base = start + 12 * 3600;
+    for (uint32_t s = 0; s < 4 * 3600; s += 30) pt.add(base + s, 1012.0f - s / 1800.0f);
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, -6.0f, pt.slopePer3h());
+
+    pt.reset();
+    TEST_ASSERT_FALSE(pt.valid());
+}
+
+// 履歴 REPLAY_ROWS 件の派生指標: computeBatch（表引き） / computeExact（libm）
+void test_replay_speed_report(void) {
+    for (size_t i = 0; i < REPLAY_ROWS; ++i) {
+        g_t[i] = 5.0f + (float)(i % 3000) * 0.01f;
+        g_h[i] = 20.0f + (float)(i % 700) * 0.1f;
+    }
+
+    constexpr int  PASSES = 5;
+    volatile float sink   = 0.0f;
+    clock_t t0 = clock();
+    for (int k = 0; k < PASSES; ++k) {
+        g_calc.computeBatch(g_t, g_h, g_dp, g_hi, g_ah, REPLAY_ROWS);
+        sink = sink + g_dp[k] + g_ah[REPLAY_ROWS - 1 - k];
+    }
+    clock_t t1 = clock();
+    float maxDp = 0.0f;
+    for (int k = 0; k < PASSES; ++k) {
+        for (size_t i = 0; i < REPLAY_ROWS; ++i) {
+            DerivedValues v;
+            DerivedCalc::computeExact(g_t[i], g_h[i], v);
+            sink = sink + v.absHumidity;
+            if (!k) maxDp = fmaxf(maxDp, fabsf(v.dewPoint - g_dp[i]));
+        }
+    }
+    clock_t t2 = clock();
+    TEST_ASSERT_LESS_OR_EQUAL(0.02f, maxDp);
+
+    double fastUs  = (t1 - t0) * 1e6 / CLOCKS_PER_SEC / PASSES / REPLAY_ROWS;
+    double exactUs = (t2 - t1) * 1e6 / CLOCKS_PER_SEC / PASSES / REPLAY_ROWS;
+    char   msg[112];
+    snprintf(msg, sizeof(msg), "%u rows: table %.4f us/sample, libm %.4f us/sample (%.1f ms vs %.1f ms)",
+             (unsigned)REPLAY_ROWS, fastUs, exactUs, fastUs * REPLAY_ROWS / 1000,
+             exactUs * REPLAY_ROWS / 1000);
+    TEST_MESSAGE(msg);
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_matches_libm_within_documented_error);
+    RUN_TEST(test_fast_ln);
+    RUN_TEST(test_reference_points);
+    RUN_TEST(test_humidity_is_clamped);
+    RUN_TEST(test_batch_matches_single);
+    RUN_TEST(test_pressure_trend_needs_three_buckets);
+    RUN_TEST(test_pressure_trend_slope_and_window);
+    RUN_TEST(test_replay_speed_report);
+    return UNITY_END();
+}
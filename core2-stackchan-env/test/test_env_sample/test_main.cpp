@@ -0,0 +1,101 @@
+// ================================================================
+//  EnvSample（計測値の読み取りと重複排除）のホストテスト
+//   pio test -e native -f test_env_sample
+//   3 形式（旧・seq 付き・取得時刻付き）の読み分け、窓の中の入れ替わりと
+//   窓より古い再送、センサー再起動、表が埋まったときの追い出しを確かめる。
+// ================================================================
+
+#include <unity.h>
+#include <stdint.h>
+
+#include "EnvSample.h"
+
+namespace {
+
+using EnvSample::Verdict;
+constexpr size_t DEVICES = 4;
+constexpr uint32_t WINDOW = EnvSample::Dedup<DEVICES>::WINDOW;
+
+EnvSample::Dedup<DEVICES> g_dedup;
+
+}  // namespace
+
+void setUp(void) { g_dedup.clear(); }
+void tearDown(void) {}
+
+void test_parse_formats(void) {
+    EnvSample::Sample s;
+    TEST_ASSERT_EQUAL(EnvSample::Format::Legacy, EnvSample::parse("21.5,40.0,1013.2", s));
+    TEST_ASSERT_EQUAL_FLOAT(21.5f, s.t);
+    TEST_ASSERT_EQUAL_UINT32(0, s.time);
+
+    TEST_ASSERT_EQUAL(EnvSample::Format::Sequenced, EnvSample::parse("-3.25,88.5,998.1,42,7", s));
+    TEST_ASSERT_EQUAL_FLOAT(-3.25f, s.t);
+    TEST_ASSERT_EQUAL_FLOAT(88.5f, s.h);
+    TEST_ASSERT_EQUAL_FLOAT(998.1f, s.p);
+    TEST_ASSERT_EQUAL_UINT32(42, s.seq);
+    TEST_ASSERT_EQUAL_UINT32(7, s.bootId);
+    TEST_ASSERT_EQUAL_UINT32(0, s.time);
+
+    // 取得時刻 "<sec>.<ms>" のミリ秒は捨てる
+    TEST_ASSERT_EQUAL(EnvSample::Format::Sequenced,
+                      EnvSample::parse("20,50,1000,4000000000,65535,1760000000.250", s));
+    TEST_ASSERT_EQUAL_UINT32(4000000000u, s.seq);
+    TEST_ASSERT_EQUAL_UINT32(1760000000u, s.time);
+
+    const char* const bad[] = { "", "21.5", "21.5,40.0", "21.5,40.0,1013.2,5", "x,1,2,3,4" };
+    for (const char* p : bad) {
+        TEST_ASSERT_TRUE_MESSAGE(EnvSample::parse(p, s) == EnvSample::Format::Invalid, p);
+    }
+}
+
+void test_hash_name(void) {
+    TEST_ASSERT_EQUAL_UINT32(2166136261u, EnvSample::hashName(""));
+    TEST_ASSERT_TRUE(EnvSample::hashName("home/env/a") != EnvSample::hashName("home/env/b"));
+}
+
+// 窓の中の入れ替わりは 1 回だけ受け入れ、窓より古い再送は捨てる
+void test_window(void) {
+    TEST_ASSERT_EQUAL(Verdict::Accepted, g_dedup.accept(1, 9, 100, 0));
+    TEST_ASSERT_EQUAL(Verdict::Duplicate, g_dedup.accept(1, 9, 100, 1));
+    TEST_ASSERT_EQUAL(Verdict::Accepted, g_dedup.accept(1, 9, 103, 2));
+    TEST_ASSERT_EQUAL(Verdict::Reordered, g_dedup.accept(1, 9, 101, 3));
+    TEST_ASSERT_EQUAL(Verdict::Duplicate, g_dedup.accept(1, 9, 101, 4));
+    TEST_ASSERT_EQUAL(Verdict::Reordered, g_dedup.accept(1, 9, 103 - (WINDOW - 1), 5));
+    TEST_ASSERT_EQUAL(Verdict::Duplicate, g_dedup.accept(1, 9, 103 - WINDOW, 6));
+
+    // 窓より大きく飛んだら古い印は残らない
+    TEST_ASSERT_EQUAL(Verdict::Accepted, g_dedup.accept(1, 9, 103 + WINDOW + 5, 7));
+    TEST_ASSERT_EQUAL(Verdict::Reordered, g_dedup.accept(1, 9, 103 + WINDOW + 4, 8));
+}
+
+// bootId が変わったら seq が戻っても受け入れる（キーごとに別々）
+void test_boot_change_and_keys(void) {
+    TEST_ASSERT_EQUAL(Verdict::Accepted, g_dedup.accept(1, 9, 500, 0));
+    TEST_ASSERT_EQUAL(Verdict::Accepted, g_dedup.accept(2, 9, 500, 0));
+    TEST_ASSERT_EQUAL(Verdict::Accepted, g_dedup.accept(1, 10, 0, 1));
+    TEST_ASSERT_EQUAL(Verdict::Duplicate, g_dedup.accept(1, 10, 0, 2));
+    TEST_ASSERT_EQUAL(Verdict::Duplicate, g_dedup.accept(2, 9, 500, 2));
+}
+
+// 表が埋まったら最も長く届いていないキーを忘れる（ms の折り返しをまたいでも）
+void test_full_table_evicts_lru(void) {
+    const uint32_t t0 = 0xFFFFFF00u;
+    for (uint32_t k = 1; k <= DEVICES; ++k) g_dedup.accept(k, 1, 10, t0 + k);
+    g_dedup.accept(1, 1, 11, t0 + 0x200);   // 1 は新しく、2 が最古
+
+    TEST_ASSERT_EQUAL(Verdict::Accepted, g_dedup.accept(99, 1, 10, t0 + 0x300));
+    TEST_ASSERT_EQUAL(Verdict::Duplicate, g_dedup.accept(1, 1, 11, t0 + 0x301));
+    TEST_ASSERT_EQUAL(Verdict::Duplicate, g_dedup.accept(3, 1, 10, t0 + 0x302));
+    TEST_ASSERT_EQUAL(Verdict::Accepted, g_dedup.accept(2, 1, 10, t0 + 0x303));   // 忘れていた
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_parse_formats);
+    RUN_TEST(test_hash_name);
+    RUN_TEST(test_window);
+    RUN_TEST(test_boot_change_and_keys);
+    RUN_TEST(test_full_table_evicts_lru);
+    return UNITY_END();
+}
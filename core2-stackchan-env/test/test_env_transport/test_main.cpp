@@ -0,0 +1,293 @@
+// ================================================================
+//  EnvTransport（EnvFrame + FrameSeal + Loopback）のホストテスト
+//   pio test -e native -f test_env_transport
+//   Loopback の 2 端点（センサー役・ハブ役）で、ESP-NOW と同じ封をした
+//   フレームが往復すること、鍵違い・改ざん・送り主のなりすまし・送り直しが
+//   受信関数へ届かず rejected に数えられること、送信番号が再起動をまたいで
+//   戻らないことを確かめる。
+// ================================================================
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "EnvTransport.h"
+
+namespace {
+
+struct Inbox {
+    uint32_t count;
+    char     topic[64];
+    char     payload[256];
+};
+
+void collect(void* ctx, EnvTransport&, const char* topic, const char* payload) {
+    Inbox& in = *(Inbox*)ctx;
+    in.count++;
+    snprintf(in.topic, sizeof(in.topic), "%s", topic);
+    snprintf(in.payload, sizeof(in.payload), "%s", payload);
+}
+
+// ハブ役は時刻要求へ届いた配送路で応答する（main.cpp の onTimeRequest と同じ形）
+void echoTime(void* ctx, EnvTransport& from, const char* topic, const char* payload) {
+    collect(ctx, from, topic, payload);
+    if (strcmp(topic, "home/env/test/timereq") == 0) {
+        char reply[64];
+        snprintf(reply, sizeof(reply), "%s,1760000000,250", payload);
+        from.publish("home/env/test/time", reply);
+    }
+}
+
+const FrameAuth::Key KEY = FrameAuth::deriveKey("m5password");
+
+struct Pair {
+    LoopbackTransport sensor{"loop-sensor", 1};
+    LoopbackTransport hub{"loop-hub", 2};
+    Inbox             atSensor = {};
+    Inbox             atHub    = {};
+
+    explicit Pair(const FrameAuth::Key& sensorKey = KEY) {
+        LoopbackTransport::link(sensor, hub);
+        sensor.seal().setKey(sensorKey);
+        hub.seal().setKey(KEY);
+        sensor.setReceiver(collect, &atSensor);
+        hub.setReceiver(collect, &atHub);
+    }
+};
+
+// 送信番号の保存先（NVS の代わり）
+struct Store {
+    uint32_t value;
+    uint32_t writes;
+    bool     fail;
+};
+
+bool persist(void* ctx, uint32_t reservedUntil) {
+    Store& s = *(Store*)ctx;
+    if (s.fail) return false;
+    s.value = reservedUntil;
+    s.writes++;
+    return true;
+}
+
+}  // namespace
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// SipHash-2-4 の論文の例（鍵 00..0f, 入力 00..0e）
+void test_siphash_reference_vector(void) {
+    uint8_t k[16], m[15];
+    for (uint8_t i = 0; i < 16; ++i) k[i] = i;
+    for (uint8_t i = 0; i < 15; ++i) m[i] = i;
+    FrameAuth::Key  key = { FrameAuth::getU64(k), FrameAuth::getU64(k + 8) };
+    FrameAuth::SipHash h(key);
+    h.update(m, 5);
+    h.update(m + 5, 10);   // 分けて渡しても同じ
+    TEST_ASSERT_TRUE(h.finish() == 0xa129ca6149be45e5ULL);
+}
+
+void test_key_depends_on_password(void) {
+    FrameAuth::Key a = FrameAuth::deriveKey("m5password");
+    FrameAuth::Key b = FrameAuth::deriveKey("m5passwore");
+    TEST_ASSERT_TRUE(a.k0 == KEY.k0 && a.k1 == KEY.k1);
+    TEST_ASSERT_FALSE(a.k0 == b.k0 && a.k1 == b.k1);
+}
+
+void test_round_trip_and_reply(void) {
+    Pair p;
+    p.hub.setReceiver(echoTime, &p.atHub);
+    for (uint32_t i = 0; i < 100; ++i) {
+        char ms[16];
+        snprintf(ms, sizeof(ms), "%lu", (unsigned long)(1000 + i));
+        TEST_ASSERT_TRUE(p.sensor.publish("home/env/test/timereq", ms));
+        p.hub.loop();
+        p.sensor.loop();
+        char expect[64];
+        snprintf(expect, sizeof(expect), "%s,1760000000,250", ms);
+        TEST_ASSERT_EQUAL_STRING("home/env/test/time", p.atSensor.topic);
+        TEST_ASSERT_EQUAL_STRING(expect, p.atSensor.payload);
+    }
+    TEST_ASSERT_EQUAL_UINT32(100, p.atHub.count);
+    TEST_ASSERT_EQUAL_UINT32(100, p.atSensor.count);
+    TEST_ASSERT_EQUAL_UINT32(0, p.hub.stats().rejected + p.hub.stats().dropped);
+    TEST_ASSERT_EQUAL_UINT32(0, p.sensor.stats().rejected + p.sensor.stats().dropped);
+}
+
+void test_wrong_key_rejected(void) {
+    Pair p(FrameAuth::deriveKey("not-the-ap-password"));
+    TEST_ASSERT_TRUE(p.sensor.publish("home/env/test", "23.45,55.10,1008.30"));
+    p.hub.loop();
+    TEST_ASSERT_EQUAL_UINT32(0, p.atHub.count);
+    TEST_ASSERT_EQUAL_UINT32(1, p.hub.stats().rejected);
+
+    // 鍵の無い端点は送らない
+    LoopbackTransport a("a", 3), b("b", 4);
+    LoopbackTransport::link(a, b);
+    TEST_ASSERT_FALSE(a.publish("home/env/test", "1"));
+    TEST_ASSERT_EQUAL_UINT32(1, a.stats().failed);
+}
+
+// どのバイトを変えても・送り主の MAC を変えても通らない
+void test_tampered_or_spoofed_frames_rejected(void) {
+    Pair      p;
+    FrameSeal forger;
+    forger.setKey(KEY);
+    uint8_t frame[EnvFrame::MAX_LEN];
+    size_t  len = forger.seal(p.sensor.mac(), "home/env/test", "23.45,55.10,1008.30", frame,
+                              sizeof(frame));
+    TEST_ASSERT_TRUE(len > EnvFrame::HEADER + FrameAuth::TAG);
+
+    for (size_t i = 0; i < len; ++i) {
+        for (uint8_t bit = 0; bit < 8; ++bit) {
+            uint8_t bad[EnvFrame::MAX_LEN];
+            memcpy(bad, frame, len);
+            bad[i] ^= (uint8_t)(1 << bit);
+            TEST_ASSERT_TRUE(p.hub.receive(p.sensor.mac(), bad, len));
+            p.hub.loop();
+        }
+    }
+    uint8_t other[FrameAuth::MAC_LEN];
+    memcpy(other, p.sensor.mac(), sizeof(other));
+    other[5] ^= 0x80;
+    p.hub.receive(other, frame, len);
+    p.hub.receive(p.sensor.mac(), frame, len - 1);   // 認証子を 1 バイト欠く
+    p.hub.loop();
+    TEST_ASSERT_EQUAL_UINT32(0, p.atHub.count);
+    TEST_ASSERT_EQUAL_UINT32(len * 8 + 2, p.hub.stats().rejected + p.hub.stats().dropped);
+
+    // 手を加えていなければ通る
+    p.hub.receive(p.sensor.mac(), frame, len);
+    p.hub.loop();
+    TEST_ASSERT_EQUAL_UINT32(1, p.atHub.count);
+}
+
+// 録ったフレームの送り直し・古い番号は通らない（送り主ごとに数える）
+void test_replayed_frames_rejected(void) {
+    Pair      p;
+    FrameSeal sensor2;
+    sensor2.setKey(KEY);
+    uint8_t mac2[FrameAuth::MAC_LEN] = { 0x02, 0, 0, 0, 0, 9 };
+
+    uint8_t first[EnvFrame::MAX_LEN], second[EnvFrame::MAX_LEN];
+    size_t  n1 = sensor2.seal(mac2, "home/env/test", "1", first, sizeof(first));
+    size_t  n2 = sensor2.seal(mac2, "home/env/test", "2", second, sizeof(second));
+    p.hub.receive(mac2, second, n2);
+    p.hub.receive(mac2, second, n2);   // 同じもの
+    p.hub.receive(mac2, first, n1);    // 古い番号（順序が入れ替わって届いた分も捨てる）
+    TEST_ASSERT_TRUE(p.sensor.publish("home/env/test", "3"));   // 別の送り主は番号 1 から
+    p.hub.loop();
+    TEST_ASSERT_EQUAL_UINT32(2, p.atHub.count);
+    TEST_ASSERT_EQUAL_STRING("3", p.atHub.payload);
+    TEST_ASSERT_EQUAL_UINT32(2, p.hub.stats().rejected);
+
+    // v1（送信番号・認証子なし）は受け付けない
+    uint8_t v1[] = { 'E', 1, 13, 'h', 'o', 'm', 'e', '/', 'e', 'n', 'v', '/', 't', 'e', 's', 't',
+                     '1', '2', '3', '4', '5', '6', '7', '8' };
+    p.hub.receive(p.sensor.mac(), v1, sizeof(v1));
+    p.hub.loop();
+    TEST_ASSERT_EQUAL_UINT32(2, p.atHub.count);
+}
+
+// 送信番号は RESERVE 件ごとに保存され、保存値から再開すれば受け付けられ続ける
+void test_counter_survives_restart(void) {
+    Pair  p;
+    Store store = {};
+    p.sensor.seal().setCounter(1, persist, &store);
+    for (uint32_t i = 0; i < FrameAuth::RESERVE + 10; ++i) {
+        TEST_ASSERT_TRUE(p.sensor.publish("home/env/test", "x"));
+        p.hub.loop();
+    }
+    TEST_ASSERT_EQUAL_UINT32(2, store.writes);
+    TEST_ASSERT_EQUAL_UINT32(1 + 2 * FrameAuth::RESERVE, store.value);
+
+    // 再起動：保存値から再開すると通る。保存せずに 1 から始めると送り直しと見なされる
+    LoopbackTransport fresh("loop-sensor", 1);
+    LoopbackTransport::link(fresh, p.hub);
+    fresh.seal().setKey(KEY);
+    TEST_ASSERT_TRUE(fresh.publish("home/env/test", "stale"));
+    p.hub.loop();
+    TEST_ASSERT_EQUAL_UINT32(1, p.hub.stats().rejected);
+
+    fresh.seal().setCounter(store.value, persist, &store);
+    TEST_ASSERT_TRUE(fresh.publish("home/env/test", "resumed"));
+    p.hub.loop();
+    TEST_ASSERT_EQUAL_STRING("resumed", p.atHub.payload);
+    TEST_ASSERT_EQUAL_UINT32(FrameAuth::RESERVE + 11, p.atHub.count);
+    TEST_ASSERT_EQUAL_UINT32(3, store.writes);   // 再開直後にまず先の値を保存する
+
+    // 保存できなければ送らない（同じ番号を 2 度使わない）
+    Store broken = { 0, 0, true };
+    fresh.seal().setCounter(store.value, persist, &broken);
+    TEST_ASSERT_FALSE(fresh.publish("home/env/test", "unsaved"));
+}
+
+// 1 フレームに収まる上限ちょうどは通り、1 バイト超えは送らない
+void test_max_payload_boundary(void) {
+    Pair        p;
+    const char* topic = "home/env/test";
+    size_t      max   = p.sensor.maxPayload(topic);
+    TEST_ASSERT_EQUAL_UINT32(EnvFrame::MAX_LEN - EnvFrame::HEADER - FrameAuth::TAG - strlen(topic),
+                             max);
+    char payload[EnvFrame::MAX_LEN + 1];
+    memset(payload, 'x', max);
+    payload[max] = '\0';
+    TEST_ASSERT_TRUE(p.sensor.publish(topic, payload));
+    p.hub.loop();
+    TEST_ASSERT_EQUAL_UINT32(max, strlen(p.atHub.payload));
+
+    payload[max]     = 'x';
+    payload[max + 1] = '\0';
+    TEST_ASSERT_FALSE(p.sensor.publish(topic, payload));
+    TEST_ASSERT_EQUAL_UINT32(1, p.sensor.stats().failed);
+}
+
+// キュー 1 杯ぶんの連続送信は崩れずに届き、溢れた分は failed
+void test_queue_burst(void) {
+    Pair        p;
+    const char* sample = "23.45,55.10,1008.30,4294967295,65535,4294967295.999";
+    for (size_t i = 0; i < LoopbackTransport::QUEUE; ++i) {
+        TEST_ASSERT_TRUE(p.sensor.publish("home/env/test", sample));
+    }
+    TEST_ASSERT_FALSE(p.sensor.publish("home/env/test", sample));
+    TEST_ASSERT_EQUAL_UINT32(LoopbackTransport::QUEUE, p.hub.pending());
+    p.hub.loop();
+    TEST_ASSERT_EQUAL_UINT32(LoopbackTransport::QUEUE, p.atHub.count);
+    TEST_ASSERT_EQUAL_STRING(sample, p.atHub.payload);
+    TEST_ASSERT_EQUAL_UINT32(LoopbackTransport::QUEUE, p.sensor.stats().sent);
+    TEST_ASSERT_EQUAL_UINT32(1, p.sensor.stats().failed);
+}
+
+// 送り主の表が埋まったら最も長く届いていない送り主を忘れる
+void test_replay_guard_evicts_least_recent(void) {
+    FrameAuth::ReplayGuard<4> guard;
+    uint8_t mac[FrameAuth::MAC_LEN] = { 0x02, 0, 0, 0, 0, 0 };
+    for (uint8_t id = 0; id < 4; ++id) {
+        mac[5] = id;
+        TEST_ASSERT_TRUE(guard.accept(mac, 10));
+    }
+    mac[5] = 0;
+    TEST_ASSERT_TRUE(guard.accept(mac, 11));    // 0 を最近に
+    mac[5] = 4;
+    TEST_ASSERT_TRUE(guard.accept(mac, 1));     // 1 を忘れる
+    TEST_ASSERT_EQUAL_UINT32(1, guard.evictions());
+    mac[5] = 0;
+    TEST_ASSERT_FALSE(guard.accept(mac, 11));   // 0 は覚えている
+    mac[5] = 2;
+    TEST_ASSERT_FALSE(guard.accept(mac, 10));
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_siphash_reference_vector);
+    RUN_TEST(test_key_depends_on_password);
+    RUN_TEST(test_round_trip_and_reply);
+    RUN_TEST(test_wrong_key_rejected);
+    RUN_TEST(test_tampered_or_spoofed_frames_rejected);
+    RUN_TEST(test_replayed_frames_rejected);
+    RUN_TEST(test_counter_survives_restart);
+    RUN_TEST(test_max_payload_boundary);
+    RUN_TEST(test_queue_burst);
+    RUN_TEST(test_replay_guard_evicts_least_recent);
+    return UNITY_END();
+}
@@ -0,0 +1,151 @@
+// ================================================================
+//  EpochClock（RTC で較正する単調時計）のホストテスト
+//   pio test -e native -f test_epoch_clock
+//   日付 ↔ エポック秒の変換（うるう年・範囲外）と書式・読み取り、
+//   単調性（戻る較正は追いつくまで据え置き, step で戻せる）、読み直しの間隔、
+//   RTC の秒の変わり目での較正で配信するミリ秒が合うことを確かめる。
+// ================================================================
+
+#include <unity.h>
+#include <stdint.h>
+
+#include "EpochClock.h"
+
+namespace {
+
+EpochClock g_clock;
+
+constexpr uint32_t T0 = 1760000000u;   // 2025/10/09 08:53:20
+constexpr int64_t  S  = 1000000;       // 1 秒 [µs]
+
+// 本当の時刻が T0 + (monoUs - phaseUs) / 1e6 の RTC を stepUs ごとに読み、
+// 秒の変わり目で合わせる。合わせたときの monoUs を返す
+int64_t edgeSync(int64_t startUs, int64_t phaseUs, int64_t stepUs, bool step) {
+    g_clock.beginEdge(step);
+    for (int64_t us = startUs;; us += stepUs) {
+        uint32_t rtc = T0 + (uint32_t)((us - phaseUs) / S);
+        if (g_clock.onRtcRead(rtc, us)) return us;
+        TEST_ASSERT_TRUE(us - startUs < 3 * S);
+    }
+}
+
+}  // namespace
+
+void setUp(void) { g_clock = EpochClock(); }
+void tearDown(void) {}
+
+void test_civil_round_trip(void) {
+    struct { EpochClock::Civil c; uint32_t epoch; } cases[] = {
+        { { 1970, 1, 1, 0, 0, 1 }, 1 },
+        { { 2000, 2, 29, 12, 0, 0 }, 951825600u },         // 400 年ごとのうるう年
+        { { 2024, 12, 31, 23, 59, 59 }, 1735689599u },
+        { { 2025, 10, 9, 8, 53, 20 }, T0 },
+        { { 2106, 2, 7, 6, 28, 15 }, 0 },                  // 範囲外（2105 年まで）
+    };
+    for (auto& k : cases) {
+        TEST_ASSERT_EQUAL_UINT32(k.epoch, EpochClock::toEpoch(k.c));
+    }
+    for (uint32_t e = 1; e < 0xF0000000u; e += 86400 * 37 + 3671) {
+        TEST_ASSERT_EQUAL_UINT32(e, EpochClock::toEpoch(EpochClock::toCivil(e)));
+    }
+
+    const EpochClock::Civil bad[] = {
+        { 1969, 12, 31, 23, 59, 59 }, { 2025, 13, 1, 0, 0, 0 }, { 2025, 1, 0, 0, 0, 0 },
+        { 2025, 1, 1, 24, 0, 0 },     { 2025, 1, 1, 0, 60, 0 }, { 2025, 1, 1, 0, 0, 60 },
+    };
+    for (auto& c : bad) TEST_ASSERT_EQUAL_UINT32(0, EpochClock::toEpoch(c));
+}
+
+void test_format_and_parse(void) {
+    char buf[20];
+    EpochClock::format(T0, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("2025/10/09 08:53:20", buf);
+    TEST_ASSERT_EQUAL_UINT32(T0, EpochClock::parse(buf));
+    EpochClock::format(0, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("----/--/-- --:--:--", buf);
+
+    TEST_ASSERT_EQUAL_UINT32(0, EpochClock::parse("2025/10/09"));
+    TEST_ASSERT_EQUAL_UINT32(0, EpochClock::parse("2025/02/30 25:00:00"));
+    TEST_ASSERT_EQUAL_UINT32(0, EpochClock::parse("garbage"));
+}
+
+// 未較正は 0。較正後は単調カウンタで進み、RESYNC_SEC で読み直しを求める
+void test_runs_from_monotonic_counter(void) {
+    TEST_ASSERT_EQUAL_UINT32(0, g_clock.now(5 * S));
+    TEST_ASSERT_TRUE(g_clock.needsResync(0));
+
+    g_clock.sync(T0, 10 * S, true);
+    TEST_ASSERT_EQUAL_UINT32(T0, g_clock.now(10 * S));
+    TEST_ASSERT_EQUAL_UINT32(T0 + 90, g_clock.now(100 * S + S / 2));
+    TEST_ASSERT_FALSE(g_clock.needsResync((10 + EpochClock::RESYNC_SEC - 1) * S));
+    TEST_ASSERT_TRUE(g_clock.needsResync((10 + EpochClock::RESYNC_SEC) * S));
+}
+
+// 戻る較正は追いつくまで据え置き（ミリ秒は 999）。step = true なら戻す
+void test_monotonic_and_step(void) {
+    g_clock.sync(T0, 0, true);
+    TEST_ASSERT_EQUAL_UINT32(T0 + 100, g_clock.now(100 * S));
+
+    g_clock.sync(T0 + 95, 100 * S, false);   // 5 秒進みすぎていた
+    TEST_ASSERT_EQUAL_INT32(-5, g_clock.lastCorrection());
+    uint16_t ms;
+    TEST_ASSERT_EQUAL_UINT32(T0 + 100, g_clock.nowMs(102 * S + 300000, ms));
+    TEST_ASSERT_EQUAL_UINT16(999, ms);
+    TEST_ASSERT_EQUAL_UINT32(T0 + 101, g_clock.nowMs(106 * S + 250000, ms));
+    TEST_ASSERT_EQUAL_UINT16(250, ms);
+
+    g_clock.sync(T0, 107 * S, true);         // 手動設定は戻せる
+    TEST_ASSERT_EQUAL_UINT32(T0, g_clock.now(107 * S));
+}
+
+// 読んだ瞬間で合わせると秒の途中でもミリ秒 0 になる。変わり目を待てば
+// 配信するミリ秒が本当の時刻から読む間隔の半分以内に収まる
+void test_edge_sync_aligns_milliseconds(void) {
+    const int64_t phases[] = { 0, 1, 123456, 500000, 999999 };
+    const int64_t stepUs   = 4000;
+    for (int64_t phase : phases) {
+        g_clock = EpochClock();
+        int64_t start = 50 * S + 777;
+        int64_t at    = edgeSync(start, phase, stepUs, true);
+        TEST_ASSERT_TRUE(g_clock.valid());
+        TEST_ASSERT_FALSE(g_clock.edgePending());
+        TEST_ASSERT_TRUE(at - start <= S + stepUs);
+
+        for (int64_t us = at; us < at + 3 * S; us += 37000) {
+            int64_t  trueMs = (us - phase) / 1000;   // T0 からの本当の経過 [ms]
+            uint16_t ms;
+            uint32_t sec   = g_clock.nowMs(us, ms);
+            int64_t  gotMs = (int64_t)(sec - T0) * 1000 + ms;
+            TEST_ASSERT_INT_WITHIN(stepUs / 2000 + 1, trueMs, gotMs);
+        }
+    }
+}
+
+// 変わり目を待つ間は前の較正のまま。RTC が止まっていてもタイムアウトで合わせる
+void test_edge_keeps_clock_and_times_out(void) {
+    g_clock.sync(T0, 0, true);
+    g_clock.beginEdge(false);
+    TEST_ASSERT_FALSE(g_clock.onRtcRead(T0 + 10, 10 * S + 100));
+    TEST_ASSERT_EQUAL_UINT32(T0 + 10, g_clock.now(10 * S + 200000));
+    TEST_ASSERT_TRUE(g_clock.edgePending());
+
+    TEST_ASSERT_FALSE(g_clock.onRtcRead(T0 + 10, 11 * S));
+    TEST_ASSERT_TRUE(g_clock.onRtcRead(T0 + 10, 10 * S + 100 + EpochClock::EDGE_TIMEOUT_US));
+    TEST_ASSERT_FALSE(g_clock.edgePending());
+    TEST_ASSERT_FALSE(g_clock.onRtcRead(T0 + 11, 12 * S));   // 待っていないときは何もしない
+
+    g_clock.beginEdge(false);
+    g_clock.cancelEdge();
+    TEST_ASSERT_FALSE(g_clock.edgePending());
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_civil_round_trip);
+    RUN_TEST(test_format_and_parse);
+    RUN_TEST(test_runs_from_monotonic_counter);
+    RUN_TEST(test_monotonic_and_step);
+    RUN_TEST(test_edge_sync_aligns_milliseconds);
+    RUN_TEST(test_edge_keeps_clock_and_times_out);
+    return UNITY_END();
+}
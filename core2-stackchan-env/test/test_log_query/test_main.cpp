@@ -0,0 +1,303 @@
+// ================================================================
+//  LogQuery（ゾーンマップ → 要約 → 列の問い合わせ）のホストテスト
+//   pio test -e native -f test_log_query
+//   ハブと同じ形（LOG_BLOCK 件ごとの要約 + 列）の合成ログに問い合わせ、
+//   全件走査と件数・和・区間ごとの値が一致するかを見る。
+//   期間を 1〜104 日に広げたときの読んだ行数と時間を全件走査と並べて出す
+//   （要約で飛ばせば、かかる時間は全体の長さでなく当てはまるブロック数で決まる）。
+// ================================================================
+
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "LogQuery.h"
+
+namespace {
+
+constexpr uint32_t START = 1704067200u;   // 2024/01/01 00:00:00
+constexpr uint32_t STEP  = 300;           // 5 分間隔
+constexpr size_t   N     = 30000;         // 約 104 日
+constexpr size_t   BLOCK = 256;           // ハブの LOG_BLOCK と同じ
+constexpr size_t   BLOCKS = (N + BLOCK - 1) / BLOCK;
+constexpr uint8_t  F     = LogQuery::FIELDS;
+const float        SCALE[F] = { ColumnScan::T_SCALE, ColumnScan::H_SCALE, ColumnScan::P_SCALE };
+
+struct Summary {
+    uint32_t tMin, tMax, count;
+    int16_t  mn[F], mx[F];
+    int32_t  sum[F];
+};
+
+uint32_t g_time[N];
+int16_t  g_col[F][N];
+Summary  g_sum[BLOCKS];
+
+// ハブの試験と同じ合成データ（季節変動 + 日変化 + 週 1 回の暑い日）
+void fill() {
+    for (size_t k = 0; k < N; ++k) {
+        float day = (float)k * STEP / 86400.0f;
+        float v[F] = {
+            15.0f + 10.0f * sinf(day / 365.0f * 6.2831853f) + 4.0f * sinf(day * 6.2831853f) +
+                ((size_t)day % 7 == 3 ? 6.0f : 0.0f),
+            50.0f + 20.0f * sinf(day * 1.7f),
+            1010.0f + 8.0f * sinf(day * 0.3f),
+        };
+        g_time[k] = START + (uint32_t)k * STEP;
+        for (uint8_t f = 0; f < F; ++f) g_col[f][k] = ColumnScan::encode(v[f], SCALE[f]);
+    }
+    for (size_t b = 0; b < BLOCKS; ++b) {
+        size_t   from = b * BLOCK, n = (from + BLOCK <= N) ? BLOCK : N - from;
+        Summary& s = g_sum[b];
+        s.tMin = UINT32_MAX;
+        s.tMax = 0;
+        s.count = (uint32_t)n;
+        ColumnScan::timeRange(g_time + from, n, s.tMin, s.tMax);
+        for (uint8_t f = 0; f < F; ++f) {
+            ColumnScan::Agg a;
+            a.clear();
+            ColumnScan::aggregateCounted(g_col[f] + from, n, a);
+            s.mn[f]  = (int16_t)a.min;
+            s.mx[f]  = (int16_t)a.max;
+            s.sum[f] = (int32_t)a.sum;
+        }
+    }
+}
+
+// ハブの runLogQuery() と同じ順で渡す
+void run(LogQuery& q) {
+    for (size_t b = 0; b < BLOCKS && !q.full(); ++b) {
+        const Summary& s = g_sum[b];
+        size_t from = b * BLOCK;
+        if (q.prune(s.tMin, s.tMax, s.mn, s.mx)) continue;
+        if (q.fold(s.tMin, s.tMax, s.count, s.mn, s.mx, s.sum)) continue;
+        const int16_t* const v[F] = { g_col[0] + from, g_col[1] + from, g_col[2] + from };
+        q.scan(g_time + from, v, s.count);
+    }
+    q.finish();
+}
+
+// 結果の受け皿（区間は開始時刻ごとに足す）
+constexpr size_t MAX_BUCKETS = 4096;
+struct Result {
+    uint8_t  field;
+    uint32_t rows;
+    uint32_t count;
+    int64_t  sum;
+    uint32_t emitted;
+    uint32_t bucketStart[MAX_BUCKETS];
+    uint32_t bucketCount[MAX_BUCKETS];
+    int64_t  bucketSum[MAX_BUCKETS];
+    int32_t  bucketMin[MAX_BUCKETS];
+    int32_t  bucketMax[MAX_BUCKETS];
+};
+
+Result g_got, g_ref;
+
+void onRow(void* ctx, uint32_t, const int16_t v[F]) {
+    Result* r = (Result*)ctx;
+    r->rows++;
+    r->count++;
+    r->sum += v[r->field];
+    r->emitted++;
+}
+
+void onBucket(void* ctx, uint32_t start, const ColumnScan::Agg& a) {
+    Result* r = (Result*)ctx;
+    TEST_ASSERT_TRUE(r->emitted < MAX_BUCKETS);
+    r->bucketStart[r->emitted] = start;
+    r->bucketCount[r->emitted] = a.count;
+    r->bucketSum[r->emitted]   = a.sum;
+    r->bucketMin[r->emitted]   = a.min;
+    r->bucketMax[r->emitted]   = a.max;
+    r->count += a.count;
+    r->sum   += a.sum;
+    r->emitted++;
+}
+
+// 全件走査の基準（区間もログ順に作る）
+void reference(const LogQuery::Params& p, Result& r) {
+    memset(&r, 0, sizeof(r));
+    r.field = p.field;
+    for (size_t i = 0; i < N; ++i) {
+        uint32_t t = g_time[i];
+        if (t < p.from || t > p.to) continue;
+        if (p.whereField >= 0) {
+            int16_t w = g_col[p.whereField][i];
+            if (w < p.lo || w > p.hi) continue;
+        }
+        int16_t x = g_col[p.field][i];
+        if (!p.every) {
+            if (r.emitted == p.limit) break;
+            r.count++;
+            r.sum += x;
+            r.emitted++;
+            continue;
+        }
+        uint32_t start = t - t % p.every;
+        size_t   k     = r.emitted;
+        if (!k || r.bucketStart[k - 1] != start) {
+            if (k == p.limit) break;
+            r.bucketStart[k] = start;
+            r.bucketMin[k]   = INT16_MAX;
+            r.bucketMax[k]   = INT16_MIN;
+            r.emitted++;
+            k++;
+        }
+        --k;
+        r.bucketCount[k]++;
+        r.bucketSum[k] += x;
+        if (x < r.bucketMin[k]) r.bucketMin[k] = x;
+        if (x > r.bucketMax[k]) r.bucketMax[k] = x;
+        r.count++;
+        r.sum += x;
+    }
+}
+
+LogQuery::Stats query(const LogQuery::Params& p) {
+    memset(&g_got, 0, sizeof(g_got));
+    g_got.field = p.field;
+    LogQuery q(p, onRow, onBucket, &g_got);
+    run(q);
+    reference(p, g_ref);
+    TEST_ASSERT_EQUAL_UINT32(g_ref.count, g_got.count);
+    TEST_ASSERT_TRUE(g_ref.sum == g_got.sum);
+    TEST_ASSERT_EQUAL_UINT32(g_ref.emitted, g_got.emitted);
+    if (p.every) {
+        for (uint32_t k = 0; k < g_ref.emitted; ++k) {
+            TEST_ASSERT_EQUAL_UINT32(g_ref.bucketStart[k], g_got.bucketStart[k]);
+            TEST_ASSERT_EQUAL_UINT32(g_ref.bucketCount[k], g_got.bucketCount[k]);
+            TEST_ASSERT_TRUE(g_ref.bucketSum[k] == g_got.bucketSum[k]);
+            TEST_ASSERT_EQUAL_INT32(g_ref.bucketMin[k], g_got.bucketMin[k]);
+            TEST_ASSERT_EQUAL_INT32(g_ref.bucketMax[k], g_got.bucketMax[k]);
+        }
+    }
+    return q.stats();
+}
+
+const uint32_t LAST = START + (uint32_t)(N - 1) * STEP;
+
+}  // namespace
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// 最近 7 日の暑い時間：古いブロックは要約だけで飛ばす
+void test_recent_range_with_where_prunes_old_blocks(void) {
+    LogQuery::Params p;
+    p.from       = LAST - 7 * 86400;
+    p.whereField = 0;
+    p.lo         = ColumnScan::encode(25.0f, ColumnScan::T_SCALE);
+    LogQuery::Stats st = query(p);
+    TEST_ASSERT_TRUE(g_ref.count > 0);
+    TEST_ASSERT_TRUE(st.pruned > BLOCKS * 9 / 10);
+    TEST_ASSERT_TRUE(st.rows < N / 10);
+}
+
+// 全期間の日ごとの温度：1 日に収まるブロックは列を読まずに畳む
+void test_daily_buckets_fold_whole_blocks(void) {
+    LogQuery::Params p;
+    p.every = 86400;
+    LogQuery::Stats st = query(p);
+    TEST_ASSERT_EQUAL_UINT32(N, g_got.count);
+    TEST_ASSERT_TRUE(st.folded > 0);
+    TEST_ASSERT_EQUAL_UINT32(BLOCKS, st.folded + st.scanned);
+    TEST_ASSERT_TRUE(st.rows < N);
+}
+
+// 時間ごとの湿度（湿度 40〜60 % だけ）
+void test_hourly_buckets_with_where_on_same_field(void) {
+    LogQuery::Params p;
+    p.from       = LAST - 86400;
+    p.every      = 3600;
+    p.field      = 1;
+    p.whereField = 1;
+    p.lo         = ColumnScan::encode(40.0f, ColumnScan::H_SCALE);
+    p.hi         = ColumnScan::encode(60.0f, ColumnScan::H_SCALE);
+    query(p);
+    TEST_ASSERT_TRUE(g_ref.emitted > 0);
+}
+
+// 全行をそのまま返す
+void test_all_rows(void) {
+    LogQuery::Params p;
+    p.field = 2;
+    LogQuery::Stats st = query(p);
+    TEST_ASSERT_EQUAL_UINT32(N, g_got.count);
+    TEST_ASSERT_EQUAL_UINT32(N, st.matched);
+    TEST_ASSERT_EQUAL_UINT32(0, st.pruned);
+}
+
+// limit で止まる（行・区間とも）
+void test_limit_stops_rows_and_buckets(void) {
+    LogQuery::Params p;
+    p.limit = 100;
+    query(p);
+    TEST_ASSERT_EQUAL_UINT32(100, g_got.emitted);
+
+    p.every = 3600;
+    p.limit = 10;
+    query(p);
+    TEST_ASSERT_EQUAL_UINT32(10, g_got.emitted);
+}
+
+// 当てはまらない条件：何も返さず、ほとんど読まない
+void test_empty_result(void) {
+    LogQuery::Params p;
+    p.whereField = 2;
+    p.lo         = ColumnScan::encode(1050.0f, ColumnScan::P_SCALE);
+    LogQuery::Stats st = query(p);
+    TEST_ASSERT_EQUAL_UINT32(0, g_got.count);
+    TEST_ASSERT_EQUAL_UINT32(BLOCKS, st.pruned);
+    TEST_ASSERT_EQUAL_UINT32(0, st.rows);
+}
+
+// 最近 D 日の 25 ℃ 以上の行: ゾーンマップで飛ばす / 全件走査 の時間
+void test_cost_scales_with_matching_blocks(void) {
+    static const uint32_t DAYS[] = { 1, 7, 30, 104 };
+    constexpr int         PASSES = 20;
+    uint32_t              lastRows = 0;
+    for (uint32_t days : DAYS) {
+        LogQuery::Params p;
+        p.from       = LAST - days * 86400;
+        p.whereField = 0;
+        p.lo         = ColumnScan::encode(25.0f, ColumnScan::T_SCALE);
+
+        LogQuery::Stats st = query(p);   // 結果が全件走査と同じこと
+        TEST_ASSERT_TRUE(st.rows >= lastRows);
+        lastRows = st.rows;
+
+        clock_t t0 = clock();
+        for (int k = 0; k < PASSES; ++k) {
+            memset(&g_got, 0, sizeof(g_got));
+            LogQuery q(p, onRow, onBucket, &g_got);
+            run(q);
+        }
+        clock_t t1 = clock();
+        for (int k = 0; k < PASSES; ++k) reference(p, g_ref);
+        clock_t t2 = clock();
+
+        char msg[128];
+        snprintf(msg, sizeof(msg),
+                 "%3u days: %3u/%u blocks read, %5u rows, zone map %.1f us, full scan %.1f us",
+                 (unsigned)days, (unsigned)(st.blocks - st.pruned), (unsigned)BLOCKS,
+                 (unsigned)st.rows, (t1 - t0) * 1e6 / CLOCKS_PER_SEC / PASSES,
+                 (t2 - t1) * 1e6 / CLOCKS_PER_SEC / PASSES);
+        TEST_MESSAGE(msg);
+    }
+}
+
+int main(int, char**) {
+    fill();
+    UNITY_BEGIN();
+    RUN_TEST(test_recent_range_with_where_prunes_old_blocks);
+    RUN_TEST(test_daily_buckets_fold_whole_blocks);
+    RUN_TEST(test_hourly_buckets_with_where_on_same_field);
+    RUN_TEST(test_all_rows);
+    RUN_TEST(test_limit_stops_rows_and_buckets);
+    RUN_TEST(test_empty_result);
+    RUN_TEST(test_cost_scales_with_matching_blocks);
+    return UNITY_END();
+}
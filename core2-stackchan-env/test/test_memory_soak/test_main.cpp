@@ -0,0 +1,230 @@
+// ================================================================
+//  長時間運転のメモリ（固定バッファだけで回ること）のホストテスト
+//   pio test -e native -f test_memory_soak
+//   MQTT の受信を BufferPool（g_mqttPayloads と同じ大きさ・数）に読んで
+//   ファームウェアと同じ取り込み（HubIngest, HubIngestHost の土台）へ数百万通、
+//   HTTP の応答を ChunkWriter（g_httpChunk と同じ大きさ）で百万件流し、
+//   暖機の後はヒープの確保が 1 回も増えないこと（= 断片化が進まない）、
+//   バッファの同時使用数・ログの行数が上限で止まることを確かめる。
+//   確保はグローバルの operator new / delete を差し替えて数える。
+// ================================================================
+
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#include "BufferPool.h"
+#include "ChunkWriter.h"
+#include "HubIngestHost.h"
+
+// ===== 確保の計数 =====
+namespace {
+
+struct HeapCount {
+    size_t allocs;
+    size_t frees;
+    size_t live;
+    size_t peak;
+};
+
+HeapCount g_heap = {};
+
+void* counted(size_t n) {
+    void* p = malloc(n ? n : 1);
+    if (!p) throw std::bad_alloc();
+    g_heap.allocs++;
+    if (++g_heap.live > g_heap.peak) g_heap.peak = g_heap.live;
+    return p;
+}
+
+void uncounted(void* p) {
+    if (!p) return;
+    g_heap.frees++;
+    g_heap.live--;
+    free(p);
+}
+
+}  // namespace
+
+void* operator new(size_t n) { return counted(n); }
+void* operator new[](size_t n) { return counted(n); }
+void* operator new(size_t n, const std::nothrow_t&) noexcept { return malloc(n ? n : 1); }
+void* operator new[](size_t n, const std::nothrow_t&) noexcept { return malloc(n ? n : 1); }
+void  operator delete(void* p) noexcept { uncounted(p); }
+void  operator delete[](void* p) noexcept { uncounted(p); }
+void  operator delete(void* p, size_t) noexcept { uncounted(p); }
+void  operator delete[](void* p, size_t) noexcept { uncounted(p); }
+
+namespace {
+
+constexpr uint32_t EPOCH    = 1760000000u;
+constexpr uint32_t DEVICES  = 48;
+constexpr uint32_t MESSAGES = 2000000;   // 2 秒ごと × 48 台で約 23 時間
+constexpr uint32_t REQUESTS = 1000000;
+constexpr uint32_t WARMUP   = 10000;
+
+// ファームウェア（main.cpp）と同じ大きさ
+typedef BufferPool<1024, 2> PayloadPool;   // MQTT_PAYLOAD_SIZE, MQTT_PAYLOAD_BUFFERS
+constexpr size_t HTTP_CHUNK_SIZE = 1436;
+
+HubIngestHost g_hub;
+PayloadPool   g_pool;
+char          g_chunk[HTTP_CHUNK_SIZE];
+uint64_t      g_sent = 0;
+
+uint32_t g_seq[DEVICES];
+uint32_t g_backfillSeq[DEVICES];
+
+void countSink(void*, const char*, size_t len) { g_sent += len; }
+
+// PicoMQTT の受信コールバックと同じ流れ: 借りる → 読む → 振り分け → 返す
+void receive(const char* topic, const char* body, uint32_t ms) {
+    size_t len = strlen(body);
+    char*  buf = g_pool.acquire(len + 1);
+    TEST_ASSERT_NOT_NULL_MESSAGE(buf, "payload pool refused a message");
+    memcpy(buf, body, len);
+    buf[len] = '\0';
+    g_hub.message(topic, buf, ms);
+    g_pool.release(buf);
+}
+
+// k 通目を組み立てて流す（大半は計測値。時々、再送・時刻要求・後送り）
+void message(uint32_t k) {
+    uint32_t d  = k % DEVICES;
+    uint32_t ms = k * (2000 / DEVICES);
+    char     topic[40], body[512];
+
+    if (k % 997 == 0) {
+        snprintf(topic, sizeof(topic), "home/env/s%u/timereq", (unsigned)d);
+        snprintf(body, sizeof(body), "%u", (unsigned)ms);
+    } else if (k % 4999 == 0) {
+        uint32_t now = EPOCH + ms / 1000;
+        int      n   = snprintf(body, sizeof(body), "%u,%u", (unsigned)g_backfillSeq[d],
+                                (unsigned)(now - 600));
+        for (uint32_t i = 0; i < 8; ++i) {
+            n += snprintf(body + n, sizeof(body) - n, ";%d,%d,5000,10100", i ? 30 : 0,
+                          (int)(2000 + (k / 7 + i) % 300));
+        }
+        g_backfillSeq[d] += 8;
+        snprintf(topic, sizeof(topic), "home/env/s%u/backfill", (unsigned)d);
+    } else {
+        uint32_t seq = (k % 1009 == 0 && g_seq[d]) ? g_seq[d] - 1 : g_seq[d]++;   // 再送
+        unsigned t   = 2000 + (k / DEVICES) % 200 + d * 10;   // ×100（浮動小数の書式化は遅い）
+        snprintf(topic, sizeof(topic), "home/env/s%u", (unsigned)d);
+        snprintf(body, sizeof(body), "%u.%02u,%u.%u0,1008.%u,%u,%u", t / 100, t % 100,
+                 (unsigned)(50 - d / 5), (unsigned)(9 - d % 5 * 2), (unsigned)(d % 10),
+                 (unsigned)seq, (unsigned)(100 + d));
+    }
+    receive(topic, body, ms);
+}
+
+// /api/metrics とコンソールの 1 行ぶんに相当する応答を ChunkWriter で書く
+void request(uint32_t k) {
+    const HubIngest::Stats& rx = g_hub.ingest().stats();
+    ChunkWriter             w(g_chunk, sizeof(g_chunk), countSink, nullptr);
+    w.printf("{\"delivery\":{\"accepted\":%u,\"duplicates\":%u,\"quarantined\":%u},",
+             (unsigned)rx.accepted, (unsigned)rx.duplicates, (unsigned)rx.quarantined);
+    w.printf("\"backfill\":{\"batches\":%u,\"merged\":%u},\"log_rows\":%u}",
+             (unsigned)rx.backfillBatches, (unsigned)rx.backfillMerged,
+             (unsigned)g_hub.logRows());
+    for (uint32_t i = 0; i < 4; ++i) {
+        const HubIngestHost::LogRow& r = g_hub.logAt((k + i) % g_hub.logRows());
+        w.print("<tr><td>");
+        w.printHtml("s<&>\"'");
+        w.printf("</td><td>%.2f</td><td>%.2f</td><td>%.1f</td></tr>", r.temperature,
+                 r.humidity, r.pressure);
+    }
+    w.flush();
+}
+
+}  // namespace
+
+void setUp(void) {
+    g_hub.clear();
+    g_hub.setClock(EPOCH);
+    memset(g_seq, 0, sizeof(g_seq));
+    for (uint32_t d = 0; d < DEVICES; ++d) g_backfillSeq[d] = 1;
+    g_pool.resetStats();
+    g_sent = 0;
+}
+void tearDown(void) {}
+
+// 受信: 暖機の後は確保が増えず、貸したバッファはすべて戻り、ログは上限で止まる
+void test_messages_do_not_grow_heap(void) {
+    for (uint32_t k = 0; k < WARMUP; ++k) message(k);
+    HeapCount warm = g_heap;
+
+    for (uint32_t k = WARMUP; k < MESSAGES; ++k) message(k);
+
+    TEST_ASSERT_EQUAL_UINT32(warm.allocs, g_heap.allocs);
+    TEST_ASSERT_EQUAL_UINT32(warm.live, g_heap.live);
+    TEST_ASSERT_EQUAL_UINT32(warm.peak, g_heap.peak);
+
+    const PayloadPool::Stats& p = g_pool.stats();
+    TEST_ASSERT_EQUAL_UINT32(MESSAGES, p.acquired);
+    TEST_ASSERT_EQUAL_UINT32(0, p.inUse);
+    TEST_ASSERT_EQUAL_UINT32(1, p.highWater);
+    TEST_ASSERT_EQUAL_UINT32(0, p.exhausted);
+    TEST_ASSERT_EQUAL_UINT32(0, p.oversize);
+
+    const HubIngest::Stats& rx = g_hub.ingest().stats();
+    TEST_ASSERT_TRUE(rx.accepted > MESSAGES / 2);
+    TEST_ASSERT_TRUE(rx.duplicates > 0);
+    TEST_ASSERT_TRUE(rx.backfillMerged > 0);
+    TEST_ASSERT_TRUE(rx.timeRequests > 0);
+    TEST_ASSERT_TRUE(g_hub.logRows() <= HubIngestHost::LOG_MAX);
+
+    char msg[96];
+    snprintf(msg, sizeof(msg), "%u messages, %u accepted, %u log rows, heap allocs %u",
+             (unsigned)MESSAGES, (unsigned)rx.accepted, (unsigned)g_hub.logRows(),
+             (unsigned)g_heap.allocs);
+    TEST_MESSAGE(msg);
+}
+
+// HTTP: 応答は固定バッファの分割出力だけで、何件書いても確保が増えない
+void test_requests_do_not_grow_heap(void) {
+    for (uint32_t k = 0; k < 5000; ++k) message(k);
+    for (uint32_t k = 0; k < WARMUP; ++k) request(k);
+    HeapCount warm = g_heap;
+
+    for (uint32_t k = WARMUP; k < REQUESTS; ++k) request(k);
+
+    TEST_ASSERT_EQUAL_UINT32(warm.allocs, g_heap.allocs);
+    TEST_ASSERT_EQUAL_UINT32(warm.live, g_heap.live);
+    TEST_ASSERT_TRUE(g_sent > (uint64_t)REQUESTS * 300);
+}
+
+// 大きすぎる本文・空きが無いときは断って数える（借りたまま返らないことはない）
+void test_pool_refuses_and_counts(void) {
+    TEST_ASSERT_NULL(g_pool.acquire(PayloadPool::BUFFER_SIZE + 1));
+    char* a = g_pool.acquire(PayloadPool::BUFFER_SIZE);
+    char* b = g_pool.acquire(1);
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_NOT_NULL(b);
+    TEST_ASSERT_TRUE(a != b);
+    TEST_ASSERT_NULL(g_pool.acquire(1));
+
+    g_pool.release(a);
+    g_pool.release(a);   // 二重に返しても数はずれない
+    char* c = g_pool.acquire(16);
+    TEST_ASSERT_EQUAL_PTR(a, c);
+    g_pool.release(b);
+    g_pool.release(c);
+
+    const PayloadPool::Stats& p = g_pool.stats();
+    TEST_ASSERT_EQUAL_UINT32(3, p.acquired);
+    TEST_ASSERT_EQUAL_UINT32(1, p.oversize);
+    TEST_ASSERT_EQUAL_UINT32(1, p.exhausted);
+    TEST_ASSERT_EQUAL_UINT32(0, p.inUse);
+    TEST_ASSERT_EQUAL_UINT32(2, p.highWater);
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_messages_do_not_grow_heap);
+    RUN_TEST(test_requests_do_not_grow_heap);
+    RUN_TEST(test_pool_refuses_and_counts);
+    return UNITY_END();
+}
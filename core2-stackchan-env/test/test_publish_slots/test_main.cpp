@@ -0,0 +1,147 @@
+// ================================================================
+//  PublishSlots（送信時刻の枠）のホストテスト
+//   pio test -e native -f test_publish_slots
+//   count 台までは重ならない位置が返り、それを超えた分は満杯になること、
+//   止まったノードの枠だけが回されること、枠ありなら 20 ms 以内に重なる
+//   送信が 1 通に収まる（位相ばらばらより少ない）ことを確かめる。
+// ================================================================
+
+#include <unity.h>
+#include <stdint.h>
+
+#include "PublishSlots.h"
+
+namespace {
+
+constexpr size_t   MAX       = 64;
+constexpr uint32_t WINDOW_MS = 20;
+using Slots = PublishSlots<MAX>;
+
+Slots g_slots;
+
+uint32_t g_x = 2463534242u;
+uint32_t next() {
+    g_x ^= g_x << 13;
+    g_x ^= g_x >> 17;
+    g_x ^= g_x << 5;
+    return g_x;
+}
+
+uint32_t device(size_t i) { return 1000 + (uint32_t)i; }
+
+// 周期の中で windowMs 以内に重なる送信の最大数
+size_t maxBurst(const uint32_t* phase, size_t n, uint32_t windowMs) {
+    size_t worst = 0;
+    for (size_t i = 0; i < n; ++i) {
+        size_t k = 0;
+        for (size_t j = 0; j < n; ++j) {
+            if ((phase[j] + Slots::PERIOD_MS - phase[i]) % Slots::PERIOD_MS < windowMs) k++;
+        }
+        if (k > worst) worst = k;
+    }
+    return worst;
+}
+
+}  // namespace
+
+void setUp(void) { g_slots.clear(); }
+void tearDown(void) {}
+
+// count 台までは別々の枠、超えた分は満杯
+void test_distinct_until_full(void) {
+    const size_t counts[] = { 1, 8, 32, MAX };
+    for (size_t count : counts) {
+        g_slots.clear();
+        bool used[MAX] = {};
+        for (size_t i = 0; i < count; ++i) {
+            int s = g_slots.slotFor(device(i), 0, count);
+            TEST_ASSERT_TRUE(s >= 0 && (size_t)s < count);
+            TEST_ASSERT_FALSE(used[s]);
+            used[s] = true;
+            TEST_ASSERT_EQUAL_INT(s, g_slots.slotFor(device(i), 10, count));   // 同じノードは同じ枠
+        }
+        for (size_t i = count; i < count + 8; ++i) {
+            TEST_ASSERT_EQUAL_INT(-1, g_slots.slotFor(device(i), 10, count));
+        }
+        TEST_ASSERT_EQUAL_UINT32(count, g_slots.used(count));
+        TEST_ASSERT_EQUAL_UINT32(count, g_slots.stats().assigned);
+        TEST_ASSERT_EQUAL_UINT32(8, g_slots.stats().full);
+    }
+}
+
+// 止まったノード（IDLE_MS 何も届かない）の枠だけが新しいノードへ回る
+void test_idle_slots_reused(void) {
+    const size_t count = 32;
+    int slot[count];
+    for (size_t i = 0; i < count; ++i) slot[i] = g_slots.slotFor(device(i), 0, count);
+
+    // 偶数番だけ届き続け、奇数番は止まった
+    for (size_t i = 0; i < count; i += 2) g_slots.touch(device(i), Slots::IDLE_MS, count);
+    g_slots.touch(device(999), Slots::IDLE_MS, count);   // 枠の無いノードは何もしない
+
+    bool taken[count] = {};
+    for (size_t k = 0; k < count / 2; ++k) {
+        int got = g_slots.slotFor(device(count + k), Slots::IDLE_MS, count);
+        TEST_ASSERT_TRUE(got >= 0);
+        bool fromIdle = false;
+        for (size_t j = 1; j < count; j += 2) fromIdle = fromIdle || slot[j] == got;
+        TEST_ASSERT_TRUE(fromIdle);
+        TEST_ASSERT_FALSE(taken[got]);
+        taken[got] = true;
+    }
+    // 止まった枠を使い切ったら満杯（動いているノードの枠は取らない）
+    TEST_ASSERT_EQUAL_INT(-1, g_slots.slotFor(device(999), Slots::IDLE_MS, count));
+    TEST_ASSERT_EQUAL_UINT32(count / 2, g_slots.stats().reassigned);
+    for (size_t i = 0; i < count; i += 2) {
+        TEST_ASSERT_EQUAL_INT(slot[i], g_slots.slotFor(device(i), Slots::IDLE_MS, count));
+    }
+}
+
+// ms の折り返しをまたいでも止まった判定が崩れない
+void test_idle_across_millis_wrap(void) {
+    const uint32_t t0 = 0xFFFFF000u;
+    g_slots.slotFor(device(0), t0, 1);
+    TEST_ASSERT_EQUAL_INT(-1, g_slots.slotFor(device(1), t0 + 10000, 1));   // 折り返し後 5.9 s
+    TEST_ASSERT_EQUAL_INT(0, g_slots.slotFor(device(1), t0 + Slots::IDLE_MS, 1));
+}
+
+// 枠ありなら 20 ms 以内に重なる送信は 1 通、位相ばらばらより少ない
+void test_slots_spread_bursts(void) {
+    static uint32_t phase[MAX];
+    const size_t counts[] = { 32, MAX };
+    for (size_t count : counts) {
+        g_slots.clear();
+        for (size_t i = 0; i < count; ++i) {
+            phase[i] = Slots::offsetMs(g_slots.slotFor(device(i), 0, count), count);
+        }
+        size_t slotted = maxBurst(phase, count, WINDOW_MS);
+        for (size_t i = 0; i < count; ++i) phase[i] = next() % Slots::PERIOD_MS;
+        size_t random = maxBurst(phase, count, WINDOW_MS);
+        TEST_ASSERT_EQUAL_UINT32(1, slotted);
+        TEST_ASSERT_TRUE(random > slotted);
+    }
+}
+
+// count を減らすと範囲外の枠は使わず、戻せばそのまま使える。範囲外の count は丸める
+void test_count_changes(void) {
+    for (size_t i = 0; i < 16; ++i) g_slots.slotFor(device(i), 0, 16);
+    TEST_ASSERT_EQUAL_UINT32(4, g_slots.used(4));
+    TEST_ASSERT_EQUAL_INT(-1, g_slots.slotFor(device(100), 0, 4));
+    TEST_ASSERT_EQUAL_INT(15, g_slots.slotFor(device(15), 0, 16));
+    TEST_ASSERT_EQUAL_UINT32(16, g_slots.used(16));
+
+    TEST_ASSERT_EQUAL_UINT32(0, Slots::offsetMs(0, 0));                 // 0 → 1
+    TEST_ASSERT_EQUAL_UINT32(Slots::PERIOD_MS / 2, Slots::offsetMs(1, 2));
+    TEST_ASSERT_EQUAL_UINT32(Slots::PERIOD_MS * 63 / MAX, Slots::offsetMs(63, 200));   // → MAX
+    TEST_ASSERT_EQUAL_UINT32(16, g_slots.used(1000));
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_distinct_until_full);
+    RUN_TEST(test_idle_slots_reused);
+    RUN_TEST(test_idle_across_millis_wrap);
+    RUN_TEST(test_slots_spread_bursts);
+    RUN_TEST(test_count_changes);
+    return UNITY_END();
+}
@@ -0,0 +1,200 @@
+// ================================================================
+//  RuleTable（表情 / LED ルールの量子化表）のホストテスト
+//   pio test -e native -f test_rule_table
+// ================================================================
+
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "RuleTable.h"
+#include "TraceFormat.h"
+
+namespace {
+
+RuleTable g_table;   // 約 8KB（スタックに置かない）
+
+// 既定ルールと同じ温度ゾーン（Sad / Neutral / Happy / Doubt / Angry）
+const float ZONES[][2] = {
+    { -1e9f, 15.0f }, { 15.0f, 20.0f }, { 20.0f, 26.1f }, { 26.1f, 30.1f }, { 30.1f, 1e9f },
+};
+const size_t ZONE_COUNT = sizeof(ZONES) / sizeof(ZONES[0]);
+
+void zoneRules(RuleTable::Rule* rules) {
+    for (size_t i = 0; i < ZONE_COUNT; ++i) {
+        RuleTable::clearRule(rules[i]);
+        rules[i].lo[RULE_AXIS_TEMP] = ZONES[i][0];
+        rules[i].hi[RULE_AXIS_TEMP] = ZONES[i][1];
+    }
+}
+
+void values(float* v, float t, float h) {
+    for (uint8_t a = 0; a < RULE_AXIS_COUNT; ++a) v[a] = NAN;
+    v[RULE_AXIS_TEMP] = t;
+    v[RULE_AXIS_HUM]  = h;
+}
+
+// 素朴な線形評価（先に書いたルールが優先）
+int8_t linearEvaluate(const RuleTable::Rule* rules, size_t count, const float* v) {
+    for (size_t i = 0; i < count; ++i) {
+        bool hit = true;
+        for (uint8_t a = 0; a < RULE_AXIS_COUNT; ++a) {
+            bool open = !(rules[i].lo[a] > -1e8f) && !(rules[i].hi[a] < 1e8f);
+            hit = hit && (open || (v[a] >= rules[i].lo[a] && v[a] < rules[i].hi[a]));
+        }
+        if (hit) return (int8_t)i;
+    }
+    return RuleTable::NoRule;
+}
+
+}  // namespace
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_total_bins_matches_axes(void) {
+    size_t sum = 0;
+    for (uint8_t a = 0; a < RULE_AXIS_COUNT; ++a) sum += RuleTable::axis(a).bins;
+    TEST_ASSERT_EQUAL(sum, RuleTable::TotalBins);
+}
+
+// 各ビンの中央で表引きと線形評価が一致する（温度 × 湿度の 2 軸）
+void test_table_matches_linear_evaluation(void) {
+    RuleTable::Rule rules[4];
+    for (auto& r : rules) RuleTable::clearRule(r);
+    rules[0].lo[RULE_AXIS_TEMP] = 28.0f;                       // 暑い
+    rules[1].lo[RULE_AXIS_TEMP] = 22.0f;                       // 蒸し暑い
+    rules[1].lo[RULE_AXIS_HUM]  = 70.0f;
+    rules[2].hi[RULE_AXIS_HUM]  = 30.0f;                       // 乾燥
+    rules[3].lo[RULE_AXIS_TEMP] = 10.0f;                       // 普通
+    rules[3].hi[RULE_AXIS_TEMP] = 28.0f;
+    g_table.compile(rules, 4, nullptr);
+
+    const auto& ta = RuleTable::axis(RULE_AXIS_TEMP);
+    const auto& ha = RuleTable::axis(RULE_AXIS_HUM);
+    uint32_t mismatched = 0;
+    for (uint16_t bt = 0; bt < ta.bins; ++bt) {
+        for (uint16_t bh = 0; bh < ha.bins; bh += 5) {
+            float v[RULE_AXIS_COUNT];
+            values(v, ta.min + ta.step * (bt + 0.5f), ha.min + ha.step * (bh + 0.5f));
+            mismatched += g_table.evaluate(v, RuleTable::NoRule) != linearEvaluate(rules, 4, v);
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, mismatched);
+}
+
+// NaN の軸は、その軸に範囲を指定したルールに一致しない（ビン 0 に入らない）
+void test_nan_matches_no_constrained_rule(void) {
+    RuleTable::Rule rules[2];
+    RuleTable::clearRule(rules[0]);
+    RuleTable::clearRule(rules[1]);
+    rules[0].hi[RULE_AXIS_TEMP] = 0.0f;   // 氷点下（NaN が -40 ℃ のビンに入ると一致してしまう）
+    rules[1].lo[RULE_AXIS_HUM]  = 50.0f;  // 温度は見ない
+    g_table.compile(rules, 2, nullptr);
+
+    float v[RULE_AXIS_COUNT];
+    values(v, NAN, 40.0f);
+    TEST_ASSERT_EQUAL_INT8(RuleTable::NoRule, g_table.evaluate(v, RuleTable::NoRule));
+    TEST_ASSERT_EQUAL_INT8(RuleTable::NoRule, g_table.evaluate(v, 0));   // 保持もしない
+
+    values(v, NAN, 60.0f);
+    TEST_ASSERT_EQUAL_INT8(1, g_table.evaluate(v, RuleTable::NoRule));
+
+    values(v, -5.0f, 60.0f);
+    TEST_ASSERT_EQUAL_INT8(0, g_table.evaluate(v, RuleTable::NoRule));
+}
+
+// 保持範囲（_hold）: 境界を幅の内側で越えても切り替えず、外へ出たら切り替える
+void test_hysteresis_holds_current_rule(void) {
+    RuleTable::Rule rules[ZONE_COUNT];
+    zoneRules(rules);
+    float hyst[RULE_AXIS_COUNT] = {};
+    hyst[RULE_AXIS_TEMP] = 0.3f;
+    g_table.compile(rules, ZONE_COUNT, hyst);
+
+    float  v[RULE_AXIS_COUNT];
+    int8_t cur = RuleTable::NoRule;
+    const struct { float t; int8_t expect; } steps[] = {
+        { 19.5f, 1 },   // Neutral
+        { 20.1f, 1 },   // 境界 20.0 を越えたが保持幅の内側
+        { 20.25f, 1 },
+        { 20.45f, 2 },  // 保持幅の外 → Happy
+        { 19.85f, 2 },  // 戻っても保持
+        { 19.6f, 1 },   // 保持幅の外 → Neutral
+    };
+    for (const auto& s : steps) {
+        values(v, s.t, 50.0f);
+        cur = g_table.evaluate(v, cur);
+        TEST_ASSERT_EQUAL_INT8(s.expect, cur);
+    }
+
+    // 保持幅なしなら境界で即切り替わる
+    g_table.compile(rules, ZONE_COUNT, nullptr);
+    values(v, 20.05f, 50.0f);
+    TEST_ASSERT_EQUAL_INT8(2, g_table.evaluate(v, 1));
+}
+
+// 境界付近でゆらぐ温度を受信トレース（TraceFormat）に書き、読み戻して流す。
+// 保持幅なしでは切り替えがばたつき、保持幅ありでは本当の移動だけで切り替わる
+void test_replayed_trace_switches_only_on_real_moves(void) {
+    static uint8_t trace[128 * 1024];
+    size_t len = TraceFormat::writeHeader(trace, 1700000000u);
+    TraceFormat::Writer writer;
+    writer.begin(0);
+
+    // 1 時間は 20.0 ℃ ± 0.2 のゆらぎ、その後 1 時間で 22 ℃ まで上がる（2 秒間隔）
+    uint32_t seed = 12345;
+    uint32_t ms   = 0;
+    for (int i = 0; i < 3600; ++i, ms += 2000) {
+        seed = seed * 1103515245u + 12345u;
+        float noise = ((seed >> 16) % 401) / 1000.0f - 0.2f;
+        float base  = i < 1800 ? 20.0f : 20.0f + (i - 1800) * (2.0f / 1800);
+        char  payload[32];
+        snprintf(payload, sizeof(payload), "%.2f,50.00,1013.2", base + noise);
+        size_t n = writer.encode(ms, 0, "home/env/room", payload, trace + len, sizeof(trace) - len);
+        TEST_ASSERT_NOT_EQUAL(0, n);
+        len += n;
+    }
+
+    RuleTable::Rule rules[ZONE_COUNT];
+    zoneRules(rules);
+    float hyst[RULE_AXIS_COUNT] = {};
+    hyst[RULE_AXIS_TEMP] = 0.3f;
+
+    int switches[2] = {};
+    for (int pass = 0; pass < 2; ++pass) {
+        g_table.compile(rules, ZONE_COUNT, pass ? hyst : nullptr);
+        static TraceFormat::Reader reader;
+        reader.begin();
+        size_t pos = TraceFormat::HEADER;
+        int8_t cur = RuleTable::NoRule;
+        TraceFormat::Message m;
+        int messages = 0;
+        while (size_t used = reader.next(trace + pos, len - pos, m)) {
+            pos += used;
+            if (!m.topic) continue;
+            float v[RULE_AXIS_COUNT];
+            values(v, strtof(m.payload, nullptr), 50.0f);
+            int8_t next = g_table.evaluate(v, cur);
+            if (cur != RuleTable::NoRule && next != cur) switches[pass]++;
+            cur = next;
+            messages++;
+        }
+        TEST_ASSERT_FALSE(reader.corrupt());
+        TEST_ASSERT_EQUAL(3600, messages);
+        TEST_ASSERT_EQUAL_INT8(2, cur);   // 最後は Happy
+    }
+    TEST_ASSERT_GREATER_THAN(50, switches[0]);
+    TEST_ASSERT_EQUAL(1, switches[1]);
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_total_bins_matches_axes);
+    RUN_TEST(test_table_matches_linear_evaluation);
+    RUN_TEST(test_nan_matches_no_constrained_rule);
+    RUN_TEST(test_hysteresis_holds_current_rule);
+    RUN_TEST(test_replayed_trace_switches_only_on_real_moves);
+    return UNITY_END();
+}
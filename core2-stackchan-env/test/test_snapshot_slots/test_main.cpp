@@ -0,0 +1,168 @@
+// ================================================================
+//  SnapshotSlots（2 面交互書き込み）のホストテスト
+//   pio test -e native -f test_snapshot_slots
+//   書き込みを先頭 k バイトで打ち切る / 任意の 1 ビットを反転させても、
+//   読み出しが「直前に書き終えた内容」か「今回の内容」のどちらかに
+//   完全に一致する（壊れた内容を返さない）ことを確かめる。
+// ================================================================
+
+#include <unity.h>
+#include <string.h>
+
+#include "SnapshotSlots.h"
+
+namespace {
+
+// ハブの HubSnapshot と同じ並び（先頭に見出し、末尾に checksum）
+struct Snap {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    uint32_t seq;
+    uint32_t savedEpoch;
+    float    temperature;
+    float    servoY;
+    uint8_t  expression;
+    uint8_t  flags;
+    uint8_t  trend[90];
+    uint32_t checksum;
+};
+
+using Slots = SnapshotSlots<Snap, 0x50414E53, 1>;
+
+uint32_t g_x = 88172645u;
+uint32_t next() {
+    g_x ^= g_x << 13;
+    g_x ^= g_x >> 17;
+    g_x ^= g_x << 5;
+    return g_x;
+}
+
+Snap make(uint32_t i) {
+    Snap s;
+    memset(&s, 0, sizeof(s));
+    s.savedEpoch  = 1704067200u + i;
+    s.temperature = (float)(i % 500) * 0.1f;
+    s.servoY      = (float)(i % 90);
+    s.expression  = (uint8_t)(i % 6);
+    s.flags       = (uint8_t)i;
+    for (size_t k = 0; k < sizeof(s.trend); ++k) s.trend[k] = (uint8_t)(i + k);
+    return s;
+}
+
+bool same(const Snap& a, const Snap& b) {
+    return memcmp(&a, &b, sizeof(Snap)) == 0;
+}
+
+}  // namespace
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_empty_slots_load_nothing(void) {
+    Snap slots[Slots::SLOTS], out;
+    memset(slots, 0, sizeof(slots));
+    TEST_ASSERT_FALSE(Slots::load(slots, out));
+    memset(slots, 0xA5, sizeof(slots));   // 電源投入直後の不定な中身
+    TEST_ASSERT_FALSE(Slots::load(slots, out));
+}
+
+// 交互に書き、新しい方を読む
+void test_write_alternates_and_load_returns_newest(void) {
+    Snap slots[Slots::SLOTS], out;
+    memset(slots, 0, sizeof(slots));
+    int last = -1;
+    for (uint32_t i = 1; i <= 10; ++i) {
+        Snap s = make(i);
+        int  w = Slots::write(slots, s);
+        TEST_ASSERT_TRUE(w != last);
+        last = w;
+        TEST_ASSERT_EQUAL_UINT32(i, s.seq);
+        TEST_ASSERT_TRUE(Slots::load(slots, out));
+        TEST_ASSERT_TRUE(same(out, s));
+    }
+}
+
+// seq が一周しても新しい方を選ぶ
+void test_seq_wraps(void) {
+    Snap slots[Slots::SLOTS], out;
+    memset(slots, 0, sizeof(slots));
+    Snap a = make(1);
+    Slots::write(slots, a);
+    slots[0].seq      = UINT32_MAX;
+    slots[0].checksum = Slots::checksum(slots[0]);
+    Snap b = make(2);
+    Slots::write(slots, b);
+    TEST_ASSERT_EQUAL_UINT32(0, b.seq);
+    TEST_ASSERT_TRUE(Slots::load(slots, out));
+    TEST_ASSERT_TRUE(same(out, b));
+}
+
+// 書き込み途中の打ち切り・1 ビットの反転で壊れた内容を返さない
+void test_torn_writes_and_bit_flips_never_return_garbage(void) {
+    Snap slots[Slots::SLOTS];
+    memset(slots, 0, sizeof(slots));
+    Snap prev = make(0);
+    Slots::write(slots, prev);
+
+    uint32_t tornOld = 0, tornNew = 0;
+    for (uint32_t i = 1; i <= 20000; ++i) {
+        Snap nextSnap = make(i);
+        Snap after[Slots::SLOTS];
+        memcpy(after, slots, sizeof(after));
+        int target = Slots::write(after, nextSnap);
+
+        // 書き込み先の面を先頭 k バイトだけ書き換えた状態
+        size_t k = next() % (sizeof(Snap) + 1);
+        Snap   torn[Slots::SLOTS];
+        memcpy(torn, slots, sizeof(torn));
+        memcpy(&torn[target], &after[target], k);
+
+        Snap got;
+        TEST_ASSERT_TRUE(Slots::load(torn, got));
+        if (same(got, prev)) {
+            tornOld++;
+        } else {
+            TEST_ASSERT_TRUE(same(got, after[target]));
+            tornNew++;
+        }
+
+        // 書き終えた状態の任意の 1 ビットを反転
+        memcpy(slots, after, sizeof(slots));
+        Snap   flipped[Slots::SLOTS];
+        memcpy(flipped, slots, sizeof(flipped));
+        size_t bit = next() % (sizeof(flipped) * 8);
+        ((uint8_t*)flipped)[bit / 8] ^= (uint8_t)(1u << (bit % 8));
+        if (Slots::load(flipped, got)) {   // 読めないのは可（冷えた起動になる）
+            TEST_ASSERT_TRUE(same(got, slots[target]) || same(got, prev));
+        }
+        prev = slots[target];
+    }
+    TEST_ASSERT_TRUE(tornOld > 0);
+    TEST_ASSERT_TRUE(tornNew > 0);
+}
+
+// 大きさ・版が違う面は使わない
+void test_size_and_version_mismatch_are_rejected(void) {
+    Snap slots[Slots::SLOTS], out;
+    memset(slots, 0, sizeof(slots));
+    Snap s = make(7);
+    int  w = Slots::write(slots, s);
+    slots[w].version  = 2;
+    slots[w].checksum = Slots::checksum(slots[w]);
+    TEST_ASSERT_FALSE(Slots::load(slots, out));
+    slots[w].version  = 1;
+    slots[w].size     = sizeof(Snap) - 4;
+    slots[w].checksum = Slots::checksum(slots[w]);
+    TEST_ASSERT_FALSE(Slots::load(slots, out));
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_slots_load_nothing);
+    RUN_TEST(test_write_alternates_and_load_returns_newest);
+    RUN_TEST(test_seq_wraps);
+    RUN_TEST(test_torn_writes_and_bit_flips_never_return_garbage);
+    RUN_TEST(test_size_and_version_mismatch_are_rejected);
+    return UNITY_END();
+}
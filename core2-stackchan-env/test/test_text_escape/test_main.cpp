@@ -0,0 +1,75 @@
+// ================================================================
+//  TextEscape（JSON / HTML のエスケープ）と ChunkWriter::printHtml のホストテスト
+//   pio test -e native -f test_text_escape
+// ================================================================
+
+#include <unity.h>
+#include <string>
+
+#include "TextEscape.h"
+#include "ChunkWriter.h"
+
+namespace {
+
+void appendSink(void* ctx, const char* data, size_t len) {
+    static_cast<std::string*>(ctx)->append(data, len);
+}
+
+}  // namespace
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_json_escapes_quotes_backslash_and_controls(void) {
+    char out[64];
+    TEST_ASSERT_TRUE(TextEscape::json(out, sizeof(out), "pa\"ss\\w\nrd\x01"));
+    TEST_ASSERT_EQUAL_STRING("pa\\\"ss\\\\w\\nrd\\u0001", out);
+    TEST_ASSERT_TRUE(TextEscape::json(out, sizeof(out), "plain"));
+    TEST_ASSERT_EQUAL_STRING("plain", out);
+}
+
+void test_json_truncates_on_sequence_boundary(void) {
+    char out[6];
+    TEST_ASSERT_FALSE(TextEscape::json(out, sizeof(out), "abc\"def"));
+    TEST_ASSERT_EQUAL_STRING("abc\\\"", out);   // 5 文字 + NUL（\" を割らない）
+    char tiny[4];
+    TEST_ASSERT_FALSE(TextEscape::json(tiny, sizeof(tiny), "ab\"c"));
+    TEST_ASSERT_EQUAL_STRING("ab", tiny);
+}
+
+void test_html_escapes_attribute_breakers(void) {
+    char out[128];
+    TEST_ASSERT_TRUE(TextEscape::html(out, sizeof(out), "x' onmouseover='alert(1)<b>&\""));
+    TEST_ASSERT_EQUAL_STRING("x&#39; onmouseover=&#39;alert(1)&lt;b&gt;&amp;&quot;", out);
+}
+
+void test_worst_case_fits_max_expansion(void) {
+    char in[65];
+    memset(in, '\x1f', 64);
+    in[64] = '\0';
+    char out[64 * TextEscape::MAX_EXPANSION + 1];
+    TEST_ASSERT_TRUE(TextEscape::json(out, sizeof(out), in));
+    memset(in, '"', 64);
+    TEST_ASSERT_TRUE(TextEscape::html(out, sizeof(out), in));
+}
+
+void test_chunk_writer_print_html_across_flushes(void) {
+    std::string got;
+    char        buf[8];   // 置き換えがバッファの境目をまたぐ
+    ChunkWriter w(buf, sizeof(buf), appendSink, &got);
+    w.print("<td>");
+    w.printHtml("a<b>'c'&d");
+    w.print("</td>");
+    w.flush();
+    TEST_ASSERT_EQUAL_STRING("<td>a&lt;b&gt;&#39;c&#39;&amp;d</td>", got.c_str());
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_json_escapes_quotes_backslash_and_controls);
+    RUN_TEST(test_json_truncates_on_sequence_boundary);
+    RUN_TEST(test_html_escapes_attribute_breakers);
+    RUN_TEST(test_worst_case_fits_max_expansion);
+    RUN_TEST(test_chunk_writer_print_html_across_flushes);
+    return UNITY_END();
+}
@@ -0,0 +1,119 @@
+// ================================================================
+//  TopicRouter（MQTT トピックツリー索引）のホストテスト
+//   pio test -e native -f test_topic_router
+// ================================================================
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "TopicRouter.h"
+
+namespace {
+
+int  g_hits[4];
+char g_lastLevel[32];
+
+void onEnv(const char*, const char*, const char* const* levels, uint8_t count) {
+    g_hits[0]++;
+    strncpy(g_lastLevel, levels[count - 1], sizeof(g_lastLevel) - 1);
+}
+void onCmd(const char*, const char*, const char* const*, uint8_t) { g_hits[1]++; }
+void onStat(const char*, const char*, const char* const*, uint8_t) { g_hits[2]++; }
+void onOther(const char*, const char*, const char* const*, uint8_t) { g_hits[3]++; }
+
+uint32_t fnv(const char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) h = (h ^ (uint8_t)*s++) * 16777619u;
+    return h;
+}
+
+}  // namespace
+
+void setUp(void) {
+    memset(g_hits, 0, sizeof(g_hits));
+    g_lastLevel[0] = '\0';
+}
+void tearDown(void) {}
+
+void test_routes_wildcards(void) {
+    TopicRouter<32> r;
+    TEST_ASSERT_TRUE(r.add("home/env/+", onEnv));
+    TEST_ASSERT_TRUE(r.add("stackchan/cmd/#", onCmd));
+    TEST_ASSERT_TRUE(r.add("home/env/+/stat", onStat));
+
+    TEST_ASSERT_EQUAL(1, r.route("home/env/room", "1"));
+    TEST_ASSERT_EQUAL_STRING("room", g_lastLevel);
+    TEST_ASSERT_EQUAL(1, r.route("stackchan/cmd", "x"));        // "a/#" は "a" 自身にも一致
+    TEST_ASSERT_EQUAL(1, r.route("stackchan/cmd/link", "x"));
+    TEST_ASSERT_EQUAL(1, r.route("home/env/room/stat", "x"));
+    TEST_ASSERT_EQUAL(0, r.route("home/env", "x"));
+    TEST_ASSERT_EQUAL(0, r.route("home/envx/room", "x"));
+    TEST_ASSERT_EQUAL(1, g_hits[0]);
+    TEST_ASSERT_EQUAL(2, g_hits[1]);
+    TEST_ASSERT_EQUAL(1, g_hits[2]);
+}
+
+// FNV-1a が同じ 32bit 値になる別のレベル名でハンドラを取り違えない
+void test_hash_collision_does_not_match(void) {
+    // 衝突する 2 語を総当たりで探す（"xxxxx" の 5 文字, 数秒以内）
+    static uint32_t seen[1u << 20];
+    static char     names[1u << 20][8];
+    memset(seen, 0, sizeof(seen));
+    char a[8] = "", b[8] = "";
+    char s[8] = "aaaaaa";
+    for (uint32_t i = 0; i < 40000000u && !a[0]; ++i) {
+        uint32_t n = i;
+        for (int k = 0; k < 6; ++k, n /= 26) s[k] = (char)('a' + n % 26);
+        uint32_t h    = fnv(s);
+        uint32_t slot = h & ((1u << 20) - 1);
+        if (seen[slot] == h && strcmp(names[slot], s) != 0) {
+            strcpy(a, names[slot]);
+            strcpy(b, s);
+        }
+        seen[slot] = h;
+        strcpy(names[slot], s);
+    }
+    TEST_ASSERT_TRUE_MESSAGE(a[0] != 0, "no FNV collision found");
+    TEST_ASSERT_EQUAL_HEX32(fnv(a), fnv(b));
+
+    TopicRouter<32> r;
+    char pattern[32], topic[32];
+    snprintf(pattern, sizeof(pattern), "home/%s", a);
+    TEST_ASSERT_TRUE(r.add(pattern, onOther));
+    snprintf(topic, sizeof(topic), "home/%s", b);
+    TEST_ASSERT_EQUAL(0, r.route(topic, "x"));
+    snprintf(topic, sizeof(topic), "home/%s", a);
+    TEST_ASSERT_EQUAL(1, r.route(topic, "x"));
+
+    // 衝突する名前どうしを両方登録しても別ノードになる
+    snprintf(pattern, sizeof(pattern), "home/%s", b);
+    TEST_ASSERT_TRUE(r.add(pattern, onStat));
+    snprintf(topic, sizeof(topic), "home/%s", b);
+    TEST_ASSERT_EQUAL(1, r.route(topic, "x"));
+    TEST_ASSERT_EQUAL(1, g_hits[2]);
+    TEST_ASSERT_EQUAL(1, g_hits[3]);
+}
+
+void test_add_fails_when_full(void) {
+    TopicRouter<4> r;
+    TEST_ASSERT_TRUE(r.add("a/b/c", onOther));     // ルート + 3
+    TEST_ASSERT_FALSE(r.add("a/d", onOther));
+    TEST_ASSERT_EQUAL(1, r.route("a/b/c", "x"));
+}
+
+void test_match_helper(void) {
+    TEST_ASSERT_TRUE(mqttTopicMatches("home/env/+", "home/env/room"));
+    TEST_ASSERT_TRUE(mqttTopicMatches("stackchan/#", "stackchan"));
+    TEST_ASSERT_FALSE(mqttTopicMatches("home/env/+", "home/env/room/stat"));
+    TEST_ASSERT_FALSE(mqttTopicMatches("home/env", "home/envx"));
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_routes_wildcards);
+    RUN_TEST(test_hash_collision_does_not_match);
+    RUN_TEST(test_add_fails_when_full);
+    RUN_TEST(test_match_helper);
+    return UNITY_END();
+}
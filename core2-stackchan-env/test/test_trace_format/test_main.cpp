@@ -0,0 +1,185 @@
+// ================================================================
+//  TraceFormat（受信トレースの形式）のホストテスト
+//   pio test -e native -f test_trace_format
+//   Writer で詰めた記録が Reader で同じ順・同じ時刻・同じ配送路に戻ること、
+//   途中で切れたレコードは「足りない」で待ち、読み足せば続きから読めること、
+//   壊れた記録・番号の尽きたトピックの扱いを確かめる。
+// ================================================================
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "TraceFormat.h"
+
+namespace {
+
+TraceFormat::Writer g_writer;
+TraceFormat::Reader g_reader;
+uint8_t             g_buf[64 * 1024];
+
+struct Sent {
+    uint32_t ms;
+    uint8_t  transport;
+    char     topic[32];
+    char     payload[48];
+};
+
+// 3 台 × 10 通（計測値・時刻要求）を g_buf に詰め、長さを返す
+size_t writeSample(Sent* sent, size_t& count, uint32_t epoch) {
+    size_t len = TraceFormat::writeHeader(g_buf, epoch);
+    g_writer.begin(1000);
+    count = 0;
+    for (uint32_t k = 0; k < 10; ++k) {
+        for (uint32_t d = 0; d < 3; ++d) {
+            Sent& s = sent[count++];
+            s.ms        = 1000 + k * 2000 + d * 7 + (k >= 5 ? 300000 : 0);   // 途中に長い間隔
+            s.transport = (uint8_t)(d % 2);
+            snprintf(s.topic, sizeof(s.topic), (k % 4 == 3) ? "home/env/s%u/timereq" : "home/env/s%u",
+                     (unsigned)d);
+            snprintf(s.payload, sizeof(s.payload), "%.2f,%.2f,%.1f,%u,7", 20 + k * 0.1,
+                     50 - d * 1.0, 1013.2, (unsigned)k);
+            size_t n = g_writer.encode(s.ms, s.transport, s.topic, s.payload, g_buf + len,
+                                       sizeof(g_buf) - len);
+            TEST_ASSERT_TRUE(n > 0);
+            len += n;
+        }
+    }
+    return len;
+}
+
+}  // namespace
+
+void setUp(void) { g_reader.begin(); }
+void tearDown(void) {}
+
+void test_header_round_trip(void) {
+    uint8_t  h[TraceFormat::HEADER];
+    uint32_t epoch = 0;
+    TEST_ASSERT_EQUAL_UINT32(TraceFormat::HEADER, TraceFormat::writeHeader(h, 1760000000u));
+    TEST_ASSERT_TRUE(TraceFormat::readHeader(h, sizeof(h), epoch));
+    TEST_ASSERT_EQUAL_UINT32(1760000000u, epoch);
+
+    TEST_ASSERT_FALSE(TraceFormat::readHeader(h, sizeof(h) - 1, epoch));   // 短い
+    h[4] = TraceFormat::VERSION + 1;
+    TEST_ASSERT_FALSE(TraceFormat::readHeader(h, sizeof(h), epoch));       // 版違い
+    h[4] = TraceFormat::VERSION;
+    h[0] = 'X';
+    TEST_ASSERT_FALSE(TraceFormat::readHeader(h, sizeof(h), epoch));
+}
+
+void test_varint_boundaries(void) {
+    const uint32_t values[] = { 0, 1, 0x7F, 0x80, 0x3FFF, 0x4000, 300000, 0xFFFFFFFFu };
+    const size_t   sizes[]  = { 1, 1, 1, 2, 2, 3, 3, 5 };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+        uint8_t  p[5];
+        uint32_t v;
+        size_t   n = TraceFormat::putVarint(p, values[i]);
+        TEST_ASSERT_EQUAL_UINT32(sizes[i], n);
+        TEST_ASSERT_EQUAL_UINT32(n, TraceFormat::getVarint(p, n, v));
+        TEST_ASSERT_EQUAL_UINT32(values[i], v);
+        TEST_ASSERT_EQUAL_UINT32(0, TraceFormat::getVarint(p, n - 1, v));   // 足りない
+    }
+}
+
+// 書いた順・時刻・配送路・トピック・ペイロードがそのまま戻る（定義は 1 回ずつ）
+void test_messages_round_trip(void) {
+    static Sent sent[30];
+    size_t count, len = writeSample(sent, count, 1760000000u);
+    TEST_ASSERT_EQUAL_UINT8(6, g_writer.topics());
+
+    size_t pos = TraceFormat::HEADER, got = 0, defines = 0;
+    TraceFormat::Message m;
+    while (size_t used = g_reader.next(g_buf + pos, len - pos, m)) {
+        pos += used;
+        if (!m.topic) {
+            defines++;
+            continue;
+        }
+        TEST_ASSERT_TRUE(got < count);
+        TEST_ASSERT_EQUAL_UINT32(sent[got].ms - 1000, m.ms);
+        TEST_ASSERT_EQUAL_UINT8(sent[got].transport, m.transport);
+        TEST_ASSERT_EQUAL_STRING(sent[got].topic, m.topic);
+        TEST_ASSERT_EQUAL_STRING(sent[got].payload, m.payload);
+        got++;
+    }
+    TEST_ASSERT_EQUAL_UINT32(count, got);
+    TEST_ASSERT_EQUAL_UINT32(6, defines);
+    TEST_ASSERT_EQUAL_UINT32(len, pos);
+    TEST_ASSERT_FALSE(g_reader.corrupt());
+}
+
+// 1 バイトずつ読み足しても同じものが読める（途中で切れたレコードは 0 で待つ）
+void test_partial_records_wait_for_more(void) {
+    static Sent sent[30];
+    size_t count, len = writeSample(sent, count, 0);
+
+    size_t pos = TraceFormat::HEADER, avail = pos, got = 0;
+    TraceFormat::Message m;
+    while (avail <= len) {
+        size_t used = g_reader.next(g_buf + pos, avail - pos, m);
+        if (!used) {
+            TEST_ASSERT_FALSE(g_reader.corrupt());
+            avail++;
+            continue;
+        }
+        pos += used;
+        if (m.topic) {
+            TEST_ASSERT_EQUAL_STRING(sent[got].payload, m.payload);
+            got++;
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32(count, got);
+}
+
+void test_corrupt_records(void) {
+    TraceFormat::Message m;
+
+    const uint8_t undefinedId[] = { 0x00, 0x05, 0x01, 'x' };   // 定義の無い番号
+    TEST_ASSERT_EQUAL_UINT32(0, g_reader.next(undefinedId, sizeof(undefinedId), m));
+    TEST_ASSERT_TRUE(g_reader.corrupt());
+
+    g_reader.begin();
+    const uint8_t badDefine[] = { 0x00, TraceFormat::DEFINE, TraceFormat::TOPICS, 1, 'x' };
+    TEST_ASSERT_EQUAL_UINT32(0, g_reader.next(badDefine, sizeof(badDefine), m));
+    TEST_ASSERT_TRUE(g_reader.corrupt());
+
+    g_reader.begin();
+    const uint8_t longVarint[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01 };   // 5 バイトを超える
+    TEST_ASSERT_EQUAL_UINT32(0, g_reader.next(longVarint, sizeof(longVarint), m));
+    TEST_ASSERT_TRUE(g_reader.corrupt());
+}
+
+// 番号が尽きる・長すぎる・cap が足りないものは何も書かない
+void test_writer_rejects(void) {
+    static uint8_t out[TraceFormat::RECORD_MAX];
+    char           topic[TraceFormat::TOPIC_MAX + 2];
+    g_writer.begin(0);
+    for (unsigned i = 0; i < TraceFormat::TOPICS; ++i) {
+        snprintf(topic, sizeof(topic), "home/env/d%u", i);
+        TEST_ASSERT_TRUE(g_writer.encode(i, 0, topic, "1", out, sizeof(out)) > 0);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, g_writer.encode(100, 0, "home/env/new", "1", out, sizeof(out)));
+    TEST_ASSERT_TRUE(g_writer.encode(100, 0, "home/env/d0", "1", out, sizeof(out)) > 0);
+
+    g_writer.begin(0);
+    memset(topic, 'a', sizeof(topic) - 1);
+    topic[sizeof(topic) - 1] = '\0';
+    TEST_ASSERT_EQUAL_UINT32(0, g_writer.encode(0, 0, topic, "1", out, sizeof(out)));
+    TEST_ASSERT_EQUAL_UINT32(0, g_writer.encode(0, 0, "", "1", out, sizeof(out)));
+    TEST_ASSERT_EQUAL_UINT32(0, g_writer.encode(0, TraceFormat::TRANSPORTS, "t", "1", out,
+                                                sizeof(out)));
+    TEST_ASSERT_EQUAL_UINT32(0, g_writer.encode(0, 0, "t", "1", out, sizeof(out) - 1));
+    TEST_ASSERT_EQUAL_UINT8(0, g_writer.topics());
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_header_round_trip);
+    RUN_TEST(test_varint_boundaries);
+    RUN_TEST(test_messages_round_trip);
+    RUN_TEST(test_partial_records_wait_for_more);
+    RUN_TEST(test_corrupt_records);
+    RUN_TEST(test_writer_rejects);
+    return UNITY_END();
+}
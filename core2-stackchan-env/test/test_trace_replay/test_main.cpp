@@ -0,0 +1,269 @@
+// ================================================================
+//  TraceReplay（受信トレースの再生）と HubIngest（ファームウェアと同じ取り込み）の
+//  ホストテスト
+//   pio test -e native -f test_trace_replay
+//   センサー 4 台の 10 分ぶんに再送・順序の入れ替わり・旧形式・範囲外・
+//   時刻要求・後送り（と、その再送）を混ぜたトレースを再生し、
+//   受理・重複・隔離・応答・差し込みの数、ログが時刻順に並ぶこと、
+//   間引きがデバイスごとであること、
+//   digest が取り込み時間の測り方に依らず毎回同じになることを確かめる。
+//   digest はテストの出力に出す（同じ取り込みなら値は変わらない）。
+// ================================================================
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "TraceReplay.h"
+
+namespace {
+
+constexpr uint32_t EPOCH    = 1760000000u;
+constexpr uint32_t DEVICES  = 4;
+constexpr uint32_t STEPS    = 300;    // 2 秒ごと = 10 分
+constexpr uint32_t BACKFILL = 10;     // 後送りの行（1 時間前から 1 分おき）
+
+HubIngestHost       g_hub;
+TraceReplay::Report g_report;
+TraceFormat::Writer g_writer;
+uint8_t             g_trace[128 * 1024];
+size_t              g_len = 0;
+
+// trace_tool check が読む項目
+const char* const KEYS[] = {
+    "messages", "corrupt", "accepted", "duplicates", "reordered", "legacy", "quarantined",
+    "backfill_rows", "replies", "log_writes", "log_rows", "samples", "digest", "ingest_us_avg", "ingest_us_p50", "ingest_us_p90", "ingest_us_p99",
+    "ingest_us_max",
+};
+
+void put(uint32_t ms, const char* topic, const char* payload) {
+    size_t n = g_writer.encode(ms, 0, topic, payload, g_trace + g_len, sizeof(g_trace) - g_len);
+    TEST_ASSERT_TRUE(n > 0);
+    g_len += n;
+}
+
+void sample(uint32_t ms, uint32_t d, uint32_t seq) {
+    char topic[32], payload[64];
+    snprintf(topic, sizeof(topic), "home/env/s%u", (unsigned)d);
+    snprintf(payload, sizeof(payload), "%.2f,%.2f,%.1f,%u,%u",
+             17.0 + 14.0 * seq / STEPS + d * 0.3, 50.0 - d * 2.0, 1008.0 + d, (unsigned)seq,
+             (unsigned)(40 + d));
+    put(ms, topic, payload);
+}
+
+void backfill(uint32_t ms) {
+    char     payload[512];
+    int      n    = snprintf(payload, sizeof(payload), "500,%u", (unsigned)(EPOCH - 3600));
+    for (uint32_t i = 0; i < BACKFILL; ++i) {
+        n += snprintf(payload + n, sizeof(payload) - n, ";%d,%d,5100,10090", i ? 60 : 0,
+                      (int)(1900 + i * 50));
+    }
+    put(ms, "home/env/s2/backfill", payload);
+}
+
+// 上のトレースを組み立てる
+//   再送 1（s0 の seq 10）、入れ替わり 1（s1 の 20 と 21）、旧形式 3、範囲外 1、
+//   時刻要求 1、後送り 1 塊（+ 同じ塊の再送）
+void buildTrace() {
+    g_len = TraceFormat::writeHeader(g_trace, EPOCH);
+    g_writer.begin(0);
+    for (uint32_t k = 0; k < STEPS; ++k) {
+        uint32_t ms = k * 2000;
+        for (uint32_t d = 0; d < DEVICES; ++d) {
+            uint32_t seq = k;
+            if (d == 1 && k == 20) seq = 21;
+            if (d == 1 && k == 21) seq = 20;
+            sample(ms + d * 13, d, seq);
+        }
+        if (k == 11) sample(ms + 100, 0, 10);
+        if (k == 30 || k == 31 || k == 32) put(ms + 200, "home/env/legacy", "21.0,45.0,1000.0");
+        if (k == 40) put(ms + 300, "home/env/s3", "200.0,40.0,1010.0,1,99");
+        if (k == 50) put(ms + 400, "home/env/s1/timereq", "123456");
+        if (k == 60 || k == 61) backfill(ms + 500);
+        if (k == 70) put(ms + 600, "home/env/s0/stat", "rssi=-60");
+    }
+}
+
+uint32_t g_fakeUs = 0;
+uint32_t fakeMicros() { return g_fakeUs += 7; }        // 1 通 7 µs
+uint32_t slowMicros() { return g_fakeUs += 5000; }     // 1 通 5 ms（分布の外）
+
+}  // namespace
+
+void setUp(void) {
+    if (!g_len) buildTrace();
+    g_hub.setReply(nullptr, nullptr);
+}
+void tearDown(void) {}
+
+void test_counts(void) {
+    TEST_ASSERT_TRUE(TraceReplay::run(g_trace, g_len, g_hub, g_report));
+    const HubIngest::Stats& c = g_report.stats;
+    const uint32_t samples = DEVICES * STEPS;
+    TEST_ASSERT_FALSE(g_report.corrupt);
+    TEST_ASSERT_EQUAL_UINT32(samples + 1 + 3 + 1 + 1 + 2 + 1, g_report.messages);
+    TEST_ASSERT_EQUAL_UINT32((STEPS - 1) * 2000 + (DEVICES - 1) * 13, g_report.spanMs);
+    TEST_ASSERT_EQUAL_UINT32(samples + 1, c.accepted);                    // 範囲外も seq としては受理
+    TEST_ASSERT_EQUAL_UINT32(1, c.duplicates);
+    TEST_ASSERT_EQUAL_UINT32(1, c.reordered);
+    TEST_ASSERT_EQUAL_UINT32(3, c.legacy);
+    TEST_ASSERT_EQUAL_UINT32(1, c.quarantined);
+    TEST_ASSERT_EQUAL_UINT32(BACKFILL, c.backfillMerged);                 // 再送の塊は差し込まない
+    TEST_ASSERT_EQUAL_UINT32(BACKFILL, c.backfillDuplicates);
+    TEST_ASSERT_EQUAL_UINT32(samples + 1 + 1 + 1 + 2, g_report.replies);  // ack（重複・範囲外も）+ 時刻 + 後送り
+    TEST_ASSERT_EQUAL_UINT32(1, c.timeRequests);
+    TEST_ASSERT_EQUAL_UINT32(c.logWrites, g_report.logRows);
+    TEST_ASSERT_EQUAL_UINT32(samples + 1 + 3 - 1, g_report.samples);      // 受理 + 旧形式 - 隔離
+
+    char msg[64];
+    snprintf(msg, sizeof(msg), "digest %08lx", (unsigned long)g_report.digest);
+    TEST_MESSAGE(msg);
+}
+
+// 後送りの行は時刻順の位置（先頭）に入り、ログ全体が時刻順
+void test_log_is_time_ordered(void) {
+    TEST_ASSERT_TRUE(TraceReplay::run(g_trace, g_len, g_hub, g_report));
+    TEST_ASSERT_EQUAL_UINT32(EPOCH - 3600, g_hub.logAt(0).time);
+    TEST_ASSERT_EQUAL_FLOAT(19.0f, g_hub.logAt(0).temperature);
+    for (size_t i = 1; i < g_hub.logRows(); ++i) {
+        TEST_ASSERT_TRUE(g_hub.logAt(i - 1).time <= g_hub.logAt(i).time);
+    }
+    TEST_ASSERT_FLOAT_WITHIN(0.005f, 31.85f, g_hub.lastSample().t);   // 最後は s3 の 31.85℃
+}
+
+// 似た値のセンサーが交互に届いても、それぞれ自分の前の行と比べて間引く
+void test_thins_per_device(void) {
+    g_hub.clear();
+    g_hub.setClock(EPOCH);
+    const char* const topics[] = { "home/env/a", "home/env/b" };
+    for (uint32_t k = 0; k < 6; ++k) {
+        char payload[48];
+        snprintf(payload, sizeof(payload), "%.2f,50.0,1000.0,%u,1", k < 3 ? 20.0 : 20.5,
+                 (unsigned)k);
+        for (uint32_t d = 0; d < 2; ++d) g_hub.message(topics[d], payload, k * 60000 + d);
+    }
+    // a / b とも最初の行と 20.5℃ に上がった行だけ（直前の行と比べると b は全部落ちる）
+    TEST_ASSERT_EQUAL_UINT32(4, g_hub.logRows());
+    TEST_ASSERT_EQUAL_UINT32(EnvSample::hashName("a"), g_hub.logAt(0).device);
+    TEST_ASSERT_EQUAL_UINT32(EnvSample::hashName("b"), g_hub.logAt(1).device);
+    TEST_ASSERT_EQUAL_FLOAT(20.5f, g_hub.logAt(3).temperature);
+    TEST_ASSERT_EQUAL_UINT32(12, g_hub.samples());
+}
+
+// digest は取り込み時間の測り方・回数に依らず同じ（ハブの状態は毎回作り直す）
+void test_digest_is_deterministic(void) {
+    TEST_ASSERT_TRUE(TraceReplay::run(g_trace, g_len, g_hub, g_report));
+    uint32_t digest = g_report.digest;
+    TEST_ASSERT_EQUAL_UINT32(0, g_report.usMax);
+
+    TEST_ASSERT_TRUE(TraceReplay::run(g_trace, g_len, g_hub, g_report, fakeMicros));
+    TEST_ASSERT_EQUAL_HEX32(digest, g_report.digest);
+    TEST_ASSERT_EQUAL_UINT32(7, g_report.usMax);
+    TEST_ASSERT_EQUAL_UINT32(TraceReplay::HIST_US, g_report.percentile(0.99f));
+
+    TEST_ASSERT_TRUE(TraceReplay::run(g_trace, g_len, g_hub, g_report, slowMicros));
+    TEST_ASSERT_EQUAL_HEX32(digest, g_report.digest);
+    TEST_ASSERT_EQUAL_UINT32(5000, g_report.percentile(0.50f));   // 最後の区間 = 最大
+}
+
+// 途中で切れたトレースはそこまでの結果、壊れたトレースは corrupt、ヘッダ違いは false
+void test_truncated_and_corrupt(void) {
+    TEST_ASSERT_TRUE(TraceReplay::run(g_trace, g_len / 2, g_hub, g_report));
+    TEST_ASSERT_FALSE(g_report.corrupt);
+    TEST_ASSERT_TRUE(g_report.messages > 0 && g_report.messages < DEVICES * STEPS);
+
+    // 半分を過ぎた最初の記録の境目から先を壊す
+    static TraceFormat::Reader reader;
+    static uint8_t             bad[sizeof(g_trace)];
+    TraceFormat::Message       m;
+    size_t                     cut = TraceFormat::HEADER;
+    reader.begin();
+    while (cut < g_len / 2) cut += reader.next(g_trace + cut, g_len - cut, m);
+    memcpy(bad, g_trace, g_len);
+    memset(bad + cut, 0xFF, 8);
+    TEST_ASSERT_TRUE(TraceReplay::run(bad, g_len, g_hub, g_report));
+    TEST_ASSERT_TRUE(g_report.corrupt);
+    TEST_ASSERT_TRUE(g_report.messages > 0 && g_report.messages < DEVICES * STEPS);
+
+    bad[0] = 'X';
+    TEST_ASSERT_FALSE(TraceReplay::run(bad, g_len, g_hub, g_report));
+    TEST_ASSERT_FALSE(g_report.valid);
+}
+
+// 分位は区間の上端、最後の区間は最大
+void test_percentile(void) {
+    TraceReplay::Report r;
+    memset(&r, 0, sizeof(r));
+    TEST_ASSERT_EQUAL_UINT32(0, r.percentile(0.5f));
+    r.messages = 100;
+    r.usMax    = 9000;
+    r.hist[0]  = 50;
+    r.hist[3]  = 40;
+    r.hist[TraceReplay::HIST_BUCKETS - 1] = 10;
+    TEST_ASSERT_EQUAL_UINT32(25, r.percentile(0.50f));
+    TEST_ASSERT_EQUAL_UINT32(100, r.percentile(0.90f));
+    TEST_ASSERT_EQUAL_UINT32(9000, r.percentile(0.99f));
+}
+
+// JSON に trace_tool check の項目がすべてあり、小さすぎる cap は 0
+void test_report_json(void) {
+    TEST_ASSERT_TRUE(TraceReplay::run(g_trace, g_len, g_hub, g_report, fakeMicros));
+    char   json[1024];
+    size_t n = g_report.toJson(json, sizeof(json), 12);
+    TEST_ASSERT_TRUE(n > 0);
+    TEST_ASSERT_EQUAL_UINT32(strlen(json), n);
+    for (const char* key : KEYS) {
+        char k[40];
+        snprintf(k, sizeof(k), "\"%s\":", key);
+        TEST_ASSERT_NOT_NULL_MESSAGE(strstr(json, k), key);
+    }
+    char digest[32];
+    snprintf(digest, sizeof(digest), "\"digest\":\"%08lx\"}", (unsigned long)g_report.digest);
+    TEST_ASSERT_NOT_NULL(strstr(json, digest));
+    TEST_ASSERT_EQUAL_UINT32(0, g_report.toJson(json, n, 12));
+}
+
+// 応答は届いたトピックへ（ack は重複でも返す）
+void test_replies(void) {
+    struct Log {
+        char     last[64];
+        uint32_t count;
+    } log = {};
+    g_hub.clear();
+    g_hub.setClock(0);
+    g_hub.setReply([](void* ctx, const char* topic, const char* payload) {
+        Log* l = (Log*)ctx;
+        snprintf(l->last, sizeof(l->last), "%s %s", topic, payload);
+        l->count++;
+    }, &log);
+
+    g_hub.message("home/env/a", "20.0,50.0,1000.0,5,9", 0);
+    TEST_ASSERT_EQUAL_STRING("home/env/a/ack 9,5", log.last);
+    g_hub.message("home/env/a", "20.0,50.0,1000.0,5,9", 10);
+    TEST_ASSERT_EQUAL_UINT32(2, log.count);
+    TEST_ASSERT_EQUAL_UINT32(1, g_hub.ingest().stats().duplicates);
+
+    g_hub.message("home/env/a/timereq", "77", 20);   // 時計が未設定なら答えない
+    TEST_ASSERT_EQUAL_UINT32(2, log.count);
+    g_hub.setClock(EPOCH);
+    g_hub.message("home/env/a/timereq", "77", 2500);
+    TEST_ASSERT_EQUAL_STRING("home/env/a/time 77,1760000002,500,0,2000", log.last);
+
+    g_hub.message("home/env/a", "garbage", 30);      // 読めないものは何もしない
+    g_hub.message("home/env/a/backfill", "1,2;x", 40);
+    TEST_ASSERT_EQUAL_UINT32(3, log.count);
+    TEST_ASSERT_EQUAL_UINT32(1, g_hub.ingest().stats().accepted);
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_counts);
+    RUN_TEST(test_log_is_time_ordered);
+    RUN_TEST(test_thins_per_device);
+    RUN_TEST(test_digest_is_deterministic);
+    RUN_TEST(test_truncated_and_corrupt);
+    RUN_TEST(test_percentile);
+    RUN_TEST(test_report_json);
+    RUN_TEST(test_replies);
+    return UNITY_END();
+}
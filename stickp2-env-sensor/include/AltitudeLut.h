@@ -0,0 +1,61 @@
+#pragma once
+// ================================================================
+//  気圧 → 高度の表引き
+//   - 高度 = 44330 * (1 - (p / p0)^0.1903) は比 r = p / p0 だけの関数なので、
+//     r について表を 1 度作っておけば海面気圧を変えても作り直し不要。
+//   - r = 0.25〜1.25 を 256 区間で線形補間（300〜1100 hPa × p0 900〜1100 hPa をカバー）。
+//     補間誤差は h^2/8 * max|f''| から r=0.25 端で最大約 0.2 m、r≒1 付近では 0.02 m 以下。
+//   - 範囲外（センサ異常値など）は厳密式にフォールバック。
+//   - 海面気圧は逆数も持っておき、1 回の計算で割り算をしない。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <math.h>
+#include <stdint.h>
+
+class AltitudeLut {
+public:
+    static constexpr float    R_MIN             = 0.25f;
+    static constexpr float    R_MAX             = 1.25f;
+    static constexpr uint16_t STEPS             = 256;
+    static constexpr float    SCALE             = STEPS / (R_MAX - R_MIN);
+    static constexpr float    SEA_LEVEL_DEFAULT = 1013.25f;   // hPa
+
+    // 厳密式（テーブル範囲外・検証用）
+    static float exact(float p_hPa, float seaLevelhPa) {
+        return 44330.0f * (1.0f - powf(p_hPa / seaLevelhPa, 0.1903f));
+    }
+
+    // 起動時に 1 回だけ呼ぶ
+    void init() {
+        for (uint16_t i = 0; i <= STEPS; ++i) {
+            float r = R_MIN + (float)i / SCALE;
+            _lut[i] = 44330.0f * (1.0f - powf(r, 0.1903f));
+        }
+    }
+
+    void  setSeaLevel(float hPa) {
+        _seaLevelhPa    = hPa;
+        _invSeaLevelhPa = 1.0f / hPa;
+    }
+    float seaLevel() const { return _seaLevelhPa; }
+
+    // 気圧 [Pa] → 高度 [m]
+    float altitude(float pressurePa) const {
+        float p_hPa = pressurePa * 0.01f;  // Pa → hPa
+        float x     = (p_hPa * _invSeaLevelhPa - R_MIN) * SCALE;
+
+        if (!(x >= 0.0f && x < (float)STEPS)) {
+            return exact(p_hPa, _seaLevelhPa);
+        }
+
+        uint16_t i    = (uint16_t)x;
+        float    frac = x - (float)i;
+        return _lut[i] + (_lut[i + 1] - _lut[i]) * frac;
+    }
+
+private:
+    float _lut[STEPS + 1]  = {};
+    float _seaLevelhPa    = SEA_LEVEL_DEFAULT;
+    float _invSeaLevelhPa = 1.0f / SEA_LEVEL_DEFAULT;
+};
@@ -0,0 +1,169 @@
+#pragma once
+// ================================================================
+//  ハブ時刻への同期（MQTT の時刻トピック。NTP と同じ往復方式の簡易版）
+//   - 要求: センサー → ハブ  "<t1>"              t1 = 送信時のローカル ms
+//   - 応答: ハブ → センサー  "<t1>,<sec>,<ms>,<slotOffsetMs>,<periodMs>"
+//     ハブのエポック秒 + ミリ秒と送信時刻の枠（parseReply で読む）。
+//   - 受信時刻 t4 で往復時間 rtt = t4 - t1 を測り、ハブの時刻は往復の
+//     中間で読まれたとみなす（ハブ時刻 + rtt/2 ≒ t4 時点の時刻）。
+//   - 1 回の同期は BURST 本の要求の組（beginRound → onReply × n → finishRound）。
+//     片道の遅れの偏りは rtt が短いほど小さいので、組の中で rtt が最短の応答だけを使う。
+//     rtt が MAX_RTT_MS を超えた応答・組の外で届いた応答は捨てる（混雑時の大きな誤差を入れない）。
+//   - 再同期でのずれが STEP_MS 以下なら SLEW_RATE でゆっくり寄せ（時刻が飛ばない）、
+//     超えたら一度に合わせる（戻る場合は追いつくまで据え置き。返す時刻は常に単調）。
+//   - ドリフト: 前回の同期から予測した時刻とのずれ / 経過時間 を ppm で求め、
+//     平滑して以降の時刻計算に反映する（水晶の個体差 数十 ppm を吸収）。
+//   - 動的確保なし。Arduino 非依存（ホストでもそのままビルドできる）。
+// ================================================================
+
+#include <stdint.h>
+#include <stdio.h>
+
+class TimeSync {
+public:
+    static constexpr uint32_t MAX_RTT_MS         = 300;
+    static constexpr uint8_t  BURST              = 4;       // 1 回の同期で送る要求の数
+    static constexpr uint32_t BURST_GAP_MS       = 250;     // 組の中の要求の間隔
+    static constexpr uint32_t STEP_MS            = 1000;    // これを超えるずれは一度に合わせる
+    static constexpr float    SLEW_RATE          = 0.005f;  // 寄せる速さ（5 ms / 秒）
+    static constexpr uint32_t MIN_DRIFT_SPAN_MS  = 60000;   // これより短い間隔ではドリフトを更新しない
+    static constexpr float    DRIFT_GAIN         = 0.3f;
+    static constexpr float    DRIFT_LIMIT_PPM    = 500.0f;
+    static constexpr uint32_t SLOT_PERIOD_MIN_MS = 500;     // 送信時刻の枠の周期
+    static constexpr uint32_t SLOT_PERIOD_MAX_MS = 60000;
+
+    struct Reply {
+        uint32_t t1;
+        uint32_t sec;
+        uint16_t ms;
+        uint32_t slotOffsetMs;
+        uint32_t periodMs;       // 0 = 枠なし（ハブ側が満杯）
+    };
+
+    // 応答を読む。5 項目そろわない・後ろに余計な文字がある・ms や枠が範囲外の応答は
+    // 丸ごと捨てる（途中で切れた応答の周期 "2000" → "200" などをそのまま使わない）。
+    static bool parseReply(const char* payload, Reply& r) {
+        unsigned long t1, sec, slotMs, periodMs;
+        unsigned      ms;
+        int           end = 0;
+        int n = sscanf(payload, "%lu,%lu,%u,%lu,%lu%n", &t1, &sec, &ms, &slotMs, &periodMs, &end);
+        if (n != 5 || payload[end] != '\0' || ms > 999) {
+            return false;
+        }
+        if (periodMs != 0 && !(periodMs >= SLOT_PERIOD_MIN_MS && periodMs <= SLOT_PERIOD_MAX_MS &&
+                               slotMs < periodMs)) {
+            return false;
+        }
+        r.t1           = (uint32_t)t1;
+        r.sec          = (uint32_t)sec;
+        r.ms           = (uint16_t)ms;
+        r.slotOffsetMs = periodMs ? (uint32_t)slotMs : 0;
+        r.periodMs     = (uint32_t)periodMs;
+        return true;
+    }
+
+    // 要求の組を始める（前の組に残った候補は捨てる）
+    void beginRound() {
+        _roundOpen  = true;
+        _candidates = 0;
+    }
+
+    // 応答を候補に加える（t4 = 受信時のローカル ms）。組の BURST 本がそろって
+    // 時刻を合わせたら true
+    bool onReply(uint32_t t1, uint32_t t4, uint32_t hubSec, uint16_t hubMs) {
+        uint32_t rtt = t4 - t1;
+        if (!_roundOpen || rtt > MAX_RTT_MS || hubSec == 0 || hubMs > 999) {
+            _rejected++;
+            return false;
+        }
+        if (!_candidates || rtt < _bestRtt) {
+            _bestRtt   = rtt;
+            _bestLocal = t4;
+            _bestEpoch = (int64_t)hubSec * 1000 + hubMs + rtt / 2;   // t4 時点のエポック ms
+        }
+        if (++_candidates < BURST) return false;
+        return finishRound();
+    }
+
+    // 組を閉じ、届いた中で rtt が最短の応答で合わせる（1 本も無ければ false）
+    bool finishRound() {
+        bool any    = _roundOpen && _candidates;
+        _roundOpen  = false;
+        _candidates = 0;
+        if (any) apply(_bestLocal, _bestEpoch, _bestRtt);
+        return any;
+    }
+
+    bool valid() const { return _valid; }
+
+    // ローカル ms → エポック ms（未同期なら 0）
+    int64_t epochMsAt(uint32_t localMs) {
+        if (!_valid) return 0;
+        int64_t t = rawAt(localMs);
+        if (t < _floorMs) t = _floorMs;
+        _floorMs = t;
+        return t;
+    }
+
+    float    driftPpm()    const { return _driftPpm; }
+    uint32_t lastRttMs()   const { return _lastRttMs; }
+    int32_t  lastErrorMs() const { return _lastErrorMs; }   // 直前の再同期での補正量
+    uint32_t syncs()       const { return _syncs; }
+    uint32_t steps()       const { return _steps; }         // 一度に合わせた回数
+    uint32_t rejected()    const { return _rejected; }
+
+private:
+    void apply(uint32_t t4, int64_t est, uint32_t rtt) {
+        int64_t slew = 0;
+        if (_valid) {
+            uint32_t span = t4 - _baseLocal;
+            int64_t  err  = est - rawAt(t4);
+            _lastErrorMs  = (int32_t)err;
+            if (span >= MIN_DRIFT_SPAN_MS) {
+                _driftPpm += DRIFT_GAIN * (float)err * 1e6f / (float)span;
+                if (_driftPpm >  DRIFT_LIMIT_PPM) _driftPpm =  DRIFT_LIMIT_PPM;
+                if (_driftPpm < -DRIFT_LIMIT_PPM) _driftPpm = -DRIFT_LIMIT_PPM;
+            }
+            if (err >= -(int64_t)STEP_MS && err <= (int64_t)STEP_MS) {
+                slew = -err;   // t4 では今の時刻のまま。残りを SLEW_RATE で消していく
+            } else {
+                _steps++;
+            }
+        }
+
+        _baseLocal   = t4;
+        _baseEpochMs = est;
+        _slewMs      = slew;
+        _slewSpanMs  = (uint32_t)((float)(slew < 0 ? -slew : slew) / SLEW_RATE);
+        _lastRttMs   = rtt;
+        _valid       = true;
+        _syncs++;
+    }
+
+    int64_t rawAt(uint32_t localMs) const {
+        int32_t dt = (int32_t)(localMs - _baseLocal);   // millis() の一周をまたいでも正しい
+        int64_t t  = _baseEpochMs + dt + (int64_t)((float)dt * _driftPpm * 1e-6f);
+        if (dt <= 0) return t + _slewMs;
+        if ((uint32_t)dt < _slewSpanMs) return t + _slewMs * (int64_t)(_slewSpanMs - dt) / _slewSpanMs;
+        return t;
+    }
+
+    bool     _valid       = false;
+    uint32_t _baseLocal   = 0;
+    int64_t  _baseEpochMs = 0;
+    int64_t  _floorMs     = 0;
+    int64_t  _slewMs      = 0;     // t4 での残りの補正（0 に向けて線形に減らす）
+    uint32_t _slewSpanMs  = 0;
+    float    _driftPpm    = 0.0f;
+    uint32_t _lastRttMs   = 0;
+    int32_t  _lastErrorMs = 0;
+    uint32_t _syncs       = 0;
+    uint32_t _steps       = 0;
+    uint32_t _rejected    = 0;
+
+    bool     _roundOpen   = false;
+    uint8_t  _candidates  = 0;
+    uint32_t _bestRtt     = 0;
+    uint32_t _bestLocal   = 0;
+    int64_t  _bestEpoch   = 0;
+};
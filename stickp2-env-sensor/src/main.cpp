@@ -2,12 +2,21 @@
 #include <WiFi.h>
 #include <PubSubClient.h>
 #include <Wire.h>
+#include <Preferences.h>
+#include <LittleFS.h>
+#include <esp_wifi.h>
 #include <math.h>
+#include <stdarg.h>
 
 #include <M5Unified.h>
 #include <M5UnitUnified.h>
 #include <M5UnitUnifiedENV.h>
 
+#include "TimeSync.h"
+#include "AltitudeLut.h"
+#include "EnvTransport.h"
+#include "EspNowTransport.h"
+
 // ================================================================
 //  1. 設定・型定義 / グローバル変数
 // ================================================================
@@ -23,6 +32,21 @@ const char*   MQTT_SERVER = "192.168.4.1";
 const uint16_t MQTT_PORT  = 1883;
 const char*   MQTT_TOPIC  = "home/env/stackchan1";
 
+// ハブ → センサーへの設定配信トピック（海面気圧 hPa）
+const char*   MQTT_TOPIC_SEALEVEL = "stackchan/cmd/sealevel";
+// ハブ → センサー：リンクプロファイル切り替え（"lowlatency" / "balanced" / "lowpower"）
+const char*   MQTT_TOPIC_LINK     = "stackchan/cmd/link";
+// センサー → ハブ：リンク計測値
+const char*   MQTT_TOPIC_STAT     = "home/env/stackchan1/stat";
+// ハブ → センサー：受信確認（"<bootId>,<seq>"）
+const char*   MQTT_TOPIC_ACK      = "home/env/stackchan1/ack";
+// センサー → ハブ：時刻要求（"<t1>"） / ハブ → センサー：応答（"<t1>,<sec>,<ms>"）
+const char*   MQTT_TOPIC_TIMEREQ  = "home/env/stackchan1/timereq";
+const char*   MQTT_TOPIC_TIME     = "home/env/stackchan1/time";
+// センサー → ハブ：ジャーナルの後送り / ハブ → センサー：取り込んだ最後の seq
+const char*   MQTT_TOPIC_BACKFILL     = "home/env/stackchan1/backfill";
+const char*   MQTT_TOPIC_BACKFILL_ACK = "home/env/stackchan1/backfill/ack";
+
 WiFiClient   wifiClient;
 PubSubClient mqttClient(wifiClient);
 
@@ -40,9 +64,10 @@ struct EnvReading {
     float pressure;     // hPa
     float altitude;     // m
     bool  valid;        // 有効な値を持っているか
+    uint32_t acqMs;     // 取得時刻（millis()）。送信時にハブ時刻へ換算する
 };
 
-EnvReading g_env = {NAN, NAN, NAN, NAN, false};
+EnvReading g_env = {NAN, NAN, NAN, NAN, false, 0};
 
 // 画面レイアウト用（1行の高さ）
 const int16_t LINE_HEIGHT = 20;
@@ -51,57 +76,537 @@ const int16_t LINE_HEIGHT = 20;
 //  2. センサ関連ユーティリティ（高度計算）
 // ================================================================
 
-// ===== 高度計算（気圧→高度） =====
-float calcAltitude(const float pressurePa, const float seaLevelhPa = 1013.25f) {
-    float p_hPa = pressurePa * 0.01f;  // Pa → hPa
-    return 44330.0f * (1.0f - powf(p_hPa / seaLevelhPa, 0.1903f));
+// ===== 海面気圧（高度の基準） =====
+// ハブから配信され NVS に保存される。既定値は標準大気の 1013.25 hPa
+const float SEA_LEVEL_DEFAULT_HPA = AltitudeLut::SEA_LEVEL_DEFAULT;
+const float SEA_LEVEL_MIN_HPA     = 900.0f;
+const float SEA_LEVEL_MAX_HPA     = 1100.0f;
+
+AltitudeLut g_altitude;  // 気圧 → 高度の表と海面気圧（include/AltitudeLut.h）
+
+Preferences g_prefs;  // NVS（名前空間 "envsensor"）
+
+// ===== 海面気圧の設定（範囲外は無視） =====
+bool setSeaLevel(float hPa, bool persist) {
+    if (!(hPa >= SEA_LEVEL_MIN_HPA && hPa <= SEA_LEVEL_MAX_HPA)) {
+        return false;
+    }
+    if (fabsf(hPa - g_altitude.seaLevel()) < 0.005f) {
+        return true;  // 変化なし（ハブの定期配信で毎回 NVS を書かないように）
+    }
+
+    g_altitude.setSeaLevel(hPa);
+
+    if (persist) {
+        g_prefs.putFloat("slp", hPa);
+    }
+    Serial.printf("[ALT] sea level = %.2f hPa\n", hPa);
+    return true;
+}
+
+void loadSeaLevel() {
+    setSeaLevel(g_prefs.getFloat("slp", SEA_LEVEL_DEFAULT_HPA), false);
 }
 
 // ================================================================
 //  3. 通信層：Wi-Fi 接続 / MQTT 再接続
 // ================================================================
 
-// ===== Wi-Fi 接続 =====
-void connectWiFi() {
+// ===== リンクプロファイル =====
+//  LowLatency : モデムスリープ無し・送信出力最大
+//  Balanced   : 最小モデムスリープ（DTIM ごとに起床）
+//  LowPower   : 最大モデムスリープ（listen interval ごとに起床）・送信出力控えめ
+enum class LinkProfile : uint8_t {
+    LowLatency = 0,
+    Balanced   = 1,
+    LowPower   = 2
+};
+
+struct LinkProfileParams {
+    const char*    name;
+    wifi_ps_type_t powerSave;
+    uint16_t       listenInterval;   // ビーコン間隔単位（MAX_MODEM 時のみ有効）
+    wifi_power_t   txPower;
+    uint16_t       mqttKeepAliveSec;
+};
+
+const LinkProfileParams LINK_PROFILES[] = {
+    { "lowlatency", WIFI_PS_NONE,      1,  WIFI_POWER_19_5dBm, 15 },
+    { "balanced",   WIFI_PS_MIN_MODEM, 3,  WIFI_POWER_15dBm,   30 },
+    { "lowpower",   WIFI_PS_MAX_MODEM, 10, WIFI_POWER_11dBm,   60 },
+};
+const uint8_t LINK_PROFILE_COUNT = sizeof(LINK_PROFILES) / sizeof(LINK_PROFILES[0]);
+
+LinkProfile g_linkProfile = LinkProfile::Balanced;
+
+// ===== リンク計測値（ハブへ定期送信） =====
+const unsigned long STAT_INTERVAL_MS = 10000;
+
+uint32_t      g_lastAssocMs   = 0;   // 直近の Wi-Fi 接続所要時間
+uint32_t      g_pubLatSumUs   = 0;   // 送信区間内の publish() 所要時間
+uint32_t      g_pubLatMaxUs   = 0;
+uint16_t      g_pubLatCount   = 0;
+unsigned long g_lastStatMs    = 0;
+
+const LinkProfileParams& linkParams() {
+    return LINK_PROFILES[(uint8_t)g_linkProfile];
+}
+
+bool parseLinkProfile(const char* name, LinkProfile& out) {
+    for (uint8_t i = 0; i < LINK_PROFILE_COUNT; ++i) {
+        if (strcmp(name, LINK_PROFILES[i].name) == 0) {
+            out = (LinkProfile)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// listen interval は接続時の設定なので、begin(connect=false) 後・接続前に書き込む
+void applyStaConfig() {
+    wifi_config_t conf;
+    if (esp_wifi_get_config(WIFI_IF_STA, &conf) == ESP_OK) {
+        conf.sta.listen_interval = linkParams().listenInterval;
+        esp_wifi_set_config(WIFI_IF_STA, &conf);
+    }
+}
+
+// 接続中でも即時反映できる項目
+void applyLinkRuntime() {
+    const LinkProfileParams& lp = linkParams();
+    esp_wifi_set_ps(lp.powerSave);
+    WiFi.setTxPower(lp.txPower);
+    mqttClient.setKeepAlive(lp.mqttKeepAliveSec);
+}
+
+// ===== 高速再接続用キャッシュ =====
+//  前回 DHCP で得た BSSID / チャネル / IP を RTC メモリ（ディープスリープ
+//  復帰を跨ぐ）と NVS（電源断を跨ぐ）に保存しておき、次回は
+//  スキャン無し・固定 IP で接続する。失敗したら通常のスキャン + DHCP に戻る。
+//  固定 IP のままではハブの DHCP リースが更新されず、切れた後に同じアドレスが
+//  別のノードへ貸し出されて衝突する。リースを取った時刻（ハブ時刻）も残し、
+//  LEASE_RENEW_SEC（SoftAP の DHCP サーバの既定リース 120 分の半分）を過ぎたら
+//  BSSID / チャネルはキャッシュのまま DHCP で取り直す。接続し続けている間も
+//  loop から同じ判定で取り直す。
+const uint32_t LINK_CACHE_MAGIC       = 0x4C4E4B32;  // "LNK2"
+const uint32_t LEASE_RENEW_SEC        = 3600;
+const uint32_t FAST_ASSOC_TIMEOUT_MS  = 3000;
+const uint32_t WIFI_BOOT_TIMEOUT_MS   = 10000;  // 起動時（ハブが止まっていても先へ進む）
+const uint32_t WIFI_RETRY_TIMEOUT_MS  = 5000;   // 切断後の再接続 1 回分
+
+struct LinkCache {
+    uint32_t magic;
+    uint8_t  bssid[6];
+    uint8_t  channel;
+    uint8_t  reserved;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t leaseEpoch;   // DHCP でアドレスを取ったハブ時刻（秒, 0 = 未同期で不明）
+    uint32_t checksum;
+};
+
+RTC_DATA_ATTR LinkCache g_linkCache;
+
+bool     g_lastAssocFast   = false;  // 直近の接続が高速経路だったか
+uint32_t g_lastMqttConnMs  = 0;      // 直近の MQTT CONNECT 所要時間
+uint32_t g_bootToFirstPubMs = 0;     // 起動 → 最初の publish 成功まで（0 = 未送信）
+uint32_t g_leaseMs         = 0;      // この起動で DHCP を取った millis()（0 = 取っていない）
+uint32_t g_leaseRenewals   = 0;
+
+bool leaseRenewDue();                // 7. MQTT 送信層（ハブ時刻が要る）
+
+uint32_t linkCacheChecksum(const LinkCache& c) {
+    // FNV-1a（checksum 自身は除く）
+    const uint8_t* p = (const uint8_t*)&c;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < offsetof(LinkCache, checksum); ++i) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+bool linkCacheValid(const LinkCache& c) {
+    return c.magic == LINK_CACHE_MAGIC && c.channel != 0 && c.ip != 0 &&
+           c.checksum == linkCacheChecksum(c);
+}
+
+bool loadLinkCache() {
+    if (linkCacheValid(g_linkCache)) {
+        return true;  // RTC メモリに残っている（NVS 読み出し不要）
+    }
+    LinkCache c;
+    if (g_prefs.getBytes("linkc", &c, sizeof(c)) == sizeof(c) && linkCacheValid(c)) {
+        g_linkCache = c;
+        return true;
+    }
+    return false;
+}
+
+void saveLinkCache() {
+    LinkCache c = {};
+    c.magic = LINK_CACHE_MAGIC;
+    memcpy(c.bssid, WiFi.BSSID(), sizeof(c.bssid));
+    c.channel = (uint8_t)WiFi.channel();
+    c.ip      = (uint32_t)WiFi.localIP();
+    c.gateway = (uint32_t)WiFi.gatewayIP();
+    c.subnet  = (uint32_t)WiFi.subnetMask();
+    c.leaseEpoch = 0;                // 時刻同期の後で埋める（noteLeaseEpoch）
+    c.checksum = linkCacheChecksum(c);
+
+    // 内容が同じなら NVS は書かない（フラッシュ消耗を避ける）
+    if (memcmp(&c, &g_linkCache, sizeof(c)) != 0) {
+        g_linkCache = c;
+        g_prefs.putBytes("linkc", &c, sizeof(c));
+    }
+}
+
+void invalidateLinkCache() {
+    g_linkCache.magic = 0;
+    g_prefs.remove("linkc");
+}
+
+// 1 回分の接続試行（fast = キャッシュの BSSID/チャネルを使う。
+//   staticIp = キャッシュの IP をそのまま使う / false なら DHCP で取り直す）
+bool tryAssociate(bool fast, uint32_t timeoutMs, bool staticIp = true) {
+    uint32_t start = millis();
+
+    if (fast) {
+        IPAddress gw(g_linkCache.gateway);
+        if (staticIp) {
+            WiFi.config(IPAddress(g_linkCache.ip), gw, IPAddress(g_linkCache.subnet), gw);
+        } else {
+            WiFi.config(IPAddress(), IPAddress(), IPAddress());
+        }
+        WiFi.begin(WIFI_SSID, WIFI_PASSWORD, g_linkCache.channel, g_linkCache.bssid, false);
+    } else {
+        WiFi.config(IPAddress(), IPAddress(), IPAddress());  // DHCP に戻す
+        WiFi.begin(WIFI_SSID, WIFI_PASSWORD, 0, nullptr, false);
+    }
+    applyStaConfig();
+    esp_wifi_connect();
+
+    while (WiFi.status() != WL_CONNECTED) {
+        if (timeoutMs && millis() - start >= timeoutMs) {
+            WiFi.disconnect();
+            return false;
+        }
+        delay(5);
+    }
+    return true;
+}
+
+// ===== Wi-Fi 接続（画面表示なし・所要時間を計測） =====
+bool associateWiFi(uint32_t timeoutMs) {
+    uint32_t start = millis();
+
     WiFi.mode(WIFI_STA);
-    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+    WiFi.persistent(false);  // 接続情報は自前キャッシュで管理
 
+    g_lastAssocFast = false;
+    if (loadLinkCache()) {
+        bool renew = leaseRenewDue();
+        if (tryAssociate(true, renew ? timeoutMs : FAST_ASSOC_TIMEOUT_MS, !renew)) {
+            g_lastAssocFast = true;
+            if (renew) {
+                g_leaseMs = millis();
+                g_leaseRenewals++;
+                saveLinkCache();
+            }
+        } else {
+            Serial.println("[WiFi] fast path failed, full scan");
+            invalidateLinkCache();
+        }
+    }
+
+    if (!g_lastAssocFast) {
+        if (!tryAssociate(false, timeoutMs)) {
+            return false;
+        }
+        g_leaseMs = millis();
+        saveLinkCache();
+    }
+
+    g_lastAssocMs = millis() - start;
+    applyLinkRuntime();
+    Serial.printf("[WiFi] associated in %lu ms (%s, %s)\n",
+                  (unsigned long)g_lastAssocMs, linkParams().name,
+                  g_lastAssocFast ? "cached" : "scan");
+    return true;
+}
+
+// ===== プロファイル切り替え（コンソール → ハブ経由） =====
+void setLinkProfile(LinkProfile p, bool persist) {
+    bool needReassoc = (linkParams().listenInterval != LINK_PROFILES[(uint8_t)p].listenInterval);
+
+    g_linkProfile = p;
+    if (persist) {
+        g_prefs.putUChar("link", (uint8_t)p);
+    }
+
+    if (WiFi.status() != WL_CONNECTED) {
+        return;  // 次の接続時に反映
+    }
+
+    if (needReassoc) {
+        // listen interval を反映するため再接続（この時間も計測値として送る）
+        mqttClient.disconnect();
+        WiFi.disconnect();
+        associateWiFi(10000);
+    } else {
+        applyLinkRuntime();
+    }
+}
+
+// 受信コールバック（PubSubClient の loop の中）では切り替えない。再接続で
+// 最大 10 秒止まり、その間の受信・ack が詰まるため、loop から反映する
+LinkProfile g_pendingLink = LinkProfile::Balanced;
+bool        g_linkPending = false;
+
+void requestLinkProfile(LinkProfile p) {
+    g_pendingLink = p;
+    g_linkPending = (p != g_linkProfile);   // 元に戻す指示なら取り消し
+}
+
+// loop から呼ぶ
+void serviceLinkProfile() {
+    if (!g_linkPending) {
+        return;
+    }
+    g_linkPending = false;
+    setLinkProfile(g_pendingLink, true);
+}
+
+void loadLinkProfile() {
+    uint8_t v = g_prefs.getUChar("link", (uint8_t)LinkProfile::Balanced);
+    g_linkProfile = (v < LINK_PROFILE_COUNT) ? (LinkProfile)v : LinkProfile::Balanced;
+}
+
+// ===== Wi-Fi 接続 =====
+void connectWiFi() {
     M5.Display.fillScreen(BLACK);
     M5.Display.setCursor(0, 0);
     M5.Display.setTextSize(2);
     M5.Display.println("WiFi connecting...");
 
-    while (WiFi.status() != WL_CONNECTED) {
-        delay(500);
-        M5.Display.print(".");
+    // ハブが止まっていても起動は止めない（つながるまでジャーナルに残す）
+    if (!associateWiFi(WIFI_BOOT_TIMEOUT_MS)) {
+        M5.Display.println("WiFi offline");
+        return;
     }
 
-    M5.Display.println("\nWiFi connected");
+    M5.Display.println("WiFi connected");
     M5.Display.printf("IP: %s\n", WiFi.localIP().toString().c_str());
-    delay(1000);
+    M5.Display.printf("%s %lums%s\n", linkParams().name, (unsigned long)g_lastAssocMs,
+                      g_lastAssocFast ? " (cached)" : "");
+    if (!g_lastAssocFast) {
+        delay(1000);  // 高速経路のときは表示待ちを省いて最初の送信を急ぐ
+    }
+}
+
+void onSampleAck(const char* payload);  // 7. MQTT 送信層
+void onBackfillAck(const char* payload);
+void onTimeReply(const char* payload, uint32_t rxMs);
+void onMqttMessage(char* topic, uint8_t* payload, unsigned int length);
+
+// ===== ハブからの受信（設定配信・受信確認・時刻応答。配送路に依らない） =====
+void onTransportMessage(void*, EnvTransport&, const char* topic, const char* payload) {
+    uint32_t rxMs = millis();   // 時刻応答の t4（処理前に取る）
+
+    if (strcmp(topic, MQTT_TOPIC_ACK) == 0) {
+        onSampleAck(payload);
+    } else if (strcmp(topic, MQTT_TOPIC_TIME) == 0) {
+        onTimeReply(payload, rxMs);
+    } else if (strcmp(topic, MQTT_TOPIC_BACKFILL_ACK) == 0) {
+        onBackfillAck(payload);
+    } else if (strcmp(topic, MQTT_TOPIC_SEALEVEL) == 0) {
+        setSeaLevel(strtof(payload, nullptr), true);
+    } else if (strcmp(topic, MQTT_TOPIC_LINK) == 0) {
+        LinkProfile p;
+        if (parseLinkProfile(payload, p)) {
+            requestLinkProfile(p);
+        }
+    }
 }
 
 // ===== MQTT 再接続 =====
-void reconnectMQTT() {
-    while (!mqttClient.connected()) {
-        M5.Display.fillRect(0, LINE_HEIGHT * 4, M5.Display.width(), LINE_HEIGHT, BLACK);
-        M5.Display.setCursor(0, LINE_HEIGHT * 4);
-        M5.Display.setTextSize(1);
-        M5.Display.print("MQTT connecting...");
-
-        String clientId = "StickP2-" + String((uint32_t)ESP.getEfuseMac(), HEX);
-
-        if (mqttClient.connect(clientId.c_str())) {
-            M5.Display.fillRect(0, LINE_HEIGHT * 4, M5.Display.width(), LINE_HEIGHT, BLACK);
-            M5.Display.setCursor(0, LINE_HEIGHT * 4);
-            M5.Display.print("MQTT connected   ");
-        } else {
-            M5.Display.fillRect(0, LINE_HEIGHT * 4, M5.Display.width(), LINE_HEIGHT, BLACK);
-            M5.Display.setCursor(0, LINE_HEIGHT * 4);
-            M5.Display.printf("MQTT fail rc=%d", mqttClient.state());
-            delay(2000);
+//  クライアント ID は起動時に 1 回だけ生成し、ブローカは IP 直指定。
+//  1 回の呼び出しで試すのは 1 回だけで、つながるまで loop を止めない
+//  （その間のサンプルはジャーナルへ）。次の試行までの待ちは 200 ms から倍々で
+//  最大 2 秒、Wi-Fi ごと切れているときは最大 30 秒。
+const uint16_t MQTT_SOCKET_TIMEOUT_S = 2;
+const uint32_t MQTT_RETRY_MIN_MS     = 200;
+const uint32_t MQTT_RETRY_MAX_MS     = 2000;
+const uint32_t WIFI_RETRY_MAX_MS     = 30000;
+const uint16_t MQTT_BUFFER_SIZE      = 1024;   // 後送りの塊が入る大きさ
+
+char     g_mqttClientId[24] = "";
+uint32_t g_mqttRetryMs      = MQTT_RETRY_MIN_MS;
+uint32_t g_mqttNextTryMs    = 0;
+
+// 再接続の状況（"MQTT fail rc=-2" など）。つながっていない間は状態バーに出す
+// （LCD へは描画側が起きているときだけ転送する。ここでは文字列を書き換えるだけ）
+char     g_linkStatus[24]   = "";
+
+void setLinkStatus(const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(g_linkStatus, sizeof(g_linkStatus), fmt, ap);
+    va_end(ap);
+}
+
+void initMqttClient() {
+    snprintf(g_mqttClientId, sizeof(g_mqttClientId), "StickP2-%lx",
+             (unsigned long)(uint32_t)ESP.getEfuseMac());
+
+    IPAddress broker;
+    broker.fromString(MQTT_SERVER);
+    mqttClient.setServer(broker, MQTT_PORT);
+    mqttClient.setSocketTimeout(MQTT_SOCKET_TIMEOUT_S);
+    mqttClient.setBufferSize(MQTT_BUFFER_SIZE);
+    mqttClient.setCallback(onMqttMessage);
+}
+
+// 次の試行までの待ちを倍々に延ばす
+void backoffMQTT(uint32_t now, uint32_t maxMs) {
+    g_mqttNextTryMs = now + g_mqttRetryMs;
+    g_mqttRetryMs   = (g_mqttRetryMs * 2 > maxMs) ? maxMs : g_mqttRetryMs * 2;
+}
+
+bool reconnectMQTT() {
+    if (mqttClient.connected()) {
+        return true;
+    }
+    uint32_t now = millis();
+    if ((int32_t)(now - g_mqttNextTryMs) < 0) {
+        return false;
+    }
+
+    setLinkStatus("MQTT connecting");
+
+    // Wi-Fi ごと切れていたら再接続（キャッシュ経路から, 時間を区切る）
+    if (WiFi.status() != WL_CONNECTED && !associateWiFi(WIFI_RETRY_TIMEOUT_MS)) {
+        setLinkStatus("WiFi offline");
+        backoffMQTT(millis(), WIFI_RETRY_MAX_MS);
+        return false;
+    }
+
+    uint32_t t0 = millis();
+    // cleanSession=false：セッション保持に対応したブローカなら購読も引き継がれる
+    if (mqttClient.connect(g_mqttClientId, nullptr, nullptr, nullptr, 0, false, nullptr, false)) {
+        g_lastMqttConnMs = millis() - t0;
+        g_mqttRetryMs    = MQTT_RETRY_MIN_MS;
+        setLinkStatus("");
+        Serial.printf("[MQTT] connected %lums\n", (unsigned long)g_lastMqttConnMs);
+        mqttClient.subscribe(MQTT_TOPIC_ACK);
+        mqttClient.subscribe(MQTT_TOPIC_SEALEVEL);
+        mqttClient.subscribe(MQTT_TOPIC_LINK);
+        mqttClient.subscribe(MQTT_TOPIC_TIME);
+        mqttClient.subscribe(MQTT_TOPIC_BACKFILL_ACK);
+        return true;
+    }
+
+    setLinkStatus("MQTT fail rc=%d", mqttClient.state());
+    backoffMQTT(millis(), MQTT_RETRY_MAX_MS);
+    return false;
+}
+
+// ===== ハブへの配送路（common/EnvTransport） =====
+//  既定は Wi-Fi + MQTT。-DENV_TRANSPORT_ESPNOW=1 でビルドすると ESP-NOW で送り、
+//  始められなければ MQTT に戻る。サンプルの形式・ack・時刻同期はどちらでも同じ。
+class SensorMqttTransport : public EnvTransport {
+public:
+    const char* name() const override { return "mqtt"; }
+
+    bool begin() override {
+        initMqttClient();
+        reconnectMQTT();
+        return true;
+    }
+
+    // 切れていたら再接続を 1 回試してから受信を処理する
+    void loop() override {
+        if (reconnectMQTT()) {
+            mqttClient.loop();
         }
     }
+
+    bool ready() const override { return mqttClient.connected(); }
+
+    // PubSubClient の送信バッファ（固定ヘッダ最大 5 + トピック長 2 + トピック）
+    size_t maxPayload(const char* topic) const override {
+        size_t used = 7 + strlen(topic);
+        return (used < MQTT_BUFFER_SIZE) ? MQTT_BUFFER_SIZE - used : 0;
+    }
+
+    bool publish(const char* topic, const char* payload) override {
+        bool ok = mqttClient.publish(topic, payload);
+        if (ok) _stats.sent++;
+        else    _stats.failed++;
+        return ok;
+    }
+
+    void onMessage(const char* topic, const char* payload) { deliver(topic, payload); }
+};
+
+SensorMqttTransport g_mqttTransport;
+EspNowTransport     g_espNowTransport(WIFI_IF_STA);
+EnvTransport*       g_transport = &g_mqttTransport;
+
+// 受信ペイロードは NUL 終端が無いので写してから渡す（受信バッファ全体が入る大きさ。
+// スタックに 1 KB 置かないよう静的に持つ）
+char g_mqttRxBuf[MQTT_BUFFER_SIZE + 1];
+
+void onMqttMessage(char* topic, uint8_t* payload, unsigned int length) {
+    size_t n = (length < sizeof(g_mqttRxBuf) - 1) ? length : sizeof(g_mqttRxBuf) - 1;
+    memcpy(g_mqttRxBuf, payload, n);
+    g_mqttRxBuf[n] = '\0';
+    g_mqttTransport.onMessage(topic, g_mqttRxBuf);
+}
+
+// ESP-NOW のフレームの鍵（ハブの SoftAP のパスワードから）と送信番号
+// （FrameAuth::RESERVE 件ごとに NVS へ先の値を保存。再起動してもハブに送り直しと見なされない）
+bool saveFrameCounter(void*, uint32_t reservedUntil) {
+    return g_prefs.putUInt("fctr", reservedUntil) == sizeof(reservedUntil);
+}
+
+// ===== ESP-NOW で送る準備 =====
+//  送信先はハブの SoftAP（リンクキャッシュの BSSID とチャネル）。キャッシュが
+//  無い初回だけ通常どおり接続してキャッシュを作り、以降はアソシエーションしない。
+bool startEspNow() {
+    if (!loadLinkCache() && !associateWiFi(10000)) {
+        return false;
+    }
+    WiFi.mode(WIFI_STA);
+    WiFi.disconnect();
+    esp_wifi_set_channel(g_linkCache.channel, WIFI_SECOND_CHAN_NONE);
+    WiFi.setTxPower(linkParams().txPower);
+
+    g_espNowTransport.setPeer(g_linkCache.bssid, g_linkCache.channel);
+    g_espNowTransport.seal().setKey(FrameAuth::deriveKey(WIFI_PASSWORD));
+    g_espNowTransport.seal().setCounter(g_prefs.getUInt("fctr", 1), saveFrameCounter, nullptr);
+    if (!g_espNowTransport.begin()) {
+        return false;
+    }
+    const uint8_t* m = g_linkCache.bssid;
+    Serial.printf("[Link] ESP-NOW to %02x:%02x:%02x:%02x:%02x:%02x on channel %u\n",
+                  m[0], m[1], m[2], m[3], m[4], m[5], (unsigned)g_linkCache.channel);
+    return true;
+}
+
+void startTransport() {
+#if defined(ENV_TRANSPORT_ESPNOW) && ENV_TRANSPORT_ESPNOW
+    if (startEspNow()) {
+        g_transport = &g_espNowTransport;
+    } else {
+        Serial.println("[Link] ESP-NOW unavailable, using MQTT");
+    }
+#endif
+    if (g_transport == &g_mqttTransport && WiFi.status() != WL_CONNECTED) {
+        connectWiFi();
+    }
+    g_transport->setReceiver(onTransportMessage, nullptr);
+    g_transport->begin();
 }
 
 // ================================================================
@@ -126,12 +631,13 @@ void updateEnv(EnvReading& env) {
     if (qmp6988.updated()) {
         float pPa = qmp6988.pressure();
         env.pressure = pPa * 0.01f;      // hPa
-        env.altitude = calcAltitude(pPa);
+        env.altitude = g_altitude.altitude(pPa);
         updated      = true;
     }
 
     if (updated) {
         env.valid = true;
+        env.acqMs = millis();
     }
 }
 
@@ -139,63 +645,189 @@ void updateEnv(EnvReading& env) {
 //  5. 画面描画層：StickP2 ディスプレイ表示
 // ================================================================
 
-// ===== 画面表示担当（差分だけ描画してチカチカ防止） =====
-void drawEnv(const EnvReading& env) {
-    if (!env.valid) {
-        static bool shown = false;
-        if (!shown) {
-            shown = true;
-            M5.Display.setTextSize(2);
-            M5.Display.fillScreen(BLACK);
-            M5.Display.setCursor(0, 0);
-            M5.Display.print("No data yet...");
+// ===== スプライト描画 =====
+//  各行を off-screen の M5Canvas に描き、前回と文字が変わった桁の矩形だけを
+//  LCD へ転送する（fillRect + printf の直接描画によるチラつきと SPI 転送を削減）。
+//  等幅フォント(Font0)×2倍なので 1 文字 = 12x16 px。
+const uint8_t  FIELD_COUNT     = 4;
+const uint8_t  FIELD_MAX_CHARS = 20;
+const int16_t  GLYPH_W         = 12;
+const int16_t  STATUS_BAR_H    = 12;
+
+// 1 フレームで描画に使ってよい時間。超えたら残りの行は次のフレームへ回す
+const uint32_t FRAME_BUDGET_US = 8000;
+
+// 最後の操作からこの時間が経ったら LCD をスリープ（BtnA で復帰）
+const unsigned long DISPLAY_AWAKE_MS = 30000;
+
+struct FieldView {
+    M5Canvas canvas;
+    char     shown[FIELD_MAX_CHARS + 1];  // LCD に転送済みの文字列
+    int16_t  y;
+};
+
+FieldView g_fields[FIELD_COUNT];
+M5Canvas  g_statusCanvas;
+char      g_statusShown[48] = "";
+
+uint8_t       g_nextField      = 0;      // 予算切れで中断した行の続き
+uint32_t      g_lastFrameUs    = 0;      // 直近フレームの描画時間
+bool          g_displayAsleep  = false;
+unsigned long g_lastUserActionMs = 0;
+
+// 状態バー用（Publish 側で更新）
+bool          g_lastPublishOk  = false;
+unsigned long g_lastPublishMs  = 0;
+uint16_t      g_txQueueDepth   = 0;      // 未送信サンプル数
+
+void initDisplaySprites() {
+    for (uint8_t i = 0; i < FIELD_COUNT; ++i) {
+        FieldView& f = g_fields[i];
+        f.y = LINE_HEIGHT * i;
+        f.shown[0] = '\0';
+        f.canvas.setColorDepth(8);
+        f.canvas.createSprite(GLYPH_W * FIELD_MAX_CHARS, LINE_HEIGHT);
+        f.canvas.setTextSize(2);
+        f.canvas.setTextColor(WHITE, BLACK);
+    }
+
+    g_statusCanvas.setColorDepth(8);
+    g_statusCanvas.createSprite(M5.Display.width(), STATUS_BAR_H);
+    g_statusCanvas.setTextSize(1);
+
+    g_lastUserActionMs = millis();
+}
+
+// 前回と違う桁の範囲 [first, last] を返す。変化なしなら false
+bool diffGlyphs(const char* prev, const char* next, int& first, int& last) {
+    size_t lp = strlen(prev);
+    size_t ln = strlen(next);
+    size_t n  = (lp > ln) ? lp : ln;
+
+    first = -1;
+    last  = -1;
+    for (size_t i = 0; i < n; ++i) {
+        char a = (i < lp) ? prev[i] : ' ';
+        char b = (i < ln) ? next[i] : ' ';
+        if (a != b) {
+            if (first < 0) first = (int)i;
+            last = (int)i;
         }
+    }
+    return first >= 0;
+}
+
+// 変化した桁だけクリップして転送
+void pushFieldIfChanged(FieldView& f, const char* text) {
+    int first, last;
+    if (!diffGlyphs(f.shown, text, first, last)) {
         return;
     }
 
-    static EnvReading prev = {NAN, NAN, NAN, NAN, false};
-    const float DELTA = 0.05f;  // このくらい変わったら描画し直す
+    f.canvas.fillSprite(BLACK);
+    f.canvas.setCursor(0, 2);
+    f.canvas.print(text);
 
-    bool needRedrawTemp = isnan(prev.temperature) ||
-                          fabs(env.temperature - prev.temperature) > DELTA;
-    bool needRedrawHum  = isnan(prev.humidity)    ||
-                          fabs(env.humidity    - prev.humidity)    > DELTA;
-    bool needRedrawPres = isnan(prev.pressure)    ||
-                          fabs(env.pressure    - prev.pressure)    > DELTA;
-    bool needRedrawAlt  = isnan(prev.altitude)    ||
-                          fabs(env.altitude    - prev.altitude)    > DELTA;
+    M5.Display.setClipRect(first * GLYPH_W, f.y, (last - first + 1) * GLYPH_W, LINE_HEIGHT);
+    f.canvas.pushSprite(&M5.Display, 0, f.y);
+    M5.Display.clearClipRect();
 
-    M5.Display.setTextSize(2);
+    strncpy(f.shown, text, FIELD_MAX_CHARS);
+    f.shown[FIELD_MAX_CHARS] = '\0';
+}
 
-    // 1行目: 温度
-    if (needRedrawTemp) {
-        M5.Display.fillRect(0, 0, 200, LINE_HEIGHT, BLACK);
-        M5.Display.setCursor(0, 0);
-        M5.Display.printf("Temp: %.2f C", env.temperature);
+// 状態バー：RSSI / ブローカ接続 / 未送信数 / 電池
+//  つながっていない間は接続数・送信の欄の代わりに再接続の状況（g_linkStatus）を出す
+void drawStatusBar() {
+    char buf[sizeof(g_statusShown)];
+    int  rssi = (WiFi.status() == WL_CONNECTED) ? WiFi.RSSI() : 0;
+    int  age  = g_lastPublishMs ? (int)((millis() - g_lastPublishMs) / 1000) : -1;
+
+    if (!g_transport->ready() && g_linkStatus[0]) {
+        snprintf(buf, sizeof(buf), "%4ddBm %-20s %3d%%",
+                 rssi, g_linkStatus, (int)M5.Power.getBatteryLevel());
+    } else {
+        snprintf(buf, sizeof(buf), "%4ddBm %s Q%-2u tx%c%-3d %3d%%",
+                 rssi,
+                 !g_transport->ready() ? "--" : (g_transport == &g_espNowTransport ? "EN" : "MQ"),
+                 (unsigned)g_txQueueDepth,
+                 g_lastPublishOk ? '+' : '!',
+                 age,
+                 (int)M5.Power.getBatteryLevel());
+    }
+
+    if (strcmp(buf, g_statusShown) == 0) {
+        return;
+    }
+
+    int16_t y = M5.Display.height() - STATUS_BAR_H;
+    g_statusCanvas.fillSprite(BLACK);
+    g_statusCanvas.drawFastHLine(0, 0, g_statusCanvas.width(), DARKGREY);
+    g_statusCanvas.setTextColor(g_transport->ready() ? GREEN : ORANGE, BLACK);
+    g_statusCanvas.setCursor(2, 3);
+    g_statusCanvas.print(buf);
+    g_statusCanvas.pushSprite(&M5.Display, 0, y);
+
+    strncpy(g_statusShown, buf, sizeof(g_statusShown));
+}
+
+// ===== LCD スリープ管理（BtnA で復帰） =====
+void updateDisplayPower() {
+    unsigned long now = millis();
+
+    if (M5.BtnA.wasPressed()) {
+        g_lastUserActionMs = now;
+        if (g_displayAsleep) {
+            M5.Display.wakeup();
+            g_displayAsleep = false;
+        }
     }
 
-    // 2行目: 湿度
-    if (needRedrawHum) {
-        M5.Display.fillRect(0, LINE_HEIGHT, 200, LINE_HEIGHT, BLACK);
-        M5.Display.setCursor(0, LINE_HEIGHT);
-        M5.Display.printf("Hum : %.2f %%", env.humidity);
+    if (!g_displayAsleep && now - g_lastUserActionMs >= DISPLAY_AWAKE_MS) {
+        M5.Display.sleep();
+        g_displayAsleep = true;
     }
+}
 
-    // 3行目: 気圧
-    if (needRedrawPres) {
-        M5.Display.fillRect(0, LINE_HEIGHT * 2, 200, LINE_HEIGHT, BLACK);
-        M5.Display.setCursor(0, LINE_HEIGHT * 2);
-        M5.Display.printf("Pres: %.2f hPa", env.pressure);
+// ===== 画面表示担当（変化した桁だけ転送・時間予算つき） =====
+void drawEnv(const EnvReading& env) {
+    if (g_displayAsleep) {
+        return;  // 表示していない間は整形も転送もしない
     }
 
-    // 4行目: 高度
-    if (needRedrawAlt) {
-        M5.Display.fillRect(0, LINE_HEIGHT * 3, 200, LINE_HEIGHT, BLACK);
-        M5.Display.setCursor(0, LINE_HEIGHT * 3);
-        M5.Display.printf("Alt : %.1f m", env.altitude);
+    uint32_t start = micros();
+    char     text[FIELD_MAX_CHARS + 1];
+
+    M5.Display.startWrite();
+
+    for (uint8_t n = 0; n < FIELD_COUNT; ++n) {
+        uint8_t i = (g_nextField + n) % FIELD_COUNT;
+
+        if (!env.valid) {
+            snprintf(text, sizeof(text), "%s", (i == 0) ? "No data yet..." : "");
+        } else {
+            switch (i) {
+                case 0: snprintf(text, sizeof(text), "Temp: %.2f C",   env.temperature); break;
+                case 1: snprintf(text, sizeof(text), "Hum : %.2f %%",  env.humidity);    break;
+                case 2: snprintf(text, sizeof(text), "Pres: %.2f hPa", env.pressure);    break;
+                default: snprintf(text, sizeof(text), "Alt : %.1f m",  env.altitude);    break;
+            }
+        }
+        pushFieldIfChanged(g_fields[i], text);
+
+        if (micros() - start > FRAME_BUDGET_US) {
+            g_nextField = (i + 1) % FIELD_COUNT;
+            M5.Display.endWrite();
+            g_lastFrameUs = micros() - start;
+            return;
+        }
     }
+    g_nextField = 0;
+
+    drawStatusBar();
 
-    prev = env;
+    M5.Display.endWrite();
+    g_lastFrameUs = micros() - start;
 }
 
 // ================================================================
@@ -203,11 +835,27 @@ void drawEnv(const EnvReading& env) {
 // ================================================================
 
 // ===== Publish のタイミング管理 =====
+//  ハブから送信時刻の枠（時刻応答の <slotOffsetMs>,<periodMs>）をもらっていて
+//  時刻同期も済んでいれば、ハブ時刻で「周期の頭 + オフセット」を過ぎるたびに送る
+//  （ノードごとに位置がずれ、同じ瞬間に重ならない）。それ以外は自分の 2 秒ごと。
 const unsigned long PUBLISH_INTERVAL_MS = 2000;
+extern TimeSync g_timeSync;  // 7. MQTT 送信層
 unsigned long g_lastPublish = 0;
+uint32_t      g_slotOffsetMs = 0;
+uint32_t      g_slotPeriodMs = 0;    // 0 = 枠なし
+int64_t       g_lastSlotIndex = -1;
 
 bool shouldPublish() {
     unsigned long now = millis();
+    if (g_slotPeriodMs && g_timeSync.valid()) {
+        int64_t index = (g_timeSync.epochMsAt(now) - g_slotOffsetMs) / g_slotPeriodMs;
+        if (index != g_lastSlotIndex) {
+            g_lastSlotIndex = index;
+            g_lastPublish   = now;
+            return true;
+        }
+        return false;
+    }
     if (now - g_lastPublish >= PUBLISH_INTERVAL_MS) {
         g_lastPublish = now;
         return true;
@@ -219,32 +867,496 @@ bool shouldPublish() {
 //  7. MQTT 送信層：Publish 処理
 // ================================================================
 
+// ===== 確認付き送信（アプリケーション層の QoS1） =====
+//  PubSubClient は QoS0 でしか publish できないため、各サンプルに
+//  <seq>,<bootId> を付けてハブの ack を待つ。ack が来ないものは
+//  ACK_TIMEOUT_MS ごとに同じ内容で再送し、ハブ側が seq で重複を捨てる。
+//  未確認の送信は INFLIGHT_MAX 件までで、溢れたら最古を破棄して数える。
+const uint8_t  INFLIGHT_MAX   = 8;
+const uint32_t ACK_TIMEOUT_MS = 1500;
+
+struct InflightSample {
+    uint32_t seq;
+    uint32_t sentMs;
+    uint8_t  retries;
+    bool     used;
+    float    t, h, p;       // 押し出されたときにジャーナルへ回す値
+    uint32_t epoch;         // 取得時刻（ハブ時刻, 秒。未同期なら 0）
+    char     payload[64];
+};
+
+InflightSample g_inflight[INFLIGHT_MAX];
+uint32_t       g_txSeq         = 0;
+uint16_t       g_bootId        = 0;   // 起動ごとの乱数（ハブ側で seq のリセットを判別）
+uint32_t       g_txRetransmits = 0;
+uint32_t       g_txDropped     = 0;   // 届けられず残せもしなかった数
+uint32_t       g_txJournaled   = 0;   // ack 前に窓から押し出されてジャーナルへ回した数
+uint32_t       g_txAcked       = 0;
+
+void initDelivery() {
+    g_bootId = (uint16_t)(esp_random() | 1);
+    for (auto& e : g_inflight) e.used = false;
+}
+
+bool sendRaw(const char* payload) {
+    uint32_t t0 = micros();
+    bool ok = g_transport->publish(MQTT_TOPIC, payload);
+    uint32_t dt = micros() - t0;
+
+    g_pubLatSumUs += dt;
+    g_pubLatCount++;
+    if (dt > g_pubLatMaxUs) g_pubLatMaxUs = dt;
+    return ok;
+}
+
+void onSampleAck(const char* payload) {
+    unsigned bootId;
+    unsigned long seq;
+    if (sscanf(payload, "%u,%lu", &bootId, &seq) != 2 || bootId != g_bootId) {
+        return;
+    }
+    for (auto& e : g_inflight) {
+        if (e.used && e.seq == seq) {
+            e.used = false;
+            g_txAcked++;
+            if (g_txQueueDepth) g_txQueueDepth--;
+            return;
+        }
+    }
+}
+
+// ack 待ちの再送（loop から呼ぶ）
+void serviceInflight() {
+    if (!g_transport->ready()) {
+        return;
+    }
+    uint32_t now = millis();
+    for (auto& e : g_inflight) {
+        if (e.used && now - e.sentMs >= ACK_TIMEOUT_MS) {
+            if (sendRaw(e.payload)) {
+                g_txRetransmits++;
+                e.retries++;
+            }
+            e.sentMs = now;
+        }
+    }
+}
+
+// ===== ハブ時刻への同期 =====
+//  未同期のうちは TIME_SYNC_RETRY_MS ごと、同期後は TIME_SYNC_INTERVAL_MS ごとに
+//  TimeSync::BURST 本の要求の組を送り、往復が最短の応答で合わせる。
+//  サンプルには取得時刻をハブ時刻（エポック秒.ミリ秒）に換算して載せる。
+const uint32_t TIME_SYNC_RETRY_MS    = 5000;
+const uint32_t TIME_SYNC_INTERVAL_MS = 600000;
+
+TimeSync g_timeSync;
+uint32_t g_timeRoundMs    = 0;      // 組の 1 本目を送った時刻
+uint32_t g_lastTimeReqMs  = 0;
+uint8_t  g_timeReqInRound = 0;      // 今の組で送った要求（0 = 組の外）
+bool     g_timeReqSent    = false;
+
+// ===== DHCP リースの取り直し =====
+// 取ったリースの経過が LEASE_RENEW_SEC を過ぎたか。固定 IP で入ったリースの
+// 年齢はハブ時刻でしか分からないので、同期前は「まだ」とみなす（起動直後の
+// 高速経路を潰さない。同期後の serviceLease で取り直す）。
+bool leaseRenewDue() {
+    if (g_leaseMs) {
+        return millis() - g_leaseMs >= LEASE_RENEW_SEC * 1000UL;
+    }
+    if (!g_timeSync.valid()) {
+        return false;
+    }
+    uint32_t nowSec = (uint32_t)(g_timeSync.epochMsAt(millis()) / 1000);
+    return !g_linkCache.leaseEpoch || nowSec - g_linkCache.leaseEpoch >= LEASE_RENEW_SEC;
+}
+
+// この起動で取ったリースの時刻をキャッシュに残す（同期したとき 1 回）
+void noteLeaseEpoch() {
+    if (!g_leaseMs || g_linkCache.leaseEpoch || !linkCacheValid(g_linkCache)) {
+        return;
+    }
+    uint32_t ageSec = (millis() - g_leaseMs) / 1000;
+    g_linkCache.leaseEpoch = (uint32_t)(g_timeSync.epochMsAt(millis()) / 1000) - ageSec;
+    g_linkCache.checksum   = linkCacheChecksum(g_linkCache);
+    g_prefs.putBytes("linkc", &g_linkCache, sizeof(g_linkCache));
+}
+
+// 固定 IP のまま使い続けているリースを取り直す（loop から呼ぶ。MQTT 経路のみ）
+void serviceLease() {
+    if (g_transport != &g_mqttTransport || WiFi.status() != WL_CONNECTED || !leaseRenewDue()) {
+        return;
+    }
+    Serial.printf("[WiFi] renewing DHCP lease (%lu so far)\n", (unsigned long)g_leaseRenewals);
+    mqttClient.disconnect();
+    WiFi.disconnect();
+    associateWiFi(WIFI_RETRY_TIMEOUT_MS);   // 失敗しても MQTT の再接続側でやり直す
+}
+
+// 応答（TimeSync::parseReply）の後ろ 2 つは送信時刻の枠。読めない応答は丸ごと捨てる
+void onTimeSynced() {
+    noteLeaseEpoch();
+    Serial.printf("[Time] synced rtt=%lums err=%ldms drift=%.1fppm steps=%lu\n",
+                  (unsigned long)g_timeSync.lastRttMs(),
+                  (long)g_timeSync.lastErrorMs(),
+                  g_timeSync.driftPpm(),
+                  (unsigned long)g_timeSync.steps());
+}
+
+void onTimeReply(const char* payload, uint32_t rxMs) {
+    TimeSync::Reply r;
+    if (!TimeSync::parseReply(payload, r)) {
+        return;
+    }
+    g_slotOffsetMs = r.slotOffsetMs;
+    g_slotPeriodMs = r.periodMs;   // 0 = 枠が無い（ハブ側が満杯）
+    if (g_timeSync.onReply(r.t1, rxMs, r.sec, r.ms)) {
+        onTimeSynced();
+    }
+}
+
+// 組の 1 本目を送ったら BURST_GAP_MS ごとに残りを送り、最後の要求から MAX_RTT_MS
+// 待ってもそろわなければ届いた中の最短で合わせる
+void serviceTimeSync() {
+    if (!g_transport->ready()) {
+        return;
+    }
+    uint32_t now = millis();
+    if (g_timeReqInRound) {
+        if (g_timeReqInRound < TimeSync::BURST) {
+            if (now - g_lastTimeReqMs < TimeSync::BURST_GAP_MS) {
+                return;
+            }
+        } else {
+            if (now - g_lastTimeReqMs > TimeSync::MAX_RTT_MS) {
+                if (g_timeSync.finishRound()) {
+                    onTimeSynced();
+                }
+                g_timeReqInRound = 0;
+            }
+            return;
+        }
+    } else {
+        uint32_t interval = g_timeSync.valid() ? TIME_SYNC_INTERVAL_MS : TIME_SYNC_RETRY_MS;
+        if (g_timeReqSent && now - g_timeRoundMs < interval) {
+            return;
+        }
+        g_timeSync.beginRound();
+        g_timeRoundMs = now;
+        g_timeReqSent = true;
+    }
+
+    char payload[12];
+    snprintf(payload, sizeof(payload), "%lu", (unsigned long)now);
+    g_transport->publish(MQTT_TOPIC_TIMEREQ, payload);
+    g_lastTimeReqMs = now;
+    g_timeReqInRound++;
+}
+
+// ===== 未送サンプルのジャーナル（LittleFS のリング） =====
+//  ハブへ届けられなかったサンプル（つながっていない間のもの・ack 前に窓から
+//  押し出されたもの）をフラッシュに残し、つながったら塊で後送りする。
+//  - 1 件 16 バイトの固定長レコードを JOURNAL_SLOTS 件のリングに書く。
+//    位置は (seq - 1) % JOURNAL_SLOTS で、seq は再起動をまたいで連続する。
+//    溢れたら最古から上書きする。
+//  - ハブが取り込んだ最後の seq を NVS "jack" に、未送があることを "jpend" に置く。
+//    "jpend" が立っているときだけ起動時にファイルを読んで書き込み位置を探す。
+//  - ハブのログには取得時刻が要るので、時刻同期の前のサンプルは残さない。
+//  - 後送りは 1 塊ずつ ack を待つ（stop-and-wait）。ack が来なければ同じ範囲を
+//    送り直し、ハブは取り込み済みの seq を捨てる。どこで切れても続きから再開する。
+//    CSV: <firstSeq>,<baseEpoch>;<dt>,<t>,<h>,<p>;...
+//      dt は前の行からの秒（先頭は baseEpoch から）、t / h は 0.01、p は 0.1 単位
+const char*    JOURNAL_PATH            = "/journal.bin";
+const uint32_t JOURNAL_SLOTS           = 16384;   // 256 KB（2 秒間隔で約 9 時間分）
+const uint8_t  BACKFILL_BATCH_MAX      = 48;
+const uint32_t BACKFILL_ACK_TIMEOUT_MS = 3000;
+
+struct JournalRecord {
+    uint32_t seq;
+    uint32_t epoch;    // 取得時刻（ハブ時刻, 秒）
+    int16_t  t;        // 0.01 ℃
+    uint16_t h;        // 0.01 %
+    uint16_t p;        // 0.1 hPa
+    uint16_t check;    // ここより前の FNV-1a の下位 16 ビット
+};
+static_assert(sizeof(JournalRecord) == 16, "journal record is 16 bytes");
+
+bool     g_journalReady     = false;
+uint32_t g_journalHead      = 0;   // 書いた最後の seq
+uint32_t g_journalAcked     = 0;   // ハブが取り込んだ最後の seq
+uint32_t g_journalLost      = 0;   // 上書き・破損で送れなかった数
+uint32_t g_backfillSentLast = 0;   // ack 待ちの塊の最後の seq（0 = 待ちなし）
+uint32_t g_backfillSentMs   = 0;
+char     g_backfillBuf[MQTT_BUFFER_SIZE];
+
+uint16_t journalCheck(const JournalRecord& r) {
+    const uint8_t* b = (const uint8_t*)&r;
+    uint32_t h = 2166136261u;  // FNV-1a
+    for (size_t i = 0; i < offsetof(JournalRecord, check); ++i) {
+        h = (h ^ b[i]) * 16777619u;
+    }
+    return (uint16_t)h;
+}
+
+uint32_t journalPending() {
+    return g_journalHead - g_journalAcked;
+}
+
+// まだリングに残っている最古の未送 seq
+uint32_t journalOldest() {
+    return (journalPending() > JOURNAL_SLOTS) ? g_journalHead - JOURNAL_SLOTS + 1
+                                              : g_journalAcked + 1;
+}
+
+bool journalRead(File& f, uint32_t seq, JournalRecord& r) {
+    return f.seek((size_t)((seq - 1) % JOURNAL_SLOTS) * sizeof(r)) &&
+           f.read((uint8_t*)&r, sizeof(r)) == sizeof(r) &&
+           r.seq == seq && r.check == journalCheck(r);
+}
+
+// ハブが seq まで取り込んだ
+void journalAdvance(uint32_t seq) {
+    g_journalAcked = seq;
+    g_prefs.putUInt("jack", seq);
+    if (!journalPending()) {
+        g_prefs.putBool("jpend", false);
+    }
+}
+
+void initJournal() {
+    if (!LittleFS.begin(true)) {
+        Serial.println("[Journal] LittleFS mount failed, journaling disabled");
+        return;
+    }
+    g_journalAcked = g_prefs.getUInt("jack", 0);
+    g_journalHead  = g_journalAcked;
+
+    if (g_prefs.getBool("jpend", false)) {
+        File f = LittleFS.open(JOURNAL_PATH, "r");
+        JournalRecord r;
+        while (f && f.read((uint8_t*)&r, sizeof(r)) == sizeof(r)) {
+            if (r.check == journalCheck(r) && (int32_t)(r.seq - g_journalHead) > 0) {
+                g_journalHead = r.seq;
+            }
+        }
+        if (f) f.close();
+    } else if (!g_journalAcked) {
+        LittleFS.remove(JOURNAL_PATH);   // NVS が消えた後の古い seq を読まない
+    }
+    g_journalReady = true;
+    Serial.printf("[Journal] acked seq %lu, %lu pending\n",
+                  (unsigned long)g_journalAcked, (unsigned long)journalPending());
+}
+
+bool journalAppend(float t, float h, float p, uint32_t epoch) {
+    if (!g_journalReady || !epoch) {
+        return false;
+    }
+    JournalRecord r;
+    r.seq   = g_journalHead + 1;
+    r.epoch = epoch;
+    r.t     = (int16_t)lroundf(t * 100.0f);
+    r.h     = (uint16_t)lroundf(h * 100.0f);
+    r.p     = (uint16_t)lroundf(p * 10.0f);
+    r.check = journalCheck(r);
+
+    File f = LittleFS.open(JOURNAL_PATH, LittleFS.exists(JOURNAL_PATH) ? "r+" : "w");
+    if (!f) {
+        return false;
+    }
+    // リングの 1 周目はファイルが短い。消えていた場合は空きを 0 で埋める（検査値で弾かれる）
+    size_t off  = (size_t)((r.seq - 1) % JOURNAL_SLOTS) * sizeof(r);
+    size_t size = f.size();
+    bool   ok   = f.seek(size);
+    const JournalRecord blank = {};
+    for (; ok && size < off; size += sizeof(blank)) {
+        ok = f.write((const uint8_t*)&blank, sizeof(blank)) == sizeof(blank);
+    }
+    ok = ok && f.seek(off) && f.write((const uint8_t*)&r, sizeof(r)) == sizeof(r);
+    f.close();
+    if (!ok) {
+        return false;
+    }
+
+    if (!journalPending()) {
+        g_prefs.putBool("jpend", true);
+    }
+    g_journalHead = r.seq;
+    return true;
+}
+
+void onBackfillAck(const char* payload) {
+    uint32_t last = strtoul(payload, nullptr, 10);
+    if (!g_backfillSentLast || (int32_t)(last - g_journalAcked) <= 0 ||
+        (int32_t)(last - g_journalHead) > 0) {
+        return;
+    }
+    journalAdvance(last);
+    g_backfillSentLast = 0;   // 次の塊は次の loop で送る（受信コールバックの中では送らない）
+}
+
+// 未送があれば次の塊を送る（loop から呼ぶ）
+void serviceBackfill() {
+    if (!g_journalReady || !journalPending() || !g_transport->ready()) {
+        return;
+    }
+    uint32_t now = millis();
+    if (g_backfillSentLast && now - g_backfillSentMs < BACKFILL_ACK_TIMEOUT_MS) {
+        return;
+    }
+
+    File f = LittleFS.open(JOURNAL_PATH, "r");
+    if (!f) {
+        return;
+    }
+
+    // 読めない先頭（上書き・破損）は飛ばす
+    JournalRecord r;
+    uint32_t first = journalOldest();
+    while (first <= g_journalHead && !journalRead(f, first, r)) {
+        first++;
+    }
+    g_journalLost += (first - 1) - g_journalAcked;
+    if (first > g_journalHead) {
+        f.close();
+        journalAdvance(g_journalHead);
+        return;
+    }
+    g_journalAcked = first - 1;
+
+    size_t cap = g_transport->maxPayload(MQTT_TOPIC_BACKFILL);
+    if (cap >= sizeof(g_backfillBuf)) cap = sizeof(g_backfillBuf) - 1;
+
+    int n = snprintf(g_backfillBuf, sizeof(g_backfillBuf), "%lu,%lu",
+                     (unsigned long)first, (unsigned long)r.epoch);
+    uint32_t prev = r.epoch;
+    uint32_t seq  = first;
+    uint8_t  rows = 0;
+    do {
+        char row[32];
+        int  m = snprintf(row, sizeof(row), ";%ld,%d,%u,%u",
+                          (long)(int32_t)(r.epoch - prev), (int)r.t, (unsigned)r.h, (unsigned)r.p);
+        if ((size_t)(n + m) > cap) break;
+        memcpy(g_backfillBuf + n, row, m + 1);
+        n   += m;
+        prev = r.epoch;
+        rows++;
+        seq++;
+    } while (rows < BACKFILL_BATCH_MAX && seq <= g_journalHead && journalRead(f, seq, r));
+    f.close();
+    if (!rows) {
+        return;   // 1 行も載らない配送路
+    }
+
+    g_transport->publish(MQTT_TOPIC_BACKFILL, g_backfillBuf);
+    g_backfillSentLast = first + rows - 1;
+    g_backfillSentMs   = now;
+}
+
 // ===== MQTT 送信担当 =====
+//  CSV: <t>,<h>,<p>,<seq>,<bootId>[,<epochSec>.<ms>]（時刻は同期後のみ）
+//  配送路がつながっていない間はジャーナルへ残す（時刻同期の前は窓で再送を待つ）。
 void publishEnv(const EnvReading& env) {
     if (!env.valid) {
         return;
     }
 
-    if (!mqttClient.connected()) {
-        reconnectMQTT();
+    uint32_t epoch = 0;
+    int64_t  ms    = 0;
+    if (g_timeSync.valid()) {
+        ms    = g_timeSync.epochMsAt(env.acqMs);
+        epoch = (uint32_t)(ms / 1000);
+    }
+    if (!g_transport->ready() && journalAppend(env.temperature, env.humidity, env.pressure, epoch)) {
+        g_lastPublishOk = false;
+        g_lastPublishMs = millis();
+        return;
     }
 
-    char payload[64];
-    snprintf(payload, sizeof(payload), "%.2f,%.2f,%.2f",
-             env.temperature, env.humidity, env.pressure);
+    // 空き枠（無ければ最古をジャーナルへ回す）
+    InflightSample* slot   = nullptr;
+    InflightSample* oldest = nullptr;
+    for (auto& e : g_inflight) {
+        if (!e.used) { slot = &e; break; }
+        if (!oldest || (int32_t)(e.seq - oldest->seq) < 0) oldest = &e;
+    }
+    if (!slot) {
+        slot = oldest;
+        if (journalAppend(slot->t, slot->h, slot->p, slot->epoch)) g_txJournaled++;
+        else                                                       g_txDropped++;
+        if (g_txQueueDepth) g_txQueueDepth--;
+    }
+
+    slot->seq     = ++g_txSeq;
+    slot->retries = 0;
+    slot->used    = true;
+    slot->t       = env.temperature;
+    slot->h       = env.humidity;
+    slot->p       = env.pressure;
+    slot->epoch   = epoch;
+    int n = snprintf(slot->payload, sizeof(slot->payload), "%.2f,%.2f,%.2f,%lu,%u",
+                     env.temperature, env.humidity, env.pressure,
+                     (unsigned long)slot->seq, (unsigned)g_bootId);
+    if (epoch && n > 0 && n < (int)sizeof(slot->payload)) {
+        snprintf(slot->payload + n, sizeof(slot->payload) - n, ",%lu.%03u",
+                 (unsigned long)(ms / 1000), (unsigned)(ms % 1000));
+    }
+    g_txQueueDepth++;
 
     Serial.print("MQTT publish: ");
-    Serial.println(payload);
+    Serial.println(slot->payload);
+
+    g_lastPublishOk = sendRaw(slot->payload);
+    slot->sentMs    = millis();
+    g_lastPublishMs = slot->sentMs;
+
+    if (g_lastPublishOk && g_bootToFirstPubMs == 0) {
+        g_bootToFirstPubMs = (uint32_t)(esp_timer_get_time() / 1000);
+        Serial.printf("[BOOT] first publish %lu ms after wake\n",
+                      (unsigned long)g_bootToFirstPubMs);
+    }
+}
+
+// ===== リンク計測値の送信 =====
+//  CSV: <profile>,<assocMs>,<pubAvgUs>,<pubMaxUs>,<currentmA>,<battmV>,<rssi>,
+//       <bootToFirstPubMs>,<assocCached 0/1>,<mqttConnMs>,<retransmits>,<dropped>,
+//       <timeRttMs>,<timeDriftPpm>,<timeErrMs>（時刻同期。未同期なら 0）,
+//       <journalPending>（ジャーナルの未送件数）
+//  currentmA は電源 IC から取れない機種では 0
+void publishLinkStats() {
+    if (journalPending()) {
+        Serial.printf("[Journal] %lu pending (from window %lu, lost %lu)\n",
+                      (unsigned long)journalPending(), (unsigned long)g_txJournaled,
+                      (unsigned long)g_journalLost);
+    }
+    if (!g_transport->ready()) {
+        return;
+    }
+
+    uint32_t avg = g_pubLatCount ? (g_pubLatSumUs / g_pubLatCount) : 0;
 
-    mqttClient.publish(MQTT_TOPIC, payload);
+    char payload[176];
+    snprintf(payload, sizeof(payload), "%s,%lu,%lu,%lu,%ld,%d,%d,%lu,%d,%lu,%lu,%lu,%lu,%.1f,%ld,%lu",
+             linkParams().name,
+             (unsigned long)g_lastAssocMs,
+             (unsigned long)avg,
+             (unsigned long)g_pubLatMaxUs,
+             (long)M5.Power.getBatteryCurrent(),
+             (int)M5.Power.getBatteryVoltage(),
+             (int)WiFi.RSSI(),
+             (unsigned long)g_bootToFirstPubMs,
+             g_lastAssocFast ? 1 : 0,
+             (unsigned long)g_lastMqttConnMs,
+             (unsigned long)g_txRetransmits,
+             (unsigned long)g_txDropped,
+             (unsigned long)g_timeSync.lastRttMs(),
+             g_timeSync.driftPpm(),
+             (long)g_timeSync.lastErrorMs(),
+             (unsigned long)journalPending());
+    g_transport->publish(MQTT_TOPIC_STAT, payload);
 
-    // 画面の一番下の行だけ軽く更新
-    int16_t w = M5.Display.width();
-    int16_t h = M5.Display.height();
-    M5.Display.fillRect(0, h - LINE_HEIGHT, w, LINE_HEIGHT, BLACK);
-    M5.Display.setCursor(0, h - LINE_HEIGHT);
-    M5.Display.setTextSize(1);
-    M5.Display.print("sent");
+    g_pubLatSumUs = 0;
+    g_pubLatMaxUs = 0;
+    g_pubLatCount = 0;
 }
 
 // ================================================================
@@ -262,6 +1374,13 @@ void setup() {
     M5.Display.setTextColor(WHITE, BLACK);
     M5.Display.setTextSize(2);
 
+    // 海面気圧（NVS）と高度テーブル
+    g_prefs.begin("envsensor", false);
+    loadSeaLevel();
+    loadLinkProfile();
+    g_altitude.init();
+    initJournal();
+
     // ENV HAT III の I2C 初期化 (StickC Plus2 HATピン: SDA=0, SCL=26)
     Wire.begin(0 /*SDA*/, 26 /*SCL*/, 400000 /*Hz*/);
 
@@ -275,17 +1394,20 @@ void setup() {
         }
     }
 
-    // Wi-Fi & MQTT 初期化
-    connectWiFi();
-    mqttClient.setServer(MQTT_SERVER, MQTT_PORT);
+    // 配送路（Wi-Fi + MQTT / ESP-NOW）の初期化
+    startTransport();
+    initDelivery();
 
-    M5.Display.fillScreen(BLACK);
-    M5.Display.setCursor(0, 0);
-    M5.Display.println("StickP2 Ready");
-    delay(1000);
+    if (!g_lastAssocFast) {
+        M5.Display.fillScreen(BLACK);
+        M5.Display.setCursor(0, 0);
+        M5.Display.println("StickP2 Ready");
+        delay(1000);
+    }
 
     // 初期画面クリア
     M5.Display.fillScreen(BLACK);
+    initDisplaySprites();
 }
 
 // ================================================================
@@ -297,11 +1419,15 @@ void loop() {
     // センサー更新
     updateEnv(g_env);
 
-    // MQTT 接続維持
-    if (!mqttClient.connected()) {
-        reconnectMQTT();
-    }
-    mqttClient.loop();
+    // 配送路の維持・受信
+    g_transport->loop();
+    serviceLinkProfile();
+    serviceInflight();
+    serviceTimeSync();
+    serviceLease();
+    serviceBackfill();
+
+    updateDisplayPower();
 
     // 描画は一定間隔だけ（チカチカ防止）
     static unsigned long lastDraw = 0;
@@ -313,10 +1439,15 @@ void loop() {
         drawEnv(g_env);
     }
 
-    // 一定間隔で Publish
-    if (shouldPublish()) {
+    // 一定間隔で Publish（起動直後は最初の有効値をすぐ送る）
+    if (shouldPublish() || (g_lastPublishMs == 0 && g_env.valid)) {
         publishEnv(g_env);
     }
 
+    if (now - g_lastStatMs >= STAT_INTERVAL_MS) {
+        g_lastStatMs = now;
+        publishLinkStats();
+    }
+
     delay(10);
 }
@@ -0,0 +1,96 @@
+// ================================================================
+//  AltitudeLut（気圧 → 高度の表引き）のホストテスト
+//   pio test -e native -f test_altitude_lut
+//   300〜1100 hPa を 0.01 hPa 刻みで厳密式（powf）と比べた誤差、海面気圧を
+//   変えても作り直しが要らないこと、表の範囲外が厳密式に戻ることを確かめる。
+//   速度（powf との比較）は出力に出すだけで、合否には使わない。
+// ================================================================
+
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "AltitudeLut.h"
+
+namespace {
+
+AltitudeLut g_alt;
+
+// 300〜1100 hPa を 0.01 hPa 刻みで比べた最大誤差 [m]
+float sweepMaxError(float seaLevelhPa) {
+    g_alt.setSeaLevel(seaLevelhPa);
+    float maxErr = 0.0f;
+    for (uint32_t i = 30000; i <= 110000; ++i) {
+        float p   = (float)i;  // Pa
+        float err = fabsf(g_alt.altitude(p) - AltitudeLut::exact(p * 0.01f, seaLevelhPa));
+        if (err > maxErr) maxErr = err;
+    }
+    return maxErr;
+}
+
+}  // namespace
+
+void setUp(void) {
+    g_alt.init();
+    g_alt.setSeaLevel(AltitudeLut::SEA_LEVEL_DEFAULT);
+}
+void tearDown(void) {}
+
+void test_sweep_error(void) {
+    const float seaLevels[] = { 900.0f, AltitudeLut::SEA_LEVEL_DEFAULT, 1100.0f };
+    for (float p0 : seaLevels) {
+        float err = sweepMaxError(p0);
+        char  msg[64];
+        snprintf(msg, sizeof(msg), "p0 %.2f hPa: max err %.3f m", p0, err);
+        TEST_MESSAGE(msg);
+        TEST_ASSERT_TRUE_MESSAGE(err < 0.25f, msg);
+    }
+}
+
+// 海面気圧では 0 m、気圧が上がるほど低い（表を作り直さずに p0 を変えられる）
+void test_sea_level_change(void) {
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, 0.0f, g_alt.altitude(101325.0f));
+    g_alt.setSeaLevel(1000.0f);
+    TEST_ASSERT_EQUAL_FLOAT(1000.0f, g_alt.seaLevel());
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, 0.0f, g_alt.altitude(100000.0f));
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, AltitudeLut::exact(900.0f, 1000.0f), g_alt.altitude(90000.0f));
+
+    float last = g_alt.altitude(30000.0f);
+    for (uint32_t p = 30100; p <= 110000; p += 100) {
+        float a = g_alt.altitude((float)p);
+        TEST_ASSERT_TRUE(a < last);
+        last = a;
+    }
+}
+
+// 表の範囲外（r < 0.25, r >= 1.25, NaN）は厳密式そのもの
+void test_out_of_range_falls_back(void) {
+    TEST_ASSERT_EQUAL_FLOAT(AltitudeLut::exact(200.0f, 1013.25f), g_alt.altitude(20000.0f));
+    TEST_ASSERT_EQUAL_FLOAT(AltitudeLut::exact(1300.0f, 1013.25f), g_alt.altitude(130000.0f));
+    TEST_ASSERT_TRUE(isnan(g_alt.altitude(NAN)));
+}
+
+void test_speed_report(void) {
+    const uint32_t N    = 200000;
+    volatile float sink = 0.0f;
+    clock_t t0 = clock();
+    for (uint32_t i = 0; i < N; ++i) sink = sink + AltitudeLut::exact(300.0f + (i % 800), 1013.25f);
+    clock_t t1 = clock();
+    for (uint32_t i = 0; i < N; ++i) sink = sink + g_alt.altitude((300.0f + (i % 800)) * 100.0f);
+    clock_t t2 = clock();
+
+    char msg[80];
+    snprintf(msg, sizeof(msg), "powf %.4f us/call, table %.4f us/call",
+             (t1 - t0) * 1e6 / CLOCKS_PER_SEC / N, (t2 - t1) * 1e6 / CLOCKS_PER_SEC / N);
+    TEST_MESSAGE(msg);
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_sweep_error);
+    RUN_TEST(test_sea_level_change);
+    RUN_TEST(test_out_of_range_falls_back);
+    RUN_TEST(test_speed_report);
+    return UNITY_END();
+}
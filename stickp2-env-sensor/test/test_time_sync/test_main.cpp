@@ -0,0 +1,179 @@
+// ================================================================
+//  TimeSync（ハブ時刻への同期）のホストテスト
+//   pio test -e native -f test_time_sync
+//   応答の読み取り（壊れた応答を丸ごと捨てる）、組の中で往復が最短の応答を
+//   使うこと、往復の長すぎる応答・組の外の応答を捨てること、小さなずれは
+//   ゆっくり寄せ大きなずれは一度に合わせること（時刻は常に単調）、
+//   ドリフトの推定を確かめる。
+// ================================================================
+
+#include <unity.h>
+#include <stdint.h>
+
+#include "TimeSync.h"
+
+namespace {
+
+TimeSync g_sync;
+
+// ハブ時刻 hubMs（エポック ms）を読んだ応答を渡す
+bool reply(uint32_t t1, uint32_t t4, int64_t hubMs) {
+    return g_sync.onReply(t1, t4, (uint32_t)(hubMs / 1000), (uint16_t)(hubMs % 1000));
+}
+
+// 本当のエポック ms = E0 + ローカル ms（往復は対称 20 ms）で 1 組を回す
+constexpr int64_t E0 = 1760000000000LL;
+
+void syncRound(uint32_t local, int64_t offsetMs = 0) {
+    g_sync.beginRound();
+    for (uint8_t i = 0; i < TimeSync::BURST; ++i) {
+        uint32_t t1 = local + i * TimeSync::BURST_GAP_MS;
+        reply(t1, t1 + 20, E0 + offsetMs + t1 + 10);
+    }
+}
+
+}  // namespace
+
+void setUp(void) { g_sync = TimeSync(); }
+void tearDown(void) {}
+
+void test_parse_reply(void) {
+    TimeSync::Reply r;
+    TEST_ASSERT_TRUE(TimeSync::parseReply("1234,1760000000,250,700,2000", r));
+    TEST_ASSERT_EQUAL_UINT32(1234, r.t1);
+    TEST_ASSERT_EQUAL_UINT32(1760000000u, r.sec);
+    TEST_ASSERT_EQUAL_UINT16(250, r.ms);
+    TEST_ASSERT_EQUAL_UINT32(700, r.slotOffsetMs);
+    TEST_ASSERT_EQUAL_UINT32(2000, r.periodMs);
+
+    TEST_ASSERT_TRUE(TimeSync::parseReply("1,2,3,0,0", r));   // 枠なし
+    TEST_ASSERT_EQUAL_UINT32(0, r.periodMs);
+
+    const char* const bad[] = {
+        "",                                 // 空
+        "1234,1760000000,250",              // 旧形式（枠なし）
+        "1234,1760000000,250,700,200",      // "2000" が途中で切れた
+        "1234,1760000000,250,700,2000x",    // 後ろに余計な文字
+        "1234,1760000000,1000,700,2000",    // ms が範囲外
+        "1234,1760000000,250,2000,2000",    // 枠が周期の外
+        "1234,1760000000,250,0,70000",      // 周期が長すぎる
+        "a,1760000000,250,700,2000",
+    };
+    for (const char* p : bad) {
+        TEST_ASSERT_FALSE_MESSAGE(TimeSync::parseReply(p, r), p);
+    }
+}
+
+// 往復の偏りは rtt が長いほど大きい。組の中で最短の応答だけを使う
+void test_min_rtt_selection(void) {
+    struct { uint32_t out, back; } delays[] = { { 100, 20 }, { 10, 10 }, { 150, 30 }, { 50, 10 } };
+    g_sync.beginRound();
+    for (uint8_t i = 0; i < TimeSync::BURST; ++i) {
+        uint32_t t1 = 1000 + i * TimeSync::BURST_GAP_MS;
+        uint32_t t4 = t1 + delays[i].out + delays[i].back;
+        bool     done = reply(t1, t4, E0 + t1 + delays[i].out);   // ハブは往路の後に読む
+        TEST_ASSERT_EQUAL(i == TimeSync::BURST - 1, done);
+        TEST_ASSERT_EQUAL(i == TimeSync::BURST - 1, g_sync.valid());
+    }
+    TEST_ASSERT_EQUAL_UINT32(20, g_sync.lastRttMs());
+    TEST_ASSERT_EQUAL_INT64(E0 + 5000, g_sync.epochMsAt(5000));
+    TEST_ASSERT_EQUAL_UINT32(1, g_sync.syncs());
+}
+
+// 往復の長すぎる応答・ハブの時計が未設定の応答・組の外の応答は捨てる
+void test_rejects_outliers(void) {
+    reply(1000, 1020, E0 + 1010);                       // 組の外
+    TEST_ASSERT_EQUAL_UINT32(1, g_sync.rejected());
+
+    g_sync.beginRound();
+    TEST_ASSERT_FALSE(reply(1000, 1000 + TimeSync::MAX_RTT_MS + 1, E0 + 1100));
+    TEST_ASSERT_FALSE(g_sync.onReply(1200, 1220, 0, 0));
+    TEST_ASSERT_FALSE(reply(5000, 4990, E0 + 5000));   // t1 が t4 より後（rtt が巨大）
+    TEST_ASSERT_EQUAL_UINT32(4, g_sync.rejected());
+    TEST_ASSERT_FALSE(g_sync.finishRound());            // 候補なし
+    TEST_ASSERT_FALSE(g_sync.valid());
+
+    // そろわなくても届いた分の最短で合わせる
+    g_sync.beginRound();
+    reply(2000, 2080, E0 + 2060);
+    reply(2250, 2280, E0 + 2265);
+    TEST_ASSERT_TRUE(g_sync.finishRound());
+    TEST_ASSERT_EQUAL_UINT32(30, g_sync.lastRttMs());
+    TEST_ASSERT_EQUAL_INT64(E0 + 3000, g_sync.epochMsAt(3000));
+
+    // 閉じた組に遅れて届いた応答は使わない
+    TEST_ASSERT_FALSE(reply(2500, 2510, E0 + 9999999));
+    TEST_ASSERT_EQUAL_INT64(E0 + 4000, g_sync.epochMsAt(4000));
+}
+
+// STEP_MS 以下のずれは時刻を飛ばさず SLEW_RATE で寄せる
+void test_slew_small_error(void) {
+    syncRound(1000);
+    syncRound(30000, 200);   // ハブが 200 ms 先（30 s ではドリフトは更新しない）
+    const uint32_t t4 = 30000 + 20;   // rtt が同じなら組の 1 本目を使う
+    TEST_ASSERT_EQUAL_INT32(200, g_sync.lastErrorMs());
+    TEST_ASSERT_EQUAL_UINT32(0, g_sync.steps());
+    TEST_ASSERT_EQUAL_INT64(E0 + t4, g_sync.epochMsAt(t4));   // その場では飛ばない
+
+    const uint32_t span = (uint32_t)(200 / TimeSync::SLEW_RATE);
+    TEST_ASSERT_INT64_WITHIN(1, E0 + 200 + t4 + span / 2 - 100, g_sync.epochMsAt(t4 + span / 2));
+    TEST_ASSERT_EQUAL_INT64(E0 + 200 + t4 + span, g_sync.epochMsAt(t4 + span));
+    TEST_ASSERT_EQUAL_INT64(E0 + 200 + t4 + span + 5000, g_sync.epochMsAt(t4 + span + 5000));
+}
+
+// 先に進みすぎていた分も戻さずに遅らせて寄せる（単調）
+void test_slew_backwards_is_monotonic(void) {
+    syncRound(1000);
+    syncRound(30000, -300);
+    TEST_ASSERT_EQUAL_INT32(-300, g_sync.lastErrorMs());
+    const uint32_t t4 = 30000 + 20;   // rtt が同じなら組の 1 本目を使う
+    int64_t last = g_sync.epochMsAt(t4);
+    for (uint32_t t = t4 + 100; t < t4 + 120000; t += 100) {
+        int64_t now = g_sync.epochMsAt(t);
+        TEST_ASSERT_TRUE(now > last);
+        last = now;
+    }
+    TEST_ASSERT_EQUAL_INT64(E0 - 300 + t4 + 120000, g_sync.epochMsAt(t4 + 120000));
+}
+
+// STEP_MS を超えるずれは一度に合わせる。戻る向きは追いつくまで据え置き
+void test_step_large_error(void) {
+    syncRound(1000);
+    syncRound(30000, 5000);
+    const uint32_t t4 = 30000 + 20;   // rtt が同じなら組の 1 本目を使う
+    TEST_ASSERT_EQUAL_UINT32(1, g_sync.steps());
+    TEST_ASSERT_EQUAL_INT64(E0 + 5000 + t4, g_sync.epochMsAt(t4));
+
+    TEST_ASSERT_EQUAL_INT64(E0 + 5000 + 40000, g_sync.epochMsAt(40000));
+    syncRound(40000, 0);     // 5 s 戻る
+    const uint32_t t4b = 40000 + 20;
+    TEST_ASSERT_EQUAL_UINT32(2, g_sync.steps());
+    int64_t held = g_sync.epochMsAt(t4b);
+    TEST_ASSERT_TRUE(held > E0 + t4b);                            // 据え置き中
+    TEST_ASSERT_EQUAL_INT64(held, g_sync.epochMsAt(t4b + 1000));
+    TEST_ASSERT_EQUAL_INT64(E0 + t4b + 10000, g_sync.epochMsAt(t4b + 10000));   // 追いついた
+}
+
+// ハブの時計が +100 ppm で進むと、10 分ごとの再同期で推定が寄っていく
+void test_drift_estimate(void) {
+    for (uint32_t k = 0; k < 12; ++k) {
+        uint32_t local = 1000 + k * 600000;
+        int64_t  skew  = (int64_t)local / 10000;   // 100 ppm
+        syncRound(local, skew);
+    }
+    TEST_ASSERT_FLOAT_WITHIN(15.0f, 100.0f, g_sync.driftPpm());
+    TEST_ASSERT_EQUAL_UINT32(0, g_sync.steps());
+    TEST_ASSERT_TRUE(g_sync.lastErrorMs() >= -5 && g_sync.lastErrorMs() <= 5);
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_parse_reply);
+    RUN_TEST(test_min_rtt_selection);
+    RUN_TEST(test_rejects_outliers);
+    RUN_TEST(test_slew_small_error);
+    RUN_TEST(test_slew_backwards_is_monotonic);
+    RUN_TEST(test_step_large_error);
+    RUN_TEST(test_drift_estimate);
+    return UNITY_END();
+}
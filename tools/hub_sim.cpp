@@ -0,0 +1,481 @@
+// ================================================================
+//  ハブのホスト版（Linux, tools/mqtt_loadgen を実機なしで回す）
+//   - MQTT 3.1.1 のブローカ（QoS 0/1 の受信, QoS 0 の配信, 保持なし）を話し、
+//     home/env/# に届いたものをファームウェアの onEnvMessage() / onBackfill() /
+//     onTimeRequest() と同じコード（include/HubIngest.h: 重複排除・異常検知・
+//     派生指標・間引き・ログ・後送り・時刻要求）へ HubIngestHost.h の土台で流す。
+//     ack・時刻の応答は購読しているクライアントへ配る。
+//   - 接続数は --max-clients（ハブの mqtt.max_clients の既定 8）まで。超えた
+//     CONNECT は断る（CONNACK 3）。
+//   - HTTP の /api/metrics（?reset=load で数え直し）に、ハブと同じ名前で
+//     broker / load / delivery / backfill / time_sync の一部を返す
+//     （mqtt_loadgen がそのまま読む）。
+//   - --duration 秒（0 = SIGINT / SIGTERM まで）で止め、最後の metrics を 1 行出す。
+//   - 依存なし（POSIX ソケット + poll, 1 スレッド）。
+//
+//  ビルド:  g++ -O2 -std=c++17 -Wall -I core2-stackchan-env/include -o hub_sim tools/hub_sim.cpp
+//  例:      ./hub_sim --port 18830 --http 18080 --duration 20 &
+//           ./mqtt_loadgen --host 127.0.0.1 --port 18830 --http 18080 --duration 10 --max-loss-pct 0
+// ================================================================
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "HubIngestHost.h"
+
+namespace {
+
+// ===== 設定 =====
+struct Options {
+    int      port       = 1883;
+    int      httpPort   = 8080;     // 0 = HTTP なし
+    int      maxClients = 8;        // mqtt.max_clients の既定
+    double   duration   = 0.0;      // 0 = 止められるまで
+    uint32_t epoch      = 0;        // 0 = 今の時刻（--epoch 0 は --no-clock）
+    bool     clock      = true;     // false = 時計が未設定のハブ（時刻要求に答えない）
+};
+
+constexpr size_t PACKET_MAX = 4096;   // これを超えるパケットは切る（ハブの受信バッファ相当）
+
+using Clock = std::chrono::steady_clock;
+
+int64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               Clock::now().time_since_epoch()).count();
+}
+
+volatile sig_atomic_t g_stop = 0;
+
+// ===== 接続 1 本 =====
+struct Client {
+    int                      fd        = -1;
+    bool                     connected = false;   // CONNACK 0 を返した
+    bool                     closing   = false;   // 送り終えたら切る
+    std::string              id;
+    std::string              in;
+    std::string              out;
+    std::vector<std::string> filters;
+};
+
+struct BrokerStats {
+    uint32_t clients;
+    uint32_t peak;
+    uint32_t connects;
+    uint32_t rejected;     // 接続数の上限で断った
+};
+
+struct LoadStats {
+    int64_t  sinceUs;
+    uint32_t messages;     // 振り分けた受信
+    uint64_t routeUsSum;
+    uint32_t routeUsMax;   // 1 通の取り込み（ack の配送まで）
+    int64_t  windowUs;     // 1 秒窓の開始
+    uint32_t windowCount;
+    uint32_t rateMax;      // 1 秒あたりの最大受信数
+};
+
+Options              g_opt;
+HubIngestHost        g_hub;   // ログ 50000 件を含むので静的に置く
+std::vector<Client*> g_clients;
+BrokerStats          g_broker = {};
+LoadStats            g_load   = {};
+int64_t              g_startUs = 0;
+
+// ===== MQTT 3.1.1 のパケット =====
+void putLength(std::string& out, size_t n) {
+    do {
+        uint8_t b = n % 128;
+        n /= 128;
+        if (n) b |= 0x80;
+        out.push_back((char)b);
+    } while (n);
+}
+
+void putU16(std::string& out, uint16_t v) {
+    out.push_back((char)(v >> 8));
+    out.push_back((char)(v & 0xFF));
+}
+
+std::string packPublish(const char* topic, const char* payload) {
+    std::string body;
+    putU16(body, (uint16_t)strlen(topic));
+    body += topic;
+    body += payload;
+    std::string p(1, (char)0x30);
+    putLength(p, body.size());
+    return p + body;
+}
+
+// body[pos] から長さ付き文字列を読む（足りなければ false）
+bool getString(const std::string& body, size_t& pos, std::string& out) {
+    if (pos + 2 > body.size()) return false;
+    size_t len = ((uint8_t)body[pos] << 8) | (uint8_t)body[pos + 1];
+    if (pos + 2 + len > body.size()) return false;
+    out = body.substr(pos + 2, len);
+    pos += 2 + len;
+    return true;
+}
+
+// 購読しているクライアントへ配る（QoS 0）
+void deliver(const char* topic, const char* payload) {
+    std::string packet;
+    for (Client* c : g_clients) {
+        if (!c->connected || c->closing) continue;
+        for (const std::string& f : c->filters) {
+            if (mqttTopicMatches(f.c_str(), topic)) {
+                if (packet.empty()) packet = packPublish(topic, payload);
+                c->out += packet;
+                break;
+            }
+        }
+    }
+}
+
+void onPublish(const std::string& topic, const std::string& payload) {
+    deliver(topic.c_str(), payload.c_str());
+    if (!mqttTopicMatches("home/env/#", topic.c_str())) return;
+
+    int64_t  t0 = nowUs();
+    g_hub.message(topic.c_str(), payload.c_str(), (uint32_t)((t0 - g_startUs) / 1000));
+    uint32_t us = (uint32_t)(nowUs() - t0);
+
+    g_load.messages++;
+    g_load.routeUsSum += us;
+    if (us > g_load.routeUsMax) g_load.routeUsMax = us;
+    if (t0 - g_load.windowUs >= 1000000) {
+        g_load.windowUs    = t0;
+        g_load.windowCount = 0;
+    }
+    if (++g_load.windowCount > g_load.rateMax) g_load.rateMax = g_load.windowCount;
+}
+
+// 1 パケットを処理する（false = 切る）
+bool handlePacket(Client& c, uint8_t type, uint8_t flags, const std::string& body) {
+    if (!c.connected && type != 1) return false;
+    switch (type) {
+        case 1: {                                                // CONNECT
+            size_t      pos = 0;
+            std::string proto;
+            if (c.connected || !getString(body, pos, proto) || proto != "MQTT" ||
+                pos + 4 > body.size() || !getString(body, (pos += 4), c.id)) {
+                return false;
+            }
+            if ((int)g_broker.clients >= g_opt.maxClients) {
+                g_broker.rejected++;
+                c.out.append("\x20\x02\x00\x03", 4);            // server unavailable
+                c.closing = true;
+                return true;
+            }
+            c.connected = true;
+            c.out.append("\x20\x02\x00\x00", 4);
+            g_broker.connects++;
+            g_broker.clients++;
+            g_broker.peak = std::max(g_broker.peak, g_broker.clients);
+            return true;
+        }
+        case 3: {                                                // PUBLISH
+            uint8_t     qos = (flags >> 1) & 3;
+            size_t      pos = 0;
+            std::string topic;
+            if (qos > 1 || !getString(body, pos, topic)) return false;
+            if (qos == 1) {
+                if (pos + 2 > body.size()) return false;
+                c.out.append("\x40\x02", 2);                     // PUBACK
+                c.out.append(body, pos, 2);
+                pos += 2;
+            }
+            onPublish(topic, body.substr(pos));
+            return true;
+        }
+        case 8: {                                                // SUBSCRIBE
+            if (flags != 2 || body.size() < 2) return false;
+            size_t      pos = 2;
+            std::string ack(body, 0, 2), filter;
+            while (pos < body.size()) {
+                if (!getString(body, pos, filter) || pos >= body.size()) return false;
+                pos++;                                           // 要求 QoS（0 で返す）
+                if (std::find(c.filters.begin(), c.filters.end(), filter) == c.filters.end()) {
+                    c.filters.push_back(filter);
+                }
+                ack.push_back(0);
+            }
+            c.out.push_back((char)0x90);
+            putLength(c.out, ack.size());
+            c.out += ack;
+            return true;
+        }
+        case 10: {                                               // UNSUBSCRIBE
+            if (flags != 2 || body.size() < 2) return false;
+            size_t      pos = 2;
+            std::string filter;
+            while (pos < body.size()) {
+                if (!getString(body, pos, filter)) return false;
+                c.filters.erase(std::remove(c.filters.begin(), c.filters.end(), filter),
+                                c.filters.end());
+            }
+            c.out.append("\xB0\x02", 2);
+            c.out.append(body, 0, 2);
+            return true;
+        }
+        case 12:                                                 // PINGREQ
+            c.out.append("\xD0\x00", 2);
+            return true;
+        case 14:                                                 // DISCONNECT
+            return false;
+        default:
+            return false;
+    }
+}
+
+// 受信バッファから完結したパケットを取り出して処理する（false = 切る）
+bool parseIncoming(Client& c) {
+    while (!c.closing && c.in.size() >= 2) {
+        size_t len = 0, mul = 1, pos = 1;
+        for (;;) {
+            if (pos >= c.in.size()) return true;
+            uint8_t b = (uint8_t)c.in[pos++];
+            len += (b & 0x7F) * mul;
+            mul *= 128;
+            if (!(b & 0x80)) break;
+            if (pos > 4) return false;
+        }
+        if (len > PACKET_MAX) return false;
+        if (c.in.size() < pos + len) return true;
+        uint8_t     b0   = (uint8_t)c.in[0];
+        std::string body = c.in.substr(pos, len);
+        c.in.erase(0, pos + len);
+        if (!handlePacket(c, b0 >> 4, b0 & 0x0F, body)) return false;
+    }
+    return true;
+}
+
+bool flush(Client& c) {
+    while (!c.out.empty()) {
+        ssize_t n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+        if (n > 0) {
+            c.out.erase(0, (size_t)n);
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        } else {
+            return false;
+        }
+    }
+    return !c.closing;
+}
+
+void closeClient(Client* c) {
+    close(c->fd);
+    if (c->connected) g_broker.clients--;
+    g_clients.erase(std::find(g_clients.begin(), g_clients.end(), c));
+    delete c;
+}
+
+// ===== /api/metrics（ハブと同じ名前の一部） =====
+std::string metricsJson() {
+    const HubIngest::Stats& d = g_hub.ingest().stats();
+    uint32_t s   = (uint32_t)((nowUs() - g_load.sinceUs) / 1000000);
+    uint32_t div = g_load.messages ? g_load.messages : 1;
+    char     buf[1024];
+    snprintf(buf, sizeof(buf),
+             "{\"broker\":{\"clients\":%u,\"client_limit\":%d,\"peak\":%u,\"connects\":%u,"
+             "\"rejected\":%u},"
+             "\"load\":{\"window_s\":%u,\"messages\":%u,\"rate_avg\":%.2f,\"rate_max\":%u,"
+             "\"route_us_avg\":%u,\"route_us_max\":%u},"
+             "\"delivery\":{\"accepted\":%u,\"duplicates\":%u,\"reordered\":%u,"
+             "\"legacy\":%u,\"quarantined\":%u},"
+             "\"backfill\":{\"batches\":%u,\"rows\":%u,\"merged\":%u,\"duplicates\":%u,"
+             "\"thinned\":%u,\"rejected\":%u},"
+             "\"time_sync\":{\"hub_epoch\":%u,\"requests\":%u,\"stamped\":%u,"
+             "\"out_of_range\":%u},"
+             "\"log\":{\"rows\":%zu,\"writes\":%u}}",
+             g_broker.clients, g_opt.maxClients, g_broker.peak, g_broker.connects,
+             g_broker.rejected, s, g_load.messages, s ? (double)g_load.messages / s : 0.0,
+             g_load.rateMax, (unsigned)(g_load.routeUsSum / div), g_load.routeUsMax,
+             d.accepted, d.duplicates, d.reordered, d.legacy, d.quarantined,
+             d.backfillBatches, d.backfillRows, d.backfillMerged, d.backfillDuplicates,
+             d.backfillThinned, d.backfillRejected, g_hub.nowEpoch(), d.timeRequests,
+             d.timeStamped, d.timeRejected, g_hub.logRows(), d.logWrites);
+    return buf;
+}
+
+// HTTP/1.0 の GET を 1 本受けて返す（ローカルの道具なので 1 件ずつ同期で）
+void serveHttp(int listenFd) {
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0) return;
+    timeval tv = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    std::string req;
+    char        buf[1024];
+    ssize_t     n;
+    while (req.find("\r\n\r\n") == std::string::npos && req.size() < 8192 &&
+           (n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+        req.append(buf, (size_t)n);
+    }
+    std::string path = req.substr(0, req.find("\r\n"));
+    std::string resp;
+    if (path.compare(0, 17, "GET /api/metrics ") == 0 ||
+        path.compare(0, 17, "GET /api/metrics?") == 0) {
+        if (path.find("reset=load") != std::string::npos) {
+            g_load         = LoadStats();
+            g_load.sinceUs = nowUs();
+        }
+        std::string body = metricsJson();
+        resp = "HTTP/1.0 200 OK\r\nContent-Type: application/json\r\nContent-Length: " +
+               std::to_string(body.size()) + "\r\n\r\n" + body;
+    } else {
+        resp = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+    }
+    send(fd, resp.data(), resp.size(), MSG_NOSIGNAL);
+    close(fd);
+}
+
+int listenOn(int port) {
+    int fd  = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port        = htons((uint16_t)port);
+    if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void onReply(void*, const char* topic, const char* payload) {
+    deliver(topic, payload);
+}
+
+// ===== 引数 =====
+void usage() {
+    fprintf(stderr,
+            "usage: hub_sim [options]\n"
+            "  --port N          MQTT port (1883)\n"
+            "  --http N          HTTP port for /api/metrics (8080, 0 = off)\n"
+            "  --max-clients N   concurrent MQTT clients before CONNACK 3 (8)\n"
+            "  --duration S      seconds to run (0 = until SIGINT / SIGTERM)\n"
+            "  --epoch N         hub clock at start (now)\n"
+            "  --no-clock        run with an unset clock (time requests get no reply)\n");
+}
+
+bool parseArgs(int argc, char** argv, Options& o) {
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--no-clock") {
+            o.clock = false;
+            continue;
+        }
+        if (a == "--help" || a == "-h" || i + 1 >= argc) return false;
+        const char* v = argv[++i];
+        if (a == "--port") {
+            o.port = atoi(v);
+        } else if (a == "--http") {
+            o.httpPort = atoi(v);
+        } else if (a == "--max-clients") {
+            o.maxClients = atoi(v);
+        } else if (a == "--duration") {
+            o.duration = atof(v);
+        } else if (a == "--epoch") {
+            o.epoch = (uint32_t)strtoul(v, nullptr, 10);
+        } else {
+            return false;
+        }
+    }
+    return o.port > 0 && o.httpPort >= 0 && o.maxClients > 0 && o.duration >= 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (!parseArgs(argc, argv, g_opt)) {
+        usage();
+        return 2;
+    }
+    int mqttFd = listenOn(g_opt.port);
+    int httpFd = g_opt.httpPort ? listenOn(g_opt.httpPort) : -1;
+    if (mqttFd < 0 || (g_opt.httpPort && httpFd < 0)) {
+        fprintf(stderr, "cannot listen on %d / %d: %s\n", g_opt.port, g_opt.httpPort,
+                strerror(errno));
+        return 1;
+    }
+    signal(SIGINT, [](int) { g_stop = 1; });
+    signal(SIGTERM, [](int) { g_stop = 1; });
+
+    g_startUs      = nowUs();
+    g_load.sinceUs = g_startUs;
+    g_hub.setReply(onReply, nullptr);
+    g_hub.setClock(!g_opt.clock ? 0 : g_opt.epoch ? g_opt.epoch : (uint32_t)time(nullptr));
+    fprintf(stderr, "hub_sim: mqtt %d, http %d, max clients %d\n", g_opt.port, g_opt.httpPort,
+            g_opt.maxClients);
+
+    const int64_t endUs = g_opt.duration > 0 ? g_startUs + (int64_t)(g_opt.duration * 1e6) : 0;
+    std::vector<pollfd> fds;
+    while (!g_stop && (!endUs || nowUs() < endUs)) {
+        fds.clear();
+        fds.push_back({ mqttFd, POLLIN, 0 });
+        fds.push_back({ httpFd, POLLIN, 0 });    // -1 は poll が飛ばす
+        for (Client* c : g_clients) {
+            fds.push_back({ c->fd, (short)(POLLIN | (c->out.empty() ? 0 : POLLOUT)), 0 });
+        }
+        if (poll(fds.data(), fds.size(), 50) < 0 && errno != EINTR) break;
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(mqttFd, nullptr, nullptr);
+            int one = 1;
+            if (fd >= 0) {
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+                Client* c = new Client();
+                c->fd     = fd;
+                g_clients.push_back(c);
+            }
+        }
+        if (fds[1].revents & POLLIN) serveHttp(httpFd);
+
+        // 受信（ここで他のクライアントの out に配られる）→ 送信
+        std::vector<Client*> drop;
+        for (size_t k = 2; k < fds.size(); ++k) {
+            Client* c = g_clients[k - 2];
+            if (!(fds[k].revents & (POLLIN | POLLERR | POLLHUP))) continue;
+            char    buf[4096];
+            ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+            if (n <= 0 && !(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))) {
+                drop.push_back(c);
+                continue;
+            }
+            if (n > 0) c->in.append(buf, (size_t)n);
+            if (!parseIncoming(*c)) drop.push_back(c);
+        }
+        for (Client* c : g_clients) {
+            if (std::find(drop.begin(), drop.end(), c) == drop.end() && !flush(*c)) {
+                drop.push_back(c);
+            }
+        }
+        for (Client* c : drop) closeClient(c);
+    }
+
+    while (!g_clients.empty()) closeClient(g_clients.back());
+    close(mqttFd);
+    if (httpFd >= 0) close(httpFd);
+    printf("%s\n", metricsJson().c_str());
+    return 0;
+}
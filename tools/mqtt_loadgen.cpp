@@ -0,0 +1,606 @@
+// ================================================================
+//  MQTT 負荷生成ツール（Linux, ハブのブローカの処理能力を測る）
+//   - センサーと同じ形のサンプル "<t>,<h>,<p>,<seq>,<bootId>" を、多数の
+//     同時接続から決めた頻度で home/env/<device> へ送る。
+//   - ハブはサンプルごとに home/env/<device>/ack へ "<bootId>,<seq>" を返すので、
+//     送ってから ack が届くまでを「受信 → 重複判定 → 取り込み → ack」の
+//     往復遅延として測る。ack の来なかったものを取りこぼしとして数える。
+//   - 開始前に /api/metrics?reset=load でハブ側の負荷カウンタを 0 にし、
+//     終了後にハブの load / broker を取得して並べて出す（HTTP を使わないなら --http 0）。
+//   - --max-loss-pct を付けると、取りこぼしがそれを超えた・1 本も繋がらなかった・
+//     1 通も送れなかった・ハブに切られたときに終了コード 1 で終わる
+//     （tools/hub_sim 相手に CI で回す）。
+//   - 依存なし（POSIX ソケット + poll, 1 スレッド）。MQTT 3.1.1 の QoS 0 だけを話す。
+//
+//  ビルド:  g++ -O2 -std=c++17 -Wall -o mqtt_loadgen tools/mqtt_loadgen.cpp
+//  例:      ./mqtt_loadgen --clients 8 --rate 0.5 --duration 60
+//           ./mqtt_loadgen --clients 8 --rate 20 --phase aligned --format legacy --json
+// ================================================================
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+// ===== 設定 =====
+enum class Phase { Spread, Random, Aligned };
+enum class Format { Sample, Legacy, Raw };
+
+struct Options {
+    std::string host        = "192.168.4.1";
+    int         port        = 1883;
+    int         httpPort    = 80;       // 0 = ハブのカウンタを取らない
+    int         clients     = 8;
+    int         topics      = 0;        // 0 = clients と同じ（1 接続 1 デバイス）
+    double      rate        = 0.5;      // 1 接続あたり [通/秒]（センサーは 2 秒に 1 通）
+    double      duration    = 30.0;     // 送る時間 [秒]
+    int         connectGapMs = 20;      // 接続を張る間隔
+    int         ackTimeoutMs = 2000;
+    int         keepAliveS  = 30;
+    Phase       phase       = Phase::Spread;
+    Format      format      = Format::Sample;
+    std::string raw;                    // --format raw:<payload>
+    double      jitter      = 0.0;      // 値の揺らぎ（ハブの記録しきい値を超えるとログ書き込みが増える）
+    std::string prefix      = "load";   // デバイス名 = <prefix><番号>
+    bool        json        = false;
+    double      maxLossPct  = -1.0;     // 0 以上 = 取りこぼしがこれを超えたら終了コード 1（CI 用）
+};
+
+using Clock = std::chrono::steady_clock;
+
+int64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               Clock::now().time_since_epoch()).count();
+}
+
+// ===== MQTT 3.1.1 のパケット =====
+void putLength(std::string& out, size_t n) {
+    do {
+        uint8_t b = n % 128;
+        n /= 128;
+        if (n) b |= 0x80;
+        out.push_back((char)b);
+    } while (n);
+}
+
+void putString(std::string& out, const std::string& s) {
+    out.push_back((char)(s.size() >> 8));
+    out.push_back((char)(s.size() & 0xFF));
+    out += s;
+}
+
+std::string packConnect(const std::string& clientId, int keepAliveS) {
+    std::string body;
+    putString(body, "MQTT");
+    body.push_back(4);                        // 3.1.1
+    body.push_back(0x02);                     // clean session
+    body.push_back((char)(keepAliveS >> 8));
+    body.push_back((char)(keepAliveS & 0xFF));
+    putString(body, clientId);
+    std::string p(1, (char)0x10);
+    putLength(p, body.size());
+    return p + body;
+}
+
+std::string packSubscribe(uint16_t id, const std::string& filter) {
+    std::string body;
+    body.push_back((char)(id >> 8));
+    body.push_back((char)(id & 0xFF));
+    putString(body, filter);
+    body.push_back(0);                        // QoS 0
+    std::string p(1, (char)0x82);
+    putLength(p, body.size());
+    return p + body;
+}
+
+std::string packPublish(const std::string& topic, const std::string& payload) {
+    std::string body;
+    putString(body, topic);
+    body += payload;
+    std::string p(1, (char)0x30);
+    putLength(p, body.size());
+    return p + body;
+}
+
+// ===== 接続 1 本 =====
+enum class State { Connecting, WaitConnack, Running, Closed };
+
+struct Client {
+    int         fd       = -1;
+    State       state    = State::Connecting;
+    std::string device;
+    std::string topic;
+    std::string ackTopic;
+    uint16_t    bootId   = 0;
+    uint32_t    seq      = 0;
+    int64_t     nextSendUs = 0;
+    int64_t     intervalUs = 0;
+    int64_t     lastTxUs   = 0;
+    std::string out;
+    std::string in;
+    std::vector<int64_t> sentAt;              // seq % SENT_RING → 送信時刻（0 = ack 済み / 未送）
+    float       t = 22.0f, h = 50.0f, p = 1010.0f;
+};
+
+constexpr size_t SENT_RING = 4096;
+
+struct Totals {
+    uint64_t connected   = 0;
+    uint64_t refused     = 0;   // CONNACK で断られた（ハブの接続数の上限など）
+    uint64_t failed      = 0;   // TCP がつながらない
+    uint64_t closed      = 0;   // 途中で切られた
+    uint64_t sent        = 0;
+    uint64_t sendBlocked = 0;   // 送信が詰まって予定どおり送れなかった
+    uint64_t acked       = 0;
+    uint64_t lateAcks    = 0;   // タイムアウト後に届いた ack
+    uint64_t lost        = 0;
+    uint64_t bytesOut    = 0;
+    std::vector<uint32_t> latencyUs;
+};
+
+bool setNonBlocking(int fd) {
+    int fl = fcntl(fd, F_GETFL, 0);
+    return fl >= 0 && fcntl(fd, F_SETFL, fl | O_NONBLOCK) == 0;
+}
+
+bool resolve(const std::string& host, int port, sockaddr_in& addr) {
+    addrinfo hints = {};
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0 || !res) {
+        return false;
+    }
+    memcpy(&addr, res->ai_addr, sizeof(addr));
+    freeaddrinfo(res);
+    return true;
+}
+
+void closeClient(Client& c, Totals& tot, bool unexpected) {
+    if (c.fd >= 0) close(c.fd);
+    c.fd = -1;
+    if (unexpected && c.state == State::Running) tot.closed++;
+    c.state = State::Closed;
+}
+
+std::string makePayload(const Options& o, Client& c, std::mt19937& rng) {
+    if (o.jitter > 0) {
+        std::uniform_real_distribution<float> d(-(float)o.jitter, (float)o.jitter);
+        c.t = 22.0f + d(rng);
+        c.h = 50.0f + d(rng) * 5.0f;
+        c.p = 1010.0f + d(rng) * 2.0f;
+    }
+    char buf[96];
+    switch (o.format) {
+        case Format::Sample:
+            snprintf(buf, sizeof(buf), "%.2f,%.2f,%.2f,%u,%u", c.t, c.h, c.p, c.seq, c.bootId);
+            return buf;
+        case Format::Legacy:
+            snprintf(buf, sizeof(buf), "%.2f,%.2f,%.2f", c.t, c.h, c.p);
+            return buf;
+        case Format::Raw:
+            break;
+    }
+    return o.raw;
+}
+
+// 受信バッファから完結したパケットを取り出して処理する
+void parseIncoming(Client& c, Totals& tot, int64_t now) {
+    for (;;) {
+        if (c.in.size() < 2) return;
+        size_t len = 0, mul = 1, pos = 1;
+        for (;;) {
+            if (pos >= c.in.size()) return;
+            uint8_t b = (uint8_t)c.in[pos++];
+            len += (b & 0x7F) * mul;
+            mul *= 128;
+            if (!(b & 0x80)) break;
+            if (pos > 4) {
+                c.in.clear();
+                return;
+            }
+        }
+        if (c.in.size() < pos + len) return;
+        uint8_t     type = (uint8_t)c.in[0] >> 4;
+        std::string body = c.in.substr(pos, len);
+        c.in.erase(0, pos + len);
+
+        if (type == 2 && body.size() >= 2) {                     // CONNACK
+            if (body[1] != 0) {
+                tot.refused++;
+                c.state = State::Closed;
+                return;
+            }
+            tot.connected++;
+            c.state = State::Running;
+            c.out += packSubscribe(1, c.ackTopic);
+        } else if (type == 3 && body.size() >= 2) {              // PUBLISH（QoS 0）
+            size_t tl = ((uint8_t)body[0] << 8) | (uint8_t)body[1];
+            if (body.size() < 2 + tl) continue;
+            std::string topic   = body.substr(2, tl);
+            std::string payload = body.substr(2 + tl);
+            unsigned boot = 0, seq = 0;
+            if (topic != c.ackTopic || sscanf(payload.c_str(), "%u,%u", &boot, &seq) != 2 ||
+                boot != c.bootId) {
+                continue;
+            }
+            int64_t& at = c.sentAt[seq % SENT_RING];
+            if (at > 0) {
+                tot.latencyUs.push_back((uint32_t)(now - at));
+                tot.acked++;
+                at = 0;
+            } else if (at < 0) {
+                tot.lateAcks++;                                  // 取りこぼし扱いの後に届いた
+                at = 0;
+            }
+        }
+    }
+}
+
+// ack の来ないまま時間切れになったものを数える（負の値 = 時間切れ）
+void expireAcks(Client& c, Totals& tot, int64_t now, int64_t timeoutUs) {
+    for (int64_t& at : c.sentAt) {
+        if (at > 0 && now - at > timeoutUs) {
+            at = -1;
+            tot.lost++;
+        }
+    }
+}
+
+bool flush(Client& c, Totals& tot) {
+    while (!c.out.empty()) {
+        ssize_t n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+        if (n > 0) {
+            tot.bytesOut += (uint64_t)n;
+            c.out.erase(0, (size_t)n);
+            c.lastTxUs = nowUs();
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ===== ハブの /api/metrics（HTTP/1.0 の GET を 1 回） =====
+std::string httpGet(const Options& o, const std::string& path) {
+    sockaddr_in addr;
+    if (!resolve(o.host, o.httpPort, addr)) return "";
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return "";
+    timeval tv = { 5, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return "";
+    }
+    std::string req = "GET " + path + " HTTP/1.0\r\nHost: " + o.host + "\r\n\r\n";
+    send(fd, req.data(), req.size(), MSG_NOSIGNAL);
+    std::string resp;
+    char buf[2048];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) resp.append(buf, (size_t)n);
+    close(fd);
+    size_t body = resp.find("\r\n\r\n");
+    return (body == std::string::npos) ? "" : resp.substr(body + 4);
+}
+
+// JSON から "key":{...} の値を取り出す（入れ子の {} を数えるだけ）
+std::string jsonObject(const std::string& json, const char* key) {
+    std::string k = std::string("\"") + key + "\":{";
+    size_t at = json.find(k);
+    if (at == std::string::npos) return "null";
+    size_t start = at + k.size() - 1, depth = 0;
+    for (size_t i = start; i < json.size(); ++i) {
+        if (json[i] == '{') depth++;
+        if (json[i] == '}' && --depth == 0) return json.substr(start, i - start + 1);
+    }
+    return "null";
+}
+
+// ===== 引数 =====
+void usage() {
+    fprintf(stderr,
+            "usage: mqtt_loadgen [options]\n"
+            "  --host H          broker / hub address (192.168.4.1)\n"
+            "  --port N          MQTT port (1883)\n"
+            "  --http N          hub HTTP port for /api/metrics (80, 0 = off)\n"
+            "  --clients N       concurrent connections (8)\n"
+            "  --topics N        distinct devices, shared round-robin (= clients)\n"
+            "  --rate R          messages per second per client (0.5)\n"
+            "  --duration S      seconds to publish (30)\n"
+            "  --phase P         spread | random | aligned (spread)\n"
+            "  --format F        sample | legacy | raw:<payload> (sample)\n"
+            "  --jitter X        value noise; above the hub's log deltas it adds log writes (0)\n"
+            "  --connect-gap MS  delay between connects (20)\n"
+            "  --ack-timeout MS  ack deadline before a sample counts as lost (2000)\n"
+            "  --prefix S        device name prefix (load)\n"
+            "  --json            print one JSON object instead of text\n"
+            "  --max-loss-pct P  exit 1 if loss exceeds P %%, nothing connected / sent, or the hub closed a client (off)\n");
+}
+
+bool parseArgs(int argc, char** argv, Options& o) {
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto next = [&](const char*& v) {
+            if (i + 1 >= argc) return false;
+            v = argv[++i];
+            return true;
+        };
+        const char* v = nullptr;
+        if (a == "--json") {
+            o.json = true;
+        } else if (a == "--help" || a == "-h") {
+            return false;
+        } else if (!next(v)) {
+            return false;
+        } else if (a == "--host") {
+            o.host = v;
+        } else if (a == "--port") {
+            o.port = atoi(v);
+        } else if (a == "--http") {
+            o.httpPort = atoi(v);
+        } else if (a == "--clients") {
+            o.clients = atoi(v);
+        } else if (a == "--topics") {
+            o.topics = atoi(v);
+        } else if (a == "--rate") {
+            o.rate = atof(v);
+        } else if (a == "--duration") {
+            o.duration = atof(v);
+        } else if (a == "--jitter") {
+            o.jitter = atof(v);
+        } else if (a == "--connect-gap") {
+            o.connectGapMs = atoi(v);
+        } else if (a == "--ack-timeout") {
+            o.ackTimeoutMs = atoi(v);
+        } else if (a == "--prefix") {
+            o.prefix = v;
+        } else if (a == "--max-loss-pct") {
+            o.maxLossPct = atof(v);
+        } else if (a == "--phase") {
+            std::string p = v;
+            if (p == "spread")       o.phase = Phase::Spread;
+            else if (p == "random")  o.phase = Phase::Random;
+            else if (p == "aligned") o.phase = Phase::Aligned;
+            else return false;
+        } else if (a == "--format") {
+            std::string f = v;
+            if (f == "sample")                  o.format = Format::Sample;
+            else if (f == "legacy")             o.format = Format::Legacy;
+            else if (f.compare(0, 4, "raw:") == 0) { o.format = Format::Raw; o.raw = f.substr(4); }
+            else return false;
+        } else {
+            return false;
+        }
+    }
+    if (o.topics <= 0) o.topics = o.clients;
+    return o.clients > 0 && o.rate > 0 && o.duration > 0 && o.port > 0;
+}
+
+uint32_t percentile(const std::vector<uint32_t>& sorted, double q) {
+    if (sorted.empty()) return 0;
+    size_t i = (size_t)std::ceil(q * sorted.size());
+    return sorted[i ? i - 1 : 0];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options o;
+    if (!parseArgs(argc, argv, o)) {
+        usage();
+        return 2;
+    }
+    sockaddr_in addr;
+    if (!resolve(o.host, o.port, addr)) {
+        fprintf(stderr, "cannot resolve %s\n", o.host.c_str());
+        return 1;
+    }
+    if (o.httpPort) httpGet(o, "/api/metrics?reset=load");
+
+    std::mt19937 rng((uint32_t)nowUs());
+    std::vector<Client> clients((size_t)o.clients);
+    Totals tot;
+    const int64_t intervalUs = (int64_t)(1e6 / o.rate);
+
+    // 接続を少しずつ張る（一斉に張るとハブの accept が詰まる）
+    for (int i = 0; i < o.clients; ++i) {
+        Client& c  = clients[(size_t)i];
+        c.device   = o.prefix + std::to_string(i % o.topics);
+        c.topic    = "home/env/" + c.device;
+        c.ackTopic = c.topic + "/ack";
+        c.bootId   = (uint16_t)(rng() | 1);
+        c.intervalUs = intervalUs;
+        c.sentAt.assign(SENT_RING, 0);
+        c.fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (c.fd < 0 || !setNonBlocking(c.fd) ||
+            (connect(c.fd, (sockaddr*)&addr, sizeof(addr)) != 0 && errno != EINPROGRESS)) {
+            tot.failed++;
+            closeClient(c, tot, false);
+            continue;
+        }
+        if (o.connectGapMs) usleep((useconds_t)o.connectGapMs * 1000);
+    }
+
+    int64_t start = nowUs() + 200000;   // CONNACK を待つ余裕
+    for (size_t i = 0; i < clients.size(); ++i) {
+        int64_t offset = 0;
+        if (o.phase == Phase::Spread)      offset = (int64_t)(intervalUs * i / clients.size());
+        else if (o.phase == Phase::Random) offset = (int64_t)(rng() % (uint64_t)intervalUs);
+        clients[i].nextSendUs = start + offset;
+    }
+
+    const int64_t endUs     = start + (int64_t)(o.duration * 1e6);
+    const int64_t drainUs   = endUs + (int64_t)o.ackTimeoutMs * 1000;
+    const int64_t timeoutUs = (int64_t)o.ackTimeoutMs * 1000;
+    const int64_t pingUs    = (int64_t)o.keepAliveS * 1000000 / 2;
+    int64_t       nextExpire = start;
+    std::vector<pollfd> fds;
+
+    for (;;) {
+        int64_t now = nowUs();
+        if (now >= drainUs) break;
+
+        // 予定の送信
+        for (Client& c : clients) {
+            if (c.state == State::Connecting && c.fd >= 0) continue;
+            if (c.state != State::Running) continue;
+            if (now < endUs && now >= c.nextSendUs) {
+                if (c.out.size() > 64 * 1024) {
+                    tot.sendBlocked++;              // 相手が読んでいない
+                } else {
+                    ++c.seq;
+                    c.out += packPublish(c.topic, makePayload(o, c, rng));
+                    if (o.format == Format::Sample) c.sentAt[c.seq % SENT_RING] = now;
+                    tot.sent++;
+                }
+                c.nextSendUs += c.intervalUs;
+                if (c.nextSendUs < now) c.nextSendUs = now + c.intervalUs;   // 大きく遅れたら追いかけない
+            }
+            if (c.out.empty() && now - c.lastTxUs > pingUs) {
+                c.out.append("\xC0\x00", 2);           // PINGREQ
+            }
+        }
+        if (now >= nextExpire) {
+            for (Client& c : clients) expireAcks(c, tot, now, timeoutUs);
+            nextExpire = now + 100000;
+        }
+
+        // poll（次の送信予定まで）
+        int64_t wake = drainUs;
+        fds.clear();
+        for (Client& c : clients) {
+            if (c.fd < 0) continue;
+            short ev = POLLIN;
+            if (c.state == State::Connecting || !c.out.empty()) ev |= POLLOUT;
+            fds.push_back({ c.fd, ev, 0 });
+            if (c.state == State::Running && c.nextSendUs < wake && now < endUs) wake = c.nextSendUs;
+        }
+        int waitMs = (int)std::max<int64_t>(0, std::min<int64_t>((wake - now) / 1000, 50));
+        if (poll(fds.data(), fds.size(), waitMs) < 0 && errno != EINTR) break;
+
+        now = nowUs();
+        size_t k = 0;
+        for (Client& c : clients) {
+            if (c.fd < 0) continue;
+            const pollfd& pf = fds[k++];
+            if (c.state == State::Connecting && (pf.revents & (POLLOUT | POLLERR | POLLHUP))) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err) {
+                    tot.failed++;
+                    closeClient(c, tot, false);
+                    continue;
+                }
+                c.state = State::WaitConnack;
+                c.out   = packConnect("loadgen-" + std::to_string(getpid()) + "-" +
+                                      std::to_string(&c - clients.data()), o.keepAliveS);
+            }
+            if (pf.revents & POLLIN) {
+                char buf[4096];
+                ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+                if (n <= 0) {
+                    closeClient(c, tot, true);
+                    continue;
+                }
+                c.in.append(buf, (size_t)n);
+                parseIncoming(c, tot, now);
+                if (c.state == State::Closed) {
+                    closeClient(c, tot, false);
+                    continue;
+                }
+            }
+            if (!c.out.empty() && c.state != State::Connecting && !flush(c, tot)) {
+                closeClient(c, tot, true);
+            }
+        }
+    }
+    for (Client& c : clients) {
+        expireAcks(c, tot, INT64_MAX, 0);
+        if (c.fd >= 0) {
+            send(c.fd, "\xE0\x00", 2, MSG_NOSIGNAL);   // DISCONNECT
+            closeClient(c, tot, false);
+        }
+    }
+
+    std::string hub = o.httpPort ? httpGet(o, "/api/metrics") : "";
+    std::string hubLoad   = hub.empty() ? "null" : jsonObject(hub, "load");
+    std::string hubBroker = hub.empty() ? "null" : jsonObject(hub, "broker");
+
+    std::sort(tot.latencyUs.begin(), tot.latencyUs.end());
+    const std::vector<uint32_t>& L = tot.latencyUs;
+    double seconds  = o.duration;
+    double achieved = tot.sent / seconds;
+    double lossPct  = (o.format == Format::Sample && tot.sent)
+                        ? 100.0 * (double)tot.lost / (double)tot.sent : 0.0;
+    bool   failed   = o.maxLossPct >= 0 &&
+                      (!tot.connected || !tot.sent || tot.closed || lossPct > o.maxLossPct);
+
+    if (o.json) {
+        printf("{\"clients\":%d,\"topics\":%d,\"rate\":%.3f,\"duration_s\":%.1f,"
+               "\"connected\":%llu,\"refused\":%llu,\"failed\":%llu,\"closed\":%llu,"
+               "\"sent\":%llu,\"send_blocked\":%llu,\"msgs_per_s\":%.1f,\"bytes_out\":%llu,"
+               "\"acked\":%llu,\"lost\":%llu,\"late_acks\":%llu,\"loss_pct\":%.3f,"
+               "\"latency_us\":{\"p50\":%u,\"p90\":%u,\"p99\":%u,\"p999\":%u,\"max\":%u},"
+               "\"hub_load\":%s,\"hub_broker\":%s}\n",
+               o.clients, o.topics, o.rate, o.duration,
+               (unsigned long long)tot.connected, (unsigned long long)tot.refused,
+               (unsigned long long)tot.failed, (unsigned long long)tot.closed,
+               (unsigned long long)tot.sent, (unsigned long long)tot.sendBlocked, achieved,
+               (unsigned long long)tot.bytesOut, (unsigned long long)tot.acked,
+               (unsigned long long)tot.lost, (unsigned long long)tot.lateAcks, lossPct,
+               percentile(L, 0.50), percentile(L, 0.90), percentile(L, 0.99),
+               percentile(L, 0.999), L.empty() ? 0 : L.back(),
+               hubLoad.c_str(), hubBroker.c_str());
+        return failed ? 1 : 0;
+    }
+
+    printf("clients   %d (%d devices), %.2f msg/s each, %.0f s\n",
+           o.clients, o.topics, o.rate, o.duration);
+    printf("connect   %llu ok, %llu refused, %llu failed, %llu closed by hub\n",
+           (unsigned long long)tot.connected, (unsigned long long)tot.refused,
+           (unsigned long long)tot.failed, (unsigned long long)tot.closed);
+    printf("sent      %llu (%.1f msg/s, %llu bytes), %llu blocked\n",
+           (unsigned long long)tot.sent, achieved, (unsigned long long)tot.bytesOut,
+           (unsigned long long)tot.sendBlocked);
+    if (o.format == Format::Sample) {
+        printf("acked     %llu, lost %llu (%.3f%%), late %llu\n",
+               (unsigned long long)tot.acked, (unsigned long long)tot.lost, lossPct,
+               (unsigned long long)tot.lateAcks);
+        printf("latency   p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, p99.9 %.2f ms, max %.2f ms\n",
+               percentile(L, 0.50) / 1000.0, percentile(L, 0.90) / 1000.0,
+               percentile(L, 0.99) / 1000.0, percentile(L, 0.999) / 1000.0,
+               (L.empty() ? 0 : L.back()) / 1000.0);
+    }
+    if (o.httpPort) {
+        printf("hub load   %s\n", hubLoad.c_str());
+        printf("hub broker %s\n", hubBroker.c_str());
+    }
+    if (failed) printf("FAILED    loss %.3f%% over %.3f%% (or nothing connected / sent, or closed by hub)\n",
+                       lossPct, o.maxLossPct);
+    return failed ? 1 : 0;
+}
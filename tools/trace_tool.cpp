@@ -0,0 +1,196 @@
+// ================================================================
+//  受信トレースの道具（Linux）
+//   dump   <trace.bin>                   記録を 1 通 1 行（ms 配送路 トピック ペイロード）で出す
+//   replay <trace.bin> [--out report.json] 記録をファームウェアと同じ取り込み（HubIngest）へ
+//                                          流し、結果の JSON（TraceReplay）を出す
+//   check  <report.json> <baseline.json>  再生結果を基準と比べる
+//
+//   check の判定
+//     - 結果の数（受理・重複・隔離・ログ行・表示へ渡したサンプルなど）と
+//       digest は再生が決定的なので完全一致を求める。
+//     - 取り込み時間（ingest_us_*）は --latency-pct（既定 20 %）と
+//       --latency-slack-us（既定 25 µs = 分布の 1 区間）まで伸びてよい。
+//     - 退行があれば終了コード 1。
+//
+//  ビルド:  g++ -O2 -std=c++17 -Wall -I core2-stackchan-env/include -o trace_tool tools/trace_tool.cpp
+// ================================================================
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "TraceFormat.h"
+#include "TraceReplay.h"
+
+namespace {
+
+const char* const TRANSPORT_NAMES[TraceFormat::TRANSPORTS] = { "mqtt", "espnow", "-", "other" };
+
+// 完全一致を求める項目
+const char* const EXACT_KEYS[] = {
+    "messages", "corrupt", "accepted", "duplicates", "reordered", "legacy", "quarantined",
+    "backfill_rows", "replies", "log_writes", "log_rows", "samples", "digest",
+};
+
+// 伸びの上限を当てる項目
+const char* const LATENCY_KEYS[] = {
+    "ingest_us_avg", "ingest_us_p50", "ingest_us_p90", "ingest_us_p99",
+};
+
+bool readFile(const char* path, std::string& out) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+    char buf[8192];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.append(buf, n);
+    fclose(f);
+    return true;
+}
+
+int dump(const char* path) {
+    std::string data;
+    uint32_t    epoch = 0;
+    if (!readFile(path, data) ||
+        !TraceFormat::readHeader((const uint8_t*)data.data(), data.size(), epoch)) {
+        fprintf(stderr, "%s: not a trace file\n", path);
+        return 2;
+    }
+    static TraceFormat::Reader reader;
+    reader.begin();
+    const uint8_t* p   = (const uint8_t*)data.data();
+    size_t         pos = TraceFormat::HEADER;
+    uint32_t       messages = 0, lastMs = 0;
+    TraceFormat::Message m;
+    while (size_t used = reader.next(p + pos, data.size() - pos, m)) {
+        pos += used;
+        if (!m.topic) continue;
+        printf("%u %s %s %s\n", m.ms, TRANSPORT_NAMES[m.transport], m.topic, m.payload);
+        messages++;
+        lastMs = m.ms;
+    }
+    fprintf(stderr, "start epoch %u, %u messages over %.1f s, %zu bytes%s\n", epoch, messages,
+            lastMs / 1000.0, data.size(),
+            reader.corrupt() ? ", CORRUPT" : (pos < data.size() ? ", truncated tail" : ""));
+    return reader.corrupt() ? 1 : 0;
+}
+
+uint32_t nowMicros() {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int replay(const char* path, const char* outPath) {
+    static HubIngestHost       hub;
+    static TraceReplay::Report report;
+    std::string data;
+    if (!readFile(path, data)) {
+        fprintf(stderr, "cannot read %s\n", path);
+        return 2;
+    }
+    uint32_t wall0 = nowMicros();
+    if (!TraceReplay::run((const uint8_t*)data.data(), data.size(), hub, report, nowMicros)) {
+        fprintf(stderr, "%s: not a trace file\n", path);
+        return 2;
+    }
+    uint32_t wallMs = (nowMicros() - wall0) / 1000;
+
+    char   json[1024];
+    size_t n = report.toJson(json, sizeof(json), wallMs);
+    if (outPath) {
+        FILE* f = fopen(outPath, "wb");
+        if (!f || fwrite(json, 1, n, f) != n) {
+            fprintf(stderr, "cannot write %s\n", outPath);
+            if (f) fclose(f);
+            return 2;
+        }
+        fclose(f);
+    }
+    printf("%.*s\n", (int)n, json);
+    if (report.corrupt) fprintf(stderr, "%s: CORRUPT after %u messages\n", path, report.messages);
+    return report.corrupt ? 1 : 0;
+}
+
+// 平らな JSON（{"key":値,...}）から値の文字列を取り出す（引用符は外す）
+bool jsonValue(const std::string& json, const char* key, std::string& out) {
+    std::string k = std::string("\"") + key + "\":";
+    size_t at = json.find(k);
+    if (at == std::string::npos) return false;
+    size_t start = at + k.size();
+    size_t end   = json.find_first_of(",}", start);
+    if (end == std::string::npos) return false;
+    out = json.substr(start, end - start);
+    if (out.size() >= 2 && out.front() == '"' && out.back() == '"') {
+        out = out.substr(1, out.size() - 2);
+    }
+    return true;
+}
+
+int check(const char* reportPath, const char* basePath, double latencyPct, double slackUs) {
+    std::string report, base;
+    if (!readFile(reportPath, report) || !readFile(basePath, base)) {
+        fprintf(stderr, "cannot read %s or %s\n", reportPath, basePath);
+        return 2;
+    }
+    int failures = 0;
+    printf("%-20s %14s %14s\n", "", "baseline", "report");
+    for (const char* key : EXACT_KEYS) {
+        std::string a, b;
+        bool ok = jsonValue(base, key, a) && jsonValue(report, key, b) && a == b;
+        printf("%-20s %14s %14s%s\n", key, a.c_str(), b.c_str(), ok ? "" : "  MISMATCH");
+        failures += !ok;
+    }
+    for (const char* key : LATENCY_KEYS) {
+        std::string a, b;
+        if (!jsonValue(base, key, a) || !jsonValue(report, key, b)) {
+            printf("%-20s %14s %14s  MISSING\n", key, a.c_str(), b.c_str());
+            failures++;
+            continue;
+        }
+        double limit = atof(a.c_str()) * (1.0 + latencyPct / 100.0) + slackUs;
+        bool   ok    = atof(b.c_str()) <= limit;
+        printf("%-20s %14s %14s  (limit %.0f)%s\n", key, a.c_str(), b.c_str(), limit,
+               ok ? "" : "  REGRESSION");
+        failures += !ok;
+    }
+    printf("%s\n", failures ? "FAIL" : "PASS");
+    return failures ? 1 : 0;
+}
+
+void usage() {
+    fprintf(stderr,
+            "usage: trace_tool dump <trace.bin>\n"
+            "       trace_tool replay <trace.bin> [--out report.json]\n"
+            "       trace_tool check <report.json> <baseline.json>"
+            " [--latency-pct P] [--latency-slack-us U]\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc == 3 && strcmp(argv[1], "dump") == 0) return dump(argv[2]);
+    if (argc >= 3 && strcmp(argv[1], "replay") == 0) {
+        if (argc == 3) return replay(argv[2], nullptr);
+        if (argc == 5 && strcmp(argv[3], "--out") == 0) return replay(argv[2], argv[4]);
+        usage();
+        return 2;
+    }
+    if (argc >= 4 && strcmp(argv[1], "check") == 0) {
+        double pct = 20.0, slack = 25.0;
+        for (int i = 4; i < argc; ++i) {
+            if (i + 1 < argc && strcmp(argv[i], "--latency-pct") == 0) {
+                pct = atof(argv[++i]);
+            } else if (i + 1 < argc && strcmp(argv[i], "--latency-slack-us") == 0) {
+                slack = atof(argv[++i]);
+            } else {
+                usage();
+                return 2;
+            }
+        }
+        return check(argv[2], argv[3], pct, slack);
+    }
+    usage();
+    return 2;
+}